@@ -15,6 +15,7 @@
 // and the grateful thanks of the Qt team.
 
 #include "big5codec_p.h"
+#include "textkernels.h"
 namespace zdytool {
 #ifndef Z_NO_BIG_TEXTCODECS
 
@@ -6347,7 +6348,59 @@ namespace zdytool {
         return UnicodeToBig5hkscs(ch, buf);
     }
 
+    char32_t Big5CodePoints::nextMultibyte(const uchar *&src, const uchar *end) {
+        uchar buf[2];
+        buf[0] = *src++;
+        if (!IsFirstByte(buf[0]))
+            return SpecialCharacter::ReplacementCharacter;
+        if (src == end)
+            return Incomplete;
+        buf[1] = *src++;
+        uint u;
+        if (!IsSecondByte(buf[1]) || Big5ToUnicode(buf, &u) != 2)
+            return SpecialCharacter::ReplacementCharacter;
+        return ZValidChar(u);
+    }
+
+    int kernels::Big5Tag::encodeMultibyte(const ushort *&src, const ushort *, uchar *dst) {
+        const ushort ch = *src++;
+        if (UnicodeToBig5(ch, dst) == 2 && dst[0] >= 0xa1 && dst[0] <= 0xf9)
+            return 2;
+        *dst = '?';
+        return 1;
+    }
+
+    size_t Big5Codec::maxDecodedLength(size_t len, const ConverterState *) const {
+        return len;
+    }
+
+    size_t Big5Codec::maxEncodedLength(size_t len, const ConverterState *) const {
+        return boundedSize(len, 2);
+    }
+
+    size_t Big5Codec::nextSyncPoint(const char *chars, size_t len, size_t from) const {
+        return nextSyncPointAfter(chars, len, from, 0x40);
+    }
+
+    size_t Big5Codec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const {
+        // the byte after a first byte is always taken with it, valid or not
+        const size_t run = doubleByteRunStart(chars, to, 0x81, 0xfe);
+        return run + ((to - run) & ~size_t(1));
+    }
+
+    size_t Big5Codec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const {
+        return nextCharacterBoundary(uc, len, from);
+    }
+
     u16string Big5Codec::convertToUnicode(const char *chars, int len, ConverterState *state) const {
+        u16string result(maxDecodedLength(len, state), 0);
+        result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+        return result;
+    }
+
+    TextCodec::ConversionResult Big5Codec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+                                                            ConverterState *state) const {
+        ConversionResult r = {0, 0, ConversionOk};
         ushort replacement = SpecialCharacter::ReplacementCharacter;
         uchar buf[2] = {0};
         int nbuf = 0;
@@ -6360,21 +6413,27 @@ namespace zdytool {
         }
         int invalid = 0;
 
-        u16string result;
-        for (int i = 0; i < len; i++) {
+        ushort *dst = out;
+        ushort *const dstEnd = out + outLength;
+        size_t i = 0;
+        for (; i < len; i++) {
+            if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+                r.status = ConversionOutputFull;
+                break;
+            }
             uchar ch = chars[i];
             switch (nbuf) {
                 case 0:
                     if (IsLatin(ch)) {
                         // ASCII
-                        result += char(ch);
+                        *dst++ = ch;
                     } else if (IsFirstByte(ch)) {
                         // Big5-ETen
                         buf[0] = ch;
                         nbuf = 1;
                     } else {
                         // Invalid
-                        result += replacement;
+                        *dst++ = replacement;
                         ++invalid;
                     }
                     break;
@@ -6384,15 +6443,15 @@ namespace zdytool {
                         uint u;
                         buf[1] = ch;
                         if (Big5ToUnicode(buf, &u) == 2)
-                            result += ZValidChar(u);
+                            *dst++ = ZValidChar(u);
                         else {
                             // Error
-                            result += replacement;
+                            *dst++ = replacement;
                             ++invalid;
                         }
                     } else {
                         // Error
-                        result += replacement;
+                        *dst++ = replacement;
                         ++invalid;
                     }
                     nbuf = 0;
@@ -6404,11 +6463,23 @@ namespace zdytool {
             state->state_data[0] = buf[0];
             state->state_data[1] = buf[1];
             state->invalidChars += invalid;
+            if (nbuf && r.status == ConversionOk)
+                r.status = ConversionIncomplete;
         }
-        return result;
+        r.consumed = i;
+        r.produced = dst - out;
+        return r;
     }
 
     string Big5Codec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const {
+        string rstr(maxEncodedLength(len, state), '\0');
+        rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+        return rstr;
+    }
+
+    TextCodec::ConversionResult Big5Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+                                                              ConverterState *state) const {
+        ConversionResult r = {0, 0, ConversionOk};
         char replacement = '?';
         if (state) {
             if (state->flags & ConvertInvalidToNull)
@@ -6417,12 +6488,14 @@ namespace zdytool {
 
         int invalid = 0;
 
-        int rlen = 2 * len + 1;
-        std::vector<char> rstr(rlen + 1);
-        rstr[rlen] = '\0';
-
-        uchar *cursor = (uchar *) rstr.data();
-        for (int i = 0; i < len; i++) {
+        uchar *cursor = (uchar *) out;
+        uchar *const cursorEnd = cursor + outLength;
+        size_t i = 0;
+        for (; i < len; i++) {
+            if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+                r.status = ConversionOutputFull;
+                break;
+            }
             ushort ch = uc[i];
             uchar c[2];
             if (ch < 0x80) {
@@ -6436,12 +6509,13 @@ namespace zdytool {
                 ++invalid;
             }
         }
-        string rstr_str(rstr.data(), cursor - (const uchar *) rstr.data());
 
         if (state) {
             state->invalidChars += invalid;
         }
-        return rstr_str;
+        r.consumed = i;
+        r.produced = cursor - (uchar *) out;
+        return r;
     }
 
     list<string> Big5Codec::_aliases() {
@@ -6461,7 +6535,37 @@ namespace zdytool {
     }
 
 
+    size_t Big5hkscsCodec::maxDecodedLength(size_t len, const ConverterState *) const {
+        return len;
+    }
+
+    size_t Big5hkscsCodec::maxEncodedLength(size_t len, const ConverterState *) const {
+        return boundedSize(len, 2);
+    }
+
+    size_t Big5hkscsCodec::nextSyncPoint(const char *chars, size_t len, size_t from) const {
+        return nextSyncPointAfter(chars, len, from, 0x40);
+    }
+
+    size_t Big5hkscsCodec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const {
+        // the byte after a first byte is always taken with it, valid or not
+        const size_t run = doubleByteRunStart(chars, to, 0x81, 0xfe);
+        return run + ((to - run) & ~size_t(1));
+    }
+
+    size_t Big5hkscsCodec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const {
+        return nextCharacterBoundary(uc, len, from);
+    }
+
     u16string Big5hkscsCodec::convertToUnicode(const char *chars, int len, ConverterState *state) const {
+        u16string result(maxDecodedLength(len, state), 0);
+        result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+        return result;
+    }
+
+    TextCodec::ConversionResult Big5hkscsCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+                                                                 ConverterState *state) const {
+        ConversionResult r = {0, 0, ConversionOk};
         uchar buf[2] = {0};
         int nbuf = 0;
         ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -6474,21 +6578,27 @@ namespace zdytool {
         }
         int invalid = 0;
 
-        u16string result;
-        for (int i = 0; i < len; i++) {
+        ushort *dst = out;
+        ushort *const dstEnd = out + outLength;
+        size_t i = 0;
+        for (; i < len; i++) {
+            if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+                r.status = ConversionOutputFull;
+                break;
+            }
             uchar ch = chars[i];
             switch (nbuf) {
                 case 0:
                     if (IsLatin(ch)) {
                         // ASCII
-                        result += char(ch);
+                        *dst++ = ch;
                     } else if (IsFirstByte(ch)) {
                         // Big5-HKSCS
                         buf[0] = ch;
                         nbuf = 1;
                     } else {
                         // Invalid
-                        result += replacement;
+                        *dst++ = replacement;
                         ++invalid;
                     }
                     break;
@@ -6498,15 +6608,15 @@ namespace zdytool {
                         uint u;
                         buf[1] = ch;
                         if (Big5hkscsToUnicode(buf, &u) == 2)
-                            result += ZValidChar(u);
+                            *dst++ = ZValidChar(u);
                         else {
                             // Error
-                            result += replacement;
+                            *dst++ = replacement;
                             ++invalid;
                         }
                     } else {
                         // Error
-                        result += replacement;
+                        *dst++ = replacement;
                         ++invalid;
                     }
                     nbuf = 0;
@@ -6518,12 +6628,24 @@ namespace zdytool {
             state->state_data[0] = buf[0];
             state->state_data[1] = buf[1];
             state->invalidChars += invalid;
+            if (nbuf && r.status == ConversionOk)
+                r.status = ConversionIncomplete;
         }
-        return result;
+        r.consumed = i;
+        r.produced = dst - out;
+        return r;
     }
 
 
     string Big5hkscsCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const {
+        string rstr(maxEncodedLength(len, state), '\0');
+        rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+        return rstr;
+    }
+
+    TextCodec::ConversionResult Big5hkscsCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+                                                                   ConverterState *state) const {
+        ConversionResult r = {0, 0, ConversionOk};
         char replacement = '?';
         if (state) {
             if (state->flags & ConvertInvalidToNull)
@@ -6532,11 +6654,14 @@ namespace zdytool {
 
         int invalid = 0;
 
-        int rlen = 2 * len + 1;
-        std::vector<char> rstr(rlen + 1);
-        rstr[rlen] = '\0';
-        uchar *cursor = (uchar *) rstr.data();
-        for (int i = 0; i < len; i++) {
+        uchar *cursor = (uchar *) out;
+        uchar *const cursorEnd = cursor + outLength;
+        size_t i = 0;
+        for (; i < len; i++) {
+            if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+                r.status = ConversionOutputFull;
+                break;
+            }
             unsigned short ch = uc[i];
             uchar c[2];
             if (ch < 0x80) {
@@ -6552,12 +6677,13 @@ namespace zdytool {
                 ++invalid;
             }
         }
-        string rstr_str(rstr.data(), cursor - (const uchar *) rstr.data());
 
         if (state) {
             state->invalidChars += invalid;
         }
-        return rstr_str;
+        r.consumed = i;
+        r.produced = cursor - (uchar *) out;
+        return r;
     }
 
 
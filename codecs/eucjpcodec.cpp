@@ -41,6 +41,7 @@
  */
 
 #include "eucjpcodec_p.h"
+#include "textkernels.h"
 namespace zdytool {
 #ifndef Z_NO_BIG_TEXTCODECS
 
@@ -61,8 +62,115 @@ namespace zdytool {
 		conv = 0;
 	}
 
+	char32_t EucJpCodePoints::nextMultibyte(const uchar *&src, const uchar *end)
+	{
+		static const JpUnicodeConv *const conv = JpUnicodeConv::newConverter(JpUnicodeConv::Default);
+		const uchar ch = *src++;
+		if (ch != Ss2 && ch != Ss3 && !IsEucChar(ch))
+			return SpecialCharacter::ReplacementCharacter;
+		if (src == end)
+			return Incomplete;
+		const uchar ch2 = *src++;
+		uint u;
+		if (ch == Ss2) {
+			// JIS X 0201 Kana
+			if (!IsKana(ch2))
+				return SpecialCharacter::ReplacementCharacter;
+			u = conv->jisx0201ToUnicode(ch2);
+		} else if (ch == Ss3) {
+			// JIS X 0212-1990
+			if (!IsEucChar(ch2))
+				return SpecialCharacter::ReplacementCharacter;
+			if (src == end)
+				return Incomplete;
+			const uchar ch3 = *src++;
+			if (!IsEucChar(ch3))
+				return SpecialCharacter::ReplacementCharacter;
+			u = conv->jisx0212ToUnicode(ch2 & 0x7f, ch3 & 0x7f);
+		} else {
+			// JIS X 0208-1990
+			if (!IsEucChar(ch2))
+				return SpecialCharacter::ReplacementCharacter;
+			u = conv->jisx0208ToUnicode(ch & 0x7f, ch2 & 0x7f);
+		}
+		return ZValidChar(u);
+	}
+
+	int kernels::EucJpTag::encodeMultibyte(const ushort *&src, const ushort *, uchar *dst)
+	{
+		static const JpUnicodeConv *const conv = JpUnicodeConv::newConverter(JpUnicodeConv::Default);
+		const ushort ch = *src++;
+		uint j;
+		if ((j = conv->unicodeToJisx0201(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			if (j < 0x80) {
+				// JIS X 0201 Latin ?
+				*dst = j;
+				return 1;
+			}
+			// JIS X 0201 Kana
+			dst[0] = Ss2;
+			dst[1] = j;
+			return 2;
+		}
+		if ((j = conv->unicodeToJisx0208(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			// JIS X 0208
+			dst[0] = (j >> 8)   | 0x80;
+			dst[1] = (j & 0xff) | 0x80;
+			return 2;
+		}
+		if ((j = conv->unicodeToJisx0212(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			// JIS X 0212
+			dst[0] = Ss3;
+			dst[1] = (j >> 8)   | 0x80;
+			dst[2] = (j & 0xff) | 0x80;
+			return 3;
+		}
+		*dst = '?';
+		return 1;
+	}
+
+	size_t EucJpCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t EucJpCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return boundedSize(len, 3);
+	}
+
+	size_t EucJpCodec::nextSyncPoint(const char *chars, size_t len, size_t from) const
+	{
+		return nextSyncPointAfter(chars, len, from, 0x80);
+	}
+
+	size_t EucJpCodec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		// a run of first bytes pairs up from its start, unless the byte in
+		// front of it is a single shift, which may take one or two of them
+		// or may itself be the bad second byte of a character
+		const size_t run = doubleByteRunStart(chars, to, 0xa1, 0xfe);
+		if (run > 0 && (uchar(chars[run - 1]) == Ss2 || uchar(chars[run - 1]) == Ss3))
+			return previousSyncPointAfter(chars, run - 1, 0x80);
+		return run + ((to - run) & ~size_t(1));
+	}
+
+	size_t EucJpCodec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
 	string EucJpCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult EucJpCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														   ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -70,11 +178,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 3*len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[len] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
-		for (int i = 0; i < len; i++) {
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursorEnd - cursor < 3)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			ushort ch = uc[i];
 			uint j;
 			if (ch < 0x80) {
@@ -104,17 +215,27 @@ namespace zdytool {
 				++invalid;
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		r.consumed = i;
+		r.produced = cursor - (uchar*)out;
+		return r;
 	}
 
 
 	u16string EucJpCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult EucJpCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														 ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		uchar buf[2] = {0, 0};
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -127,14 +248,20 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		u16string result;
-		for (int i=0; i<len; i++) {
+		ushort *dst = out;
+		ushort *const dstEnd = out + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
 				if (ch < 0x80) {
 					// ASCII
-					result += char(ch);
+					*dst++ = ch;
 				} else if (ch == Ss2 || ch == Ss3) {
 					// JIS X 0201 Kana or JIS X 0212
 					buf[0] = ch;
@@ -145,7 +272,7 @@ namespace zdytool {
 					nbuf = 1;
 				} else {
 					// Invalid
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				break;
@@ -154,9 +281,9 @@ namespace zdytool {
 					// JIS X 0201 Kana
 					if (IsKana(ch)) {
 						uint u = conv->jisx0201ToUnicode(ch);
-						result += ZValidChar(u);
+						*dst++ = ZValidChar(u);
 					} else {
-						result += replacement;
+						*dst++ = replacement;
 						++invalid;
 					}
 					nbuf = 0;
@@ -167,7 +294,7 @@ namespace zdytool {
 						nbuf = 2;
 					} else {
 						// Error
-						result += replacement;
+						*dst++ = replacement;
 						++invalid;
 						nbuf = 0;
 					}
@@ -175,10 +302,10 @@ namespace zdytool {
 					// JIS X 0208-1990
 					if (IsEucChar(ch)) {
 						uint u = conv->jisx0208ToUnicode(buf[0] & 0x7f, ch & 0x7f);
-						result += ZValidChar(u);
+						*dst++ = ZValidChar(u);
 					} else {
 						// Error
-						result += replacement;
+						*dst++ = replacement;
 						++invalid;
 					}
 					nbuf = 0;
@@ -188,9 +315,9 @@ namespace zdytool {
 				// JIS X 0212
 				if (IsEucChar(ch)) {
 					uint u = conv->jisx0212ToUnicode(buf[1] & 0x7f, ch & 0x7f);
-					result += ZValidChar(u);
+					*dst++ = ZValidChar(u);
 				} else {
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				nbuf = 0;
@@ -201,8 +328,12 @@ namespace zdytool {
 			state->state_data[0] = buf[0];
 			state->state_data[1] = buf[1];
 			state->invalidChars += invalid;
+			if (nbuf && r.status == ConversionOk)
+				r.status = ConversionIncomplete;
 		}
-		return result;
+		r.consumed = i;
+		r.produced = dst - out;
+		return r;
 	}
 
 	int EucJpCodec::_mibEnum()
@@ -16,6 +16,7 @@
 
 #include "euckrcodec_p.h"
 #include "cp949codetbl_p.h"
+#include "textkernels.h"
 
 #include <algorithm>
 namespace zdytool {
@@ -27,8 +28,70 @@ namespace zdytool {
 #define        IsCP949Char(c)      (((c) >= 0x81) && ((c) <= 0xa0))
 #define        ZValidChar(u)        ((u) ? (ushort)(u) : (ushort)SpecialCharacter::ReplacementCharacter)
 
+	char32_t EucKrCodePoints::nextMultibyte(const uchar *&src, const uchar *end)
+	{
+		const uchar ch = *src++;
+		if (!IsEucChar(ch))
+			return SpecialCharacter::ReplacementCharacter;
+		if (src == end)
+			return Incomplete;
+		const uchar ch2 = *src++;
+		if (!IsEucChar(ch2))
+			return SpecialCharacter::ReplacementCharacter;
+		uint u = Ksc5601ToUnicode((ch << 8) | ch2);
+		return ZValidChar(u);
+	}
+
+	int kernels::EucKrTag::encodeMultibyte(const ushort *&src, const ushort *, uchar *dst)
+	{
+		const uint j = UnicodeToKsc5601(*src++);
+		if (!j) {
+			*dst = '?';
+			return 1;
+		}
+		dst[0] = (j >> 8)   | 0x80;
+		dst[1] = (j & 0xff) | 0x80;
+		return 2;
+	}
+
+	size_t EucKrCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t EucKrCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return boundedSize(len, 2);
+	}
+
+	size_t EucKrCodec::nextSyncPoint(const char *chars, size_t len, size_t from) const
+	{
+		return nextSyncPointAfter(chars, len, from, 0x80);
+	}
+
+	size_t EucKrCodec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		// the byte after a first byte is always taken with it, valid or not
+		const size_t run = doubleByteRunStart(chars, to, 0xa1, 0xfe);
+		return run + ((to - run) & ~size_t(1));
+	}
+
+	size_t EucKrCodec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
 	string EucKrCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult EucKrCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														   ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -36,11 +99,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 2*len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
-		for (int i = 0; i < len; i++) {
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			unsigned short ch = uc[i];
 			uint j;
 			if (ch < 0x80) {
@@ -56,16 +122,26 @@ namespace zdytool {
 				++invalid;
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		r.consumed = i;
+		r.produced = cursor - (uchar*)out;
+		return r;
 	}
 
 	u16string EucKrCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult EucKrCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														 ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		uchar buf[2] = {0, 0};
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -78,21 +154,27 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		u16string result;
-		for (int i=0; i<len; i++) {
+		ushort *dst = out;
+		ushort *const dstEnd = out + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
 				if (ch < 0x80) {
 					// ASCII
-					result += char(ch);
+					*dst++ = ch;
 				} else if (IsEucChar(ch)) {
 					// KSC 5601
 					buf[0] = ch;
 					nbuf = 1;
 				} else {
 					// Invalid
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				break;
@@ -100,10 +182,10 @@ namespace zdytool {
 				// KSC 5601
 				if (IsEucChar(ch)) {
 					uint u = Ksc5601ToUnicode((buf[0] << 8) |  ch);
-					result += ZValidChar(u);
+					*dst++ = ZValidChar(u);
 				} else {
 					// Error
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				nbuf = 0;
@@ -116,8 +198,12 @@ namespace zdytool {
 			state->state_data[0] = buf[0];
 			state->state_data[1] = buf[1];
 			state->invalidChars += invalid;
+			if (nbuf && r.status == ConversionOk)
+				r.status = ConversionIncomplete;
 		}
-		return result;
+		r.consumed = i;
+		r.produced = dst - out;
+		return r;
 	}
 
 	int EucKrCodec::_mibEnum()
@@ -3301,8 +3387,43 @@ namespace zdytool {
 	/*!
 	  \reimp
 	*/
+	size_t CP949Codec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t CP949Codec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return boundedSize(len, 2);
+	}
+
+	size_t CP949Codec::nextSyncPoint(const char *chars, size_t len, size_t from) const
+	{
+		return nextSyncPointAfter(chars, len, from, 0x40);
+	}
+
+	size_t CP949Codec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		const size_t run = doubleByteRunStart(chars, to, 0x81, 0xfe);
+		return run + ((to - run) & ~size_t(1));
+	}
+
+	size_t CP949Codec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
 	string CP949Codec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult CP949Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														   ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -3310,11 +3431,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 2*len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
-		for (int i = 0; i < len; i++) {
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			unsigned short ch = uc[i];
 			uint j;
 			if (ch < 0x80) {
@@ -3369,16 +3493,26 @@ namespace zdytool {
 				}
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		r.consumed = i;
+		r.produced = cursor - (uchar*)out;
+		return r;
 	}
 
 	u16string CP949Codec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult CP949Codec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														 ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		uchar buf[2] = {0, 0};
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -3391,14 +3525,20 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		u16string result;
-		for (int i=0; i<len; i++) {
+		ushort *dst = out;
+		ushort *const dstEnd = out + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
 				if (ch < 0x80) {
 					// ASCII
-					result += char(ch);
+					*dst++ = ch;
 				} else if (IsEucChar(ch)) {
 					// KSC 5601
 					buf[0] = ch;
@@ -3408,7 +3548,7 @@ namespace zdytool {
 					nbuf = 1;
 				} else {
 					// Invalid
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				break;
@@ -3416,7 +3556,7 @@ namespace zdytool {
 				// KSC 5601
 				if (IsEucChar(ch) && !IsCP949Char(buf[0])) {
 					uint u = Ksc5601ToUnicode((buf[0] << 8) |  ch);
-					result += ZValidChar(u);
+					*dst++ = ZValidChar(u);
 				} else {
 					// Rest of CP949
 					int row, column;
@@ -3429,7 +3569,7 @@ namespace zdytool {
 					else if (0x81 <= ch && ch <= 0xfe)
 						column = ch - 0x81 + 52;
 					else {
-						result += replacement;
+						*dst++ = replacement;
 						++invalid;
 						break;
 					}
@@ -3441,12 +3581,12 @@ namespace zdytool {
 						internal_code = 3008 + row * 84 + column;
 					// check whether the conversion avialble in the table.
 					if (internal_code < 0 || internal_code >= 8822) {
-						result += replacement;
+						*dst++ = replacement;
 						++invalid;
 						break;
 					}
 					else
-						result += ZValidChar(cp949_icode_to_unicode[internal_code]);
+						*dst++ = ZValidChar(cp949_icode_to_unicode[internal_code]);
 				}
 				nbuf = 0;
 				break;
@@ -3458,8 +3598,12 @@ namespace zdytool {
 			state->state_data[0] = buf[0];
 			state->state_data[1] = buf[1];
 			state->invalidChars += invalid;
+			if (nbuf && r.status == ConversionOk)
+				r.status = ConversionIncomplete;
 		}
-		return result;
+		r.consumed = i;
+		r.produced = dst - out;
+		return r;
 	}
 #endif // Z_NO_BIG_TEXTCODECS
 }
\ No newline at end of file
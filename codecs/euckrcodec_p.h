@@ -62,6 +62,13 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t nextSyncPoint(const char *, size_t, size_t) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
 	};
 
 	class CP949Codec : public TextCodec {
@@ -76,6 +83,13 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t nextSyncPoint(const char *, size_t, size_t) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
 	};
 
 #endif // Z_NO_BIG_TEXTCODECS
@@ -15,6 +15,7 @@
 // and the grateful thanks of the Qt team.
 
 #include "gb18030codec_p.h"
+#include "textkernels.h"
 namespace zdytool {
 #ifndef Z_NO_BIG_TEXTCODECS
 
@@ -46,14 +47,99 @@ namespace zdytool {
 
 	static uint Gb18030ToUnicode(const uchar *gbstr, int& len);
 	static int UnicodeToGb18030(uint unicode, uchar *gbchar);
+	static int Gb18030Length(uint unicode);
 	int UnicodeToGbk(uint unicode, uchar *gbchar);
 
 	Gb18030Codec::Gb18030Codec()
 	{
 	}
 
+	size_t Gb18030Codec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		// a sequence pending in the state may complete to a surrogate pair, and
+		// the buffer based conversion wants room for one before each character
+		return boundedSize(len, 1, 2);
+	}
+
+	size_t Gb18030Codec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		// four bytes per character, and the buffer based conversion wants room
+		// for a four byte sequence before each character
+		return boundedSize(len, 4, 4);
+	}
+
+	size_t Gb18030Codec::nextSyncPoint(const char *chars, size_t len, size_t from) const
+	{
+		// the second byte of a four byte sequence goes down to 0x30
+		return nextSyncPointAfter(chars, len, from, 0x30);
+	}
+
+	size_t Gb18030Codec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		// a run of first bytes pairs up from its start, unless the byte in
+		// front of it is a digit that may be the second byte of a four byte
+		// sequence, whose third byte would then start the run
+		const size_t run = doubleByteRunStart(chars, to, 0x81, 0xfe);
+		if (run > 0 && Is2ndByteIn4Bytes(uchar(chars[run - 1])))
+			return previousSyncPointAfter(chars, run - 1, 0x30);
+		return run + ((to - run) & ~size_t(1));
+	}
+
+	size_t Gb18030Codec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
+	size_t Gb18030Codec::encodedLength(const ushort *uc, size_t len, const ConverterState *state) const
+	{
+		// walks convertFromUnicode() but only adds up the sequence lengths;
+		// anything without an encoding takes one replacement byte
+		size_t n = 0;
+		size_t i = 0;
+		int clen;
+		if (state && state->remainingChars && len) {
+			// the high surrogate was left over from the last call
+			if (UCS4Tool::isLowSurrogate(uc[0])) {
+				clen = Gb18030Length(UCS4Tool::surrogateToUcs4(state->state_data[0], uc[0]));
+				n += clen >= 2 ? clen : 1;
+				i = 1;
+			} else {
+				++n;
+			}
+		}
+		for (; i < len; i++) {
+			ushort ch = uc[i];
+			if (IsLatin(ch)) {
+				++n;
+			} else if (UCS4Tool::isHighSurrogate(ch)) {
+				// a trailing high surrogate is kept pending and writes nothing yet
+				if (i + 1 == len)
+					break;
+				if (UCS4Tool::isLowSurrogate(uc[i + 1])) {
+					clen = Gb18030Length(UCS4Tool::surrogateToUcs4(ch, uc[++i]));
+					n += clen >= 2 ? clen : 1;
+				} else {
+					++n;
+				}
+			} else {
+				clen = Gb18030Length(ch);
+				n += clen >= 2 ? clen : 1;
+			}
+		}
+		return n;
+	}
+
 	string Gb18030Codec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult Gb18030Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+																 ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		char replacement = '?';
 		int high = -1;
 		if (state) {
@@ -64,23 +150,28 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 4 *len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
 
-		for (int i = 0; i < len; i++) {
-			unsigned short ch = uc[i];
-			int len;
+		size_t i = 0;
+		for (; i < len; i++) {
+			// a character gives at most four bytes, plus the replacement for
+			// a lone high surrogate left over from the last call
+			if (Z_UNLIKELY(cursorEnd - cursor < (high >= 0 ? 5 : 4))) {
+				result.status = ConversionOutputFull;
+				break;
+			}
+			ushort ch = uc[i];
+			int clen;
 			uchar buf[4];
 			if (high >= 0) {
-				if (UCS4Tool::isLowSurrogate(uc[i])) {
+				// the high surrogate was left over from the last call
+				if (UCS4Tool::isLowSurrogate(ch)) {
 					// valid surrogate pair
-					++i;
-					uint u = UCS4Tool::surrogateToUcs4(high, uc[i]);
-					len = UnicodeToGb18030(u, buf);
-					if (len >= 2) {
-						for (int j=0; j<len; j++)
+					uint u = UCS4Tool::surrogateToUcs4(high, ch);
+					clen = UnicodeToGb18030(u, buf);
+					if (clen >= 2) {
+						for (int j=0; j<clen; j++)
 							*cursor++ = buf[j];
 					} else {
 						*cursor++ = replacement;
@@ -98,12 +189,28 @@ namespace zdytool {
 			if (IsLatin(ch)) {
 				// ASCII
 				*cursor++ = ch;
-			} else if (UCS4Tool::isHighSurrogate(uc[i])) {
+			} else if (UCS4Tool::isHighSurrogate(ch)) {
 				// surrogates area. check for correct encoding
 				// we need at least one more character, first the high surrogate, then the low one
-				high = ch;
-			} else if ((len = UnicodeToGb18030(ch, buf)) >= 2) {
-				for (int j=0; j<len; j++)
+				if (i + 1 == len) {
+					high = ch;
+				} else if (UCS4Tool::isLowSurrogate(uc[i + 1])) {
+					// valid surrogate pair
+					uint u = UCS4Tool::surrogateToUcs4(ch, uc[++i]);
+					clen = UnicodeToGb18030(u, buf);
+					if (clen >= 2) {
+						for (int j=0; j<clen; j++)
+							*cursor++ = buf[j];
+					} else {
+						*cursor++ = replacement;
+						++invalid;
+					}
+				} else {
+					*cursor++ = replacement;
+					++invalid;
+				}
+			} else if ((clen = UnicodeToGb18030(ch, buf)) >= 2) {
+				for (int j=0; j<clen; j++)
 					*cursor++ = buf[j];
 			} else {
 				// Error
@@ -111,24 +218,51 @@ namespace zdytool {
 				++invalid;
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 			state->state_data[0] = high;
-			if (high)
-				state->remainingChars = 1;
+			state->remainingChars = high >= 0 ? 1 : 0;
+			if (high >= 0 && result.status == ConversionOk)
+				result.status = ConversionIncomplete;
 		}
-		return rstr_str;
+		result.consumed = i;
+		result.produced = cursor - (uchar*)out;
+		return result;
 	}
 
 	u16string Gb18030Codec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	static inline size_t appendSupplementary(ushort *dst, uint u)
+	{
+		dst[0] = UCS4Tool::highSurrogate(u);
+		dst[1] = UCS4Tool::lowSurrogate(u);
+		return 2;
+	}
+
+	static inline size_t appendSupplementary(char32_t *dst, uint u)
+	{
+		*dst = u;
+		return 1;
+	}
+
+	// Decodes into UTF-16 when Char is ushort and into UCS-4 when it is char32_t.
+	template <typename Char>
+	static TextCodec::ConversionResult gb18030ToUnicode(Char *out, size_t outLength, const char *chars, size_t len,
+														TextCodec::ConverterState *state)
+	{
+		const size_t maxCharLength = sizeof(Char) == sizeof(ushort) ? 2 : 1;
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
 		uchar buf[4];
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
 		if (state) {
-			if (state->flags & ConvertInvalidToNull)
+			if (state->flags & TextCodec::ConvertInvalidToNull)
 				replacement = SpecialCharacter::Null;
 			nbuf = state->remainingChars;
 			buf[0] = (state->state_data[0] >> 24) & 0xff;
@@ -138,11 +272,15 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		std::vector<uint16_t> result(len+1);
-		result[len] = '\0';
-		int unicodeLen = 0;
-		ushort *const resultData = reinterpret_cast<ushort*>(result.data());
-		for (int i = 0; i < len; i++) {
+		size_t unicodeLen = 0;
+		Char *const resultData = out;
+		size_t i = 0;
+		for (; i < len; i++) {
+			// a character gives at most a surrogate pair
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(outLength - unicodeLen < maxCharLength)) {
+				result.status = TextCodec::ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
@@ -205,8 +343,10 @@ namespace zdytool {
 					buf[3] = ch;
 					int clen = 4;
 					uint u = Gb18030ToUnicode(buf, clen);
-					if (clen == 4) {
-						resultData[unicodeLen] = ZValidChar(u);
+					if (clen == 4 && UCS4Tool::requiresSurrogates(u)) {
+						unicodeLen += appendSupplementary(resultData + unicodeLen, u);
+					} else if (clen == 4) {
+						resultData[unicodeLen] = ZValidChar(static_cast<ushort>(u));
 						++unicodeLen;
 					} else {
 						resultData[unicodeLen] = replacement;
@@ -222,14 +362,92 @@ namespace zdytool {
 				break;
 			}
 		}
-		u16string result_str(result.data(),unicodeLen);
 
 		if (state) {
 			state->remainingChars = nbuf;
 			state->state_data[0] = (buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + buf[3];
 			state->invalidChars += invalid;
+			if (nbuf && result.status == TextCodec::ConversionOk)
+				result.status = TextCodec::ConversionIncomplete;
+		}
+		result.consumed = i;
+		result.produced = unicodeLen;
+		return result;
+	}
+
+	char32_t Gb18030CodePoints::nextMultibyte(const uchar *&src, const uchar *end)
+	{
+		// the same cases as gb18030ToUnicode(), one character at a time
+		uchar buf[4];
+		buf[0] = *src++;
+		if (!Is1stByte(buf[0]))
+			return SpecialCharacter::ReplacementCharacter;
+		if (src == end)
+			return Incomplete;
+		buf[1] = *src++;
+		if (Is2ndByteIn2Bytes(buf[1])) {
+			int clen = 2;
+			uint u = Gb18030ToUnicode(buf, clen);
+			if (clen != 2)
+				return SpecialCharacter::ReplacementCharacter;
+			return ZValidChar(static_cast<ushort>(u));
+		}
+		if (!Is2ndByteIn4Bytes(buf[1]))
+			return SpecialCharacter::ReplacementCharacter;
+		if (src == end)
+			return Incomplete;
+		buf[2] = *src++;
+		if (!Is3rdByte(buf[2]))
+			return SpecialCharacter::ReplacementCharacter;
+		if (src == end)
+			return Incomplete;
+		buf[3] = *src++;
+		if (!Is4thByte(buf[3]))
+			return SpecialCharacter::ReplacementCharacter;
+		int clen = 4;
+		uint u = Gb18030ToUnicode(buf, clen);
+		if (clen != 4)
+			return SpecialCharacter::ReplacementCharacter;
+		if (UCS4Tool::requiresSurrogates(u))
+			return u;
+		return ZValidChar(static_cast<ushort>(u));
+	}
+
+	int kernels::Gb18030Tag::encodeMultibyte(const ushort *&src, const ushort *end, uchar *dst)
+	{
+		// the same cases as convertFromUnicode(), one character at a time
+		const ushort ch = *src;
+		uint u = ch;
+		if (UCS4Tool::isHighSurrogate(ch)) {
+			if (src + 1 == end)
+				return 0;
+			if (!UCS4Tool::isLowSurrogate(src[1])) {
+				++src;
+				*dst = '?';
+				return 1;
+			}
+			u = UCS4Tool::surrogateToUcs4(ch, src[1]);
+			++src;
 		}
-		return result_str;
+		++src;
+		const int clen = UnicodeToGb18030(u, dst);
+		if (clen >= 2)
+			return clen;
+		*dst = '?';
+		return 1;
+	}
+
+	TextCodec::ConversionResult Gb18030Codec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+															   ConverterState *state) const
+	{
+		return gb18030ToUnicode(out, outLength, chars, len, state);
+	}
+
+	TextCodec::ConversionResult Gb18030Codec::convertToUcs4(char32_t *out, size_t outLength, const char *chars, size_t len,
+															ConverterState *state) const
+	{
+		// four byte sequences go straight to code points, without a surrogate pair
+		return gb18030ToUnicode(out, outLength, chars, len, state);
 	}
 
 
@@ -274,8 +492,41 @@ namespace zdytool {
 		return list;
 	}
 
+	size_t GbkCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t GbkCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return boundedSize(len, 2);
+	}
+
+	size_t GbkCodec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		// every character is one or two bytes, and the byte after a first
+		// byte is always taken with it
+		const size_t run = doubleByteRunStart(chars, to, 0x81, 0xfe);
+		return run + ((to - run) & ~size_t(1));
+	}
+
+	size_t GbkCodec::encodedLength(const ushort *uc, size_t len, const ConverterState *state) const
+	{
+		// not the GB18030 kernel; this encoding has no four byte sequences
+		return TextCodec::encodedLength(uc, len, state);
+	}
+
 	u16string GbkCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult GbkCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														  ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		uchar buf[2];
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -288,12 +539,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		std::vector<uint16_t> result(len+1);
-		result[len] = '\0';
-		int unicodeLen = 0;
-		ushort *const resultData = reinterpret_cast<ushort*>(result.data());
-
-		for (int i=0; i<len; i++) {
+		size_t unicodeLen = 0;
+		ushort *const resultData = out;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(unicodeLen == outLength)) {
+				result.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
@@ -337,19 +590,38 @@ namespace zdytool {
 				break;
 			}
 		}
-		u16string result_str(result.data(),unicodeLen);
 
 		if (state) {
 			state->remainingChars = nbuf;
 			state->state_data[0] = buf[0];
 			state->state_data[1] = buf[1];
 			state->invalidChars += invalid;
+			if (nbuf && result.status == ConversionOk)
+				result.status = ConversionIncomplete;
 		}
-		return result_str;
+		result.consumed = i;
+		result.produced = unicodeLen;
+		return result;
+	}
+
+	TextCodec::ConversionResult GbkCodec::convertToUcs4(char32_t *out, size_t outLength, const char *chars, size_t len,
+														ConverterState *state) const
+	{
+		// not the GB18030 kernel; this encoding has no four byte sequences
+		return TextCodec::convertToUcs4(out, outLength, chars, len, state);
 	}
 
 	string GbkCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult GbkCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+															ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -357,12 +629,15 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 2*len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
 
-		for (int i = 0; i < len; i++) {
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+				result.status = ConversionOutputFull;
+				break;
+			}
 			ushort ch = uc[i];
 			uchar buf[2];
 
@@ -374,16 +649,17 @@ namespace zdytool {
 				*cursor++ = buf[1];
 			} else {
 				// Error
-				*cursor += replacement;
+				*cursor++ = replacement;
 				++invalid;
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		result.consumed = i;
+		result.produced = cursor - (uchar*)out;
+		return result;
 	}
 
 
@@ -416,8 +692,39 @@ namespace zdytool {
 	}
 
 
+	size_t Gb2312Codec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Gb2312Codec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return boundedSize(len, 2);
+	}
+
+	size_t Gb2312Codec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		const size_t run = doubleByteRunStart(chars, to, 0xa1, 0xfe);
+		return run + ((to - run) & ~size_t(1));
+	}
+
+	size_t Gb2312Codec::encodedLength(const ushort *uc, size_t len, const ConverterState *state) const
+	{
+		// not the GB18030 kernel; this encoding has no four byte sequences
+		return TextCodec::encodedLength(uc, len, state);
+	}
+
 	u16string Gb2312Codec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult Gb2312Codec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														  ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		uchar buf[2];
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -430,11 +737,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		std::vector<uint16_t> result(len+1);
-		result[len] = '\0';
-		int unicodeLen = 0;
-		ushort *const resultData = reinterpret_cast<ushort*>(result.data());
-		for (int i=0; i<len; i++) {
+		size_t unicodeLen = 0;
+		ushort *const resultData = out;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(unicodeLen == outLength)) {
+				result.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
@@ -478,20 +788,38 @@ namespace zdytool {
 				break;
 			}
 		}
-		u16string result_str(result.data(),unicodeLen);
 
 		if (state) {
 			state->remainingChars = nbuf;
 			state->state_data[0] = buf[0];
 			state->state_data[1] = buf[1];
 			state->invalidChars += invalid;
+			if (nbuf && result.status == ConversionOk)
+				result.status = ConversionIncomplete;
 		}
-		return result_str;
+		result.consumed = i;
+		result.produced = unicodeLen;
+		return result;
 	}
 
+	TextCodec::ConversionResult Gb2312Codec::convertToUcs4(char32_t *out, size_t outLength, const char *chars, size_t len,
+															ConverterState *state) const
+	{
+		// not the GB18030 kernel; this encoding has no four byte sequences
+		return TextCodec::convertToUcs4(out, outLength, chars, len, state);
+	}
 
 	string Gb2312Codec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult Gb2312Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+															ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -499,12 +827,15 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 2*len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
 
-		for (int i = 0; i < len; i++) {
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+				result.status = ConversionOutputFull;
+				break;
+			}
 			ushort ch = uc[i];
 			uchar buf[2];
 
@@ -521,12 +852,13 @@ namespace zdytool {
 				++invalid;
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		result.consumed = i;
+		result.produced = cursor - (uchar*)out;
+		return result;
 	}
 
 
@@ -8887,7 +9219,7 @@ namespace zdytool {
 						}
 					} else if (InRange(gb4lin, 0x2E248, 0x12E247)) {
 						/* GB+90308130 - GB+E3329A35 */
-						uni = gb4lin - 0xE248;
+						uni = gb4lin - 0x1E248;
 					} else {
 						/* undefined or reserved area */
 						len = 1;
@@ -9004,6 +9336,34 @@ namespace zdytool {
 	}
 
 
+	static int Gb18030Length(uint uni) {
+		/* Returns the bytesize UnicodeToGb18030() gives, without writing it. */
+		indexTbl_t        u2g;
+
+		if (IsLatin(uni)) {
+			return 1;
+		}
+		else if (uni <= 0xD7FF || InRange(uni, 0xE766, 0xFFFF)) {
+			u2g = ucs_to_gb18030_index[uni >> 8];
+
+			if ((uint8_t)(uni & 0xFF) >= u2g.tblBegin && (uint8_t)(uni & 0xFF) <= u2g.tblEnd) {
+				// table entries above 0x8000 are 2-byte GB18030
+				return ucs_to_gb18030[uni - u2g.tblOffset] > 0x8000 ? 2 : 4;
+			}
+			// calculated algorithmically, always 4-byte
+			return 4;
+		}
+		else if (InRange(uni, 0xE000, 0xE765)) {
+			// User-defined areas in GB18030 (2-byte)
+			return 2;
+		}
+		else if (InRange(uni, 0x10000, 0x10FFFF)) {
+			return 4;
+		}
+		return 0;
+	}
+
+
 	int UnicodeToGbk(uint uni, uchar *gbchar) {
 		/* Returns the bytesize of the GBK character. */
 		/* Intended for improving performance of GB2312 and GBK functions. */
@@ -41,6 +41,15 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const uint16_t *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(uint16_t *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const uint16_t *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t nextSyncPoint(const char *, size_t, size_t) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
+		size_t encodedLength(const ushort *, size_t, const ConverterState *) const;
 	};
 
 	class GbkCodec : public Gb18030Codec {
@@ -57,6 +66,13 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t encodedLength(const ushort *, size_t, const ConverterState *) const;
 	};
 
 	class Gb2312Codec : public Gb18030Codec {
@@ -72,6 +88,13 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t encodedLength(const ushort *, size_t, const ConverterState *) const;
 	};
 
 #endif // Z_NO_BIG_TEXTCODECS
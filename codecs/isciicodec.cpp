@@ -47,12 +47,12 @@ namespace zdytool {
 	{
 	}
 
-	string IsciiCodec::name() const
+	string IsciiCodec::_name(int idx)
 	{
 	  return codecs[idx].name;
 	}
 
-	int IsciiCodec::mibEnum() const
+	int IsciiCodec::_mibEnum(int idx)
 	{
 		/* There is no MIBEnum for Iscii */
 		return -3000-idx;
@@ -148,8 +148,28 @@ namespace zdytool {
 	};
 
 
+	size_t IsciiCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t IsciiCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		// a character gives at most a pair of bytes
+		return boundedSize(len, 2);
+	}
+
 	string IsciiCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string result(maxEncodedLength(len, state), '\0');
+		result.resize(convertFromUnicode(&result[0], result.size(), uc, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult IsciiCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+															   ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		char replacement = '?';
 		bool halant = false;
 		if (state) {
@@ -159,15 +179,18 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		std::vector<char> result(2 * len + 1);
-		result[2 * len] = '\0';
-
-
-		uchar *ch = reinterpret_cast<uchar *>(result.data());
+		uchar *ch = reinterpret_cast<uchar *>(out);
+		uchar *const end = ch + outLength;
 
 		const int base = codecs[idx].base;
 
-		for (int i =0; i < len; ++i) {
+		size_t i = 0;
+		for (; i < len; ++i) {
+			// a character gives at most a pair of bytes
+			if (Z_UNLIKELY(end - ch < 2)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			const ushort codePoint = uc[i];
 
 			/* The low 7 bits of ISCII is plain ASCII. However, we go all the
@@ -207,29 +230,37 @@ namespace zdytool {
 			}
 			halant = (pos == 0x4d);
 		}
-		string result_str(result.data(),ch - (uchar *)result.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 			state->state_data[0] = halant;
 		}
-		return result_str;
+		r.consumed = i;
+		r.produced = ch - reinterpret_cast<uchar *>(out);
+		return r;
 	}
 
 	u16string IsciiCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
+	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult IsciiCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+															 ConverterState *state) const
 	{
 		bool halant = false;
 		if (state) {
 			halant = state->state_data[0];
 		}
 
-		std::vector<uint16_t> result(len+1);
-		result[len] = '\0';
-		ushort *uc = result.data();
+		ushort *uc = out;
+		const size_t count = std::min(len, outLength);
 
 		const int base = codecs[idx].base;
 
-		for (int i = 0; i < len; ++i) {
+		for (size_t i = 0; i < count; ++i) {
 			ushort ch = (uchar) chars[i];
 			if (ch < 0xa0)
 				*uc++ = ch;
@@ -248,11 +279,11 @@ namespace zdytool {
 			}
 			halant = ((uchar)chars[i] == 0xe8);
 		}
-		u16string result_str(result.data(),uc - result.data());
 
 		if (state) {
 			state->state_data[0] = halant;
 		}
-		return result_str;
+		ConversionResult r = { count, size_t(uc - out), count < len ? ConversionOutputFull : ConversionOk };
+		return r;
 	}
 }
\ No newline at end of file
@@ -30,11 +30,18 @@ namespace zdytool {
 
 		static TextCodec *create(const char *name);
 
-		string name() const;
-		int mibEnum() const;
+		static string _name(int);
+		static int _mibEnum(int);
+
+		string name() const { return _name(idx); }
+		int mibEnum() const { return _mibEnum(idx); }
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
 
 	private:
 		int idx;
@@ -64,8 +64,95 @@ namespace zdytool {
 		conv = 0;
 	}
 
+	size_t JisCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	// A stateless conversion drops an escape sequence or character that is
+	// cut off by the end of the input, which is just what a conversion with
+	// a fresh state leaves pending. remainingChars does not count the bytes
+	// of such a tail, so the generic stateless paths must not re-decode it.
+	TextCodec::ConversionResult JisCodec::convertToUcs4(char32_t *out, size_t outLength, const char *chars, size_t len,
+														ConverterState *cs) const
+	{
+		if (!cs) {
+			ConverterState local;
+			return TextCodec::convertToUcs4(out, outLength, chars, len, &local);
+		}
+		return TextCodec::convertToUcs4(out, outLength, chars, len, cs);
+	}
+
+	size_t JisCodec::decodedLength(const char *chars, size_t len, const ConverterState *cs) const
+	{
+		if (!cs) {
+			ConverterState local;
+			return TextCodec::decodedLength(chars, len, &local);
+		}
+		return TextCodec::decodedLength(chars, len, cs);
+	}
+
+	size_t JisCodec::codePointCount(const char *chars, size_t len, const ConverterState *cs) const
+	{
+		// there are no surrogate pairs in any of the character sets
+		return decodedLength(chars, len, cs);
+	}
+
+	size_t JisCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		// a character gives at most an escape sequence of four bytes and two
+		// bytes of data, and the conversion ends by switching back to ASCII
+		return boundedSize(len, 6, 3);
+	}
+
+	// Works out the character set that encodes \a ch while \a state is the
+	// set in use and stores the code in \a j. Returns UnknownState if no set
+	// has the character.
+	static Iso2022State jisCharset(const JpUnicodeConv *conv, ushort ch, Iso2022State state, uint *j)
+	{
+		if (UCS2Tool::row(ch) == 0x00 && UCS2Tool::cell(ch) < 0x80) {
+			// Ascii
+			if (state != JISX0201_Latin ||
+				UCS2Tool::cell(ch) == ReverseSolidus || UCS2Tool::cell(ch) == Tilde) {
+				state = Ascii;
+			}
+			*j = UCS2Tool::cell(ch);
+		} else if ((*j = conv->unicodeToJisx0201(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			if (*j < 0x80) {
+				// JIS X 0201 Latin
+				if (state != Ascii ||
+					UCS2Tool::cell(ch) == YenSign || UCS2Tool::cell(ch) == Overline) {
+					state = JISX0201_Latin;
+				}
+			} else {
+				// JIS X 0201 Kana
+				state = JISX0201_Kana;
+				*j &= 0x7f;
+			}
+		} else if ((*j = conv->unicodeToJisx0208(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			// JIS X 0208
+			state = JISX0208_1983;
+		} else if ((*j = conv->unicodeToJisx0212(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			// JIS X 0212
+			state = JISX0212;
+		} else {
+			// Invalid
+			state = UnknownState;
+		}
+		return state;
+	}
+
 	string JisCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *cs) const
 	{
+		string result(maxEncodedLength(len, cs), '\0');
+		result.resize(convertFromUnicode(&result[0], result.size(), uc, len, cs).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult JisCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														 ConverterState *cs) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (cs) {
 			if (cs->flags & ConvertInvalidToNull)
@@ -73,70 +160,123 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		string result;
+		char *cursor = out;
+		char *const cursorEnd = out + outLength;
 		Iso2022State state = Ascii;
 		Iso2022State prev = Ascii;
-		for (int i = 0; i < len; i++) {
-			ushort ch = uc[i];
+		size_t i = 0;
+		for (; i < len; i++) {
+			// room for the longest character and the final switch back to ASCII
+			if (Z_UNLIKELY(cursorEnd - cursor < 9)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			uint j;
-			if (UCS2Tool::row(ch) == 0x00 && UCS2Tool::cell(ch) < 0x80) {
-				// Ascii
-				if (state != JISX0201_Latin ||
-					UCS2Tool::cell(ch) == ReverseSolidus || UCS2Tool::cell(ch) == Tilde) {
-					state = Ascii;
-				}
-				j = UCS2Tool::cell(ch);
-			} else if ((j = conv->unicodeToJisx0201(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
-				if (j < 0x80) {
-					// JIS X 0201 Latin
-					if (state != Ascii ||
-						UCS2Tool::cell(ch) == YenSign || UCS2Tool::cell(ch) == Overline) {
-						state = JISX0201_Latin;
-					}
-				} else {
-					// JIS X 0201 Kana
-					state = JISX0201_Kana;
-					j &= 0x7f;
-				}
-			} else if ((j = conv->unicodeToJisx0208(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
-				// JIS X 0208
-				state = JISX0208_1983;
-			} else if ((j = conv->unicodeToJisx0212(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
-				// JIS X 0212
-				state = JISX0212;
-			} else {
-				// Invalid
-				state = UnknownState;
+			state = jisCharset(conv, uc[i], state, &j);
+			if (state == UnknownState) {
 				j = replacement;
 				++invalid;
 			}
 			if (state != prev) {
+				const char *seq;
 				if (state == UnknownState) {
-					result += Esc_Ascii;
+					seq = Esc_Ascii;
 				} else {
-					result += Esc_SEQ[state - MinState];
+					seq = Esc_SEQ[state - MinState];
 				}
+				while (*seq)
+					*cursor++ = *seq++;
 				prev = state;
 			}
 			if (j < 0x0100) {
-				result += j & 0xff;
+				*cursor++ = j & 0xff;
 			} else {
-				result += (j >> 8) & 0xff;
-				result += j & 0xff;
+				*cursor++ = (j >> 8) & 0xff;
+				*cursor++ = j & 0xff;
 			}
 		}
 		if (prev != Ascii) {
-			result += Esc_Ascii;
+			for (const char *seq = Esc_Ascii; *seq; ++seq)
+				*cursor++ = *seq;
 		}
 
 		if (cs) {
 			cs->invalidChars += invalid;
 		}
-		return result;
+		r.consumed = i;
+		r.produced = cursor - out;
+		return r;
+	}
+
+	size_t JisCodec::encodedLength(const ushort *uc, size_t len, const ConverterState *) const
+	{
+		// the encoder starts over in ASCII on every call, so it cannot be run
+		// a scratch buffer at a time; walk the same state machine instead
+		size_t n = 0;
+		Iso2022State state = Ascii;
+		Iso2022State prev = Ascii;
+		for (size_t i = 0; i < len; i++) {
+			uint j;
+			state = jisCharset(conv, uc[i], state, &j);
+			if (state != prev) {
+				n += strlen(state == UnknownState ? Esc_Ascii : Esc_SEQ[state - MinState]);
+				prev = state;
+			}
+			// the replacement of an invalid character is a single byte
+			n += (state == UnknownState || j < 0x0100) ? 1 : 2;
+		}
+		if (prev != Ascii)
+			n += strlen(Esc_Ascii);
+		return n;
+	}
+
+	// Tells whether the encoder is in ASCII after uc[pos - 1], an ASCII
+	// character. It is unless JIS X 0201 Roman was in use, which only a
+	// backslash or a tilde leaves for ASCII.
+	static bool jisAsciiAfter(const JpUnicodeConv *conv, const ushort *uc, size_t pos)
+	{
+		for (size_t k = pos; k-- > 0;) {
+			if (uc[k] == ReverseSolidus || uc[k] == Tilde)
+				return true;
+			if (uc[k] >= 0x80) {
+				uint j;
+				return jisCharset(conv, uc[k], JISX0201_Latin, &j) != JISX0201_Latin;
+			}
+		}
+		return true;
+	}
+
+	size_t JisCodec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		// every call starts out in ASCII and switches back to it at the end,
+		// so a cut leaves no trace only where the whole text is in ASCII too
+		size_t i = std::max<size_t>(from, 1);
+		while (i < len) {
+			if (uc[i - 1] >= 0x80) {
+				++i;
+				continue;
+			}
+			if (jisAsciiAfter(conv, uc, i))
+				return i;
+			while (i < len && uc[i - 1] < 0x80 && uc[i - 1] != ReverseSolidus && uc[i - 1] != Tilde)
+				++i;
+			if (i < len && uc[i - 1] < 0x80)
+				return i;
+		}
+		return len;
 	}
 
 	u16string JisCodec::convertToUnicode(const char* chars, int len, ConverterState *cs) const
 	{
+		u16string result(maxDecodedLength(len, cs), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, cs).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult JisCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														 ConverterState *cs) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		uchar buf[4] = {0, 0, 0, 0};
 		int nbuf = 0;
 		Iso2022State state = Ascii, prev = Ascii;
@@ -156,8 +296,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		u16string result;
-		for (int i=0; i<len; i++) {
+		ushort *dst = out;
+		ushort *const dstEnd = out + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			if (esc) {
 				// Escape sequence
@@ -242,16 +388,16 @@ namespace zdytool {
 						switch (state) {
 						case Ascii:
 							if (ch < 0x80) {
-								result += char(ch);
+								*dst++ = ch;
 								break;
 							}
 						case JISX0201_Latin:
 							u = conv->jisx0201ToUnicode(ch);
-							result += ZValidChar(u);
+							*dst++ = ZValidChar(u);
 							break;
 						case JISX0201_Kana:
 							u = conv->jisx0201ToUnicode(ch | 0x80);
-							result += ZValidChar(u);
+							*dst++ = ZValidChar(u);
 							break;
 						case JISX0208_1978:
 						case JISX0208_1983:
@@ -259,7 +405,7 @@ namespace zdytool {
 							buf[nbuf++] = ch;
 							break;
 						default:
-							result += SpecialCharacter::ReplacementCharacter;
+							*dst++ = SpecialCharacter::ReplacementCharacter;
 							break;
 						}
 						break;
@@ -268,14 +414,14 @@ namespace zdytool {
 						case JISX0208_1978:
 						case JISX0208_1983:
 							u = conv->jisx0208ToUnicode(buf[0] & 0x7f, ch & 0x7f);
-							result += ZValidChar(u);
+							*dst++ = ZValidChar(u);
 							break;
 						case JISX0212:
 							u = conv->jisx0212ToUnicode(buf[0] & 0x7f, ch & 0x7f);
-							result += ZValidChar(u);
+							*dst++ = ZValidChar(u);
 							break;
 						default:
-							result += replacement;
+							*dst++ = replacement;
 							++invalid;
 							break;
 						}
@@ -292,9 +438,13 @@ namespace zdytool {
 			cs->state_data[0] = (buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + buf[3];
 			cs->state_data[1] = (prev << 8) + state;
 			cs->state_data[2] = esc;
+			if ((nbuf || esc) && r.status == ConversionOk)
+				r.status = ConversionIncomplete;
 		}
 
-		return result;
+		r.consumed = i;
+		r.produced = dst - out;
+		return r;
 	}
 
 	int JisCodec::_mibEnum()
@@ -64,6 +64,15 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t decodedLength(const char *, size_t, const ConverterState *) const;
+		size_t codePointCount(const char *, size_t, const ConverterState *) const;
+		size_t encodedLength(const ushort *, size_t, const ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
 
 		JisCodec();
 		~JisCodec();
@@ -20,6 +20,62 @@ namespace zdytool {
 	{
 	}
 
+	size_t Latin1Codec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Latin1Codec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Latin1Codec::nextSyncPoint(const char *, size_t, size_t from) const
+	{
+		return from;
+	}
+
+	size_t Latin1Codec::previousSyncPoint(const char *, size_t, size_t to, ConverterState *) const
+	{
+		return to;
+	}
+
+	size_t Latin1Codec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
+	size_t Latin1Codec::decodedLength(const char *, size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Latin1Codec::codePointCount(const char *, size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Latin1Codec::encodedLength(const ushort *, size_t len, const ConverterState *) const
+	{
+		// one byte per character, a replacement included
+		return len;
+	}
+
+	bool Latin1Codec::validateToUnicode(const char *, size_t) const
+	{
+		// every byte is a Latin-1 character
+		return true;
+	}
+
+	bool Latin1Codec::validateFromUnicode(const ushort *ch, size_t len) const
+	{
+		for (size_t i = 0; i < len; ++i) {
+			if (ch[i] > 0xff)
+				return false;
+		}
+		return true;
+	}
+
 	u16string Latin1Codec::convertToUnicode(const char *chars, int len, ConverterState *) const
 	{
 		if (chars == 0)
@@ -28,15 +84,30 @@ namespace zdytool {
 		return u16string_fromLatin1(chars, len);
 	}
 
+	TextCodec::ConversionResult Latin1Codec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+															  ConverterState *) const
+	{
+		size_t count = std::min(len, outLength);
+		from_latin1(out, chars, count);
+		ConversionResult result = { count, count, count < len ? ConversionOutputFull : ConversionOk };
+		return result;
+	}
 
 	string Latin1Codec::convertFromUnicode(const ushort *ch, int len, ConverterState *state) const
+	{
+		string r(len, '\0');
+		convertFromUnicode(&r[0], r.size(), ch, len, state);
+		return r;
+	}
+
+	TextCodec::ConversionResult Latin1Codec::convertFromUnicode(char *out, size_t outLength, const ushort *ch, size_t len,
+																ConverterState *state) const
 	{
 		const char replacement = (state && state->flags & ConvertInvalidToNull) ? 0 : '?';
-		std::vector<char> r(len+1);
-		r[len] ='\0';
-		char *d = r.data();
+		size_t count = std::min(len, outLength);
+		char *d = out;
 		int invalid = 0;
-		for (int i = 0; i < len; ++i) {
+		for (size_t i = 0; i < count; ++i) {
 			if (ch[i] > 0xff) {
 				d[i] = replacement;
 				++invalid;
@@ -47,16 +118,16 @@ namespace zdytool {
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		string r_str(r.data(),len);
-		return r_str;
+		ConversionResult result = { count, count, count < len ? ConversionOutputFull : ConversionOk };
+		return result;
 	}
 
-	string Latin1Codec::name() const
+	string Latin1Codec::_name()
 	{
 		return "ISO-8859-1";
 	}
 
-	list<string> Latin1Codec::aliases() const
+	list<string> Latin1Codec::_aliases()
 	{
 		list<string> list;
 		list.push_back("latin1");
@@ -75,7 +146,7 @@ namespace zdytool {
 	}
 
 
-	int Latin1Codec::mibEnum() const
+	int Latin1Codec::_mibEnum()
 	{
 		return 4;
 	}
@@ -85,18 +156,48 @@ namespace zdytool {
 	{
 	}
 
-	u16string Latin15Codec::convertToUnicode(const char* chars, int len, ConverterState *) const
+	size_t Latin15Codec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Latin15Codec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t Latin15Codec::nextSyncPoint(const char *, size_t, size_t from) const
+	{
+		return from;
+	}
+
+	size_t Latin15Codec::previousSyncPoint(const char *, size_t, size_t to, ConverterState *) const
+	{
+		return to;
+	}
+
+	size_t Latin15Codec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
+	u16string Latin15Codec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
 		if (chars == 0)
 			return u16string();
 
-		std::basic_string<uint16_t> str = u16string_fromLatin1(chars, len);
-		std::vector<uint16_t> str_c(len+1);
-		int str_len = len;
-		memcpy(str_c.data(),str.data(),len*sizeof(uint16_t));
-		str_c[len] = '\0';
-		ushort *uc = str_c.data();
-		while(len--) {
+		u16string str(len, 0);
+		convertToUnicode(&str[0], str.size(), chars, len, state);
+		return str;
+	}
+
+	TextCodec::ConversionResult Latin15Codec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+															   ConverterState *) const
+	{
+		size_t count = std::min(len, outLength);
+		from_latin1(out, chars, count);
+		ushort *uc = out;
+		for (size_t i = 0; i < count; ++i) {
 			switch(*uc) {
 				case 0xa4:
 					*uc = 0x20ac;
@@ -127,18 +228,25 @@ namespace zdytool {
 			}
 			uc++;
 		}
-		u16string str_str(str_c.data(),str_len);
-		return str_str;
+		ConversionResult result = { count, count, count < len ? ConversionOutputFull : ConversionOk };
+		return result;
 	}
 
 	string Latin15Codec::convertFromUnicode(const ushort *in, int length, ConverterState *state) const
+	{
+		string r(length, '\0');
+		convertFromUnicode(&r[0], r.size(), in, length, state);
+		return r;
+	}
+
+	TextCodec::ConversionResult Latin15Codec::convertFromUnicode(char *out, size_t outLength, const ushort *in, size_t length,
+																 ConverterState *state) const
 	{
 		const char replacement = (state && state->flags & ConvertInvalidToNull) ? 0 : '?';
-		std::vector<char> r(length+1);
-		r[length] = '\0';
-		char *d = r.data();
+		size_t count = std::min(length, outLength);
+		char *d = out;
 		int invalid = 0;
-		for (int i = 0; i < length; ++i) {
+		for (size_t i = 0; i < count; ++i) {
 			uchar c;
 			ushort uc = in[i];
 			if (uc < 0x0100) {
@@ -203,24 +311,24 @@ namespace zdytool {
 			state->remainingChars = 0;
 			state->invalidChars += invalid;
 		}
-		string r_str(r.data(),length);
-		return r_str;
+		ConversionResult result = { count, count, count < length ? ConversionOutputFull : ConversionOk };
+		return result;
 	}
 
 
-	string Latin15Codec::name() const
+	string Latin15Codec::_name()
 	{
 		return "ISO-8859-15";
 	}
 
-	list<string> Latin15Codec::aliases() const
+	list<string> Latin15Codec::_aliases()
 	{
 		list<string> list;
 		list.push_back("latin9");
 		return list;
 	}
 
-	int Latin15Codec::mibEnum() const
+	int Latin15Codec::_mibEnum()
 	{
 		return 111;
 	}
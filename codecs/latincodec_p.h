@@ -30,10 +30,26 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t nextSyncPoint(const char *, size_t, size_t) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
+		size_t decodedLength(const char *, size_t, const ConverterState *) const;
+		size_t codePointCount(const char *, size_t, const ConverterState *) const;
+		size_t encodedLength(const ushort *, size_t, const ConverterState *) const;
+		bool validateToUnicode(const char *, size_t) const;
+		bool validateFromUnicode(const ushort *, size_t) const;
 
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 	};
 
 
@@ -45,10 +61,21 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t nextSyncPoint(const char *, size_t, size_t) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
+
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
 
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 	};
 }
 #endif // LATINCODEC_P_H
@@ -611,28 +611,67 @@ namespace zdytool {
 		return map;
 	}
 
-	u16string SimpleTextCodec::convertToUnicode(const char* chars, int len, ConverterState *) const
+	size_t SimpleTextCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t SimpleTextCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t SimpleTextCodec::nextSyncPoint(const char *, size_t, size_t from) const
+	{
+		return from;
+	}
+
+	size_t SimpleTextCodec::previousSyncPoint(const char *, size_t, size_t to, ConverterState *) const
+	{
+		return to;
+	}
+
+	size_t SimpleTextCodec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
+	u16string SimpleTextCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
 		if (len <= 0 || chars == 0)
 			return u16string();
 
-		const uchar * c = (const uchar *)chars;
+		u16string r(len, 0);
+		convertToUnicode(&r[0], r.size(), chars, len, state);
+		return r;
+	}
 
-		std::vector<uint16_t> r(len+1);
-		r[len] = '\0';
-		ushort* uc = r.data();
+	TextCodec::ConversionResult SimpleTextCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+																  ConverterState *) const
+	{
+		const uchar * c = (const uchar *)chars;
+		size_t count = std::min(len, outLength);
+		ushort* uc = out;
 
-		for (int i = 0; i < len; i++) {
+		for (size_t i = 0; i < count; i++) {
 			if (c[i] > 127)
 				uc[i] = unicodevalues[forwardIndex].values[c[i]-128];
 			else
 				uc[i] = char(c[i]);
 		}
-		u16string r_str(r.data(),len);
-		return r_str;
+		ConversionResult result = { count, count, count < len ? ConversionOutputFull : ConversionOk };
+		return result;
 	}
 
 	string SimpleTextCodec::convertFromUnicode(const ushort *in, int length, ConverterState *state) const
+	{
+		string r(length, '\0');
+		convertFromUnicode(&r[0], r.size(), in, length, state);
+		return r;
+	}
+
+	TextCodec::ConversionResult SimpleTextCodec::convertFromUnicode(char *out, size_t outLength, const ushort *in, size_t length,
+																	ConverterState *state) const
 	{
 		const char replacement = (state && state->flags & ConvertInvalidToNull) ? 0 : '?';
 		int invalid = 0;
@@ -649,12 +688,11 @@ namespace zdytool {
 			}
 		}
 
-		std::vector<char> r(length+1);
-		r[length] = '\0';
-		int i = length;
+		size_t count = std::min(length, outLength);
+		size_t i = count;
 		int u;
 		const ushort* ucp = in;
-		uchar* rp = (uchar *)r.data();
+		uchar* rp = (uchar *)out;
 		const uchar* rmp = (const uchar *)rmap->data();
 		int rmsize = (int) rmap->size();
 		while(i--)
@@ -676,16 +714,16 @@ namespace zdytool {
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		string r_str(r.data(),length);
-		return r_str;
+		ConversionResult result = { count, count, count < length ? ConversionOutputFull : ConversionOk };
+		return result;
 	}
 
-	string SimpleTextCodec::name() const
+	string SimpleTextCodec::_name(int forwardIndex)
 	{
 		return unicodevalues[forwardIndex].mime;
 	}
 
-	list<string> SimpleTextCodec::aliases() const
+	list<string> SimpleTextCodec::_aliases(int forwardIndex)
 	{
 		list<string> list;
 		const char * const*a = unicodevalues[forwardIndex].aliases;
@@ -696,7 +734,7 @@ namespace zdytool {
 		return list;
 	}
 
-	int SimpleTextCodec::mibEnum() const
+	int SimpleTextCodec::_mibEnum(int forwardIndex)
 	{
 		return unicodevalues[forwardIndex].mib;
 	}
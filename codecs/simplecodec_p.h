@@ -32,10 +32,21 @@ namespace zdytool {
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const override;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const override;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const override;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const override;
+		size_t maxDecodedLength(size_t, const ConverterState *) const override;
+		size_t maxEncodedLength(size_t, const ConverterState *) const override;
+		size_t nextSyncPoint(const char *, size_t, size_t) const override;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const override;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const override;
 
-		string name() const override;
-		list<string> aliases() const override;
-		int mibEnum() const override;
+		static string _name(int);
+		static list<string> _aliases(int);
+		static int _mibEnum(int);
+
+		string name() const override { return _name(forwardIndex); }
+		list<string> aliases() const override { return _aliases(forwardIndex); }
+		int mibEnum() const override { return _mibEnum(forwardIndex); }
 
 	private:
 		int forwardIndex;
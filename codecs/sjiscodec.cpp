@@ -16,6 +16,7 @@
 // and the grateful thanks of the Qt team.
 
 #include "sjiscodec_p.h"
+#include "textkernels.h"
 namespace zdytool {
 #ifndef Z_NO_BIG_TEXTCODECS
 	enum {
@@ -41,8 +42,98 @@ namespace zdytool {
 	}
 
 
+	char32_t SjisCodePoints::next(const uchar *&src, const uchar *end)
+	{
+		static const JpUnicodeConv *const conv = JpUnicodeConv::newConverter(JpUnicodeConv::Default);
+		const uchar ch = *src++;
+		if (ch < 0x80)
+			return ZValidChar(ch);
+		if (IsKana(ch)) {
+			// JIS X 0201 Latin or JIS X 0201 Kana
+			uint u = conv->jisx0201ToUnicode(ch);
+			return ZValidChar(u);
+		}
+		if (!IsSjisChar1(ch))
+			return SpecialCharacter::ReplacementCharacter;
+		if (src == end)
+			return Incomplete;
+		const uchar ch2 = *src++;
+		if (!IsSjisChar2(ch2))
+			return SpecialCharacter::ReplacementCharacter;
+		uint u;
+		if ((u = conv->sjisibmvdcToUnicode(ch, ch2)) || (u = conv->cp932ToUnicode(ch, ch2)))
+			return ZValidChar(u);
+		if (IsUserDefinedChar1(ch))
+			return SpecialCharacter::ReplacementCharacter;
+		u = conv->sjisToUnicode(ch, ch2);
+		return ZValidChar(u);
+	}
+
+	int kernels::SjisTag::encodeMultibyte(const ushort *&src, const ushort *, uchar *dst)
+	{
+		static const JpUnicodeConv *const conv = JpUnicodeConv::newConverter(JpUnicodeConv::Default);
+		const ushort ch = *src++;
+		uint j;
+		if ((j = conv->unicodeToJisx0201(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			// JIS X 0201 Latin or JIS X 0201 Kana
+			*dst = j;
+			return 1;
+		}
+		if ((j = conv->unicodeToSjis(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0
+			|| (j = conv->unicodeToSjisibmvdc(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0
+			|| (j = conv->unicodeToCp932(UCS2Tool::row(ch), UCS2Tool::cell(ch))) != 0) {
+			// JIS X 0208, its IBM VDC or CP932
+			dst[0] = (j >> 8);
+			dst[1] = (j & 0xff);
+			return 2;
+		}
+		if (conv->unicodeToJisx0212(UCS2Tool::row(ch), UCS2Tool::cell(ch)) != 0) {
+			// JIS X 0212 (can't be encoded in ShiftJIS !)
+			dst[0] = 0x81;        // white square
+			dst[1] = 0xa0;        // white square
+			return 2;
+		}
+		*dst = '?';
+		return 1;
+	}
+
+	size_t SjisCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
+	size_t SjisCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return boundedSize(len, 2);
+	}
+
+	size_t SjisCodec::nextSyncPoint(const char *chars, size_t len, size_t from) const
+	{
+		return nextSyncPointAfter(chars, len, from, 0x40);
+	}
+
+	size_t SjisCodec::previousSyncPoint(const char *chars, size_t, size_t to, ConverterState *) const
+	{
+		// half-width kana are also second bytes, so runs cannot be paired up
+		return previousSyncPointAfter(chars, to, 0x40);
+	}
+
+	size_t SjisCodec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
 	string SjisCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult SjisCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														   ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -50,11 +141,14 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		int rlen = 2*len + 1;
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
-		for (int i = 0; i < len; i++) {
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursorEnd - cursor < 2)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			ushort ch = uc[i];
 			uint j;
 			if (UCS2Tool::row(ch) == 0x00 && UCS2Tool::cell(ch) < 0x80) {
@@ -85,16 +179,26 @@ namespace zdytool {
 				++invalid;
 			}
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		r.consumed = i;
+		r.produced = cursor - (uchar*)out;
+		return r;
 	}
 
 	u16string SjisCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult SjisCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+														 ConverterState *state) const
+	{
+		ConversionResult r = { 0, 0, ConversionOk };
 		uchar buf[1] = {0};
 		int nbuf = 0;
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
@@ -106,24 +210,30 @@ namespace zdytool {
 		}
 		int invalid = 0;
 		uint u= 0;
-		u16string result;
-		for (int i=0; i<len; i++) {
+		ushort *dst = out;
+		ushort *const dstEnd = out + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if ((nbuf == 0 || i == 0) && Z_UNLIKELY(dst == dstEnd)) {
+				r.status = ConversionOutputFull;
+				break;
+			}
 			uchar ch = chars[i];
 			switch (nbuf) {
 			case 0:
 				if (ch < 0x80) {
-					result += ZValidChar(ch);
+					*dst++ = ZValidChar(ch);
 				} else if (IsKana(ch)) {
 					// JIS X 0201 Latin or JIS X 0201 Kana
 					u = conv->jisx0201ToUnicode(ch);
-					result += ZValidChar(u);
+					*dst++ = ZValidChar(u);
 				} else if (IsSjisChar1(ch)) {
 					// JIS X 0208
 					buf[0] = ch;
 					nbuf = 1;
 				} else {
 					// Invalid
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				break;
@@ -131,19 +241,19 @@ namespace zdytool {
 				// JIS X 0208
 				if (IsSjisChar2(ch)) {
 					if ((u = conv->sjisibmvdcToUnicode(buf[0], ch))) {
-						result += ZValidChar(u);
+						*dst++ = ZValidChar(u);
 					} else if ((u = conv->cp932ToUnicode(buf[0], ch))) {
-						result += ZValidChar(u);
+						*dst++ = ZValidChar(u);
 					}
 					else if (IsUserDefinedChar1(buf[0])) {
-						result += SpecialCharacter::ReplacementCharacter;
+						*dst++ = SpecialCharacter::ReplacementCharacter;
 					} else {
 						u = conv->sjisToUnicode(buf[0], ch);
-						result += ZValidChar(u);
+						*dst++ = ZValidChar(u);
 					}
 				} else {
 					// Invalid
-					result += replacement;
+					*dst++ = replacement;
 					++invalid;
 				}
 				nbuf = 0;
@@ -155,8 +265,12 @@ namespace zdytool {
 			state->remainingChars = nbuf;
 			state->state_data[0] = buf[0];
 			state->invalidChars += invalid;
+			if (nbuf && r.status == ConversionOk)
+				r.status = ConversionIncomplete;
 		}
-		return result;
+		r.consumed = i;
+		r.produced = dst - out;
+		return r;
 	}
 
 
@@ -38,13 +38,21 @@
 #endif // !Z_NO_BIG_TEXTCODECS
 
 #include <stdlib.h>
+#include <limits.h>
 #include <ctype.h>
 #include <locale.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
 #if defined (_XOPEN_UNIX) && !defined(__QNXNTO__) && !defined(__osf__) && !(defined(__ANDROID__) || defined(ANDROID))
 # include <langinfo.h>
 #endif
 namespace zdytool {
     typedef list<TextCodec *>::const_iterator TextCodecListConstIt;
+    // the codecs created by the application, newest first; the built-in
+    // codecs are kept by TextCodecRegistry
     list<TextCodec *> allCodecs;
     TextCodec *codecForLocale_m;
     TextCodecCache codecCache;
@@ -83,6 +91,219 @@ namespace zdytool {
         return (*h == '\0');
     }
 
+    static uint codecNameHash(const char *key, size_t len, uint seed) {
+        uint h = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (size_t i = 0; i < len; ++i) {
+            h ^= uchar(key[i]);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    // The letters and digits of a codec name, lower-cased: all the
+    // spellings TextCodecNameMatch() takes for one name give the same key.
+    static string normalizedCodecName(const string &n) {
+        string key;
+        for (size_t i = 0; i < n.size(); ++i) {
+            if (z_isalnum(n[i]))
+                key += z_tolower(n[i]);
+        }
+        return key;
+    }
+
+    // A built-in codec, described well enough to be found by name or MIB
+    // without constructing it. A descriptor with a count above one stands
+    // for that many codecs built from one table, created with their index.
+    struct TextCodecDescriptor {
+        string (*name)(int);
+        list<string> (*aliases)(int);
+        int (*mibEnum)(int);
+        TextCodec *(*create)(int);
+        int count;
+    };
+
+    template <typename Codec>
+    static string describedName(int) { return Codec::_name(); }
+
+    template <typename Codec>
+    static list<string> describedAliases(int) { return Codec::_aliases(); }
+
+    template <typename Codec>
+    static int describedMibEnum(int) { return Codec::_mibEnum(); }
+
+    template <typename Codec>
+    static TextCodec *createDescribed(int) { return new Codec; }
+
+    template <typename Codec>
+    static string describedIndexedName(int i) { return Codec::_name(i); }
+
+    template <typename Codec>
+    static list<string> describedIndexedAliases(int i) { return Codec::_aliases(i); }
+
+    template <typename Codec>
+    static int describedIndexedMibEnum(int i) { return Codec::_mibEnum(i); }
+
+    template <typename Codec>
+    static TextCodec *createIndexed(int i) { return new Codec(i); }
+
+    static list<string> noAliases(int) { return list<string>(); }
+
+#define Z_DESCRIBE_CODEC(Codec) \
+        { describedName<Codec>, describedAliases<Codec>, describedMibEnum<Codec>, createDescribed<Codec>, 1 }
+
+    // the built-in codecs, the one that takes precedence first
+    static const TextCodecDescriptor builtinCodecs[] = {
+        Z_DESCRIBE_CODEC(Utf8Codec),
+        Z_DESCRIBE_CODEC(Latin1Codec),
+        Z_DESCRIBE_CODEC(Latin15Codec),
+        Z_DESCRIBE_CODEC(Utf32LECodec),
+        Z_DESCRIBE_CODEC(Utf32BECodec),
+        Z_DESCRIBE_CODEC(Utf32Codec),
+        Z_DESCRIBE_CODEC(Utf16LECodec),
+        Z_DESCRIBE_CODEC(Utf16BECodec),
+        Z_DESCRIBE_CODEC(Utf16Codec),
+#if defined(WIN32)
+        Z_DESCRIBE_CODEC(WindowsLocalCodec),
+#endif // WIN32
+#if !defined(Z_NO_BIG_TEXTCODECS) && !defined(__INTEGRITY)
+        Z_DESCRIBE_CODEC(Big5hkscsCodec),
+        Z_DESCRIBE_CODEC(Big5Codec),
+        Z_DESCRIBE_CODEC(CP949Codec),
+        Z_DESCRIBE_CODEC(EucKrCodec),
+        Z_DESCRIBE_CODEC(SjisCodec),
+        Z_DESCRIBE_CODEC(JisCodec),
+        Z_DESCRIBE_CODEC(EucJpCodec),
+        Z_DESCRIBE_CODEC(Gb2312Codec),
+        Z_DESCRIBE_CODEC(GbkCodec),
+        Z_DESCRIBE_CODEC(Gb18030Codec),
+#endif // !Z_NO_BIG_TEXTCODECS && !__INTEGRITY
+        { describedIndexedName<SimpleTextCodec>, describedIndexedAliases<SimpleTextCodec>,
+          describedIndexedMibEnum<SimpleTextCodec>, createIndexed<SimpleTextCodec>, SimpleTextCodec::numSimpleCodecs },
+        { describedIndexedName<IsciiCodec>, noAliases,
+          describedIndexedMibEnum<IsciiCodec>, createIndexed<IsciiCodec>, 9 },
+        Z_DESCRIBE_CODEC(TsciiCodec)
+    };
+
+#undef Z_DESCRIBE_CODEC
+
+    // The built-in codecs and a perfect hash of their names and aliases.
+    // Keys are hashed into buckets, and each bucket has a seed that puts
+    // its keys into slots no other key uses, so a lookup is two hashes and
+    // one compare. The hash is built by the first lookup that is not for
+    // one of the first CommonCodecs codecs, whose keys are compared one by
+    // one until then. Keys are only added, under the codec mutex, and are
+    // published before they are read, so lookups take no lock and allocate
+    // nothing once the keys they compare exist. A codec is constructed the
+    // first time it is asked for.
+    class TextCodecRegistry {
+    public:
+        TextCodecRegistry();
+
+        size_t size() const { return entries.size(); }
+
+        string name(size_t i) const { return entries[i].descriptor->name(entries[i].index); }
+
+        list<string> aliases(size_t i) const { return entries[i].descriptor->aliases(entries[i].index); }
+
+        int mibEnum(size_t i) const { return entries[i].descriptor->mibEnum(entries[i].index); }
+
+        TextCodec *codec(size_t i) const {
+            TextCodec *c = instances[i].load(std::memory_order_acquire);
+            if (Z_LIKELY(c != 0))
+                return c;
+            return create(i);
+        }
+
+        TextCodec *find(const string &name) const {
+            char key[64];
+            size_t len = 0;
+            for (size_t i = 0; i < name.size(); ++i) {
+                if (z_isalnum(name[i])) {
+                    if (len < sizeof(key))
+                        key[len] = z_tolower(name[i]);
+                    ++len;
+                }
+            }
+            if (Z_UNLIKELY(len > sizeof(key))) {
+                const string longKey = normalizedCodecName(name);
+                return find(longKey.data(), longKey.size());
+            }
+            return find(key, len);
+        }
+
+        TextCodec *find(const char *key, size_t len) const {
+            if (Z_UNLIKELY(!len))
+                return 0;
+            if (Z_UNLIKELY(!indexed.load(std::memory_order_acquire))) {
+                // most processes only ever ask for a Unicode or Latin
+                // codec, whose keys are cheaper to compare than to index
+                size_t keyed = keyedCount.load(std::memory_order_acquire);
+                size_t k = 0;
+                for (size_t e = 0; e < CommonCodecs && e < entries.size(); ++e) {
+                    if (Z_UNLIKELY(e >= keyed)) {
+                        keyed = addCommonKeys(e);
+                        if (e >= keyed)
+                            break;
+                    }
+                    for (; k < commonEnd[e]; ++k) {
+                        const Slot &slot = commonKeys[k];
+                        if (slot.name.size() == len && memcmp(slot.name.data(), key, len) == 0)
+                            return codec(slot.entry);
+                    }
+                }
+                std::call_once(indexOnce, &TextCodecRegistry::buildIndex, this);
+            }
+            if (Z_UNLIKELY(slots.empty()))
+                return 0;
+            const uint seed = seeds[codecNameHash(key, len, 0) % seeds.size()];
+            const Slot &slot = slots[codecNameHash(key, len, seed) & (slots.size() - 1)];
+            if (slot.entry != NoEntry && slot.name.size() == len && memcmp(slot.name.data(), key, len) == 0)
+                return codec(slot.entry);
+            return 0;
+        }
+
+    private:
+        enum { NoEntry = -1, CommonCodecs = 9, CommonKeys = 32 };
+
+        struct Entry {
+            const TextCodecDescriptor *descriptor;
+            int index;
+        };
+
+        struct Slot {
+            string name;
+            int entry;
+        };
+
+        std::vector<Entry> entries;
+        // the keys of the first CommonCodecs codecs, added in precedence
+        // order as lookups reach them; the keys of codec e end at
+        // commonEnd[e], for the first keyedCount codecs
+        mutable Slot commonKeys[CommonKeys];
+        mutable size_t commonEnd[CommonCodecs];
+        mutable std::atomic<size_t> keyedCount;
+        std::unique_ptr<std::atomic<TextCodec *>[]> instances;
+        mutable std::once_flag indexOnce;
+        mutable std::atomic<bool> indexed;
+        mutable std::vector<uint> seeds;
+        mutable std::vector<Slot> slots;
+
+        TextCodec *create(size_t i) const;
+
+        void addKeys(std::vector<Slot> *keys, size_t i) const;
+
+        size_t addCommonKeys(size_t i) const;
+
+        void buildIndex() const;
+
+        bool place(const std::vector<Slot> &keys, size_t bucketCount, size_t slotCount) const;
+    };
+
+    // set while a built-in codec is constructed, which is not added to
+    // allCodecs; guarded by textCodecsMutex
+    static bool creatingBuiltinCodec = false;
+    static std::atomic<int> userCodecCount(0);
+
 
 #if !defined(WIN32) && !defined(Z_LOCALE_IS_UTF8)
     static TextCodec *checkForCodec(const string &name) {
@@ -97,8 +318,6 @@ namespace zdytool {
     }
 #endif
 
-    static void setup();
-
 // \threadsafe
 // this returns the codec the method sets up as locale codec to
 // avoid a race condition in codecForLocale() when
@@ -106,11 +325,6 @@ namespace zdytool {
     static TextCodec *setupLocaleMapper() {
         TextCodec *locale = 0;
 
-        {
-            std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
-            if (allCodecs.empty())
-                setup();
-        }
 #if defined(Z_LOCALE_IS_UTF8)
         locale = TextCodec::codecForName("UTF-8");
 #elif defined(WIN32)
@@ -193,44 +407,135 @@ namespace zdytool {
         return locale;
     }
 
-    static void setup() {
-        static bool initialized = false;
-        if (initialized)
-            return;
-        initialized = true;
-
-        (void) new TsciiCodec;
-        for (int i = 0; i < 9; ++i)
-            (void) new IsciiCodec(i);
-        for (int i = 0; i < SimpleTextCodec::numSimpleCodecs; ++i)
-            (void) new SimpleTextCodec(i);
-
-#  if !defined(Z_NO_BIG_TEXTCODECS) && !defined(__INTEGRITY)
-        (void) new Gb18030Codec;
-        (void) new GbkCodec;
-        (void) new Gb2312Codec;
-        (void) new EucJpCodec;
-        (void) new JisCodec;
-        (void) new SjisCodec;
-        (void) new EucKrCodec;
-        (void) new CP949Codec;
-        (void) new Big5Codec;
-        (void) new Big5hkscsCodec;
-#  endif // !Z_NO_BIG_TEXTCODECS && !__INTEGRITY
+    TextCodecRegistry::TextCodecRegistry() : keyedCount(0), indexed(false) {
+        for (size_t d = 0; d < sizeof(builtinCodecs) / sizeof(builtinCodecs[0]); ++d) {
+            const TextCodecDescriptor *descriptor = &builtinCodecs[d];
+            // of the codecs sharing a table, the last one takes precedence
+            for (int i = descriptor->count - 1; i >= 0; --i) {
+                Entry entry = { descriptor, i };
+                entries.push_back(entry);
+            }
+        }
+        instances.reset(new std::atomic<TextCodec *>[entries.size()]());
+    }
 
-#if defined(WIN32)
-        (void) new WindowsLocalCodec;
-#endif // WIN32
+    // Appends the normalized name and aliases of codec \a i to \a keys,
+    // the name first.
+    void TextCodecRegistry::addKeys(std::vector<Slot> *keys, size_t i) const {
+        list<string> names = aliases(i);
+        names.push_front(name(i));
+        for (list<string>::const_iterator nit = names.cbegin(), ncend = names.cend(); nit != ncend; ++nit) {
+            Slot slot = { normalizedCodecName(*nit), int(i) };
+            if (!slot.name.empty())
+                keys->push_back(slot);
+        }
+    }
+
+    // Adds the keys of the common codecs up to and including \a i and
+    // returns how many codecs have their keys.
+    size_t TextCodecRegistry::addCommonKeys(size_t i) const {
+        std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
+
+        size_t e = keyedCount.load(std::memory_order_relaxed);
+        if (e > i)
+            return e;
+        size_t end = e ? commonEnd[e - 1] : 0;
+        for (; e <= i; ++e) {
+            std::vector<Slot> keys;
+            addKeys(&keys, e);
+            // a codec whose keys do not fit is only found through the index
+            if (end + keys.size() > CommonKeys)
+                break;
+            for (size_t k = 0; k < keys.size(); ++k)
+                commonKeys[end++] = keys[k];
+            commonEnd[e] = end;
+        }
+        keyedCount.store(e, std::memory_order_release);
+        return e;
+    }
+
+    void TextCodecRegistry::buildIndex() const {
+        std::vector<Slot> keys;
+        for (size_t e = 0; e < entries.size(); ++e)
+            addKeys(&keys, e);
+        // the first codec to claim a name keeps it, as in a search that
+        // checks each codec's name before its aliases
+        std::stable_sort(keys.begin(), keys.end(), [](const Slot &a, const Slot &b) {
+            return a.name < b.name;
+        });
+        keys.erase(std::unique(keys.begin(), keys.end(), [](const Slot &a, const Slot &b) {
+            return a.name == b.name;
+        }), keys.end());
+
+        if (!keys.empty()) {
+            size_t slotCount = 1;
+            while (slotCount < 2 * keys.size())
+                slotCount <<= 1;
+            while (!place(keys, (keys.size() + 1) / 2, slotCount))
+                slotCount <<= 1;
+        }
+        indexed.store(true, std::memory_order_release);
+    }
+
+    TextCodec *TextCodecRegistry::create(size_t i) const {
+        std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
+
+        TextCodec *c = instances[i].load(std::memory_order_relaxed);
+        if (!c) {
+            creatingBuiltinCodec = true;
+            c = entries[i].descriptor->create(entries[i].index);
+            creatingBuiltinCodec = false;
+            instances[i].store(c, std::memory_order_release);
+        }
+        return c;
+    }
+
+    bool TextCodecRegistry::place(const std::vector<Slot> &keys, size_t bucketCount, size_t slotCount) const {
+        std::vector<std::vector<size_t> > buckets(bucketCount);
+        for (size_t i = 0; i < keys.size(); ++i)
+            buckets[codecNameHash(keys[i].name.data(), keys[i].name.size(), 0) % bucketCount].push_back(i);
+
+        // the fullest buckets are the hardest to place, so they go first
+        std::vector<size_t> order(bucketCount);
+        for (size_t b = 0; b < bucketCount; ++b)
+            order[b] = b;
+        std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        seeds.assign(bucketCount, 0);
+        const Slot freeSlot = { string(), NoEntry };
+        slots.assign(slotCount, freeSlot);
+        std::vector<size_t> taken;
+        for (size_t o = 0; o < bucketCount; ++o) {
+            const std::vector<size_t> &bucket = buckets[order[o]];
+            if (bucket.empty())
+                break;
+            uint seed = 1;
+            for (;; ++seed) {
+                if (seed > 0x10000)
+                    return false;
+                taken.clear();
+                size_t i = 0;
+                for (; i < bucket.size(); ++i) {
+                    size_t pos = codecNameHash(keys[bucket[i]].name.data(), keys[bucket[i]].name.size(), seed) & (slotCount - 1);
+                    if (slots[pos].entry != NoEntry || std::find(taken.begin(), taken.end(), pos) != taken.end())
+                        break;
+                    taken.push_back(pos);
+                }
+                if (i == bucket.size())
+                    break;
+            }
+            seeds[order[o]] = seed;
+            for (size_t i = 0; i < bucket.size(); ++i)
+                slots[taken[i]] = keys[bucket[i]];
+        }
+        return true;
+    }
 
-        (void) new Utf16Codec;
-        (void) new Utf16BECodec;
-        (void) new Utf16LECodec;
-        (void) new Utf32Codec;
-        (void) new Utf32BECodec;
-        (void) new Utf32LECodec;
-        (void) new Latin15Codec;
-        (void) new Latin1Codec;
-        (void) new Utf8Codec;
+    static const TextCodecRegistry &builtinCodecRegistry() {
+        static const TextCodecRegistry registry;
+        return registry;
     }
 
 /*!
@@ -240,10 +545,22 @@ namespace zdytool {
     \value ConvertInvalidToNull  If this flag is set, each invalid input
                                  character is output as a null character.
     \value IgnoreHeader  Ignore any Unicode byte-order mark and don't generate any.
+    \value RecordInvalid  Have a TextDecoder record where invalid input was
+                          found; see TextDecoder::invalidSequences().
 
     \omitvalue FreeFunction
 */
 
+/*!
+    \variable TextCodec::ConverterState::state_data
+
+    Inline storage for the codec's conversion state: StateDataSize words,
+    aligned to eight bytes. It holds everything the built-in codecs carry
+    between calls, from a UTF-8 partial sequence to an incomplete ISO-2022
+    escape sequence, and it is copied along with the rest of the state, so
+    a codec that fits in it never has to allocate \c d.
+*/
+
 /*!
     \fn TextCodec::ConverterState::ConverterState(ConversionFlags flags)
 
@@ -251,15 +568,74 @@ namespace zdytool {
 */
 
 /*!
-    Destroys the ConverterState object.
+    Constructs a ConverterState that takes over the conversion state of
+    \a other, which is left cleared.
+*/
+    TextCodec::ConverterState::ConverterState(ConverterState &&other)
+            : flags(other.flags), remainingChars(other.remainingChars), invalidChars(other.invalidChars),
+              d(other.d) {
+        memcpy(state_data, other.state_data, sizeof(state_data));
+        other.flags = ConversionFlags(other.flags & ~FreeFunction);
+        other.d = nullptr;
+        other.clear();
+    }
+
+/*!
+    \fn TextCodec::ConverterState::~ConverterState()
+
+    Destroys the ConverterState object. The built-in codecs keep all of
+    their state in state_data, so this only does work for a codec that
+    allocated \c d.
+*/
+
+/*!
+    \internal
+    Frees the state a codec allocated outside of state_data.
 */
-    TextCodec::ConverterState::~ConverterState() {
+    void TextCodec::ConverterState::releaseData() {
         if (flags & FreeFunction)
             (TextCodecUnalignedPointer::decode(state_data))(this);
         else if (d)
             free(d);
     }
 
+/*!
+    Releases the conversion state held by this object and takes over the
+    state of \a other, which is left cleared.
+*/
+    TextCodec::ConverterState &TextCodec::ConverterState::operator=(ConverterState &&other) {
+        if (this != &other) {
+            clear();
+            flags = other.flags;
+            remainingChars = other.remainingChars;
+            invalidChars = other.invalidChars;
+            memcpy(state_data, other.state_data, sizeof(state_data));
+            d = other.d;
+            other.flags = ConversionFlags(other.flags & ~FreeFunction);
+            other.d = nullptr;
+            other.clear();
+        }
+        return *this;
+    }
+
+/*!
+    Releases any conversion state and returns the object to the state of a
+    freshly constructed one, so that it can be used for a new stream.
+
+    The flags given by the caller are kept. A codec may have added
+    IgnoreHeader after reading a byte order mark; restore the original
+    flags if the next stream may start with one.
+*/
+    void TextCodec::ConverterState::clear() {
+        if (Z_UNLIKELY((flags & FreeFunction) || d))
+            releaseData();
+        flags = ConversionFlags(flags & ~FreeFunction);
+        d = nullptr;
+        remainingChars = 0;
+        invalidChars = 0;
+        memset(state_data, 0, sizeof(state_data));
+    }
+
 /*!
     \class TextCodec
     \brief The TextCodec class provides conversions between text encodings.
@@ -386,6 +762,17 @@ namespace zdytool {
          \li Converts a Unicode string to an 8-bit character string.
     \endtable
 
+    The buffer based overloads of convertToUnicode() and convertFromUnicode()
+    fall back to the string based ones. A codec that can convert into a
+    caller supplied buffer without allocating should reimplement them too,
+    stopping at a character boundary when the output buffer is full.
+
+    Such a codec should also reimplement maxDecodedLength() and
+    maxEncodedLength() to return the smallest buffer size its conversion
+    never reports as full. decodedLength() and encodedLength() count by
+    converting into a scratch buffer; a codec whose buffer based
+    conversion cannot be resumed exactly has to reimplement them as well.
+
     \sa TextDecoder, TextEncoder
 */
 
@@ -398,10 +785,11 @@ namespace zdytool {
     TextCodec::TextCodec() {
         std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
 
-        if (allCodecs.empty())
-            setup();
-
+        // the built-in codecs are found through their descriptors
+        if (creatingBuiltinCodec)
+            return;
         allCodecs.push_front(this);
+        userCodecCount.fetch_add(1, std::memory_order_release);
     }
 
 
@@ -427,40 +815,42 @@ namespace zdytool {
     Searches all installed TextCodec objects and returns the one
     which best matches \a name; the match is case-insensitive. Returns
     0 if no codec matching the name \a name could be found.
+
+    The names and aliases of the built-in codecs are kept in a hash table
+    that is never changed, so looking them up takes no lock, and a
+    built-in codec is only constructed the first time it is returned.
+    Codecs created by the application are searched under a lock, before
+    the table.
 */
     TextCodec *TextCodec::codecForName(const string &name) {
         if (name.size() <= 0)
             return 0;
 
-        std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
+        if (Z_UNLIKELY(userCodecCount.load(std::memory_order_acquire) > 0)) {
+            std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
 
-        setup();
-        TextCodecCache *cache = &codecCache;
-        TextCodec *codec;
-        if (cache && cache->find(name) != cache->cend()) {
-            codec = cache->at(name);
-            if (codec)
-                return codec;
-        }
+            TextCodecCache *cache = &codecCache;
+            TextCodecCache::const_iterator cached = cache->find(name);
+            if (cached != cache->cend() && cached->second)
+                return cached->second;
 
-        for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it) {
-            TextCodec *cursor = *it;
-            if (TextCodecNameMatch(cursor->name().data(), name.data())) {
-                if (cache)
+            for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it) {
+                TextCodec *cursor = *it;
+                if (TextCodecNameMatch(cursor->name().data(), name.data())) {
                     cache->insert(std::pair<string, TextCodec *>(name, cursor));
-                return cursor;
-            }
-            list<string> aliases = cursor->aliases();
-            for (list<string>::const_iterator ait = aliases.cbegin(), acend = aliases.cend(); ait != acend; ++ait) {
-                if (TextCodecNameMatch((*ait).data(), name.data())) {
-                    if (cache)
-                        cache->insert(std::pair<string, TextCodec *>(name, cursor));
                     return cursor;
                 }
+                list<string> aliases = cursor->aliases();
+                for (list<string>::const_iterator ait = aliases.cbegin(), acend = aliases.cend(); ait != acend; ++ait) {
+                    if (TextCodecNameMatch((*ait).data(), name.data())) {
+                        cache->insert(std::pair<string, TextCodec *>(name, cursor));
+                        return cursor;
+                    }
+                }
             }
         }
 
-        return 0;
+        return builtinCodecRegistry().find(name);
     }
 
 
@@ -470,31 +860,19 @@ namespace zdytool {
     \l{TextCodec::mibEnum()}{MIBenum} \a mib.
 */
     TextCodec *TextCodec::codecForMib(int mib) {
-        std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
-
-        if (allCodecs.empty())
-            setup();
-
-        //key = "MIB: " + string::number(mib);
-        std::stringstream key_s;
-        key_s << "MIB: " << mib;
-        string key = key_s.str();
+        if (Z_UNLIKELY(userCodecCount.load(std::memory_order_acquire) > 0)) {
+            std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
 
-        TextCodecCache *cache = &codecCache;
-        TextCodec *codec;
-        if (cache && cache->find(key) != cache->cend()) {
-            codec = cache->at(key);
-            if (codec)
-                return codec;
+            for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it) {
+                if ((*it)->mibEnum() == mib)
+                    return *it;
+            }
         }
 
-        for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it) {
-            TextCodec *cursor = *it;
-            if (cursor->mibEnum() == mib) {
-                if (cache)
-                    cache->insert(std::pair<string, TextCodec *>(key, cursor));
-                return cursor;
-            }
+        const TextCodecRegistry &registry = builtinCodecRegistry();
+        for (size_t i = 0; i < registry.size(); ++i) {
+            if (registry.mibEnum(i) == mib)
+                return registry.codec(i);
         }
         return 0;
     }
@@ -510,16 +888,21 @@ namespace zdytool {
     \sa availableMibs(), name(), aliases()
 */
     list<string> TextCodec::availableCodecs() {
-        std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
+        list<string> codecs;
 
-        if (allCodecs.empty())
-            setup();
+        {
+            std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
 
-        list<string> codecs;
+            for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it) {
+                codecs.push_back((*it)->name());
+                codecs.merge((*it)->aliases());
+            }
+        }
 
-        for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it) {
-            codecs.push_back((*it)->name());
-            codecs.merge((*it)->aliases());
+        const TextCodecRegistry &registry = builtinCodecRegistry();
+        for (size_t i = 0; i < registry.size(); ++i) {
+            codecs.push_back(registry.name(i));
+            codecs.merge(registry.aliases(i));
         }
         return codecs;
     }
@@ -532,15 +915,18 @@ namespace zdytool {
     \sa availableCodecs(), mibEnum()
 */
     list<int> TextCodec::availableMibs() {
-        std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
+        list<int> codecs;
 
-        if (allCodecs.empty())
-            setup();
+        {
+            std::lock_guard<std::recursive_mutex> locker(textCodecsMutex);
 
-        list<int> codecs;
+            for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it)
+                codecs.push_back((*it)->mibEnum());
+        }
 
-        for (TextCodecListConstIt it = allCodecs.cbegin(), cend = allCodecs.cend(); it != cend; ++it)
-            codecs.push_back((*it)->mibEnum());
+        const TextCodecRegistry &registry = builtinCodecRegistry();
+        for (size_t i = 0; i < registry.size(); ++i)
+            codecs.push_back(registry.mibEnum(i));
 
         return codecs;
     }
@@ -643,168 +1029,1378 @@ namespace zdytool {
     adjust the \c remainingChars and \c invalidChars members of the struct.
 */
 
-/*!
-    Creates a TextDecoder with a specified \a flags to decode chunks
-    of \c{char *} data to create chunks of Unicode data.
+    struct TextCodecStateSnapshot {
+        explicit TextCodecStateSnapshot(const TextCodec::ConverterState *s)
+                : flags(TextCodec::DefaultConversion), remainingChars(0), invalidChars(0) {
+            memset(state_data, 0, sizeof(state_data));
+            if (s) {
+                flags = s->flags;
+                remainingChars = s->remainingChars;
+                invalidChars = s->invalidChars;
+                memcpy(state_data, s->state_data, sizeof(state_data));
+            }
+        }
 
-    The caller is responsible for deleting the returned object.
-*/
-    TextDecoder *TextCodec::makeDecoder(TextCodec::ConversionFlags flags) const {
-        return new TextDecoder(this, flags);
-    }
+        void restore(TextCodec::ConverterState *s) const {
+            if (!s)
+                return;
+            s->flags = flags;
+            s->remainingChars = remainingChars;
+            s->invalidChars = invalidChars;
+            memcpy(s->state_data, state_data, sizeof(state_data));
+        }
+
+        TextCodec::ConversionFlags flags;
+        int remainingChars;
+        int invalidChars;
+        uint state_data[TextCodec::ConverterState::StateDataSize];
+    };
 
 /*!
-    Creates a TextEncoder with a specified \a flags to encode chunks
-    of Unicode data as \c{char *} data.
+    \enum TextCodec::ConversionStatus
+
+    \value ConversionOk  All of the input was converted.
+    \value ConversionOutputFull  The output buffer was too small; the conversion
+                                 stopped at a character boundary and can be resumed
+                                 from the first byte (or character) not consumed.
+    \value ConversionIncomplete  All of the input was consumed, but it ended in the
+                                 middle of a multi-byte sequence. With a state the
+                                 pending bytes are kept for the next call.
+*/
 
-    The caller is responsible for deleting the returned object.
+/*!
+    \fn TextCodec::ConversionResult TextCodec::convertToUnicode(uint16_t *out, size_t outLength,
+                                       const char *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length bytes of \a in from the encoding of the
+    subclass to Unicode, writing at most \a outLength characters to \a out.
+    Returns the number of bytes consumed, the number of characters
+    produced and whether the output buffer ran full.
+
+    The built-in codecs reimplement this function and never allocate. The
+    default implementation goes through the std::basic_string<uint16_t>
+    based convertToUnicode(); if its result does not fit into \a out,
+    nothing is consumed and \a state is left untouched.
+    At most \c INT_MAX units of input are taken per call; the rest is
+    reported as ConversionOutputFull.
 */
-    TextEncoder *TextCodec::makeEncoder(TextCodec::ConversionFlags flags) const {
-        return new TextEncoder(this, flags);
+    TextCodec::ConversionResult
+    TextCodec::convertToUnicode(ushort *out, size_t outLength, const char *in, size_t length,
+                                ConverterState *state) const {
+        TextCodecStateSnapshot saved(state);
+        const size_t count = std::min(length, size_t(INT_MAX));
+        u16string result = convertToUnicode(in, int(count), state);
+        if (result.size() > outLength) {
+            saved.restore(state);
+            ConversionResult r = {0, 0, ConversionOutputFull};
+            return r;
+        }
+        memcpy(out, result.data(), result.size() * sizeof(ushort));
+        ConversionStatus status = ConversionOk;
+        if (count < length)
+            status = ConversionOutputFull;
+        else if (state && state->remainingChars)
+            status = ConversionIncomplete;
+        ConversionResult r = {count, result.size(), status};
+        return r;
     }
 
 /*!
-    \fn std::string TextCodec::fromUnicode(const uint16_t *input, int number,
-                                           ConverterState *state) const
-
-    Converts the first \a number of characters from the \a input array
-    from Unicode to the encoding of this codec, and returns the result
-    in a string.
-
-    The \a state of the convertor used is updated.
+    \fn TextCodec::ConversionResult TextCodec::convertFromUnicode(char *out, size_t outLength,
+                                       const uint16_t *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length characters of \a in from Unicode to the
+    encoding of the subclass, writing at most \a outLength bytes to \a out.
+    Returns the number of characters consumed, the number of bytes
+    produced and whether the output buffer ran full.
+
+    The built-in codecs reimplement this function and never allocate. The
+    default implementation goes through the std::string based
+    convertFromUnicode(); if its result does not fit into \a out, nothing
+    is consumed and \a state is left untouched.
+    At most \c INT_MAX units of input are taken per call; the rest is
+    reported as ConversionOutputFull.
 */
+    TextCodec::ConversionResult
+    TextCodec::convertFromUnicode(char *out, size_t outLength, const ushort *in, size_t length,
+                                  ConverterState *state) const {
+        TextCodecStateSnapshot saved(state);
+        const size_t count = std::min(length, size_t(INT_MAX));
+        string result = convertFromUnicode(in, int(count), state);
+        if (result.size() > outLength) {
+            saved.restore(state);
+            ConversionResult r = {0, 0, ConversionOutputFull};
+            return r;
+        }
+        memcpy(out, result.data(), result.size());
+        ConversionStatus status = ConversionOk;
+        if (count < length)
+            status = ConversionOutputFull;
+        else if (state && state->remainingChars)
+            status = ConversionIncomplete;
+        ConversionResult r = {count, result.size(), status};
+        return r;
+    }
+
+    // Codecs without UCS-4 kernels of their own convert through UTF-16, a
+    // block on the stack at a time.
+    static const size_t TextCodecUcs4Block = 256;
+
+    // Writes the code points of the UTF-16 in \a in to \a out, or only counts
+    // them if \a out is null. A surrogate without its other half is counted
+    // as invalid in \a state and replaced.
+    static size_t utf16ToUcs4(char32_t *out, const ushort *in, size_t length,
+                              TextCodec::ConverterState *state = nullptr) {
+        size_t n = 0;
+        for (size_t i = 0; i < length; ++i, ++n) {
+            uint uc = in[i];
+            if (UCS4Tool::isHighSurrogate(uc) && i + 1 < length && UCS4Tool::isLowSurrogate(in[i + 1]))
+                uc = UCS4Tool::surrogateToUcs4(ushort(uc), in[++i]);
+            if (out)
+                out[n] = ucs4ScalarValue(uc, state);
+        }
+        return n;
+    }
 
 /*!
-    Converts \a str from Unicode to the encoding of this codec, and
-    returns the result in a string.
+    \fn TextCodec::ConversionResult TextCodec::convertToUcs4(char32_t *out, size_t outLength,
+                                       const char *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length bytes of \a in from the encoding of the
+    subclass to UCS-4, writing at most \a outLength code points to \a out.
+    Characters outside the Basic Multilingual Plane are written as one
+    code point instead of a surrogate pair. Never more than
+    maxDecodedLength() code points are produced.
+
+    Only Unicode scalar values are written: a surrogate without its other
+    half, or a value above U+10FFFF, is invalid input and is written as
+    U+FFFD, or as 0 with ConvertInvalidToNull.
+
+    If \a outLength is too small for all of the input, as many characters
+    as fit are converted and ConversionOutputFull is returned, so a caller
+    can go on with a buffer of any size, even a single code point.
+
+    The UTF codecs and GB18030 reimplement this function with kernels that
+    write code points directly. The default implementation decodes a block
+    of UTF-16 at a time with convertToUnicode() and joins the surrogate
+    pairs; the \a state is shared with the UTF-16 conversion.
 */
-    string TextCodec::fromUnicode(const u16string &str) const {
-        return convertFromUnicode(str.data(), str.length(), 0);
+    TextCodec::ConversionResult
+    TextCodec::convertToUcs4(char32_t *out, size_t outLength, const char *in, size_t length,
+                             ConverterState *state) const {
+        ConversionResult result = {0, 0, ConversionOk};
+        ushort block[TextCodecUcs4Block];
+        // without a state, shift states and the like still have to carry over
+        // from one block to the next
+        ConverterState local;
+        ConverterState *blockState = state ? state : &local;
+        for (;;) {
+            const size_t room = outLength - result.produced;
+            // a code point takes at least one unit, but a surrogate pair takes two
+            size_t blockLength = std::min(TextCodecUcs4Block, std::max<size_t>(room, 2));
+            TextCodecStateSnapshot saved(blockState);
+            ConversionResult r = convertToUnicode(block, blockLength, in + result.consumed,
+                                                  length - result.consumed, blockState);
+            if (Z_UNLIKELY(room && blockLength > room && utf16ToUcs4(nullptr, block, r.produced) > room)) {
+                // two units were two characters, one more than there is room
+                // for; convert the first on its own
+                saved.restore(blockState);
+                blockLength = room;
+                r = convertToUnicode(block, blockLength, in + result.consumed, length - result.consumed, blockState);
+            }
+            if (Z_UNLIKELY(r.status == ConversionOutputFull && !r.consumed && !r.produced
+                           && blockLength == TextCodecUcs4Block)) {
+                // a codec that cannot resume; let it convert everything at once
+                u16string str = toUnicode(in + result.consumed, length - result.consumed, blockState);
+                if (utf16ToUcs4(nullptr, str.data(), str.size()) > room) {
+                    saved.restore(blockState);
+                    result.status = ConversionOutputFull;
+                    break;
+                }
+                result.produced += utf16ToUcs4(out + result.produced, str.data(), str.size(), blockState);
+                result.consumed = length;
+                r.status = blockState->remainingChars ? ConversionIncomplete : ConversionOk;
+            } else {
+                if (Z_UNLIKELY(utf16ToUcs4(nullptr, block, r.produced) > room)) {
+                    saved.restore(blockState);
+                    result.status = ConversionOutputFull;
+                    break;
+                }
+                result.produced += utf16ToUcs4(out + result.produced, block, r.produced, blockState);
+                result.consumed += r.consumed;
+            }
+            result.status = r.status;
+            if (r.status != ConversionOutputFull || (!r.consumed && !r.produced))
+                break;
+        }
+
+        if (!state && local.remainingChars > 0 && result.status != ConversionOutputFull) {
+            // the end of the input is final; what the local state holds back
+            // is converted on its own, as a stateless call does
+            const size_t tail = std::min(size_t(local.remainingChars), result.consumed);
+            ConversionResult r = convertToUnicode(block, TextCodecUcs4Block, in + result.consumed - tail, tail, nullptr);
+            if (utf16ToUcs4(nullptr, block, r.produced) > outLength - result.produced) {
+                result.consumed -= tail;
+                result.status = ConversionOutputFull;
+            } else {
+                result.produced += utf16ToUcs4(out + result.produced, block, r.produced);
+                result.status = ConversionOk;
+            }
+        }
+        return result;
     }
 
+
 /*!
-    \fn std::basic_string<uint16_t> TextCodec::toUnicode(const char *input, int size,
-                                      ConverterState *state) const
+    \fn TextCodec::ConversionResult TextCodec::convertFromUcs4(char *out, size_t outLength,
+                                       const char32_t *in, size_t length, ConverterState *state) const
 
-    Converts the first \a size characters from the \a input from the
-    encoding of this codec to Unicode, and returns the result in a
-    std::basic_string<uint16_t>.
+    Converts the first \a length code points of \a in from UCS-4 to the
+    encoding of the subclass, writing at most \a outLength bytes to \a out.
+    Values above U+10FFFF are encoded as U+FFFD.
 
-    The \a state of the convertor used is updated.
+    The default implementation splits a block of code points into UTF-16
+    at a time and encodes it with convertFromUnicode(); the \a state is
+    shared with the UTF-16 conversion.
 */
+    TextCodec::ConversionResult
+    TextCodec::convertFromUcs4(char *out, size_t outLength, const char32_t *in, size_t length,
+                               ConverterState *state) const {
+        ConversionResult result = {0, 0, ConversionOk};
+        ushort block[TextCodecUcs4Block];
+        do {
+            size_t units = 0;
+            size_t count = 0;
+            while (result.consumed + count < length && units + 2 <= TextCodecUcs4Block) {
+                uint uc = in[result.consumed + count++];
+                if (Z_UNLIKELY(uc > SpecialCharacter::LastValidCodePoint)) {
+                    block[units++] = SpecialCharacter::ReplacementCharacter;
+                } else if (UCS4Tool::requiresSurrogates(uc)) {
+                    block[units++] = UCS4Tool::highSurrogate(uc);
+                    block[units++] = UCS4Tool::lowSurrogate(uc);
+                } else {
+                    block[units++] = ushort(uc);
+                }
+            }
 
-/*!
-    Converts \a a from the encoding of this codec to Unicode, and
-    returns the result in a std::basic_string<uint16_t>.
-*/
-    u16string TextCodec::toUnicode(const string &a) const {
-        return convertToUnicode(a.data(), a.length(), 0);
+            const size_t blockUnits = units;
+            TextCodecStateSnapshot saved(state);
+            ConversionResult r;
+            for (;;) {
+                r = convertFromUnicode(out + result.produced, outLength - result.produced, block, units, state);
+                if (r.consumed == units)
+                    break;
+                // find the code points the encoder got through
+                size_t i = 0;
+                count = 0;
+                for (;;) {
+                    const size_t step = (UCS4Tool::isHighSurrogate(block[i]) && i + 1 < units
+                                         && UCS4Tool::isLowSurrogate(block[i + 1])) ? 2 : 1;
+                    if (i + step > r.consumed)
+                        break;
+                    i += step;
+                    ++count;
+                }
+                if (i == r.consumed)
+                    break;
+                // it stopped between the halves of a pair; encode up to the pair only
+                saved.restore(state);
+                units = i;
+            }
+            result.consumed += count;
+            result.produced += r.produced;
+            result.status = r.status;
+            if (r.consumed < blockUnits) {
+                result.status = ConversionOutputFull;
+                break;
+            }
+        } while (result.consumed < length);
+        return result;
     }
 
 /*!
-    Returns \c true if the Unicode character \a ch can be fully encoded
-    with this codec; otherwise returns \c false.
-*/
-    bool TextCodec::canEncode(ushort ch) const {
-        ConverterState state;
-        state.flags = ConvertInvalidToNull;
-        convertFromUnicode(&ch, 1, &state);
-        return (state.invalidChars == 0);
-    }
+    Converts the first \a length bytes of \a in from the encoding of this
+    codec to Unicode and appends the result to \a target.
 
-/*!
-    \overload
+    The capacity of \a target grows geometrically and the characters are
+    decoded straight into its tail, so feeding a stream to this function
+    a chunk at a time takes amortized linear time and builds no temporary
+    strings.
 
-    \a s contains the string being tested for encode-ability.
+    \sa maxDecodedLength()
 */
-    bool TextCodec::canEncode(const u16string &s) const {
-        ConverterState state;
-        state.flags = ConvertInvalidToNull;
-        convertFromUnicode(s.data(), s.length(), &state);
-        return (state.invalidChars == 0);
+    void TextCodec::appendToUnicode(u16string *target, const char *in, size_t length, ConverterState *state) const {
+        appendDecoded(target, in, length, state);
     }
 
 /*!
-    \overload
+    Converts the first \a length characters of \a in from Unicode to the
+    encoding of this codec and appends the result to \a target.
 
-    \a chars contains the source characters.
+    Like appendToUnicode(), the capacity of \a target grows geometrically
+    and the bytes are encoded straight into its tail.
+
+    \sa maxEncodedLength()
 */
-    u16string TextCodec::toUnicode(const char *chars) const {
-        int len = strlen(chars);
-        return convertToUnicode(chars, len, 0);
+    void TextCodec::appendFromUnicode(string *target, const ushort *in, size_t length, ConverterState *state) const {
+        appendEncoded(target, in, length, state);
     }
 
-
 /*!
-    \class TextEncoder
-    \brief The TextEncoder class provides a state-based encoder.
-    \reentrant
+    Converts \a count independent byte strings to Unicode in one call,
+    appending the results back to back to \a target. String \e i starts at
+    \a inputs[i] and is \a lengths[i] bytes long, and is converted as
+    toUnicode(\a inputs[i], \a lengths[i]) would convert it.
 
-    A text encoder converts text from Unicode into an encoded text format
-    using a specific codec.
+    \a offsets must have room for \a count + 1 entries. On return its
+    entry \e i is the index in \a target where the result of string
+    \e i starts, and entry \a count is the new size of \a target.
 
-    The encoder converts Unicode into another format, remembering any
-    state that is required between calls.
+    This is meant for decoding many short fields, such as a column of
+    records: \a target grows geometrically across the whole batch
+    instead of one string being allocated per field, and it can be
+    reused from batch to batch.
 
-    \sa TextCodec::makeEncoder(), TextDecoder
+    \sa fromUnicodeBatch()
 */
+    void TextCodec::toUnicodeBatch(u16string *target, size_t *offsets,
+                                   const char *const *inputs, const size_t *lengths, size_t count) const {
+        size_t used = target->size();
+        for (size_t i = 0; i < count; ++i) {
+            offsets[i] = used;
+            const char *in = inputs[i];
+            const size_t length = lengths[i];
+            size_t pos = 0;
+            for (;;) {
+                const size_t needed = boundedSize(maxDecodedLength(length - pos), 1, used);
+                if (needed > target->size())
+                    target->resize(std::max(needed, boundedSize(target->size(), 2)));
+                ConversionResult r = convertToUnicode(&(*target)[used], target->size() - used,
+                                                      in + pos, length - pos, nullptr);
+                used += r.produced;
+                pos += r.consumed;
+                if (Z_LIKELY(r.status != ConversionOutputFull))
+                    break;
+                if (!r.consumed && !r.produced) {
+                    target->resize(used);
+                    while (pos < length) {
+                        const int chunk = int(std::min(length - pos, size_t(INT_MAX)));
+                        target->append(convertToUnicode(in + pos, chunk, nullptr));
+                        pos += chunk;
+                    }
+                    used = target->size();
+                    break;
+                }
+            }
+        }
+        offsets[count] = used;
+        target->resize(used);
+    }
 
 /*!
-    \fn TextEncoder::TextEncoder(const TextCodec *codec)
+    Converts \a count independent Unicode strings to the encoding of this
+    codec in one call, appending the results back to back to \a target.
+    String \e i starts at \a inputs[i] and is \a lengths[i] characters
+    long, and is converted as fromUnicode(\a inputs[i], \a lengths[i])
+    would convert it.
 
-    Constructs a text encoder for the given \a codec.
-*/
+    \a offsets must have room for \a count + 1 entries and receives the
+    start of each result in \a target, as for toUnicodeBatch().
 
-/*!
-    Constructs a text encoder for the given \a codec and conversion \a flags.
+    \sa toUnicodeBatch()
 */
-    TextEncoder::TextEncoder(const TextCodec *codec, TextCodec::ConversionFlags flags)
-            : c(codec), state() {
-        state.flags = flags;
+    void TextCodec::fromUnicodeBatch(string *target, size_t *offsets,
+                                     const ushort *const *inputs, const size_t *lengths, size_t count) const {
+        size_t used = target->size();
+        for (size_t i = 0; i < count; ++i) {
+            offsets[i] = used;
+            const ushort *in = inputs[i];
+            const size_t length = lengths[i];
+            size_t pos = 0;
+            for (;;) {
+                const size_t needed = boundedSize(maxEncodedLength(length - pos), 1, used);
+                if (needed > target->size())
+                    target->resize(std::max(needed, boundedSize(target->size(), 2)));
+                ConversionResult r = convertFromUnicode(&(*target)[used], target->size() - used,
+                                                        in + pos, length - pos, nullptr);
+                used += r.produced;
+                pos += r.consumed;
+                if (Z_LIKELY(r.status != ConversionOutputFull))
+                    break;
+                if (!r.consumed && !r.produced) {
+                    target->resize(used);
+                    while (pos < length) {
+                        const int chunk = int(std::min(length - pos, size_t(INT_MAX)));
+                        target->append(convertFromUnicode(in + pos, chunk, nullptr));
+                        pos += chunk;
+                    }
+                    used = target->size();
+                    break;
+                }
+            }
+        }
+        offsets[count] = used;
+        target->resize(used);
     }
 
-/*!
-    Destroys the encoder.
-*/
-    TextEncoder::~TextEncoder() {
+    static const size_t TextCodecParallelChunk = 256 * 1024;
+
+    // Cuts [0, length) into at most \a threads pieces of at least
+    // TextCodecParallelChunk units, at points found by \a syncPoint.
+    template <typename SyncPoint>
+    static std::vector<size_t> parallelBounds(size_t length, unsigned int threads, const SyncPoint &syncPoint) {
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        const size_t pieces = std::min<size_t>(threads, length / TextCodecParallelChunk);
+        std::vector<size_t> bounds(1, 0);
+        for (size_t i = 1; i < pieces; ++i) {
+            const size_t pos = syncPoint(std::max(length / pieces * i, bounds.back() + 1));
+            if (pos >= length)
+                break;
+            bounds.push_back(pos);
+        }
+        bounds.push_back(length);
+        return bounds;
+    }
+
+    // Calls \a run for every piece from 0 to \a count - 1, piece 0 on the
+    // calling thread and the others on threads of their own.
+    template <typename Run>
+    static void runParallel(size_t count, const Run &run) {
+        std::vector<std::thread> workers;
+        workers.reserve(count - 1);
+        for (size_t i = 1; i < count; ++i) {
+            try {
+                workers.push_back(std::thread(run, i));
+            } catch (const std::system_error &) {
+                run(i);
+            }
+        }
+        run(0);
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
     }
 
 /*!
-    \internal
-    Determines whether the eecoder encountered a failure while decoding the input. If
-    an error was encountered, the produced result is undefined, and gets converted as according
-    to the conversion flags.
- */
-    bool TextEncoder::hasFailure() const {
-        return state.invalidChars != 0;
+    Converts the first \a length bytes of \a in to Unicode on up to
+    \a threads threads and returns the result, which is the same as what
+    toUnicode(\a in, \a length) returns. If \a threads is 0 one thread
+    is used for each processor.
+
+    The input is cut at the points nextSyncPoint() finds, so that every
+    piece can be decoded on its own, and the pieces are decoded
+    concurrently and joined. Each thread is given at least a few hundred
+    kilobytes; shorter input, and input in an encoding that cannot be cut,
+    such as ISO-2022-JP or UTF-16, is decoded on the calling thread.
+
+    \sa parallelFromUnicode(), nextSyncPoint()
+*/
+    u16string TextCodec::parallelToUnicode(const char *in, size_t length, unsigned int threads) const {
+        const std::vector<size_t> bounds = parallelBounds(length, threads, [this, in, length](size_t from) {
+            return nextSyncPoint(in, length, from);
+        });
+        if (bounds.size() == 2)
+            return toUnicode(in, length);
+
+        std::vector<u16string> parts(bounds.size() - 1);
+        runParallel(parts.size(), [this, in, &bounds, &parts](size_t i) {
+            parts[i] = toUnicode(in + bounds[i], bounds[i + 1] - bounds[i]);
+        });
+
+        size_t total = 0;
+        for (size_t i = 0; i < parts.size(); ++i)
+            total += parts[i].size();
+        u16string result(std::move(parts[0]));
+        result.reserve(total);
+        for (size_t i = 1; i < parts.size(); ++i)
+            result.append(parts[i]);
+        return result;
     }
 
 /*!
-    Converts the uint16 type string \a str into an encoded string.
+    Converts the first \a length characters of \a in from Unicode on up
+    to \a threads threads and returns the result, which is the same as
+    what fromUnicode(\a in, \a length) returns. If \a threads is 0 one
+    thread is used for each processor.
+
+    The input is cut at the points nextEncodeSyncPoint() finds, never
+    inside a surrogate pair, and every piece is encoded into a segment of
+    its own. The segments are then copied once into a string of their
+    total size. Short input, and input for a codec whose encoder cannot be
+    cut, such as UTF-16 with its byte order mark, is encoded on the calling
+    thread.
+
+    \sa parallelToUnicode(), nextEncodeSyncPoint()
 */
-    string TextEncoder::fromUnicode(const u16string &str) {
-        string result = c->fromUnicode(str.data(), str.length(), &state);
+    string TextCodec::parallelFromUnicode(const ushort *in, size_t length, unsigned int threads) const {
+        std::vector<string> segments;
+        parallelFromUnicode(&segments, in, length, threads);
+        if (segments.size() == 1)
+            return std::move(segments[0]);
+
+        size_t total = 0;
+        for (size_t i = 0; i < segments.size(); ++i)
+            total += segments[i].size();
+        string result;
+        result.reserve(total);
+        for (size_t i = 0; i < segments.size(); ++i)
+            result.append(segments[i]);
         return result;
     }
 
 /*!
     \overload
 
-    Converts \a len characters (not bytes) from \a uc, and returns the
-    result in a string.
+    Leaves the encoded pieces in \a segments instead of joining them, one
+    string per piece in order. Writing them out one after another, for
+    instance with a single writev() call, gives the same bytes as
+    fromUnicode(\a in, \a length) and saves the final copy.
 */
-    string TextEncoder::fromUnicode(const ushort *uc, int len) {
-        string result = c->fromUnicode(uc, len, &state);
-        return result;
+    void TextCodec::parallelFromUnicode(std::vector<string> *segments, const ushort *in, size_t length,
+                                        unsigned int threads) const {
+        const std::vector<size_t> bounds = parallelBounds(length, threads, [this, in, length](size_t from) {
+            return nextEncodeSyncPoint(in, length, from);
+        });
+        segments->clear();
+        segments->resize(bounds.size() - 1);
+        if (bounds.size() == 2) {
+            (*segments)[0] = fromUnicode(in, length);
+            return;
+        }
+        runParallel(segments->size(), [this, in, &bounds, segments](size_t i) {
+            (*segments)[i] = fromUnicode(in + bounds[i], bounds[i + 1] - bounds[i]);
+        });
     }
 
+    // decodeBackward() first looks this many bytes back, or twice the
+    // number of units asked for if that is more
+    static const size_t TextCodecBackwardSpan = 64;
+
 /*!
-    \class TextDecoder
-    \brief The TextDecoder class provides a state-based decoder.
-    \reentrant
+    Decodes the end of the first \a end bytes of \a in, giving at least
+    \a minLength UTF-16 units unless the start of \a in is reached first,
+    and returns the text. The byte offset at which decoding started is
+    stored in \a start, if it is not null; decoding \a in up to there and
+    appending the returned text gives what toUnicode(\a in, \a end)
+    returns.
 
-    A text decoder converts text from an encoded text format into Unicode
-    using a specific codec.
+    Only a little more than the returned text is decoded. The start is
+    found with previousSyncPoint(), a span of bytes before \a end that is
+    doubled until it holds enough text. Codecs that cannot find a place to
+    start in the middle of their input, such as ISO-2022-JP, decode it all.
+
+    Passing the start back as \a end walks the text backwards, a block at
+    a time:
+
+    \code
+    size_t end = size;
+    while (end > 0) {
+        std::basic_string<uint16_t> block = codec->decodeBackward(data, end, 4096, &end);
+        ...
+    }
+    \endcode
+
+    \sa previousSyncPoint(), parallelToUnicode()
+*/
+    u16string TextCodec::decodeBackward(const char *in, size_t end, size_t minLength, size_t *start) const {
+        size_t span = std::max(TextCodecBackwardSpan, saturatedSum(minLength, minLength));
+        for (;;) {
+            const size_t to = end > span ? end - span : 0;
+            // past the start of the input a byte order mark is a character
+            ConverterState state(IgnoreHeader);
+            const size_t from = to ? std::min(previousSyncPoint(in, end, to, &state), to) : 0;
+            u16string result;
+            if (!from) {
+                result = toUnicode(in, end);
+            } else {
+                result = toUnicode(in + from, end - from, &state);
+                if (state.remainingChars > 0) {
+                    // the end of the input is final; what the state holds
+                    // back is converted on its own, as a stateless call does
+                    const size_t tail = std::min(size_t(state.remainingChars), end - from);
+                    result += toUnicode(in + end - tail, tail);
+                }
+            }
+            if (!from || result.size() >= minLength) {
+                if (start)
+                    *start = from;
+                return result;
+            }
+            span = std::max(saturatedSum(span, span), saturatedSum(end - from, end - from));
+        }
+    }
+
+/*!
+    \fn template <typename Allocator> std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator>
+        TextCodec::toUnicode(const char *in, size_t length, const Allocator &allocator,
+                             ConverterState *state) const
+    \overload
+
+    Converts the first \a length bytes of \a in to Unicode and returns a
+    string whose storage comes from \a allocator, so that the text decoded
+    while serving a request can live in an arena and be released with it.
+    The allocator's \c value_type must be \c uint16_t.
+
+    The result is decoded straight into the returned string; reimplementations
+    of the std::allocator based appendToUnicode() are not consulted.
+*/
+
+/*!
+    \fn template <typename Allocator> std::basic_string<char, std::char_traits<char>, Allocator>
+        TextCodec::fromUnicode(const uint16_t *in, size_t length, const Allocator &allocator,
+                               ConverterState *state) const
+    \overload
+
+    Converts the first \a length characters of \a in from Unicode and
+    returns a string whose storage comes from \a allocator. The allocator's
+    \c value_type must be \c char.
+*/
+
+/*!
+    \fn template <typename Allocator> void TextCodec::appendToUnicode(
+        std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator> *target,
+        const char *in, size_t length, ConverterState *state) const
+    \overload
+
+    Appends to a \a target that uses a custom allocator, growing it the same
+    way as the std::allocator version does.
+*/
+
+/*!
+    \fn template <typename Allocator> void TextCodec::appendFromUnicode(
+        std::basic_string<char, std::char_traits<char>, Allocator> *target,
+        const uint16_t *in, size_t length, ConverterState *state) const
+    \overload
+
+    Appends to a \a target that uses a custom allocator, growing it the same
+    way as the std::allocator version does.
+*/
+
+/*!
+    Returns an upper bound for the number of characters that converting
+    \a length bytes with \a state can produce. A buffer of that size is
+    large enough for toUnicode() to never report ConversionOutputFull, so
+    a caller can allocate the output for a whole batch of records up front.
+
+    The built-in codecs return a tight bound for their encoding. The
+    default implementation assumes at most four characters per byte;
+    reimplement it if your codec can produce more.
+
+    \sa decodedLength(), maxEncodedLength()
+*/
+    size_t TextCodec::maxDecodedLength(size_t length, const ConverterState *state) const {
+        (void)state;
+        return boundedSize(length, 4, 4);
+    }
+
+/*!
+    Returns an upper bound for the number of bytes that converting
+    \a length characters with \a state can produce, including any byte
+    order mark or trailing shift sequence the codec writes.
+
+    The default implementation assumes at most four bytes per character;
+    reimplement it if your codec can produce more.
+
+    \sa encodedLength(), maxDecodedLength()
+*/
+    size_t TextCodec::maxEncodedLength(size_t length, const ConverterState *state) const {
+        (void)state;
+        return boundedSize(length, 4, 4);
+    }
+
+    // The counting passes below run the conversion on a copy of the caller's
+    // state, a scratch buffer at a time. A stateless conversion treats the end
+    // of the input as final, so a sequence the copy keeps pending is converted
+    // once more on its own to account for what a stateless call makes of it.
+    static const size_t TextCodecCountingChunk = 256;
+
+/*!
+    Returns the exact number of characters that
+    toUnicode(\a in, \a length, \a state) would produce, without writing
+    any output and without changing \a state.
+
+    \sa maxDecodedLength(), encodedLength()
+*/
+    size_t TextCodec::decodedLength(const char *in, size_t length, const ConverterState *state) const {
+        ConverterState counting;
+        TextCodecStateSnapshot(state).restore(&counting);
+        counting.flags = ConversionFlags(counting.flags & ~FreeFunction);
+
+        ushort scratch[TextCodecCountingChunk];
+        size_t total = 0;
+        size_t pos = 0;
+        for (;;) {
+            ConversionResult r = convertToUnicode(scratch, TextCodecCountingChunk, in + pos, length - pos, &counting);
+            if (Z_UNLIKELY(r.status == ConversionOutputFull && !r.consumed && !r.produced)) {
+                // a codec that cannot resume; let it convert everything at once
+                ConverterState copy;
+                TextCodecStateSnapshot(state).restore(&copy);
+                copy.flags = ConversionFlags(copy.flags & ~FreeFunction);
+                return toUnicode(in, length, state ? &copy : nullptr).size();
+            }
+            total += r.produced;
+            pos += r.consumed;
+            if (r.status != ConversionOutputFull)
+                break;
+        }
+
+        if (!state && counting.remainingChars > 0) {
+            const size_t tail = std::min(size_t(counting.remainingChars), length);
+            total += convertToUnicode(scratch, TextCodecCountingChunk, in + length - tail, tail, nullptr).produced;
+        }
+        return total;
+    }
+
+/*!
+    Returns the number of Unicode code points that
+    toUcs4(\a in, \a length, \a state) would produce. For well-formed
+    input that is the characters toUnicode() would produce with each
+    surrogate pair counted once. Nothing is written and \a state is not
+    changed.
+
+    \sa decodedLength()
+*/
+    size_t TextCodec::codePointCount(const char *in, size_t length, const ConverterState *state) const {
+        ConverterState counting;
+        TextCodecStateSnapshot(state).restore(&counting);
+        counting.flags = ConversionFlags(counting.flags & ~FreeFunction);
+
+        char32_t scratch[TextCodecCountingChunk];
+        size_t total = 0;
+        size_t pos = 0;
+        for (;;) {
+            ConversionResult r = convertToUcs4(scratch, TextCodecCountingChunk, in + pos, length - pos, &counting);
+            if (Z_UNLIKELY(r.status == ConversionOutputFull && !r.consumed && !r.produced)) {
+                ConverterState copy;
+                TextCodecStateSnapshot(state).restore(&copy);
+                copy.flags = ConversionFlags(copy.flags & ~FreeFunction);
+                return toUcs4(in, length, state ? &copy : nullptr).size();
+            }
+            total += r.produced;
+            pos += r.consumed;
+            if (r.status != ConversionOutputFull)
+                break;
+        }
+
+        if (!state && counting.remainingChars > 0) {
+            const size_t tail = std::min(size_t(counting.remainingChars), length);
+            total += convertToUcs4(scratch, TextCodecCountingChunk, in + length - tail, tail, nullptr).produced;
+        }
+        return total;
+    }
+
+/*!
+    Returns the exact number of bytes that
+    fromUnicode(\a in, \a length, \a state) would produce, without writing
+    any output and without changing \a state.
+
+    \sa maxEncodedLength(), decodedLength()
+*/
+    size_t TextCodec::encodedLength(const ushort *in, size_t length, const ConverterState *state) const {
+        ConverterState counting;
+        TextCodecStateSnapshot(state).restore(&counting);
+        counting.flags = ConversionFlags(counting.flags & ~FreeFunction);
+
+        char scratch[TextCodecCountingChunk];
+        size_t total = 0;
+        size_t pos = 0;
+        for (;;) {
+            ConversionResult r = convertFromUnicode(scratch, TextCodecCountingChunk, in + pos, length - pos, &counting);
+            if (Z_UNLIKELY(r.status == ConversionOutputFull && !r.consumed && !r.produced)) {
+                ConverterState copy;
+                TextCodecStateSnapshot(state).restore(&copy);
+                copy.flags = ConversionFlags(copy.flags & ~FreeFunction);
+                return fromUnicode(in, length, state ? &copy : nullptr).size();
+            }
+            total += r.produced;
+            pos += r.consumed;
+            if (r.status != ConversionOutputFull)
+                break;
+        }
+
+        if (!state && counting.remainingChars > 0) {
+            // a stateless call starts with the header again, which has
+            // been counted already
+            const size_t tail = std::min(size_t(counting.remainingChars), length);
+            const size_t header = convertFromUnicode(scratch, TextCodecCountingChunk, in, 0, nullptr).produced;
+            total += convertFromUnicode(scratch, TextCodecCountingChunk, in + length - tail, tail, nullptr).produced - header;
+        }
+        return total;
+    }
+
+/*!
+    \fn bool TextCodec::validate(const char *in, size_t length) const
+
+    Returns \c true if the first \a length bytes of \a in are well formed
+    in the encoding of this codec, that is, if converting them to Unicode
+    finds no invalid or incomplete sequence; otherwise returns \c false.
+
+    Nothing is allocated and no output is produced, so this is cheaper
+    than converting the input and checking the state afterwards.
+
+    \sa canEncode()
+*/
+
+/*!
+    \fn bool TextCodec::validate(const std::string &ba) const
+    \overload
+*/
+
+/*!
+    \fn bool TextCodec::canEncode(const uint16_t *in, size_t length) const
+    \overload
+
+    Tests the first \a length characters of \a in without building the
+    encoded string.
+*/
+
+/*!
+    Implements validate(). The default implementation runs the codec's
+    decoder over the input into a scratch buffer on the stack and stops at
+    the first invalid sequence. Codecs that can tell valid input apart
+    without decoding it reimplement this function.
+*/
+    bool TextCodec::validateToUnicode(const char *in, size_t length) const {
+        ConverterState checking;
+        ushort scratch[TextCodecCountingChunk];
+        size_t pos = 0;
+        for (;;) {
+            ConversionResult r = convertToUnicode(scratch, TextCodecCountingChunk, in + pos, length - pos, &checking);
+            if (checking.invalidChars)
+                return false;
+            if (Z_UNLIKELY(r.status == ConversionOutputFull && !r.consumed && !r.produced)) {
+                ConverterState copy;
+                toUnicode(in, length, &copy);
+                return copy.invalidChars == 0 && copy.remainingChars == 0;
+            }
+            pos += r.consumed;
+            if (r.status != ConversionOutputFull)
+                break;
+        }
+        return checking.remainingChars == 0;
+    }
+
+/*!
+    Implements canEncode(). The default implementation runs the codec's
+    encoder over the input into a scratch buffer on the stack and stops at
+    the first character it cannot encode.
+*/
+    bool TextCodec::validateFromUnicode(const ushort *in, size_t length) const {
+        ConverterState checking(ConvertInvalidToNull);
+        char scratch[TextCodecCountingChunk];
+        size_t pos = 0;
+        for (;;) {
+            ConversionResult r = convertFromUnicode(scratch, TextCodecCountingChunk, in + pos, length - pos, &checking);
+            if (checking.invalidChars)
+                return false;
+            if (Z_UNLIKELY(r.status == ConversionOutputFull && !r.consumed && !r.produced)) {
+                ConverterState copy(ConvertInvalidToNull);
+                fromUnicode(in, length, &copy);
+                return copy.invalidChars == 0;
+            }
+            pos += r.consumed;
+            if (r.status != ConversionOutputFull)
+                break;
+        }
+        return true;
+    }
+
+/*!
+    Returns the first position at or after \a from, and before \a length,
+    where the bytes in \a in can be cut so that both sides decode on their
+    own, without a ConverterState, to what the whole would decode to. That
+    holds when no bytes are carried over the cut and the decoder does
+    nothing special at the start of its input. Returns \a length if there
+    is no such position.
+
+    parallelToUnicode() uses this to split its input. The default returns
+    \a length, so the input is never cut; codecs whose sequences can be
+    resynchronized reimplement it.
+
+    \sa nextSyncPointAfter()
+*/
+    size_t TextCodec::nextSyncPoint(const char *, size_t length, size_t) const {
+        return length;
+    }
+
+/*!
+    Returns the first position at or after \a from, and before \a length,
+    that directly follows a byte below \a limit in \a in, or \a length if
+    there is none.
+
+    In a multibyte encoding in which no byte below \a limit is ever part
+    of a longer sequence, such a byte is a character of its own, or ends
+    an invalid one, and leaves the decoder with nothing carried over.
+*/
+    size_t TextCodec::nextSyncPointAfter(const char *in, size_t length, size_t from, unsigned char limit) {
+        for (size_t i = std::max<size_t>(from, 1); i < length; ++i) {
+            if (uchar(in[i - 1]) < limit)
+                return i;
+        }
+        return length;
+    }
+
+/*!
+    Returns the first position at or after \a from, and before \a length,
+    where the UTF-16 text in \a in can be cut so that both sides encode on
+    their own, without a ConverterState, to what the whole would encode to.
+    Returns \a length if there is no such position.
+
+    parallelFromUnicode() uses this to split its input. The default returns
+    \a length, so the input is never cut; codecs whose encoder carries
+    nothing from one character to the next reimplement it.
+
+    \sa nextCharacterBoundary(), nextSyncPoint()
+*/
+    size_t TextCodec::nextEncodeSyncPoint(const ushort *, size_t length, size_t) const {
+        return length;
+    }
+
+/*!
+    Returns the first position at or after \a from, and before \a length,
+    that neither follows a surrogate nor comes before a low surrogate in
+    \a in, or \a length if there is none. Encoders may hold back a
+    surrogate at the end of their input, even an unpaired one.
+*/
+    size_t TextCodec::nextCharacterBoundary(const ushort *in, size_t length, size_t from) {
+        for (size_t i = std::max<size_t>(from, 1); i < length; ++i) {
+            if (!UCS4Tool::isSurrogate(in[i - 1]) && !UCS4Tool::isLowSurrogate(in[i]))
+                return i;
+        }
+        return length;
+    }
+
+/*!
+    Returns the last position at or before \a to, in the first \a length
+    bytes of \a in, at which a decoder can start and decode the rest as it
+    would be decoded from the start of \a in. \a state is the state the
+    decoder will start with; it has the IgnoreHeader flag set, and a codec
+    that takes something from the start of its input, such as the byte
+    order a UTF-16 header gives, stores it there.
+
+    decodeBackward() uses this to find where to start. The default returns
+    0, so the input is decoded from its start; codecs whose sequences can
+    be resynchronized reimplement it. Where a byte can be both the first
+    and a later byte of a sequence, they look further back until it is
+    clear which one it is.
+
+    \sa previousSyncPointAfter(), doubleByteRunStart(), nextSyncPoint()
+*/
+    size_t TextCodec::previousSyncPoint(const char *, size_t, size_t, ConverterState *) const {
+        return 0;
+    }
+
+/*!
+    Returns the last position at or before \a to that directly follows a
+    byte below \a limit in \a in, or 0 if there is none.
+
+    \sa nextSyncPointAfter()
+*/
+    size_t TextCodec::previousSyncPointAfter(const char *in, size_t to, unsigned char limit) {
+        for (size_t i = to; i > 0; --i) {
+            if (uchar(in[i - 1]) < limit)
+                return i;
+        }
+        return 0;
+    }
+
+/*!
+    Returns the start of the run of bytes from \a low to \a high that ends
+    at \a to in \a in.
+
+    In a double-byte encoding in which every such byte can be the first as
+    well as the second byte of a character, the run cannot be read from its
+    end. Once the byte in front of it is known to end a character, though,
+    the run is read in pairs from its start, so every even distance from
+    the start is a character boundary.
+*/
+    size_t TextCodec::doubleByteRunStart(const char *in, size_t to, unsigned char low, unsigned char high) {
+        size_t i = to;
+        while (i > 0 && uchar(in[i - 1]) >= low && uchar(in[i - 1]) <= high)
+            --i;
+        return i;
+    }
+
+/*!
+    Creates a TextDecoder with a specified \a flags to decode chunks
+    of \c{char *} data to create chunks of Unicode data.
+
+    The caller is responsible for deleting the returned object.
+*/
+    TextDecoder *TextCodec::makeDecoder(TextCodec::ConversionFlags flags) const {
+        return new TextDecoder(this, flags);
+    }
+
+/*!
+    Creates a TextEncoder with a specified \a flags to encode chunks
+    of Unicode data as \c{char *} data.
+
+    The caller is responsible for deleting the returned object.
+*/
+    TextEncoder *TextCodec::makeEncoder(TextCodec::ConversionFlags flags) const {
+        return new TextEncoder(this, flags);
+    }
+
+/*!
+    Converts \a str from Unicode to the encoding of this codec, and
+    returns the result in a string.
+*/
+    string TextCodec::fromUnicode(const u16string &str) const {
+        return fromUnicode(str.data(), str.length(), nullptr);
+    }
+
+/*!
+    Converts the first \a length characters from the \a in array
+    from Unicode to the encoding of this codec, and returns the result
+    in a string. Inputs of more than \c INT_MAX characters are encoded
+    through appendFromUnicode().
+
+    The \a state of the convertor used is updated.
+*/
+    string TextCodec::fromUnicode(const ushort *in, size_t length, ConverterState *state) const {
+        if (Z_LIKELY(length <= size_t(INT_MAX)))
+            return convertFromUnicode(in, int(length), state);
+        string result;
+        appendFromUnicode(&result, in, length, state);
+        return result;
+    }
+
+/*!
+    Converts \a a from the encoding of this codec to Unicode, and
+    returns the result in a std::basic_string<uint16_t>.
+*/
+    u16string TextCodec::toUnicode(const string &a) const {
+        return toUnicode(a.data(), a.length(), nullptr);
+    }
+
+/*!
+    Converts the first \a length bytes from \a in from the encoding of
+    this codec to Unicode, and returns the result in a
+    std::basic_string<uint16_t>. Inputs of more than \c INT_MAX bytes are
+    decoded through appendToUnicode().
+
+    The \a state of the convertor used is updated.
+*/
+    u16string TextCodec::toUnicode(const char *in, size_t length, ConverterState *state) const {
+        if (Z_LIKELY(length <= size_t(INT_MAX)))
+            return convertToUnicode(in, int(length), state);
+        u16string result;
+        appendToUnicode(&result, in, length, state);
+        return result;
+    }
+
+/*!
+    Converts \a a from the encoding of this codec to UCS-4, and returns
+    the result in a std::basic_string<char32_t>.
+*/
+    u32string TextCodec::toUcs4(const string &a) const {
+        return toUcs4(a.data(), a.length(), nullptr);
+    }
+
+/*!
+    \overload
+
+    Converts the first \a length bytes from \a in from the encoding of
+    this codec to UCS-4 without a detour through UTF-16 where the codec
+    supports it; a character outside the Basic Multilingual Plane takes
+    one element instead of a surrogate pair.
+
+    The \a state of the convertor used is updated.
+
+    \sa toUnicode()
+*/
+    u32string TextCodec::toUcs4(const char *in, size_t length, ConverterState *state) const {
+        u32string result;
+        size_t pos = 0;
+        size_t extra = 0;
+        for (;;) {
+            const size_t size = result.size();
+            const size_t needed = boundedSize(maxDecodedLength(length - pos, state), 1, boundedSize(extra, 1, size));
+            if (needed > result.capacity())
+                result.reserve(std::max(needed, boundedSize(result.capacity(), 2)));
+            result.resize(needed);
+            ConversionResult r = convertToUcs4(&result[size], needed - size, in + pos, length - pos, state);
+            result.resize(size + r.produced);
+            pos += r.consumed;
+            if (Z_LIKELY(r.status != ConversionOutputFull))
+                break;
+            if (!r.consumed && !r.produced)
+                extra = std::max<size_t>(16, boundedSize(extra, 2));
+        }
+        return result;
+    }
+
+/*!
+    Converts \a uc from UCS-4 to the encoding of this codec, and returns
+    the result in a string.
+*/
+    string TextCodec::fromUcs4(const u32string &uc) const {
+        return fromUcs4(uc.data(), uc.length(), nullptr);
+    }
+
+/*!
+    \overload
+
+    Converts the first \a length code points from the \a in array from
+    UCS-4 to the encoding of this codec, and returns the result in a string.
+
+    The \a state of the convertor used is updated.
+
+    \sa fromUnicode()
+*/
+    string TextCodec::fromUcs4(const char32_t *in, size_t length, ConverterState *state) const {
+        string result;
+        size_t pos = 0;
+        size_t extra = 0;
+        for (;;) {
+            const size_t size = result.size();
+            const size_t needed = boundedSize(maxEncodedLength(boundedSize(length - pos, 2), state), 1,
+                                              boundedSize(extra, 1, size));
+            if (needed > result.capacity())
+                result.reserve(std::max(needed, boundedSize(result.capacity(), 2)));
+            result.resize(needed);
+            ConversionResult r = convertFromUcs4(&result[size], needed - size, in + pos, length - pos, state);
+            result.resize(size + r.produced);
+            pos += r.consumed;
+            if (Z_LIKELY(r.status != ConversionOutputFull))
+                break;
+            if (!r.consumed && !r.produced)
+                extra = std::max<size_t>(16, boundedSize(extra, 2));
+        }
+        return result;
+    }
+
+/*!
+    \fn TextCodec::ConversionResult TextCodec::toUcs4(char32_t *out, size_t outLength,
+                                      const char *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length bytes of \a in from the encoding of this
+    codec to UCS-4, writing at most \a outLength code points into \a out.
+    A buffer of maxDecodedLength() elements is always large enough.
+
+    The returned ConversionResult works like that of toUnicode().
+*/
+
+/*!
+    \fn TextCodec::ConversionResult TextCodec::fromUcs4(char *out, size_t outLength,
+                                      const char32_t *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length code points of \a in from UCS-4 to the
+    encoding of this codec, writing at most \a outLength bytes into \a out.
+
+    The returned ConversionResult works like that of fromUnicode().
+*/
+
+/*!
+    \fn TextCodec::ConversionResult TextCodec::toUnicode(uint16_t *out, size_t outLength,
+                                      const char *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length bytes of \a in from the encoding of this
+    codec to Unicode, writing at most \a outLength characters into \a out.
+
+    The returned ConversionResult holds the number of bytes consumed, the
+    number of characters written and a status. On ConversionOutputFull the
+    conversion stopped at a character boundary; continue with the remaining
+    input once \a out has been drained. The \a state of the convertor used
+    is updated.
+*/
+
+/*!
+    \fn TextCodec::ConversionResult TextCodec::fromUnicode(char *out, size_t outLength,
+                                      const uint16_t *in, size_t length, ConverterState *state) const
+
+    Converts the first \a length characters of \a in from Unicode to the
+    encoding of this codec, writing at most \a outLength bytes into \a out.
+
+    The returned ConversionResult holds the number of characters consumed,
+    the number of bytes written and a status. On ConversionOutputFull the
+    conversion stopped at a character boundary; continue with the remaining
+    input once \a out has been drained. The \a state of the convertor used
+    is updated.
+*/
+
+/*!
+    Returns \c true if the Unicode character \a ch can be fully encoded
+    with this codec; otherwise returns \c false.
+*/
+    bool TextCodec::canEncode(ushort ch) const {
+        return validateFromUnicode(&ch, 1);
+    }
+
+/*!
+    \overload
+
+    \a s contains the string being tested for encode-ability.
+*/
+    bool TextCodec::canEncode(const u16string &s) const {
+        return validateFromUnicode(s.data(), s.length());
+    }
+
+/*!
+    \overload
+
+    \a chars contains the source characters.
+*/
+    u16string TextCodec::toUnicode(const char *chars) const {
+        return toUnicode(chars, strlen(chars), nullptr);
+    }
+
+
+/*!
+    \class TextEncoder
+    \brief The TextEncoder class provides a state-based encoder.
+    \reentrant
+
+    A text encoder converts text from Unicode into an encoded text format
+    using a specific codec.
+
+    The encoder converts Unicode into another format, remembering any
+    state that is required between calls.
+
+    \sa TextCodec::makeEncoder(), TextDecoder
+*/
+
+/*!
+    \fn TextEncoder::TextEncoder(const TextCodec *codec)
+
+    Constructs a text encoder for the given \a codec.
+*/
+
+/*!
+    Constructs a text encoder for the given \a codec and conversion \a flags.
+*/
+    TextEncoder::TextEncoder(const TextCodec *codec, TextCodec::ConversionFlags flags)
+            : c(codec), flags(flags), state() {
+        state.flags = flags;
+    }
+
+/*!
+    Destroys the encoder.
+*/
+    TextEncoder::~TextEncoder() {
+    }
+
+/*!
+    \fn TextEncoder::TextEncoder(TextEncoder &&other)
+
+    Constructs a encoder that takes over the codec and conversion state of
+    \a other.
+*/
+
+/*!
+    \fn const TextCodec *TextEncoder::codec() const
+
+    Returns the codec this encoder converts with.
+*/
+
+/*!
+    Discards any state carried over from previous calls, such as a partial
+    character or a byte order mark that was already written, so that the encoder can be
+    reused for a new stream. The conversion flags given at construction
+    are restored.
+*/
+    void TextEncoder::reset() {
+        state.clear();
+        state.flags = flags;
+    }
+
+/*!
+    \internal
+    Determines whether the eecoder encountered a failure while decoding the input. If
+    an error was encountered, the produced result is undefined, and gets converted as according
+    to the conversion flags.
+ */
+    bool TextEncoder::hasFailure() const {
+        return state.invalidChars != 0;
+    }
+
+/*!
+    Converts the uint16 type string \a str into an encoded string.
+*/
+    string TextEncoder::fromUnicode(const u16string &str) {
+        string result = c->fromUnicode(str.data(), str.length(), &state);
+        return result;
+    }
+
+/*!
+    \overload
+
+    Converts \a len characters (not bytes) from \a uc, and returns the
+    result in a string.
+*/
+    string TextEncoder::fromUnicode(const ushort *uc, size_t len) {
+        return c->fromUnicode(uc, len, &state);
+    }
+
+/*!
+    \overload
+
+    Converts \a len characters from \a uc into the caller supplied buffer
+    \a out, writing at most \a outLength bytes. Nothing is allocated.
+
+    If the result is TextCodec::ConversionOutputFull, call this function
+    again with the characters that were not consumed once room has been made
+    in \a out.
+*/
+    TextCodec::ConversionResult TextEncoder::fromUnicode(char *out, size_t outLength, const ushort *uc, size_t len) {
+        return c->fromUnicode(out, outLength, uc, len, &state);
+    }
+
+/*!
+    \fn template <typename Allocator> std::basic_string<char, std::char_traits<char>, Allocator>
+        TextEncoder::fromUnicode(const uint16_t *uc, size_t len, const Allocator &allocator)
+    \overload
+
+    Converts \a len characters from \a uc and returns a string whose
+    storage comes from \a allocator.
+
+    \sa TextCodec::fromUnicode()
+*/
+
+/*!
+    \fn template <typename Allocator> void TextEncoder::fromUnicode(
+        std::basic_string<char, std::char_traits<char>, Allocator> *target, const uint16_t *uc, size_t len)
+    \overload
+
+    The converted string is appended to \a target.
+
+    \sa TextCodec::appendFromUnicode()
+*/
+
+/*!
+    Converts the UCS-4 string \a str into an encoded string.
+*/
+    string TextEncoder::fromUcs4(const u32string &str) {
+        return c->fromUcs4(str.data(), str.length(), &state);
+    }
+
+/*!
+    \overload
+
+    Converts \a len code points from \a uc, and returns the result in a
+    string.
+*/
+    string TextEncoder::fromUcs4(const char32_t *uc, size_t len) {
+        return c->fromUcs4(uc, len, &state);
+    }
+
+/*!
+    \overload
+
+    Converts \a len code points from \a uc into the caller supplied buffer
+    \a out, writing at most \a outLength bytes.
+*/
+    TextCodec::ConversionResult TextEncoder::fromUcs4(char *out, size_t outLength, const char32_t *uc, size_t len) {
+        return c->fromUcs4(out, outLength, uc, len, &state);
+    }
+
+/*!
+    \class TextDecoder
+    \brief The TextDecoder class provides a state-based decoder.
+    \reentrant
+
+    A text decoder converts text from an encoded text format into Unicode
+    using a specific codec.
 
     The decoder converts text in this format into Unicode, remembering any
     state that is required between calls.
@@ -823,7 +2419,7 @@ namespace zdytool {
 */
 
     TextDecoder::TextDecoder(const TextCodec *codec, TextCodec::ConversionFlags flags)
-            : c(codec), state() {
+            : c(codec), flags(flags), state(), streamOffset(0), invalidLimit(16), pending() {
         state.flags = flags;
     }
 
@@ -834,7 +2430,33 @@ namespace zdytool {
     }
 
 /*!
-    \fn std::basic_string<uint16_t> TextDecoder::toUnicode(const char *chars, int len)
+    \fn TextDecoder::TextDecoder(TextDecoder &&other)
+
+    Constructs a decoder that takes over the codec and conversion state of
+    \a other.
+*/
+
+/*!
+    \fn const TextCodec *TextDecoder::codec() const
+
+    Returns the codec this decoder converts with.
+*/
+
+/*!
+    Discards any state carried over from previous calls, such as a partial
+    character or a byte order mark that was already seen, so that the decoder can be
+    reused for a new stream. The conversion flags given at construction
+    are restored.
+*/
+    void TextDecoder::reset() {
+        state.clear();
+        state.flags = flags;
+        streamOffset = 0;
+        invalid.clear();
+    }
+
+/*!
+    \fn std::basic_string<uint16_t> TextDecoder::toUnicode(const char *chars, size_t len)
 
     Converts the first \a len bytes in \a chars to Unicode, returning
     the result.
@@ -843,8 +2465,79 @@ namespace zdytool {
     encoding is at the end of the characters), the decoder remembers
     enough state to continue with the next call to this function.
 */
-    u16string TextDecoder::toUnicode(const char *chars, int len) {
-        return c->toUnicode(chars, len, &state);
+    u16string TextDecoder::toUnicode(const char *chars, size_t len) {
+        if (Z_LIKELY(!(flags & TextCodec::RecordInvalid)))
+            return c->toUnicode(chars, len, &state);
+        TextCodec::ConverterState before;
+        saveState(&before);
+        u16string result = c->toUnicode(chars, len, &state);
+        recordInvalid(chars, len, before);
+        return result;
+    }
+
+/*!
+    \overload
+
+    Converts the first \a len bytes in \a chars to Unicode into the caller
+    supplied buffer \a out, writing at most \a outLength characters.
+    Nothing is allocated.
+
+    If the result is TextCodec::ConversionOutputFull, call this function
+    again with the bytes that were not consumed once room has been made in
+    \a out. A trailing partial multi-byte sequence is kept in the decoder
+    state and reported as TextCodec::ConversionIncomplete.
+*/
+    TextCodec::ConversionResult TextDecoder::toUnicode(ushort *out, size_t outLength, const char *chars, size_t len) {
+        if (Z_LIKELY(!(flags & TextCodec::RecordInvalid)))
+            return c->toUnicode(out, outLength, chars, len, &state);
+        TextCodec::ConverterState before;
+        saveState(&before);
+        TextCodec::ConversionResult result = c->toUnicode(out, outLength, chars, len, &state);
+        recordInvalid(chars, result.consumed, before);
+        return result;
+    }
+
+/*!
+    Converts the first \a len bytes in \a chars to UCS-4, returning the
+    result. Characters outside the Basic Multilingual Plane take one
+    element each, so there are no surrogate pairs to join afterwards.
+
+    Like toUnicode(), the decoder remembers enough state to continue
+    with the next call; the two can be mixed on one decoder.
+*/
+    u32string TextDecoder::toUcs4(const char *chars, size_t len) {
+        if (Z_LIKELY(!(flags & TextCodec::RecordInvalid)))
+            return c->toUcs4(chars, len, &state);
+        TextCodec::ConverterState before;
+        saveState(&before);
+        u32string result = c->toUcs4(chars, len, &state);
+        recordInvalid(chars, len, before);
+        return result;
+    }
+
+/*!
+    \overload
+
+    Converts the bytes in \a ba to UCS-4 and returns the result.
+*/
+    u32string TextDecoder::toUcs4(const string &ba) {
+        return toUcs4(ba.data(), ba.length());
+    }
+
+/*!
+    \overload
+
+    Converts the first \a len bytes in \a chars to UCS-4 into the caller
+    supplied buffer \a out, writing at most \a outLength code points.
+*/
+    TextCodec::ConversionResult TextDecoder::toUcs4(char32_t *out, size_t outLength, const char *chars, size_t len) {
+        if (Z_LIKELY(!(flags & TextCodec::RecordInvalid)))
+            return c->toUcs4(out, outLength, chars, len, &state);
+        TextCodec::ConverterState before;
+        saveState(&before);
+        TextCodec::ConversionResult result = c->toUcs4(out, outLength, chars, len, &state);
+        recordInvalid(chars, result.consumed, before);
+        return result;
     }
 
     void from_latin1(ushort *dst, const char *str, size_t size) {
@@ -852,49 +2545,67 @@ namespace zdytool {
             *dst++ = (uchar) *str++;
     }
 
-    void to_latin1(uchar *dst, const ushort *src, int length) {
+    void to_latin1(uchar *dst, const ushort *src, size_t length) {
         while (length--) {
             *dst++ = (*src > 0xff) ? '?' : (uchar) *src;
             ++src;
         }
     }
 
-    u16string u16string_fromLatin1(const char *str, int size) {
-        std::vector<uint16_t> d(size + 1);
-        d[size] = '\0';
-        from_latin1(d.data(), str, uint(size));
-        std::basic_string<uint16_t> s(&d[0], size);
+    u16string u16string_fromLatin1(const char *str, size_t size) {
+        u16string s(size, 0);
+        from_latin1(&s[0], str, size);
         return s;
     }
 
-    string u16string_toLatin1(const ushort *src, int length) {
-        std::vector<char> d(length + 1);
-        d[length] = '\0';
-        to_latin1((uchar *) d.data(), src, length);
-        return string(d.data(), length);
+    string u16string_toLatin1(const ushort *src, size_t length) {
+        string s(length, '\0');
+        to_latin1((uchar *) &s[0], src, length);
+        return s;
     }
 
 
 /*! \overload
 
-    The converted string is returned in \a target.
+    The converted string is appended to \a target.
+
+    \sa TextCodec::appendToUnicode()
  */
-    void TextDecoder::toUnicode(u16string *target, const char *chars, int len) {
+    void TextDecoder::toUnicode(u16string *target, const char *chars, size_t len) {
         if (!target)
             return;
-        switch (c->mibEnum()) {
-            case 106: // utf8
-                static_cast<const Utf8Codec *>(c)->convertToUnicode(target, chars, len, &state);
-                break;
-            case 4: // latin1
-                target->resize(len);
-                from_latin1((ushort *) target->data(), chars, len);
-                break;
-            default:
-                *target = c->toUnicode(chars, len, &state);
+        if (Z_LIKELY(!(flags & TextCodec::RecordInvalid))) {
+            c->appendToUnicode(target, chars, len, &state);
+            return;
         }
+        TextCodec::ConverterState before;
+        saveState(&before);
+        c->appendToUnicode(target, chars, len, &state);
+        recordInvalid(chars, len, before);
     }
 
+/*!
+    \fn template <typename Allocator> std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator>
+        TextDecoder::toUnicode(const char *chars, size_t len, const Allocator &allocator)
+    \overload
+
+    Converts the first \a len bytes in \a chars to Unicode and returns a
+    string whose storage comes from \a allocator.
+
+    \sa TextCodec::toUnicode()
+*/
+
+/*!
+    \fn template <typename Allocator> void TextDecoder::toUnicode(
+        std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator> *target, const char *chars, size_t len)
+    \overload
+
+    The converted string is appended to \a target, which uses a custom
+    allocator.
+
+    \sa TextCodec::appendToUnicode()
+*/
+
 
 /*!
     \overload
@@ -903,7 +2614,7 @@ namespace zdytool {
     and returns the result.
 */
     u16string TextDecoder::toUnicode(const string &ba) {
-        return c->toUnicode(ba.data(), ba.length(), &state);
+        return toUnicode(ba.data(), ba.length());
     }
 
 /*!
@@ -1028,4 +2739,402 @@ namespace zdytool {
     bool TextDecoder::hasFailure() const {
         return state.invalidChars != 0;
     }
+
+/*!
+    \class TextDecoder::InvalidSequence
+    \brief Describes invalid input found by a TextDecoder.
+
+    \c offset is the position of the sequence in the stream, counted in
+    bytes from the first byte given to the decoder since it was created or
+    reset. \c bytes holds the first \c length bytes of the sequence, up to
+    and including the byte at which the codec noticed the error.
+*/
+
+/*!
+    \fn const std::vector<TextDecoder::InvalidSequence> &TextDecoder::invalidSequences() const
+
+    Returns the invalid sequences found so far, in stream order. Nothing is
+    recorded unless the decoder was created with TextCodec::RecordInvalid;
+    hasFailure() tells whether there was any invalid input at all.
+
+    \sa setInvalidSequenceLimit()
+*/
+
+/*!
+    \fn void TextDecoder::setInvalidSequenceLimit(size_t limit)
+
+    Records at most \a limit invalid sequences; those found later are only
+    counted. The default is 16.
+*/
+
+/*!
+    \internal
+    Copies the conversion state into \a saved.
+*/
+    void TextDecoder::saveState(TextCodec::ConverterState *saved) const {
+        TextCodecStateSnapshot(&state).restore(saved);
+        saved->flags = TextCodec::ConversionFlags(saved->flags & ~TextCodec::FreeFunction);
+    }
+
+/*!
+    \internal
+    Accounts for the \a len bytes at \a chars that were just converted
+    starting from the state \a before. Only if the conversion found invalid
+    input are they converted again, one byte at a time, to locate it.
+
+    The first bytes of a sequence left incomplete at the end of \a chars
+    are kept in \c pending, so that a sequence is recorded with the same
+    bytes however the input was cut into calls.
+*/
+    void TextDecoder::recordInvalid(const char *chars, size_t len, const TextCodec::ConverterState &before) {
+        if (state.invalidChars != before.invalidChars && invalid.size() < invalidLimit) {
+            TextCodec::ConverterState replay;
+            TextCodecStateSnapshot(&before).restore(&replay);
+            // a sequence left pending by the previous call started before chars
+            size_t count = uint(replay.remainingChars);
+            uint64_t sequenceStart = streamOffset - std::min<uint64_t>(count, streamOffset);
+            InvalidSequence sequence;
+            memcpy(sequence.bytes, pending, sizeof(sequence.bytes));
+            ushort scratch[8];
+            for (size_t i = 0; i < len && invalid.size() < invalidLimit; ++i) {
+                if (replay.remainingChars == 0) {
+                    sequenceStart = streamOffset + i;
+                    count = 0;
+                }
+                if (count < sizeof(sequence.bytes))
+                    sequence.bytes[count] = uchar(chars[i]);
+                ++count;
+                const int invalidBefore = replay.invalidChars;
+                c->toUnicode(scratch, sizeof(scratch) / sizeof(scratch[0]), chars + i, 1, &replay);
+                if (replay.invalidChars != invalidBefore) {
+                    sequence.offset = sequenceStart;
+                    sequence.length = int(std::min(count, sizeof(sequence.bytes)));
+                    invalid.push_back(sequence);
+                    // the byte that exposed the error may start the next sequence
+                    sequence.bytes[0] = uchar(chars[i]);
+                    count = 1;
+                    sequenceStart = streamOffset + i;
+                }
+            }
+        }
+
+        const size_t remaining = uint(state.remainingChars);
+        if (remaining > len) {
+            // still the sequence the previous call left pending
+            for (size_t i = remaining - len, j = 0; i < sizeof(pending) && j < len; ++i, ++j)
+                pending[i] = uchar(chars[j]);
+        } else if (remaining) {
+            memcpy(pending, chars + len - remaining, std::min(remaining, sizeof(pending)));
+        }
+        streamOffset += len;
+    }
+
+/*!
+    \class TextDecoderPool
+    \brief The TextDecoderPool class recycles text decoders.
+    \threadsafe
+
+    Servers that open many short lived streams can take decoders from a
+    pool instead of creating one per stream. Decoders are kept per codec
+    and conversion flags, and are reset() when they are handed back.
+
+    \code
+    TextDecoder *decoder = pool.acquire(codec);
+    std::basic_string<uint16_t> text = decoder->toUnicode(chunk);
+    pool.release(decoder);
+    \endcode
+
+    \sa TextDecoder::reset()
+*/
+
+/*!
+    Constructs an empty pool that keeps at most \a maxIdle released
+    decoders for each codec and flags combination.
+*/
+    TextDecoderPool::TextDecoderPool(size_t maxIdle)
+            : maxIdle(maxIdle) {
+    }
+
+/*!
+    Destroys the pool and the decoders it holds. Decoders that are still
+    acquired must be released before the pool is destroyed.
+*/
+    TextDecoderPool::~TextDecoderPool() {
+        clear();
+    }
+
+/*!
+    Returns a decoder for \a codec with the conversion \a flags, reusing a
+    released one when there is one. Hand it back with release() once the
+    stream is finished.
+*/
+    TextDecoder *TextDecoderPool::acquire(const TextCodec *codec, TextCodec::ConversionFlags flags) {
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            std::map<Key, std::vector<TextDecoder *>>::iterator it = idle.find(Key(codec, flags));
+            if (it != idle.end() && !it->second.empty()) {
+                TextDecoder *decoder = it->second.back();
+                it->second.pop_back();
+                return decoder;
+            }
+        }
+        return new TextDecoder(codec, flags);
+    }
+
+/*!
+    Resets \a decoder and returns it to the pool. The decoder is deleted
+    instead if the pool already holds enough idle decoders for its codec.
+*/
+    void TextDecoderPool::release(TextDecoder *decoder) {
+        if (!decoder)
+            return;
+        decoder->reset();
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            std::vector<TextDecoder *> &list = idle[Key(decoder->c, decoder->flags)];
+            if (list.size() < maxIdle) {
+                list.push_back(decoder);
+                return;
+            }
+        }
+        delete decoder;
+    }
+
+/*!
+    Deletes all idle decoders held by the pool.
+*/
+    void TextDecoderPool::clear() {
+        std::map<Key, std::vector<TextDecoder *>> decoders;
+        {
+            std::lock_guard<std::mutex> locker(mutex);
+            decoders.swap(idle);
+        }
+        for (std::map<Key, std::vector<TextDecoder *>>::iterator it = decoders.begin(); it != decoders.end(); ++it) {
+            for (size_t i = 0; i < it->second.size(); ++i)
+                delete it->second[i];
+        }
+    }
+
+/*!
+    \class TextTranscoder
+    \brief The TextTranscoder class converts text from one encoding
+    straight into another.
+    \reentrant
+
+    A transcoder takes text in the encoding of one codec and produces it
+    in the encoding of another, e.g. GBK, Big5 or Shift-JIS to UTF-8,
+    without building an intermediate std::basic_string<uint16_t>. The
+    text is decoded a block at a time into a small buffer inside the
+    transcoder and encoded from there, so the only allocation is the
+    output. Where both encodings leave ASCII untouched, runs of ASCII
+    are copied from the input to the output directly.
+
+    Like TextDecoder and TextEncoder, the transcoder keeps the state of
+    both conversions between calls, so a stream can be fed to it in
+    chunks of any size. The output is that of a TextEncoder for \c to fed
+    by a TextDecoder for \c from, one block at a time; codecs that keep no
+    state between encoding calls, such as ISO-2022-JP, may therefore emit
+    a few extra escape sequences, and a byte order mark is only written
+    once there is text to follow it.
+
+    \sa TextDecoder, TextEncoder
+*/
+
+/*!
+    Constructs a transcoder from the encoding of \a from to that of \a to.
+*/
+    TextTranscoder::TextTranscoder(const TextCodec *from, const TextCodec *to)
+            : from(from), to(to), decoderState(), encoderState() {
+        init();
+    }
+
+/*!
+    Constructs a transcoder from the encoding of \a from to that of \a to,
+    decoding and encoding with the conversion \a flags.
+*/
+    TextTranscoder::TextTranscoder(const TextCodec *from, const TextCodec *to, TextCodec::ConversionFlags flags)
+            : from(from), to(to), decoderState(), encoderState() {
+        decoderState.flags = flags;
+        encoderState.flags = flags;
+        init();
+    }
+
+/*!
+    Destroys the transcoder.
+*/
+    TextTranscoder::~TextTranscoder() {
+    }
+
+    void TextTranscoder::init() {
+        blockStart = blockEnd = 0;
+
+        // ASCII can skip the intermediate buffer if every ASCII byte decodes
+        // to itself and every ASCII character encodes to itself on its own
+        asciiTransparent = true;
+        for (int i = 0; i < 0x80 && asciiTransparent; ++i) {
+            const char ch = char(i);
+            const ushort uc = ushort(i);
+            ushort decoded[4];
+            char encoded[16];
+            TextCodec::ConversionResult d = from->toUnicode(decoded, 4, &ch, 1);
+            TextCodec::ConversionResult e = to->fromUnicode(encoded, 16, &uc, 1);
+            asciiTransparent = d.produced == 1 && decoded[0] == uc && e.produced == 1 && encoded[0] == ch;
+        }
+
+        // codecs that read or write a byte order mark only do so at the start
+        // of the stream; the shortcut has to wait until they are past it
+        TextCodec::ConverterState probe;
+        ushort decoded[4];
+        decoderHeader = from->toUnicode(decoded, 4, "\xef\xbb\xbf", 3, &probe).produced == 0;
+        TextCodec::ConverterState encoderProbe;
+        const ushort a = 'A';
+        char encoded[16];
+        encoderHeader = to->fromUnicode(encoded, 16, &a, 1, &encoderProbe).produced != 1;
+    }
+
+    // a state holds nothing back when none of its words are set and no
+    // codec data is attached
+    static bool stateAtRest(const TextCodec::ConverterState &state) {
+        if (state.remainingChars || state.d)
+            return false;
+        for (int i = 0; i < TextCodec::ConverterState::StateDataSize; ++i) {
+            if (state.state_data[i])
+                return false;
+        }
+        return true;
+    }
+
+    bool TextTranscoder::atRest() const {
+        return stateAtRest(decoderState) && stateAtRest(encoderState)
+               && (!decoderHeader || (decoderState.flags & TextCodec::IgnoreHeader))
+               && (!encoderHeader || (encoderState.flags & TextCodec::IgnoreHeader));
+    }
+
+/*!
+    Converts the bytes in \a ba and returns the result.
+*/
+    string TextTranscoder::transcode(const string &ba) {
+        return transcode(ba.data(), ba.size());
+    }
+
+/*!
+    \overload
+
+    Converts the first \a len bytes in \a chars and returns the result.
+
+    If \a chars ends in the middle of a multi-byte sequence, the
+    transcoder remembers enough state to continue with the next call.
+*/
+    string TextTranscoder::transcode(const char *chars, size_t len) {
+        string result;
+        transcode(&result, chars, len);
+        return result;
+    }
+
+/*!
+    \overload
+
+    The converted bytes are appended to \a target, whose capacity grows
+    geometrically.
+*/
+    void TextTranscoder::transcode(string *target, const char *chars, size_t len) {
+        if (!target)
+            return;
+        size_t pos = 0;
+        size_t slack = 0;
+        for (;;) {
+            const size_t units = boundedSize(from->maxDecodedLength(len - pos, &decoderState), 1, blockEnd - blockStart);
+            const size_t size = target->size();
+            const size_t needed = boundedSize(to->maxEncodedLength(units, &encoderState), 1, boundedSize(slack, 1, size));
+            if (needed > target->capacity())
+                target->reserve(std::max(needed, boundedSize(target->capacity(), 2)));
+            target->resize(needed);
+            TextCodec::ConversionResult r = transcode(&(*target)[size], needed - size, chars + pos, len - pos);
+            target->resize(size + r.produced);
+            pos += r.consumed;
+            if (Z_LIKELY(r.status != TextCodec::ConversionOutputFull))
+                break;
+            // a codec without tight bounds; give it more room
+            if (!r.consumed && !r.produced)
+                slack = std::max<size_t>(64, boundedSize(slack, 2));
+        }
+    }
+
+/*!
+    \overload
+
+    Converts the first \a len bytes in \a chars into the caller supplied
+    buffer \a out, writing at most \a outLength bytes. Nothing is
+    allocated.
+
+    If the result is TextCodec::ConversionOutputFull, call this function
+    again with the bytes that were not consumed, even if there are none
+    left, once room has been made in \a out: text that was already
+    decoded may still be waiting for room.
+*/
+    TextCodec::ConversionResult TextTranscoder::transcode(char *out, size_t outLength, const char *chars, size_t len) {
+        TextCodec::ConversionResult r = { 0, 0, TextCodec::ConversionOk };
+        for (;;) {
+            // first encode what an earlier round decoded but had no room for
+            if (blockStart < blockEnd) {
+                TextCodec::ConversionResult e = to->fromUnicode(out + r.produced, outLength - r.produced,
+                                                                block + blockStart, blockEnd - blockStart,
+                                                                &encoderState);
+                blockStart += e.consumed;
+                r.produced += e.produced;
+                if (e.status == TextCodec::ConversionOutputFull) {
+                    r.status = TextCodec::ConversionOutputFull;
+                    return r;
+                }
+            }
+            if (r.consumed == len)
+                break;
+
+            if (asciiTransparent && atRest()) {
+                const uchar *src = reinterpret_cast<const uchar *>(chars) + r.consumed;
+                uchar *dst = reinterpret_cast<uchar *>(out) + r.produced;
+                const size_t n = std::min(len - r.consumed, outLength - r.produced);
+                size_t i = 0;
+                while (i < n && src[i] < 0x80) {
+                    dst[i] = src[i];
+                    ++i;
+                }
+                r.consumed += i;
+                r.produced += i;
+                if (r.consumed == len)
+                    break;
+                if (i == n) {
+                    r.status = TextCodec::ConversionOutputFull;
+                    return r;
+                }
+            }
+
+            size_t take = len - r.consumed;
+            TextCodec::ConversionResult d;
+            for (;;) {
+                d = from->toUnicode(block, BlockSize, chars + r.consumed, take, &decoderState);
+                // a codec converting through a string hands back all or nothing
+                if (Z_LIKELY(d.consumed || d.produced || take == 1))
+                    break;
+                take /= 2;
+            }
+            r.consumed += d.consumed;
+            blockStart = 0;
+            blockEnd = d.produced;
+            if (Z_UNLIKELY(!d.consumed && !d.produced))
+                break;
+        }
+        if (decoderState.remainingChars || encoderState.remainingChars)
+            r.status = TextCodec::ConversionIncomplete;
+        return r;
+    }
+
+/*!
+    Determines whether any errors were found while decoding or encoding.
+
+    Returns true if either side found an invalid character.
+*/
+    bool TextTranscoder::hasFailure() const {
+        return decoderState.invalidChars != 0 || encoderState.invalidChars != 0;
+    }
 }
\ No newline at end of file
@@ -20,8 +20,11 @@
 #include <string>
 #include <list>
 #include <cstdint>
+#include <climits>
+#include <type_traits>
 #include <cstdlib>
 #include <map>
+#include <vector>
 #include <algorithm>
 #include <mutex>
 #include <cstring>
@@ -65,6 +68,12 @@ namespace zdytool {
 
         bool canEncode(const std::basic_string<uint16_t> &) const;
 
+        bool canEncode(const uint16_t *in, size_t length) const { return validateFromUnicode(in, length); }
+
+        bool validate(const std::basic_string<char> &ba) const { return validateToUnicode(ba.data(), ba.length()); }
+
+        bool validate(const char *in, size_t length) const { return validateToUnicode(in, length); }
+
         std::basic_string<uint16_t> toUnicode(const std::basic_string<char> &) const;
 
         std::basic_string<uint16_t> toUnicode(const char *chars) const;
@@ -75,35 +84,148 @@ namespace zdytool {
             DefaultConversion,
             ConvertInvalidToNull = 0x80000000,
             IgnoreHeader = 0x1,
-            FreeFunction = 0x2
+            FreeFunction = 0x2,
+            RecordInvalid = 0x4
         };
 
         struct ConverterState {
+            enum { StateDataSize = 8 };
+
             ConverterState(ConversionFlags f = DefaultConversion)
                     : flags(f), remainingChars(0), invalidChars(0),
-                      d(nullptr) { state_data[0] = state_data[1] = state_data[2] = 0; }
+                      d(nullptr) { memset(state_data, 0, sizeof(state_data)); }
 
-            ~ConverterState();
+            ConverterState(ConverterState &&other);
+
+            ~ConverterState() {
+                if (Z_UNLIKELY((flags & FreeFunction) || d))
+                    releaseData();
+            }
+
+            ConverterState &operator=(ConverterState &&other);
+
+            void clear();
 
             ConversionFlags flags;
             int remainingChars;
             int invalidChars;
-            unsigned int state_data[3];
+            alignas(8) unsigned int state_data[StateDataSize];
             void *d;
         private:
+            void releaseData();
+
             ConverterState(const ConverterState &) = delete;
 
             ConverterState &operator=(const ConverterState &) = delete;
         };
 
-        std::basic_string<uint16_t> toUnicode(const char *in, int length, ConverterState *state = nullptr) const {
-            return convertToUnicode(in, length, state);
+        std::basic_string<uint16_t> toUnicode(const char *in, size_t length, ConverterState *state = nullptr) const;
+
+        std::basic_string<char> fromUnicode(const uint16_t *in, size_t length, ConverterState *state = nullptr) const;
+
+        enum ConversionStatus {
+            ConversionOk,
+            ConversionOutputFull,
+            ConversionIncomplete
+        };
+
+        struct ConversionResult {
+            size_t consumed;
+            size_t produced;
+            ConversionStatus status;
+        };
+
+        ConversionResult toUnicode(uint16_t *out, size_t outLength, const char *in, size_t length,
+                                   ConverterState *state = nullptr) const {
+            return convertToUnicode(out, outLength, in, length, state);
         }
 
-        std::basic_string<char> fromUnicode(const uint16_t *in, int length, ConverterState *state = nullptr) const {
-            return convertFromUnicode(in, length, state);
+        ConversionResult fromUnicode(char *out, size_t outLength, const uint16_t *in, size_t length,
+                                     ConverterState *state = nullptr) const {
+            return convertFromUnicode(out, outLength, in, length, state);
         }
 
+        std::basic_string<char32_t> toUcs4(const std::basic_string<char> &) const;
+
+        std::basic_string<char32_t> toUcs4(const char *in, size_t length, ConverterState *state = nullptr) const;
+
+        std::basic_string<char> fromUcs4(const std::basic_string<char32_t> &uc) const;
+
+        std::basic_string<char> fromUcs4(const char32_t *in, size_t length, ConverterState *state = nullptr) const;
+
+        ConversionResult toUcs4(char32_t *out, size_t outLength, const char *in, size_t length,
+                                ConverterState *state = nullptr) const {
+            return convertToUcs4(out, outLength, in, length, state);
+        }
+
+        ConversionResult fromUcs4(char *out, size_t outLength, const char32_t *in, size_t length,
+                                  ConverterState *state = nullptr) const {
+            return convertFromUcs4(out, outLength, in, length, state);
+        }
+
+        virtual void appendToUnicode(std::basic_string<uint16_t> *target, const char *in, size_t length,
+                                     ConverterState *state = nullptr) const;
+
+        virtual void appendFromUnicode(std::basic_string<char> *target, const uint16_t *in, size_t length,
+                                       ConverterState *state = nullptr) const;
+
+        template <typename Allocator>
+        typename std::enable_if<std::is_same<typename Allocator::value_type, uint16_t>::value,
+                std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator>>::type
+        toUnicode(const char *in, size_t length, const Allocator &allocator, ConverterState *state = nullptr) const {
+            std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator> result(allocator);
+            appendDecoded(&result, in, length, state);
+            return result;
+        }
+
+        template <typename Allocator>
+        typename std::enable_if<std::is_same<typename Allocator::value_type, char>::value,
+                std::basic_string<char, std::char_traits<char>, Allocator>>::type
+        fromUnicode(const uint16_t *in, size_t length, const Allocator &allocator,
+                    ConverterState *state = nullptr) const {
+            std::basic_string<char, std::char_traits<char>, Allocator> result(allocator);
+            appendEncoded(&result, in, length, state);
+            return result;
+        }
+
+        template <typename Allocator>
+        void appendToUnicode(std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator> *target,
+                             const char *in, size_t length, ConverterState *state = nullptr) const {
+            appendDecoded(target, in, length, state);
+        }
+
+        template <typename Allocator>
+        void appendFromUnicode(std::basic_string<char, std::char_traits<char>, Allocator> *target,
+                               const uint16_t *in, size_t length, ConverterState *state = nullptr) const {
+            appendEncoded(target, in, length, state);
+        }
+
+        void toUnicodeBatch(std::basic_string<uint16_t> *target, size_t *offsets,
+                            const char *const *inputs, const size_t *lengths, size_t count) const;
+
+        void fromUnicodeBatch(std::basic_string<char> *target, size_t *offsets,
+                              const uint16_t *const *inputs, const size_t *lengths, size_t count) const;
+
+        std::basic_string<uint16_t> parallelToUnicode(const char *in, size_t length, unsigned int threads = 0) const;
+
+        std::basic_string<char> parallelFromUnicode(const uint16_t *in, size_t length, unsigned int threads = 0) const;
+
+        void parallelFromUnicode(std::vector<std::basic_string<char>> *segments, const uint16_t *in, size_t length,
+                                 unsigned int threads = 0) const;
+
+        std::basic_string<uint16_t> decodeBackward(const char *in, size_t end, size_t minLength = 1,
+                                                   size_t *start = nullptr) const;
+
+        virtual size_t maxDecodedLength(size_t length, const ConverterState *state = nullptr) const;
+
+        virtual size_t maxEncodedLength(size_t length, const ConverterState *state = nullptr) const;
+
+        virtual size_t decodedLength(const char *in, size_t length, const ConverterState *state = nullptr) const;
+
+        virtual size_t codePointCount(const char *in, size_t length, const ConverterState *state = nullptr) const;
+
+        virtual size_t encodedLength(const uint16_t *in, size_t length, const ConverterState *state = nullptr) const;
+
         TextDecoder *makeDecoder(ConversionFlags flags = DefaultConversion) const;
 
         TextEncoder *makeEncoder(ConversionFlags flags = DefaultConversion) const;
@@ -121,6 +243,91 @@ namespace zdytool {
         virtual std::basic_string<char>
         convertFromUnicode(const uint16_t *in, int length, ConverterState *state) const = 0;
 
+        virtual ConversionResult
+        convertToUnicode(uint16_t *out, size_t outLength, const char *in, size_t length, ConverterState *state) const;
+
+        virtual ConversionResult
+        convertFromUnicode(char *out, size_t outLength, const uint16_t *in, size_t length, ConverterState *state) const;
+
+        virtual ConversionResult
+        convertToUcs4(char32_t *out, size_t outLength, const char *in, size_t length, ConverterState *state) const;
+
+        virtual ConversionResult
+        convertFromUcs4(char *out, size_t outLength, const char32_t *in, size_t length, ConverterState *state) const;
+
+        virtual bool validateToUnicode(const char *in, size_t length) const;
+
+        virtual bool validateFromUnicode(const uint16_t *in, size_t length) const;
+
+        virtual size_t nextSyncPoint(const char *in, size_t length, size_t from) const;
+
+        static size_t nextSyncPointAfter(const char *in, size_t length, size_t from, unsigned char limit);
+
+        virtual size_t nextEncodeSyncPoint(const uint16_t *in, size_t length, size_t from) const;
+
+        static size_t nextCharacterBoundary(const uint16_t *in, size_t length, size_t from);
+
+        virtual size_t previousSyncPoint(const char *in, size_t length, size_t to, ConverterState *state) const;
+
+        static size_t previousSyncPointAfter(const char *in, size_t to, unsigned char limit);
+
+        static size_t doubleByteRunStart(const char *in, size_t to, unsigned char low, unsigned char high);
+
+        template <typename String>
+        void appendDecoded(String *target, const char *in, size_t length, ConverterState *state) const {
+            size_t pos = 0;
+            for (;;) {
+                const size_t size = target->size();
+                const size_t needed = saturatedSum(size, maxDecodedLength(length - pos, state));
+                if (needed > target->capacity())
+                    target->reserve(std::max(needed, saturatedSum(target->capacity(), target->capacity())));
+                target->resize(needed);
+                ConversionResult r = convertToUnicode(&(*target)[size], needed - size, in + pos, length - pos, state);
+                target->resize(size + r.produced);
+                pos += r.consumed;
+                if (Z_LIKELY(r.status != ConversionOutputFull))
+                    break;
+                if (!r.consumed && !r.produced) {
+                    // the codec's bound was too tight for its string based conversion
+                    while (pos < length) {
+                        const int chunk = int(std::min(length - pos, size_t(INT_MAX)));
+                        const std::basic_string<uint16_t> decoded = convertToUnicode(in + pos, chunk, state);
+                        target->append(decoded.data(), decoded.size());
+                        pos += chunk;
+                    }
+                    break;
+                }
+            }
+        }
+
+        template <typename String>
+        void appendEncoded(String *target, const uint16_t *in, size_t length, ConverterState *state) const {
+            size_t pos = 0;
+            for (;;) {
+                const size_t size = target->size();
+                const size_t needed = saturatedSum(size, maxEncodedLength(length - pos, state));
+                if (needed > target->capacity())
+                    target->reserve(std::max(needed, saturatedSum(target->capacity(), target->capacity())));
+                target->resize(needed);
+                ConversionResult r = convertFromUnicode(&(*target)[size], needed - size, in + pos, length - pos, state);
+                target->resize(size + r.produced);
+                pos += r.consumed;
+                if (Z_LIKELY(r.status != ConversionOutputFull))
+                    break;
+                if (!r.consumed && !r.produced) {
+                    while (pos < length) {
+                        const int chunk = int(std::min(length - pos, size_t(INT_MAX)));
+                        const std::basic_string<char> encoded = convertFromUnicode(in + pos, chunk, state);
+                        target->append(encoded.data(), encoded.size());
+                        pos += chunk;
+                    }
+                    break;
+                }
+            }
+        }
+
+        static size_t saturatedSum(size_t a, size_t b) { return b > SIZE_MAX - a ? SIZE_MAX : a + b; }
+
         static bool TextCodecNameMatch(const char *a, const char *b);
 
         TextCodec();
@@ -135,20 +342,54 @@ namespace zdytool {
 
     class TextEncoder {
     public:
-        explicit TextEncoder(const TextCodec *codec) : c(codec), state() {}
+        explicit TextEncoder(const TextCodec *codec) : c(codec), flags(TextCodec::DefaultConversion), state() {}
 
         TextEncoder(const TextCodec *codec, TextCodec::ConversionFlags flags);
 
+        TextEncoder(TextEncoder &&other) = default;
+
         ~TextEncoder();
 
+        TextEncoder &operator=(TextEncoder &&other) = default;
+
+        const TextCodec *codec() const { return c; }
+
+        void reset();
+
         std::basic_string<char> fromUnicode(const std::basic_string<uint16_t> &str);
 
-        std::basic_string<char> fromUnicode(const uint16_t *uc, int len);
+        std::basic_string<char> fromUnicode(const uint16_t *uc, size_t len);
+
+        TextCodec::ConversionResult fromUnicode(char *out, size_t outLength, const uint16_t *uc, size_t len);
+
+        std::basic_string<char> fromUcs4(const std::basic_string<char32_t> &str);
+
+        std::basic_string<char> fromUcs4(const char32_t *uc, size_t len);
+
+        TextCodec::ConversionResult fromUcs4(char *out, size_t outLength, const char32_t *uc, size_t len);
+
+        template <typename Allocator>
+        typename std::enable_if<std::is_same<typename Allocator::value_type, char>::value,
+                std::basic_string<char, std::char_traits<char>, Allocator>>::type
+        fromUnicode(const uint16_t *uc, size_t len, const Allocator &allocator) {
+            std::basic_string<char, std::char_traits<char>, Allocator> result(allocator);
+            fromUnicode(&result, uc, len);
+            return result;
+        }
+
+        template <typename Allocator>
+        void fromUnicode(std::basic_string<char, std::char_traits<char>, Allocator> *target,
+                         const uint16_t *uc, size_t len) {
+            if (!target)
+                return;
+            c->appendFromUnicode(target, uc, len, &state);
+        }
 
         bool hasFailure() const;
 
     private:
         const TextCodec *c;
+        TextCodec::ConversionFlags flags;
         TextCodec::ConverterState state;
 
         TextEncoder(const TextEncoder &) = delete;
@@ -158,27 +399,155 @@ namespace zdytool {
 
     class TextDecoder {
     public:
-        explicit TextDecoder(const TextCodec *codec) : c(codec), state() {}
+        struct InvalidSequence {
+            uint64_t offset;
+            int length;
+            unsigned char bytes[4];
+        };
+
+        explicit TextDecoder(const TextCodec *codec)
+                : c(codec), flags(TextCodec::DefaultConversion), state(), streamOffset(0), invalidLimit(16),
+                  pending() {}
 
         TextDecoder(const TextCodec *codec, TextCodec::ConversionFlags flags);
 
+        TextDecoder(TextDecoder &&other) = default;
+
         ~TextDecoder();
 
-        std::basic_string<uint16_t> toUnicode(const char *chars, int len);
+        TextDecoder &operator=(TextDecoder &&other) = default;
+
+        const TextCodec *codec() const { return c; }
+
+        void reset();
+
+        std::basic_string<uint16_t> toUnicode(const char *chars, size_t len);
 
         std::basic_string<uint16_t> toUnicode(const std::basic_string<char> &ba);
 
-        void toUnicode(std::basic_string<uint16_t> *target, const char *chars, int len);
+        void toUnicode(std::basic_string<uint16_t> *target, const char *chars, size_t len);
+
+        TextCodec::ConversionResult toUnicode(uint16_t *out, size_t outLength, const char *chars, size_t len);
+
+        std::basic_string<char32_t> toUcs4(const char *chars, size_t len);
+
+        std::basic_string<char32_t> toUcs4(const std::basic_string<char> &ba);
+
+        TextCodec::ConversionResult toUcs4(char32_t *out, size_t outLength, const char *chars, size_t len);
+
+        template <typename Allocator>
+        typename std::enable_if<std::is_same<typename Allocator::value_type, uint16_t>::value,
+                std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator>>::type
+        toUnicode(const char *chars, size_t len, const Allocator &allocator) {
+            std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator> result(allocator);
+            toUnicode(&result, chars, len);
+            return result;
+        }
+
+        template <typename Allocator>
+        void toUnicode(std::basic_string<uint16_t, std::char_traits<uint16_t>, Allocator> *target,
+                       const char *chars, size_t len) {
+            if (!target)
+                return;
+            if (Z_LIKELY(!(flags & TextCodec::RecordInvalid))) {
+                c->appendToUnicode(target, chars, len, &state);
+                return;
+            }
+            TextCodec::ConverterState before;
+            saveState(&before);
+            c->appendToUnicode(target, chars, len, &state);
+            recordInvalid(chars, len, before);
+        }
 
         bool hasFailure() const;
 
+        const std::vector<InvalidSequence> &invalidSequences() const { return invalid; }
+
+        void setInvalidSequenceLimit(size_t limit) { invalidLimit = limit; }
+
     private:
         const TextCodec *c;
+        TextCodec::ConversionFlags flags;
         TextCodec::ConverterState state;
+        uint64_t streamOffset;
+        size_t invalidLimit;
+        std::vector<InvalidSequence> invalid;
+        unsigned char pending[4];
+
+        void saveState(TextCodec::ConverterState *saved) const;
+
+        void recordInvalid(const char *chars, size_t len, const TextCodec::ConverterState &before);
 
         TextDecoder(const TextDecoder &) = delete;
 
         TextDecoder &operator=(const TextDecoder &) = delete;
+
+        friend class TextDecoderPool;
+    };
+
+    class TextDecoderPool {
+    public:
+        explicit TextDecoderPool(size_t maxIdle = 64);
+
+        ~TextDecoderPool();
+
+        TextDecoder *acquire(const TextCodec *codec, TextCodec::ConversionFlags flags = TextCodec::DefaultConversion);
+
+        void release(TextDecoder *decoder);
+
+        void clear();
+
+    private:
+        typedef std::pair<const TextCodec *, TextCodec::ConversionFlags> Key;
+
+        std::mutex mutex;
+        std::map<Key, std::vector<TextDecoder *>> idle;
+        size_t maxIdle;
+
+        TextDecoderPool(const TextDecoderPool &) = delete;
+
+        TextDecoderPool &operator=(const TextDecoderPool &) = delete;
+    };
+
+    class TextTranscoder {
+    public:
+        TextTranscoder(const TextCodec *from, const TextCodec *to);
+
+        TextTranscoder(const TextCodec *from, const TextCodec *to, TextCodec::ConversionFlags flags);
+
+        ~TextTranscoder();
+
+        std::basic_string<char> transcode(const std::basic_string<char> &ba);
+
+        std::basic_string<char> transcode(const char *chars, size_t len);
+
+        void transcode(std::basic_string<char> *target, const char *chars, size_t len);
+
+        TextCodec::ConversionResult transcode(char *out, size_t outLength, const char *chars, size_t len);
+
+        bool hasFailure() const;
+
+    private:
+        enum { BlockSize = 512 };
+
+        const TextCodec *from;
+        const TextCodec *to;
+        TextCodec::ConverterState decoderState;
+        TextCodec::ConverterState encoderState;
+        uint16_t block[BlockSize];
+        size_t blockStart;
+        size_t blockEnd;
+        bool asciiTransparent;
+        bool decoderHeader;
+        bool encoderHeader;
+
+        void init();
+
+        bool atRest() const;
+
+        TextTranscoder(const TextTranscoder &) = delete;
+
+        TextTranscoder &operator=(const TextTranscoder &) = delete;
     };
 }
 #endif // TEXTCODEC_H
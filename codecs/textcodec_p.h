@@ -33,6 +33,7 @@ namespace zdytool {
     using std::basic_string;
     typedef basic_string<uint16_t> u16string;
     typedef basic_string<char> string;
+    typedef basic_string<char32_t> u32string;
     typedef uint16_t ushort;
     typedef unsigned char uchar;
     typedef unsigned int uint;
@@ -87,11 +88,19 @@ namespace zdytool {
 
     void from_latin1(ushort *dst, const char *str, size_t size);
 
-    void to_latin1(uchar *dst, const ushort *src, int length);
+    void to_latin1(uchar *dst, const ushort *src, size_t length);
 
-    u16string u16string_fromLatin1(const char *str, int size);
+    u16string u16string_fromLatin1(const char *str, size_t size);
 
-    string u16string_toLatin1(const ushort *src, int length);
+    string u16string_toLatin1(const ushort *src, size_t length);
+
+    // Returns n * factor + extra, or SIZE_MAX if that does not fit, so that
+    // an oversized output buffer fails to allocate instead of wrapping around.
+    static inline size_t boundedSize(size_t n, size_t factor, size_t extra = 0) {
+        if (n > (SIZE_MAX - extra) / factor)
+            return SIZE_MAX;
+        return n * factor + extra;
+    }
 
     extern list<TextCodec *> allCodecs;
     extern TextCodec *codecForLocale_m;
@@ -149,6 +158,18 @@ namespace zdytool {
         }
     };
 
+    // Returns \a uc if it is a Unicode scalar value. A surrogate or a value
+    // past U+10FFFF is counted as invalid in \a state and replaced, so UCS-4
+    // output only ever holds scalar values.
+    static inline char32_t ucs4ScalarValue(unsigned int uc, TextCodec::ConverterState *state) {
+        if (Z_LIKELY(uc <= SpecialCharacter::LastValidCodePoint && !UCS4Tool::isSurrogate(uc)))
+            return char32_t(uc);
+        if (!state)
+            return SpecialCharacter::ReplacementCharacter;
+        ++state->invalidChars;
+        return (state->flags & TextCodec::ConvertInvalidToNull) ? 0 : SpecialCharacter::ReplacementCharacter;
+    }
+
     typedef void (*TextCodecStateFreeFunction)(TextCodec::ConverterState *);
 
     struct TextCodecUnalignedPointer {
@@ -0,0 +1,104 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textcodepoints.h"
+
+namespace zdytool {
+
+/*!
+    \class CodePointIterator
+    \brief The CodePointIterator class decodes encoded bytes one code point at a time.
+
+    The iterator reads the bytes between a position and an end pointer and
+    decodes a character only when it is advanced, so a parser that looks at
+    a prefix of the text, or stops at the first character it does not
+    want, decodes no more than it reads. The encoding is given by the
+    \c Traits argument, one of Utf8CodePoints, Latin1CodePoints,
+    Gb18030CodePoints, Big5CodePoints, EucJpCodePoints, EucKrCodePoints
+    and SjisCodePoints. The loop is compiled for that encoding: ASCII bytes
+    are handled inline and the other sequences go straight to the codec's
+    tables, without a virtual call per character.
+
+    Each character is decoded as the stateless TextCodec::toUcs4() of the
+    codec would decode it: invalid sequences give U+FFFD, and a sequence
+    cut off by the end pointer is treated as the codec treats one at the
+    end of its input. The UTF-8 codec gives U+FFFD for each of its bytes;
+    the multibyte codecs drop it. Stateful encodings, such as ISO-2022-JP,
+    and the UTF-16 and UTF-32 codecs have no traits.
+
+    \code
+    for (char32_t c : codePoints<Gb18030CodePoints>(data, size)) {
+        if (c == '\n')
+            break;
+        ...
+    }
+    \endcode
+
+    \sa CodePointRange, TextDecoder
+*/
+
+/*!
+    \fn CodePointIterator::CodePointIterator()
+
+    Constructs an iterator over no bytes.
+*/
+
+/*!
+    \fn CodePointIterator::CodePointIterator(const char *position, const char *end)
+
+    Constructs an iterator at the character that starts at \a position.
+    The input ends at \a end; an iterator constructed with \a position
+    equal to \a end is the end iterator.
+
+    \a position must be the start of a character. A byte order mark at the
+    start of the input is not skipped; use codePoints() for that.
+*/
+
+/*!
+    \fn CodePointIterator::reference CodePointIterator::operator*() const
+
+    Returns the current code point.
+*/
+
+/*!
+    \fn const char *CodePointIterator::position() const
+
+    Returns a pointer to the first byte of the current character, or the
+    end pointer if the iterator is at the end. It may be used to construct
+    a new iterator, or to hand the rest of the input to a TextDecoder.
+*/
+
+/*!
+    \class CodePointRange
+    \brief The CodePointRange class makes the code points of encoded bytes usable in a range-based for loop.
+
+    The range skips a byte order mark at the start of the input, if the
+    encoding has one.
+
+    \sa codePoints()
+*/
+
+/*!
+    \fn CodePointRange<Traits> codePoints(const char *chars, size_t len)
+    \relates CodePointRange
+
+    Returns the code points of the \a len bytes at \a chars, decoded with
+    \c Traits.
+*/
+
+/*!
+    \fn CodePointRange<Traits> codePoints(const std::basic_string<char> &ba)
+    \relates CodePointRange
+    \overload
+*/
+}
@@ -0,0 +1,185 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTCODEPOINTS_H
+#define TEXTCODEPOINTS_H
+
+#include <cstddef>
+#include <iterator>
+#include "textcodec.h"
+namespace zdytool {
+    struct CodePointTraits {
+        // returned by next() for a sequence cut off by the end of the input
+        static const char32_t Incomplete = 0xffffffff;
+
+        static const unsigned char *skipHeader(const unsigned char *begin, const unsigned char *) {
+            return begin;
+        }
+    };
+
+    struct Utf8CodePoints : CodePointTraits {
+        static const unsigned char *skipHeader(const unsigned char *begin, const unsigned char *end);
+
+        static char32_t next(const unsigned char *&src, const unsigned char *end) {
+            if (Z_LIKELY(*src < 0x80))
+                return *src++;
+            return nextMultibyte(src, end);
+        }
+
+        static char32_t nextMultibyte(const unsigned char *&src, const unsigned char *end);
+    };
+
+    struct Latin1CodePoints : CodePointTraits {
+        static char32_t next(const unsigned char *&src, const unsigned char *) {
+            return *src++;
+        }
+    };
+
+#ifndef Z_NO_BIG_TEXTCODECS
+    struct Gb18030CodePoints : CodePointTraits {
+        static char32_t next(const unsigned char *&src, const unsigned char *end) {
+            if (Z_LIKELY(*src < 0x80))
+                return *src++;
+            return nextMultibyte(src, end);
+        }
+
+        static char32_t nextMultibyte(const unsigned char *&src, const unsigned char *end);
+    };
+
+    struct Big5CodePoints : CodePointTraits {
+        static char32_t next(const unsigned char *&src, const unsigned char *end) {
+            if (Z_LIKELY(*src < 0x80))
+                return *src++;
+            return nextMultibyte(src, end);
+        }
+
+        static char32_t nextMultibyte(const unsigned char *&src, const unsigned char *end);
+    };
+
+    struct EucJpCodePoints : CodePointTraits {
+        static char32_t next(const unsigned char *&src, const unsigned char *end) {
+            if (Z_LIKELY(*src < 0x80))
+                return *src++;
+            return nextMultibyte(src, end);
+        }
+
+        static char32_t nextMultibyte(const unsigned char *&src, const unsigned char *end);
+    };
+
+    struct EucKrCodePoints : CodePointTraits {
+        static char32_t next(const unsigned char *&src, const unsigned char *end) {
+            if (Z_LIKELY(*src < 0x80))
+                return *src++;
+            return nextMultibyte(src, end);
+        }
+
+        static char32_t nextMultibyte(const unsigned char *&src, const unsigned char *end);
+    };
+
+    struct SjisCodePoints : CodePointTraits {
+        // a NUL byte decodes to the replacement character, so every byte
+        // takes the same path
+        static char32_t next(const unsigned char *&src, const unsigned char *end);
+    };
+#endif // Z_NO_BIG_TEXTCODECS
+
+    template <typename Traits>
+    class CodePointIterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef char32_t value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const char32_t *pointer;
+        typedef const char32_t &reference;
+
+        CodePointIterator() : cur(nullptr), nextPos(nullptr), end(nullptr), value(0) {}
+
+        CodePointIterator(const char *position, const char *end)
+                : cur(reinterpret_cast<const unsigned char *>(position)), nextPos(cur),
+                  end(reinterpret_cast<const unsigned char *>(end)), value(0) {
+            load();
+        }
+
+        reference operator*() const { return value; }
+
+        pointer operator->() const { return &value; }
+
+        CodePointIterator &operator++() {
+            cur = nextPos;
+            load();
+            return *this;
+        }
+
+        CodePointIterator operator++(int) {
+            CodePointIterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const CodePointIterator &other) const { return cur == other.cur; }
+
+        bool operator!=(const CodePointIterator &other) const { return cur != other.cur; }
+
+        const char *position() const { return reinterpret_cast<const char *>(cur); }
+
+    private:
+        const unsigned char *cur;
+        const unsigned char *nextPos;
+        const unsigned char *end;
+        char32_t value;
+
+        void load() {
+            if (cur == end)
+                return;
+            nextPos = cur;
+            value = Traits::next(nextPos, end);
+            // a truncated sequence can only sit at the end and decodes to nothing
+            if (Z_UNLIKELY(value == Traits::Incomplete))
+                cur = nextPos = end;
+        }
+    };
+
+    template <typename Traits>
+    class CodePointRange {
+    public:
+        typedef CodePointIterator<Traits> iterator;
+        typedef CodePointIterator<Traits> const_iterator;
+
+        CodePointRange(const char *chars, size_t len) {
+            const unsigned char *b = reinterpret_cast<const unsigned char *>(chars);
+            const unsigned char *e = b + len;
+            b = Traits::skipHeader(b, e);
+            first = reinterpret_cast<const char *>(b);
+            last = chars + len;
+        }
+
+        iterator begin() const { return iterator(first, last); }
+
+        iterator end() const { return iterator(last, last); }
+
+    private:
+        const char *first;
+        const char *last;
+    };
+
+    template <typename Traits>
+    inline CodePointRange<Traits> codePoints(const char *chars, size_t len) {
+        return CodePointRange<Traits>(chars, len);
+    }
+
+    template <typename Traits>
+    inline CodePointRange<Traits> codePoints(const std::basic_string<char> &ba) {
+        return CodePointRange<Traits>(ba.data(), ba.size());
+    }
+}
+#endif // TEXTCODEPOINTS_H
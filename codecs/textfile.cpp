@@ -0,0 +1,243 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textfile.h"
+#include "textcodec_p.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#ifndef WIN32
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+namespace zdytool {
+
+    namespace {
+        // input is handed to the transcoder a window at a time, so the bytes
+        // it decodes are still in cache when they are encoded
+        enum {
+            WindowSize = 256 * 1024,
+            OutputSize = 1024 * 1024
+        };
+
+        class InputFile {
+        public:
+            InputFile() : file(nullptr), owned(false), map(nullptr), size(0), pos(0) {}
+
+            ~InputFile() {
+#ifndef WIN32
+                if (map)
+                    munmap(const_cast<char *>(map), size);
+#endif
+                if (owned)
+                    std::fclose(file);
+            }
+
+            bool open(const string &path) {
+                if (path == "-") {
+                    file = stdin;
+                } else {
+                    file = std::fopen(path.c_str(), "rb");
+                    owned = file != nullptr;
+                }
+                if (!file)
+                    return false;
+#ifndef WIN32
+                struct stat st;
+                int fd = fileno(file);
+                if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+                    && static_cast<uint64_t>(st.st_size) <= static_cast<uint64_t>(SIZE_MAX)) {
+                    void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (p != MAP_FAILED) {
+                        map = static_cast<const char *>(p);
+                        size = static_cast<size_t>(st.st_size);
+#  ifdef MADV_SEQUENTIAL
+                        madvise(p, size, MADV_SEQUENTIAL);
+#  endif
+                        return true;
+                    }
+                }
+#endif
+                buffer.resize(WindowSize);
+                return true;
+            }
+
+            bool isMapped() const { return map != nullptr; }
+
+            // sets *len to 0 at the end of the file
+            bool next(const char **data, size_t *len) {
+                if (map) {
+                    *data = map + pos;
+                    *len = std::min<size_t>(size - pos, WindowSize);
+                    pos += *len;
+                    return true;
+                }
+                *data = &buffer[0];
+                *len = std::fread(&buffer[0], 1, buffer.size(), file);
+                return *len || !std::ferror(file);
+            }
+
+        private:
+            std::FILE *file;
+            bool owned;
+            const char *map;
+            size_t size;
+            size_t pos;
+            std::vector<char> buffer;
+
+            InputFile(const InputFile &) = delete;
+
+            InputFile &operator=(const InputFile &) = delete;
+        };
+
+        class OutputFile {
+        public:
+            OutputFile() : file(nullptr), owned(false) {}
+
+            ~OutputFile() {
+                if (owned)
+                    std::fclose(file);
+            }
+
+            bool open(const string &path) {
+                if (path == "-") {
+                    file = stdout;
+                    return true;
+                }
+                file = std::fopen(path.c_str(), "wb");
+                if (!file)
+                    return false;
+                owned = true;
+                // writes are already large, skip the copy into the stdio buffer
+                std::setvbuf(file, nullptr, _IONBF, 0);
+                return true;
+            }
+
+            bool write(const char *data, size_t len) {
+                return !len || std::fwrite(data, 1, len, file) == len;
+            }
+
+            bool close() {
+                bool ok = !std::ferror(file) && std::fflush(file) == 0;
+                if (owned) {
+                    owned = false;
+                    ok = std::fclose(file) == 0 && ok;
+                }
+                return ok;
+            }
+
+        private:
+            std::FILE *file;
+            bool owned;
+
+            OutputFile(const OutputFile &) = delete;
+
+            OutputFile &operator=(const OutputFile &) = delete;
+        };
+    }
+
+/*!
+    \class TranscodeStats
+    \brief The TranscodeStats struct reports what transcodeFile() did.
+
+    \a bytesRead and \a bytesWritten count the input and output bytes,
+    \a mapped is true if the input was memory mapped rather than read, and
+    \a hasFailure is true if invalid input was found or a character could
+    not be represented in the target encoding.
+*/
+
+/*!
+    Converts the file at \a srcPath from \a srcCodec to \a dstCodec and
+    writes the result to \a dstPath, which is created or truncated. A path
+    of "-" stands for the standard input or output. The conversion \a flags
+    are passed to both codecs.
+
+    Regular files are memory mapped where the platform allows it, other
+    inputs are read. Either way the input is converted in windows of a few
+    hundred kilobytes, with the converter state carried from one window to
+    the next, and the output is written in blocks of a megabyte.
+
+    Returns false if a file could not be opened, read or written. Invalid
+    input does not make the conversion fail; it is reported through
+    \a stats when that is not null.
+
+    \sa TextTranscoder
+*/
+    bool transcodeFile(const string &srcPath, const TextCodec *srcCodec,
+                       const string &dstPath, const TextCodec *dstCodec,
+                       TextCodec::ConversionFlags flags, TranscodeStats *stats) {
+        if (stats) {
+            stats->bytesRead = 0;
+            stats->bytesWritten = 0;
+            stats->mapped = false;
+            stats->hasFailure = false;
+        }
+        if (!srcCodec || !dstCodec)
+            return false;
+
+        InputFile input;
+        OutputFile output;
+        if (!input.open(srcPath) || !output.open(dstPath))
+            return false;
+
+        TextTranscoder transcoder(srcCodec, dstCodec, flags);
+        std::vector<char> out(OutputSize);
+        size_t used = 0;
+        uint64_t read = 0;
+        uint64_t written = 0;
+        bool ok = true;
+        for (;;) {
+            const char *data;
+            size_t len;
+            if (!input.next(&data, &len)) {
+                ok = false;
+                break;
+            }
+            read += len;
+
+            // an empty window still goes through, to push out text the
+            // transcoder is holding back
+            size_t pos = 0;
+            for (;;) {
+                TextCodec::ConversionResult r = transcoder.transcode(out.data() + used, out.size() - used,
+                                                                     data + pos, len - pos);
+                pos += r.consumed;
+                used += r.produced;
+                if (r.status != TextCodec::ConversionOutputFull)
+                    break;
+                ok = output.write(&out[0], used);
+                written += used;
+                used = 0;
+                if (!ok)
+                    break;
+            }
+            if (!ok || !len)
+                break;
+        }
+        ok = ok && output.write(&out[0], used);
+        written += used;
+        ok = output.close() && ok;
+
+        if (stats) {
+            stats->bytesRead = read;
+            stats->bytesWritten = written;
+            stats->mapped = input.isMapped();
+            stats->hasFailure = transcoder.hasFailure();
+        }
+        return ok;
+    }
+}
@@ -0,0 +1,32 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTFILE_H
+#define TEXTFILE_H
+
+#include <string>
+#include "textcodec.h"
+namespace zdytool {
+    struct TranscodeStats {
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+        bool mapped;
+        bool hasFailure;
+    };
+
+    bool transcodeFile(const std::basic_string<char> &srcPath, const TextCodec *srcCodec,
+                       const std::basic_string<char> &dstPath, const TextCodec *dstCodec,
+                       TextCodec::ConversionFlags flags = TextCodec::DefaultConversion,
+                       TranscodeStats *stats = nullptr);
+}
+#endif // TEXTFILE_H
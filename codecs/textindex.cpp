@@ -0,0 +1,416 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textindex.h"
+#include "textcodec_p.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace zdytool {
+
+    namespace {
+        enum {
+            // keeps the scratch buffer of add() and the index file small
+            MinInterval = 64,
+            ScratchSize = 4096,
+            FileVersion = 1
+        };
+
+        const char fileMagic[4] = { 'T', 'C', 'D', 'I' };
+
+        const size_t RecordSize = 2 * 8 + 2 * 4 + TextCodec::ConverterState::StateDataSize * 4;
+
+        // the index file is little endian whatever the host is
+        void putU32(string *out, uint32_t v) {
+            for (int i = 0; i < 4; ++i)
+                out->push_back(char(v >> (8 * i)));
+        }
+
+        void putU64(string *out, uint64_t v) {
+            for (int i = 0; i < 8; ++i)
+                out->push_back(char(v >> (8 * i)));
+        }
+
+        uint32_t getU32(const uchar *&p) {
+            uint32_t v = 0;
+            for (int i = 0; i < 4; ++i)
+                v |= uint32_t(*p++) << (8 * i);
+            return v;
+        }
+
+        uint64_t getU64(const uchar *&p) {
+            uint64_t v = 0;
+            for (int i = 0; i < 8; ++i)
+                v |= uint64_t(*p++) << (8 * i);
+            return v;
+        }
+
+        void putRecord(string *out, const DecodeIndex::Checkpoint &cp) {
+            putU64(out, cp.byteOffset);
+            putU64(out, cp.utf16Offset);
+            putU32(out, uint32_t(cp.flags));
+            putU32(out, uint32_t(cp.remainingChars));
+            for (int i = 0; i < TextCodec::ConverterState::StateDataSize; ++i)
+                putU32(out, cp.stateData[i]);
+        }
+
+        void getRecord(const uchar *&p, DecodeIndex::Checkpoint *cp) {
+            cp->byteOffset = getU64(p);
+            cp->utf16Offset = getU64(p);
+            cp->flags = TextCodec::ConversionFlags(getU32(p) & ~TextCodec::FreeFunction);
+            cp->remainingChars = int(getU32(p));
+            for (int i = 0; i < TextCodec::ConverterState::StateDataSize; ++i)
+                cp->stateData[i] = getU32(p);
+        }
+    }
+
+/*!
+    \class DecodeIndex
+    \brief The DecodeIndex class maps offsets in decoded text to offsets in the encoded bytes.
+
+    The index is built in one pass over the encoded data, which is passed
+    to add() in chunks of any size. Every interval() UTF-16 units, or a
+    character later when a surrogate pair or a pending sequence is in the
+    way, it records a checkpoint: the byte offset of a character, the
+    UTF-16 offset of its text and a snapshot of the converter state there.
+    Any range of the text can then be decoded by restoring the nearest
+    checkpoint before it and decoding from its byte offset, which reads at
+    most about interval() characters that are not wanted.
+
+    \code
+    DecodeIndex index(codec);
+    if (!index.load(path + ".idx")) {
+        index.add(data, size);
+        index.save(path + ".idx");
+    }
+    std::basic_string<uint16_t> page = index.decode(data, size, first, count);
+    \endcode
+
+    The index can be saved next to the file it indexes and loaded when the
+    file is opened again. It keeps the converter state at the end of the
+    data, so if the file has grown since, the new bytes can be passed to
+    add() after load(). byteCount() tells how many bytes were indexed.
+
+    Codecs that keep their state outside ConverterState::state_data cannot
+    be indexed.
+
+    \sa TextDecoder
+*/
+
+/*!
+    \class DecodeIndex::Checkpoint
+    \brief A point at which decoding can start.
+
+    \a byteOffset is the offset of the first byte of a character and
+    \a utf16Offset the offset of its first UTF-16 unit. \a flags,
+    \a remainingChars and \a stateData are the converter state there,
+    which restore() loads into a ConverterState.
+*/
+
+/*!
+    Constructs an empty index for data encoded with \a codec, decoded using
+    the conversion \a flags, that records a checkpoint every \a interval
+    UTF-16 units.
+*/
+    DecodeIndex::DecodeIndex(const TextCodec *codec, TextCodec::ConversionFlags flags, size_t interval)
+            : c(nullptr), step(0), bytes(0), units(0), nextCheckpoint(0) {
+        reset(codec, flags, interval);
+    }
+
+/*!
+    Destroys the index.
+*/
+    DecodeIndex::~DecodeIndex() {
+    }
+
+/*!
+    \fn const TextCodec *DecodeIndex::codec() const
+
+    Returns the codec the index was built with.
+*/
+
+/*!
+    \fn size_t DecodeIndex::interval() const
+
+    Returns the number of UTF-16 units between checkpoints.
+*/
+
+/*!
+    Indexes the next \a len bytes at \a chars. Returns false if the index
+    has no codec, or the codec's state cannot be recorded or its output
+    cannot be taken in pieces.
+*/
+    bool DecodeIndex::add(const char *chars, size_t len) {
+        if (!c || (state.flags & TextCodec::FreeFunction) || state.d)
+            return false;
+        ushort scratch[ScratchSize];
+        while (len) {
+            const uint64_t toCheckpoint = nextCheckpoint - units;
+            const bool limited = toCheckpoint <= ScratchSize;
+            const size_t room = limited ? size_t(toCheckpoint) : size_t(ScratchSize);
+            TextCodec::ConversionResult r = c->toUnicode(scratch, room, chars, len, &state);
+            chars += r.consumed;
+            len -= r.consumed;
+            bytes += r.consumed;
+            units += r.produced;
+            if (r.status != TextCodec::ConversionOutputFull)
+                continue;
+            if (!limited) {
+                // a codec that cannot resume
+                if (!r.consumed && !r.produced)
+                    return false;
+                continue;
+            }
+            if (state.remainingChars == 0) {
+                checkpoints.push_back(snapshot());
+                nextCheckpoint = units + step;
+            } else if (toCheckpoint > 2) {
+                // stopped in front of a character whose bytes are split
+                // across chunks; take the checkpoint after it
+                nextCheckpoint = units + 2;
+            } else {
+                nextCheckpoint = units + step;
+            }
+        }
+        return true;
+    }
+
+/*!
+    \fn uint64_t DecodeIndex::byteCount() const
+
+    Returns the number of bytes indexed.
+*/
+
+/*!
+    \fn uint64_t DecodeIndex::utf16Count() const
+
+    Returns the number of UTF-16 units the indexed bytes decode to, not
+    counting a sequence that is cut off at the end.
+*/
+
+/*!
+    \fn size_t DecodeIndex::checkpointCount() const
+
+    Returns the number of checkpoints. There is always one, at the start.
+*/
+
+/*!
+    \fn const DecodeIndex::Checkpoint &DecodeIndex::checkpoint(size_t i) const
+
+    Returns checkpoint \a i. The checkpoints are in order of their offsets.
+*/
+
+/*!
+    Returns the last checkpoint at or before the UTF-16 offset
+    \a utf16Offset.
+*/
+    const DecodeIndex::Checkpoint &DecodeIndex::checkpointFor(uint64_t utf16Offset) const {
+        std::vector<Checkpoint>::const_iterator it =
+                std::upper_bound(checkpoints.begin(), checkpoints.end(), utf16Offset,
+                                 [](uint64_t offset, const Checkpoint &cp) { return offset < cp.utf16Offset; });
+        return *(it - 1);
+    }
+
+/*!
+    Loads the converter state recorded in \a checkpoint into \a state, to
+    decode the bytes from the checkpoint's byte offset on.
+*/
+    void DecodeIndex::restore(const Checkpoint &checkpoint, TextCodec::ConverterState *state) {
+        state->clear();
+        state->flags = checkpoint.flags;
+        state->remainingChars = checkpoint.remainingChars;
+        memcpy(state->state_data, checkpoint.stateData, sizeof(state->state_data));
+    }
+
+/*!
+    Returns the offset of the first byte of the character that contains
+    the UTF-16 unit at \a utf16Offset. \a data points at the \a size bytes
+    that were indexed.
+
+    At most interval() units are decoded to find it. If \a utf16Offset is
+    at or past the end of the text, byteCount() is returned.
+*/
+    uint64_t DecodeIndex::byteOffset(const char *data, size_t size, uint64_t utf16Offset) const {
+        if (utf16Offset >= units || !c)
+            return bytes;
+        const Checkpoint &cp = checkpointFor(utf16Offset);
+        size_t left = size_t(utf16Offset - cp.utf16Offset);
+        if (!left || cp.byteOffset > size)
+            return cp.byteOffset;
+        const char *const begin = data + cp.byteOffset;
+        const size_t avail = size - size_t(cp.byteOffset);
+        ushort scratch[ScratchSize];
+        TextCodec::ConverterState st;
+        restore(cp, &st);
+        TextCodec::ConversionResult r;
+        size_t pos = 0;
+        // decoding stops in front of the first character that does not fit,
+        // or already when less room than a surrogate pair is left
+        while (left >= 2 && pos < avail) {
+            r = c->toUnicode(scratch, std::min<size_t>(left, ScratchSize), begin + pos, avail - pos, &st);
+            pos += r.consumed;
+            left -= r.produced;
+            if (r.status != TextCodec::ConversionOutputFull)
+                break;
+        }
+        // one unit to go: codecs that write surrogate pairs want room for
+        // two, so ask those for a single code point instead
+        if (left == 1 && pos < avail) {
+            r = c->toUnicode(scratch, 1, begin + pos, avail - pos, &st);
+            if (r.produced) {
+                pos += r.consumed;
+            } else {
+                char32_t ucs;
+                r = c->toUcs4(&ucs, 1, begin + pos, avail - pos, &st);
+                if (r.produced && !UCS4Tool::requiresSurrogates(ucs))
+                    pos += r.consumed;
+            }
+        }
+        return cp.byteOffset + pos;
+    }
+
+/*!
+    Decodes up to \a length UTF-16 units of text starting at the offset
+    \a utf16Offset. \a data points at the \a size bytes that were indexed.
+
+    Only the bytes from the checkpoint before \a utf16Offset to the end of
+    the range are decoded. The range may start or end in the middle of a
+    surrogate pair.
+*/
+    u16string DecodeIndex::decode(const char *data, size_t size, uint64_t utf16Offset, size_t length) const {
+        u16string result;
+        if (utf16Offset >= units || !length || !c)
+            return result;
+        const Checkpoint &cp = checkpointFor(utf16Offset);
+        if (cp.byteOffset > size)
+            return result;
+        const size_t skip = size_t(utf16Offset - cp.utf16Offset);
+        length = size_t(std::min<uint64_t>(length, units - utf16Offset));
+        // one more unit, so that a surrogate pair at the end of the range fits
+        result.resize(skip + length + 1);
+        TextCodec::ConverterState st;
+        restore(cp, &st);
+        TextCodec::ConversionResult r = c->toUnicode(&result[0], result.size(), data + cp.byteOffset,
+                                                     size - size_t(cp.byteOffset), &st);
+        result.resize(std::min(r.produced, skip + length));
+        result.erase(0, std::min(skip, result.size()));
+        return result;
+    }
+
+/*!
+    Writes the index to the file at \a path. Returns false if the index has
+    no codec or the file cannot be written.
+*/
+    bool DecodeIndex::save(const string &path) const {
+        if (!c)
+            return false;
+        const string name = c->name();
+        string out(fileMagic, sizeof(fileMagic));
+        putU32(&out, FileVersion);
+        putU32(&out, uint32_t(name.size()));
+        out += name;
+        putU64(&out, step);
+        putRecord(&out, snapshot());
+        putU64(&out, checkpoints.size());
+        for (size_t i = 0; i < checkpoints.size(); ++i)
+            putRecord(&out, checkpoints[i]);
+
+        FILE *file = std::fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+        ok = std::fclose(file) == 0 && ok;
+        return ok;
+    }
+
+/*!
+    Replaces the index with the one in the file at \a path. Returns false,
+    leaving the index empty, if the file cannot be read, is not an index
+    file, or names a codec that is not available.
+*/
+    bool DecodeIndex::load(const string &path) {
+        reset(nullptr, TextCodec::DefaultConversion, DefaultInterval);
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        string in;
+        char buf[ScratchSize];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0)
+            in.append(buf, n);
+        const bool readOk = !std::ferror(file);
+        std::fclose(file);
+
+        const uchar *p = reinterpret_cast<const uchar *>(in.data());
+        const uchar *const end = p + in.size();
+        if (!readOk || end - p < 12 || memcmp(p, fileMagic, sizeof(fileMagic)) != 0)
+            return false;
+        p += sizeof(fileMagic);
+        if (getU32(p) != FileVersion)
+            return false;
+        const uint32_t nameLength = getU32(p);
+        if (size_t(end - p) < size_t(nameLength) + 8 + RecordSize + 8)
+            return false;
+        const TextCodec *codec = TextCodec::codecForName(string(reinterpret_cast<const char *>(p), nameLength));
+        p += nameLength;
+        const uint64_t interval = getU64(p);
+        Checkpoint tail;
+        getRecord(p, &tail);
+        const uint64_t count = getU64(p);
+        if (!codec || interval < MinInterval || interval > SIZE_MAX || !count
+            || count != uint64_t(end - p) / RecordSize || uint64_t(end - p) % RecordSize)
+            return false;
+
+        std::vector<Checkpoint> loaded(static_cast<size_t>(count));
+        for (size_t i = 0; i < loaded.size(); ++i) {
+            getRecord(p, &loaded[i]);
+            const Checkpoint &prev = i ? loaded[i - 1] : loaded[0];
+            if (i ? (loaded[i].byteOffset <= prev.byteOffset || loaded[i].utf16Offset <= prev.utf16Offset)
+                  : (loaded[i].byteOffset || loaded[i].utf16Offset))
+                return false;
+        }
+        if (tail.byteOffset < loaded.back().byteOffset || tail.utf16Offset < loaded.back().utf16Offset)
+            return false;
+
+        reset(codec, tail.flags, size_t(interval));
+        restore(tail, &state);
+        bytes = tail.byteOffset;
+        units = tail.utf16Offset;
+        nextCheckpoint = std::max(loaded.back().utf16Offset + step, units);
+        checkpoints.swap(loaded);
+        return true;
+    }
+
+    void DecodeIndex::reset(const TextCodec *codec, TextCodec::ConversionFlags flags, size_t interval) {
+        c = codec;
+        step = std::max<size_t>(interval, MinInterval);
+        state.clear();
+        state.flags = flags;
+        bytes = 0;
+        units = 0;
+        nextCheckpoint = step;
+        checkpoints.clear();
+        checkpoints.push_back(snapshot());
+    }
+
+    DecodeIndex::Checkpoint DecodeIndex::snapshot() const {
+        Checkpoint cp;
+        cp.byteOffset = bytes;
+        cp.utf16Offset = units;
+        cp.flags = TextCodec::ConversionFlags(state.flags & ~TextCodec::FreeFunction);
+        cp.remainingChars = state.remainingChars;
+        memcpy(cp.stateData, state.state_data, sizeof(cp.stateData));
+        return cp;
+    }
+}
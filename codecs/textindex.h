@@ -0,0 +1,83 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTINDEX_H
+#define TEXTINDEX_H
+
+#include <string>
+#include <vector>
+#include "textcodec.h"
+namespace zdytool {
+    class DecodeIndex {
+    public:
+        enum { DefaultInterval = 64 * 1024 };
+
+        struct Checkpoint {
+            uint64_t byteOffset;
+            uint64_t utf16Offset;
+            TextCodec::ConversionFlags flags;
+            int remainingChars;
+            unsigned int stateData[TextCodec::ConverterState::StateDataSize];
+        };
+
+        explicit DecodeIndex(const TextCodec *codec = nullptr,
+                             TextCodec::ConversionFlags flags = TextCodec::DefaultConversion,
+                             size_t interval = DefaultInterval);
+
+        ~DecodeIndex();
+
+        const TextCodec *codec() const { return c; }
+
+        size_t interval() const { return step; }
+
+        bool add(const char *chars, size_t len);
+
+        uint64_t byteCount() const { return bytes; }
+
+        uint64_t utf16Count() const { return units; }
+
+        size_t checkpointCount() const { return checkpoints.size(); }
+
+        const Checkpoint &checkpoint(size_t i) const { return checkpoints[i]; }
+
+        const Checkpoint &checkpointFor(uint64_t utf16Offset) const;
+
+        static void restore(const Checkpoint &checkpoint, TextCodec::ConverterState *state);
+
+        uint64_t byteOffset(const char *data, size_t size, uint64_t utf16Offset) const;
+
+        std::basic_string<uint16_t> decode(const char *data, size_t size, uint64_t utf16Offset, size_t length) const;
+
+        bool save(const std::basic_string<char> &path) const;
+
+        bool load(const std::basic_string<char> &path);
+
+    private:
+        const TextCodec *c;
+        size_t step;
+        TextCodec::ConverterState state;
+        uint64_t bytes;
+        uint64_t units;
+        uint64_t nextCheckpoint;
+        std::vector<Checkpoint> checkpoints;
+
+        void reset(const TextCodec *codec, TextCodec::ConversionFlags flags, size_t interval);
+
+        Checkpoint snapshot() const;
+
+        DecodeIndex(const DecodeIndex &) = delete;
+
+        DecodeIndex &operator=(const DecodeIndex &) = delete;
+    };
+}
+#endif // TEXTINDEX_H
@@ -0,0 +1,103 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textkernels.h"
+
+namespace zdytool {
+
+/*!
+    \namespace kernels
+    \brief The kernels namespace holds conversion loops that are compiled for one encoding.
+
+    TextCodec converts through virtual functions and picks its encoding at
+    run time. When the encoding is known at compile time, the function
+    templates in this namespace do the same conversion with the encoding
+    given as a tag type: Utf8Tag, Latin1Tag, Gb18030Tag, Big5Tag,
+    EucJpTag, EucKrTag or SjisTag. The loop is instantiated in the caller,
+    ASCII is handled inline and the other characters go straight to the
+    tables the codec uses, so there is no virtual call per buffer or per
+    character and the compiler can inline the loop into a parser.
+
+    Each tag gives its codec's name() and \c MibEnum, so
+    TextCodec::codecForName(Tag::name()) finds the codec that converts the
+    same way. decode() gives what the stateless TextCodec::toUnicode() of
+    that codec gives, and encode() what TextCodec::fromUnicode() gives,
+    with '?' for characters the encoding has no bytes for. Conversions that
+    continue across buffers, or that need conversion flags, should use a
+    TextDecoder or TextEncoder.
+
+    \code
+    std::basic_string<uint16_t> text;
+    kernels::decode<kernels::Gb18030Tag>(bytes, text);
+    \endcode
+
+    \sa CodePointIterator
+*/
+
+/*!
+    \fn size_t kernels::maxDecodedLength(size_t len)
+
+    Returns the number of UTF-16 units decode() may write for \a len bytes.
+*/
+
+/*!
+    \fn size_t kernels::maxEncodedLength(size_t len)
+
+    Returns the number of bytes encode() may write for \a len UTF-16 units.
+*/
+
+/*!
+    \fn size_t kernels::decode(const char *in, size_t len, uint16_t *out, size_t *consumed)
+
+    Decodes the \a len bytes at \a in with the encoding \c Tag into
+    \a out, which must have room for maxDecodedLength() units, and returns
+    the number of units written. A byte order mark at the start of \a in
+    is skipped.
+
+    A character cut off by the end of the input is not decoded. If
+    \a consumed is not null, it is set to the number of bytes decoded, so
+    that the rest can be put in front of the next buffer. A stream decoded
+    that way gives what the stateless TextCodec::toUnicode() gives for all
+    of it, however it is split.
+*/
+
+/*!
+    \fn size_t kernels::decode(const std::basic_string<char> &in, std::basic_string<uint16_t> &out)
+    \overload
+
+    Appends the decoded \a in to \a out and returns the number of bytes
+    decoded.
+*/
+
+/*!
+    \fn size_t kernels::encode(const uint16_t *in, size_t len, char *out, size_t *consumed)
+
+    Encodes the \a len UTF-16 units at \a in with the encoding \c Tag into
+    \a out, which must have room for maxEncodedLength() bytes, and returns
+    the number of bytes written.
+
+    A surrogate at the end of the input that the codec would keep for the
+    next call is not encoded: a high surrogate for the encodings that take
+    surrogate pairs, and for UTF-8 a low surrogate too. If \a consumed is
+    not null, it is set to the number of units encoded, so that the rest
+    can be put in front of the next buffer.
+*/
+
+/*!
+    \fn size_t kernels::encode(const std::basic_string<uint16_t> &in, std::basic_string<char> &out)
+    \overload
+
+    Appends the encoded \a in to \a out and returns the number of units
+    encoded.
+*/
+}
@@ -0,0 +1,212 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTKERNELS_H
+#define TEXTKERNELS_H
+
+#include <cstddef>
+#include <string>
+#include "textcodepoints.h"
+namespace zdytool {
+    namespace kernels {
+        struct Utf8Tag : Utf8CodePoints {
+            enum { MibEnum = 106, MaxBytesPerUnit = 3 };
+
+            static const char *name() { return "UTF-8"; }
+
+            static char32_t next(const unsigned char *&src, const unsigned char *end) {
+                if (Z_LIKELY(*src < 0x80))
+                    return *src++;
+                return nextMultibyte(src, end);
+            }
+
+            static char32_t nextMultibyte(const unsigned char *&src, const unsigned char *end);
+
+            static int encode(const uint16_t *&src, const uint16_t *end, unsigned char *dst) {
+                if (Z_LIKELY(*src < 0x80)) {
+                    *dst = static_cast<unsigned char>(*src++);
+                    return 1;
+                }
+                return encodeMultibyte(src, end, dst);
+            }
+
+            static int encodeMultibyte(const uint16_t *&src, const uint16_t *end, unsigned char *dst);
+        };
+
+        struct Latin1Tag : Latin1CodePoints {
+            enum { MibEnum = 4, MaxBytesPerUnit = 1 };
+
+            static const char *name() { return "ISO-8859-1"; }
+
+            static int encode(const uint16_t *&src, const uint16_t *, unsigned char *dst) {
+                const uint16_t ch = *src++;
+                *dst = ch > 0xff ? '?' : static_cast<unsigned char>(ch);
+                return 1;
+            }
+        };
+
+#ifndef Z_NO_BIG_TEXTCODECS
+        struct Gb18030Tag : Gb18030CodePoints {
+            enum { MibEnum = 114, MaxBytesPerUnit = 4 };
+
+            static const char *name() { return "GB18030"; }
+
+            static int encode(const uint16_t *&src, const uint16_t *end, unsigned char *dst) {
+                if (Z_LIKELY(*src < 0x80)) {
+                    *dst = static_cast<unsigned char>(*src++);
+                    return 1;
+                }
+                return encodeMultibyte(src, end, dst);
+            }
+
+            static int encodeMultibyte(const uint16_t *&src, const uint16_t *end, unsigned char *dst);
+        };
+
+        struct Big5Tag : Big5CodePoints {
+            enum { MibEnum = 2026, MaxBytesPerUnit = 2 };
+
+            static const char *name() { return "Big5"; }
+
+            static int encode(const uint16_t *&src, const uint16_t *end, unsigned char *dst) {
+                if (Z_LIKELY(*src < 0x80)) {
+                    *dst = static_cast<unsigned char>(*src++);
+                    return 1;
+                }
+                return encodeMultibyte(src, end, dst);
+            }
+
+            static int encodeMultibyte(const uint16_t *&src, const uint16_t *end, unsigned char *dst);
+        };
+
+        struct EucJpTag : EucJpCodePoints {
+            enum { MibEnum = 18, MaxBytesPerUnit = 3 };
+
+            static const char *name() { return "EUC-JP"; }
+
+            static int encode(const uint16_t *&src, const uint16_t *end, unsigned char *dst) {
+                if (Z_LIKELY(*src < 0x80)) {
+                    *dst = static_cast<unsigned char>(*src++);
+                    return 1;
+                }
+                return encodeMultibyte(src, end, dst);
+            }
+
+            static int encodeMultibyte(const uint16_t *&src, const uint16_t *end, unsigned char *dst);
+        };
+
+        struct EucKrTag : EucKrCodePoints {
+            enum { MibEnum = 38, MaxBytesPerUnit = 2 };
+
+            static const char *name() { return "EUC-KR"; }
+
+            static int encode(const uint16_t *&src, const uint16_t *end, unsigned char *dst) {
+                if (Z_LIKELY(*src < 0x80)) {
+                    *dst = static_cast<unsigned char>(*src++);
+                    return 1;
+                }
+                return encodeMultibyte(src, end, dst);
+            }
+
+            static int encodeMultibyte(const uint16_t *&src, const uint16_t *end, unsigned char *dst);
+        };
+
+        struct SjisTag : SjisCodePoints {
+            enum { MibEnum = 17, MaxBytesPerUnit = 2 };
+
+            static const char *name() { return "Shift_JIS"; }
+
+            static int encode(const uint16_t *&src, const uint16_t *end, unsigned char *dst) {
+                if (Z_LIKELY(*src < 0x80)) {
+                    *dst = static_cast<unsigned char>(*src++);
+                    return 1;
+                }
+                return encodeMultibyte(src, end, dst);
+            }
+
+            static int encodeMultibyte(const uint16_t *&src, const uint16_t *end, unsigned char *dst);
+        };
+#endif // Z_NO_BIG_TEXTCODECS
+
+        template <typename Tag>
+        inline size_t maxDecodedLength(size_t len) {
+            return len;
+        }
+
+        template <typename Tag>
+        inline size_t maxEncodedLength(size_t len) {
+            return len * Tag::MaxBytesPerUnit;
+        }
+
+        template <typename Tag>
+        size_t decode(const char *in, size_t len, uint16_t *out, size_t *consumed = nullptr) {
+            const unsigned char *const begin = reinterpret_cast<const unsigned char *>(in);
+            const unsigned char *const end = begin + len;
+            const unsigned char *src = Tag::skipHeader(begin, end);
+            uint16_t *dst = out;
+            while (src != end) {
+                const unsigned char *next = src;
+                const char32_t uc = Tag::next(next, end);
+                // a truncated sequence is left for the caller
+                if (Z_UNLIKELY(uc == Tag::Incomplete))
+                    break;
+                src = next;
+                if (Z_LIKELY(uc < 0x10000)) {
+                    *dst++ = static_cast<uint16_t>(uc);
+                } else {
+                    *dst++ = static_cast<uint16_t>((uc >> 10) + 0xd7c0);
+                    *dst++ = static_cast<uint16_t>((uc & 0x3ff) | 0xdc00);
+                }
+            }
+            if (consumed)
+                *consumed = src - begin;
+            return dst - out;
+        }
+
+        template <typename Tag>
+        size_t decode(const std::basic_string<char> &in, std::basic_string<uint16_t> &out) {
+            const size_t offset = out.size();
+            size_t consumed = 0;
+            out.resize(offset + maxDecodedLength<Tag>(in.size()));
+            out.resize(offset + decode<Tag>(in.data(), in.size(), &out[0] + offset, &consumed));
+            return consumed;
+        }
+
+        template <typename Tag>
+        size_t encode(const uint16_t *in, size_t len, char *out, size_t *consumed = nullptr) {
+            const uint16_t *src = in;
+            const uint16_t *const end = in + len;
+            unsigned char *const begin = reinterpret_cast<unsigned char *>(out);
+            unsigned char *dst = begin;
+            while (src != end) {
+                const int n = Tag::encode(src, end, dst);
+                // a surrogate at the end is left for the caller
+                if (Z_UNLIKELY(n == 0))
+                    break;
+                dst += n;
+            }
+            if (consumed)
+                *consumed = src - in;
+            return dst - begin;
+        }
+
+        template <typename Tag>
+        size_t encode(const std::basic_string<uint16_t> &in, std::basic_string<char> &out) {
+            const size_t offset = out.size();
+            size_t consumed = 0;
+            out.resize(offset + maxEncodedLength<Tag>(in.size()));
+            out.resize(offset + encode<Tag>(in.data(), in.size(), &out[0] + offset, &consumed));
+            return consumed;
+        }
+    }
+}
+#endif // TEXTKERNELS_H
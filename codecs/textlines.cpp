@@ -0,0 +1,170 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textlines.h"
+#include "textcodec_p.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace zdytool {
+
+    // input is decoded this many bytes at a time and the new text searched
+    // for line breaks while it is still in the cache
+    static const size_t LineDecoderBlock = 4096;
+
+    static inline bool isLineBreak(ushort u) {
+        return u == '\n' || (u & 0xfffe) == 0x2028;
+    }
+
+    // true if one of the four units in \a data may be a line break
+    static inline bool mayHaveLineBreak(uint64_t data) {
+        const uint64_t ones = 0x0001000100010001ULL;
+        const uint64_t highs = 0x8000800080008000ULL;
+        const uint64_t lf = data ^ 0x000a000a000a000aULL;
+        const uint64_t ls = (data & 0xfffefffefffefffeULL) ^ 0x2028202820282028ULL;
+        return (((lf - ones) & ~lf) | ((ls - ones) & ~ls)) & highs;
+    }
+
+/*!
+    \class LineDecoder
+    \brief The LineDecoder class decodes a byte stream into lines.
+
+    Chunks of input are passed to decode(), which hands back every line
+    they complete. A line ends at a line feed, a carriage return and line
+    feed pair, a line separator (U+2028) or a paragraph separator (U+2029);
+    the break itself is not part of the line. Text after the last break,
+    and bytes of a sequence that is cut off at the end of a chunk, are kept
+    for the next call.
+
+    The lines are handed back as views into a buffer the decoder reuses,
+    and are valid until the next call to decode(), finish() or reset().
+    The input is decoded a few kilobytes at a time and each block is
+    searched for line breaks, four characters per step, right after it
+    has been decoded.
+
+    \code
+    std::vector<LineDecoder::Line> lines;
+    while ((n = read(fd, buf, sizeof buf)) > 0) {
+        lines.clear();
+        decoder.decode(buf, n, &lines);
+        for (const LineDecoder::Line &line : lines)
+            handle(line.data, line.length);
+    }
+    \endcode
+
+    \sa TextDecoder
+*/
+
+/*!
+    \class LineDecoder::Line
+    \brief A view of one decoded line.
+
+    \a data points at the first of \a length UTF-16 units.
+*/
+
+/*!
+    Constructs a line decoder that decodes with \a codec using the
+    conversion \a flags.
+*/
+    LineDecoder::LineDecoder(const TextCodec *codec, TextCodec::ConversionFlags flags)
+            : decoder(codec, flags), lineStart(0) {
+    }
+
+/*!
+    Destroys the line decoder.
+*/
+    LineDecoder::~LineDecoder() {
+    }
+
+/*!
+    Decodes the \a len bytes at \a chars and appends the lines they
+    complete to \a lines.
+*/
+    void LineDecoder::decode(const char *chars, size_t len, std::vector<Line> *lines) {
+        // drop the lines handed out last time, keep the one still open
+        if (lineStart) {
+            buffer.erase(0, lineStart);
+            lineStart = 0;
+        }
+        const size_t first = lines->size();
+        starts.clear();
+        size_t pos = 0;
+        while (pos < len) {
+            const size_t take = std::min(len - pos, LineDecoderBlock);
+            const size_t from = buffer.size();
+            decoder.toUnicode(&buffer, chars + pos, take);
+            pos += take;
+            scan(from, lines);
+        }
+        // the buffer may have moved while it grew
+        for (size_t i = 0; i < starts.size(); ++i)
+            (*lines)[first + i].data = buffer.data() + starts[i];
+    }
+
+/*!
+    Appends the text after the last line break to \a lines, if there is
+    any, as the final line of the stream.
+*/
+    void LineDecoder::finish(std::vector<Line> *lines) {
+        if (lineStart < buffer.size()) {
+            Line line = { buffer.data() + lineStart, buffer.size() - lineStart };
+            lines->push_back(line);
+            lineStart = buffer.size();
+        }
+    }
+
+/*!
+    Drops the open line and the decoder state, to start on a new stream.
+*/
+    void LineDecoder::reset() {
+        decoder.reset();
+        buffer.clear();
+        lineStart = 0;
+    }
+
+/*!
+    \fn bool LineDecoder::hasFailure() const
+
+    Returns true if invalid input was found while decoding.
+*/
+
+    void LineDecoder::scan(size_t from, std::vector<Line> *lines) {
+        const ushort *text = buffer.data();
+        const size_t end = buffer.size();
+        size_t i = from;
+        for (;;) {
+            while (end - i >= 4) {
+                uint64_t data;
+                memcpy(&data, text + i, sizeof(data));
+                if (mayHaveLineBreak(data))
+                    break;
+                i += 4;
+            }
+            const size_t stop = std::min(end, i + 4);
+            for (; i < stop; ++i) {
+                if (!isLineBreak(text[i]))
+                    continue;
+                size_t lineEnd = i;
+                if (text[i] == '\n' && lineEnd > lineStart && text[lineEnd - 1] == '\r')
+                    --lineEnd;
+                Line line = { nullptr, lineEnd - lineStart };
+                lines->push_back(line);
+                starts.push_back(lineStart);
+                lineStart = i + 1;
+            }
+            if (i == end)
+                break;
+        }
+    }
+}
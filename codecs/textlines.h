@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTLINES_H
+#define TEXTLINES_H
+
+#include <string>
+#include <vector>
+#include "textcodec.h"
+namespace zdytool {
+    class LineDecoder {
+    public:
+        struct Line {
+            const uint16_t *data;
+            size_t length;
+        };
+
+        explicit LineDecoder(const TextCodec *codec, TextCodec::ConversionFlags flags = TextCodec::DefaultConversion);
+
+        ~LineDecoder();
+
+        const TextCodec *codec() const { return decoder.codec(); }
+
+        void decode(const char *chars, size_t len, std::vector<Line> *lines);
+
+        void finish(std::vector<Line> *lines);
+
+        void reset();
+
+        bool hasFailure() const { return decoder.hasFailure(); }
+
+    private:
+        TextDecoder decoder;
+        std::basic_string<uint16_t> buffer;
+        size_t lineStart;
+        std::vector<size_t> starts;
+
+        void scan(size_t from, std::vector<Line> *lines);
+
+        LineDecoder(const LineDecoder &) = delete;
+
+        LineDecoder &operator=(const LineDecoder &) = delete;
+    };
+}
+#endif // TEXTLINES_H
@@ -0,0 +1,220 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textpipeline.h"
+#include "textcodec_p.h"
+
+#include <thread>
+
+namespace zdytool {
+    // how often push() and pop() yield before they go to sleep
+    enum { PipelineSpinCount = 64 };
+
+/*!
+    \class PipelinedDecoder
+    \brief The PipelinedDecoder class passes byte chunks to a thread that decodes them.
+
+    One thread, the producer, queues the chunks it reads with push() and
+    ends the stream with finish(). Another thread, the consumer, takes them
+    in order with pop(), which decodes each chunk as it takes it. The
+    conversion thus runs on the consumer's core while the producer goes
+    back to its socket or file, and a single ConverterState is carried from
+    chunk to chunk as if one TextDecoder saw the whole stream.
+
+    The chunks are queued in a fixed ring of slots without locks. A slot
+    keeps its storage when it is reused, so a steady stream of chunks
+    allocates nothing once the slots have grown to the chunk size. A side
+    that finds the ring empty or full yields a few times and then sleeps
+    until the other side signals it, so an idle stream costs no CPU time.
+
+    \code
+    // reader thread
+    while ((n = recv(fd, buf, sizeof buf, 0)) > 0)
+        pipeline.push(buf, n);
+    pipeline.finish();
+
+    // worker thread
+    std::basic_string<uint16_t> text;
+    while (pipeline.pop(&text))
+        handle(text);
+    \endcode
+
+    Only one thread may push and only one thread may pop.
+
+    \sa TextDecoder
+*/
+
+/*!
+    Constructs a pipeline that decodes with \a codec using the conversion
+    \a flags and queues up to \a capacity chunks, rounded up to a power of
+    two.
+*/
+    PipelinedDecoder::PipelinedDecoder(const TextCodec *codec, TextCodec::ConversionFlags flags, size_t capacity)
+            : decoder(codec, flags), mask(0), head(0), tail(0), finished(false), waiters(0) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+/*!
+    Destroys the pipeline. Chunks that were not taken are dropped.
+*/
+    PipelinedDecoder::~PipelinedDecoder() {
+    }
+
+/*!
+    Queues a copy of the \a len bytes at \a chars. Returns false, queueing
+    nothing, if all slots are taken.
+
+    Must only be called by the producer.
+*/
+    bool PipelinedDecoder::tryPush(const char *chars, size_t len) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t & mask].assign(chars, len);
+        tail.store(t + 1, std::memory_order_release);
+        wakeWaiters();
+        return true;
+    }
+
+/*!
+    Queues a copy of the \a len bytes at \a chars, waiting for the consumer
+    to free a slot if all of them are taken. The wait spins briefly and
+    then sleeps.
+
+    Must only be called by the producer.
+*/
+    void PipelinedDecoder::push(const char *chars, size_t len) {
+        for (int spins = 0; !tryPush(chars, len); ++spins) {
+            if (spins < PipelineSpinCount)
+                std::this_thread::yield();
+            else
+                sleepUntil(&PipelinedDecoder::canPush);
+        }
+    }
+
+/*!
+    \fn void PipelinedDecoder::push(const std::basic_string<char> &ba)
+    \overload
+*/
+
+/*!
+    Marks the end of the stream. Once the consumer has taken the chunks
+    queued so far, pop() returns false.
+
+    Must only be called by the producer, after its last push().
+*/
+    void PipelinedDecoder::finish() {
+        finished.store(true, std::memory_order_release);
+        wakeWaiters();
+    }
+
+/*!
+    Takes the next chunk, if one is queued, and stores its decoded text in
+    \a target, replacing what \a target held. Returns false, leaving
+    \a target alone, if no chunk is queued.
+
+    Bytes of a sequence that continues in the next chunk are held back
+    until that chunk is taken.
+
+    Must only be called by the consumer.
+*/
+    bool PipelinedDecoder::tryPop(std::basic_string<uint16_t> *target) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        const std::basic_string<char> &chunk = slots[h & mask];
+        target->clear();
+        decoder.toUnicode(target, chunk.data(), chunk.size());
+        head.store(h + 1, std::memory_order_release);
+        wakeWaiters();
+        return true;
+    }
+
+/*!
+    Takes the next chunk like tryPop(), waiting for the producer if none is
+    queued. The wait spins briefly and then sleeps until push() or
+    finish() is called. Returns false once the producer has called finish() and every
+    chunk has been taken.
+
+    Must only be called by the consumer.
+*/
+    bool PipelinedDecoder::pop(std::basic_string<uint16_t> *target) {
+        for (int spins = 0;; ++spins) {
+            if (tryPop(target))
+                return true;
+            if (finished.load(std::memory_order_acquire))
+                return tryPop(target);
+            if (spins < PipelineSpinCount)
+                std::this_thread::yield();
+            else
+                sleepUntil(&PipelinedDecoder::canPop);
+        }
+    }
+
+/*!
+    \internal
+    Returns true if a slot is free for the producer.
+*/
+    bool PipelinedDecoder::canPush() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) != slots.size();
+    }
+
+/*!
+    \internal
+    Returns true if a chunk or the end of the stream waits for the consumer.
+*/
+    bool PipelinedDecoder::canPop() const {
+        return head.load(std::memory_order_relaxed) != tail.load(std::memory_order_acquire)
+               || finished.load(std::memory_order_acquire);
+    }
+
+/*!
+    \internal
+    Blocks until \a ready returns true. The other side calls wakeWaiters()
+    after every change to the ring, and the fences on both sides make sure
+    that either the waiter sees the change or the other side sees the
+    waiter.
+*/
+    void PipelinedDecoder::sleepUntil(bool (PipelinedDecoder::*ready)() const) {
+        std::unique_lock<std::mutex> locker(waitMutex);
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!(this->*ready)())
+            wakeUp.wait(locker);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+/*!
+    \internal
+    Wakes a side sleeping in sleepUntil(), if there is one. Costs a fence
+    and a load when nobody sleeps.
+*/
+    void PipelinedDecoder::wakeWaiters() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (Z_UNLIKELY(waiters.load(std::memory_order_relaxed))) {
+            std::lock_guard<std::mutex> locker(waitMutex);
+            wakeUp.notify_all();
+        }
+    }
+
+/*!
+    \fn bool PipelinedDecoder::hasFailure() const
+
+    Returns true if invalid input was found in the chunks taken so far.
+    Must only be called by the consumer.
+*/
+}
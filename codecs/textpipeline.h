@@ -0,0 +1,80 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTPIPELINE_H
+#define TEXTPIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "textcodec.h"
+namespace zdytool {
+    class PipelinedDecoder {
+    public:
+        enum { DefaultCapacity = 64 };
+
+        explicit PipelinedDecoder(const TextCodec *codec,
+                                  TextCodec::ConversionFlags flags = TextCodec::DefaultConversion,
+                                  size_t capacity = DefaultCapacity);
+
+        ~PipelinedDecoder();
+
+        const TextCodec *codec() const { return decoder.codec(); }
+
+        size_t capacity() const { return slots.size(); }
+
+        bool tryPush(const char *chars, size_t len);
+
+        void push(const char *chars, size_t len);
+
+        void push(const std::basic_string<char> &ba) { push(ba.data(), ba.size()); }
+
+        void finish();
+
+        bool tryPop(std::basic_string<uint16_t> *target);
+
+        bool pop(std::basic_string<uint16_t> *target);
+
+        bool hasFailure() const { return decoder.hasFailure(); }
+
+    private:
+        TextDecoder decoder;
+        std::vector<std::basic_string<char>> slots;
+        size_t mask;
+        // the producer writes tail and the consumer head; keep them on
+        // cache lines of their own
+        alignas(64) std::atomic<size_t> head;
+        alignas(64) std::atomic<size_t> tail;
+        std::atomic<bool> finished;
+        // a side that finds the ring empty or full sleeps here once it has
+        // spun for a while
+        std::mutex waitMutex;
+        std::condition_variable wakeUp;
+        std::atomic<int> waiters;
+
+        bool canPush() const;
+
+        bool canPop() const;
+
+        void sleepUntil(bool (PipelinedDecoder::*ready)() const);
+
+        void wakeWaiters();
+
+        PipelinedDecoder(const PipelinedDecoder &) = delete;
+
+        PipelinedDecoder &operator=(const PipelinedDecoder &) = delete;
+    };
+}
+#endif // TEXTPIPELINE_H
@@ -0,0 +1,324 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#include "textstreambuf.h"
+#include "textcodec_p.h"
+
+#include <algorithm>
+
+namespace zdytool {
+
+    enum { MinimumBufferSize = 64 };
+
+/*!
+    \class DecodingStreambuf
+    \brief The DecodingStreambuf class reads decoded UTF-16 text from a byte stream.
+
+    The bytes read from the source stream buffer are decoded in large
+    blocks by a TextDecoder, so characters are handed out of the get area
+    without a virtual call for each of them.
+
+    \code
+    std::ifstream file("big5.txt", std::ios::binary);
+    DecodingStreambuf buf(file.rdbuf(), TextCodec::codecForName("Big5"));
+    std::basic_istream<uint16_t> in(&buf);
+    \endcode
+
+    An incomplete sequence at the end of the source is dropped, as it is
+    when a TextDecoder is given no further input.
+
+    \sa EncodingStreambuf, TranscodingStreambuf
+*/
+
+/*!
+    \enum DecodingStreambuf::DefaultBufferSize
+
+    The buffer size, in bytes read and characters decoded, used when none
+    is given.
+*/
+
+/*!
+    Constructs a stream buffer that reads bytes from \a source and decodes
+    them with \a codec using the conversion \a flags. Up to \a bufferSize
+    bytes are read from \a source at a time.
+
+    The source and the codec must outlive the stream buffer.
+*/
+    DecodingStreambuf::DecodingStreambuf(std::streambuf *source, const TextCodec *codec,
+                                         TextCodec::ConversionFlags flags, size_t bufferSize)
+            : source(source), decoder(codec, flags),
+              in(std::max<size_t>(bufferSize, MinimumBufferSize)),
+              out(std::max<size_t>(bufferSize, MinimumBufferSize)),
+              inStart(0), inEnd(0), atEnd(false) {
+    }
+
+/*!
+    Destroys the stream buffer. The source is left open.
+*/
+    DecodingStreambuf::~DecodingStreambuf() {
+    }
+
+/*!
+    \fn bool DecodingStreambuf::hasFailure() const
+
+    Returns true if invalid input was found while decoding.
+
+    \sa TextDecoder::hasFailure()
+*/
+
+/*!
+    \reimp
+
+    Decodes the next block of input into the get area.
+*/
+    DecodingStreambuf::int_type DecodingStreambuf::underflow() {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        for (;;) {
+            if (inStart == inEnd) {
+                if (atEnd)
+                    return traits_type::eof();
+                std::streamsize n = source->sgetn(&in[0], static_cast<std::streamsize>(in.size()));
+                inStart = 0;
+                inEnd = n > 0 ? static_cast<size_t>(n) : 0;
+                if (n <= 0) {
+                    atEnd = true;
+                    return traits_type::eof();
+                }
+            }
+
+            size_t take = inEnd - inStart;
+            TextCodec::ConversionResult r;
+            for (;;) {
+                r = decoder.toUnicode(&out[0], out.size(), &in[inStart], take);
+                // a codec converting through a string hands back all or nothing
+                if (Z_LIKELY(r.consumed || r.produced || take == 1))
+                    break;
+                take /= 2;
+            }
+            inStart += r.consumed;
+            if (r.produced) {
+                setg(&out[0], &out[0], &out[0] + r.produced);
+                return traits_type::to_int_type(out[0]);
+            }
+            if (Z_UNLIKELY(!r.consumed))
+                return traits_type::eof();
+        }
+    }
+
+/*!
+    \class EncodingStreambuf
+    \brief The EncodingStreambuf class encodes UTF-16 text written to it into a byte stream.
+
+    Characters are collected in the put area and encoded in large blocks by
+    a TextEncoder, and the encoded bytes are written to the sink stream
+    buffer. Large writes are encoded directly without going through the put
+    area.
+
+    Call pubsync() or destroy the stream buffer to write out what is still
+    buffered.
+
+    \sa DecodingStreambuf
+*/
+
+/*!
+    \enum EncodingStreambuf::DefaultBufferSize
+
+    The buffer size, in characters collected and bytes encoded, used when
+    none is given.
+*/
+
+/*!
+    Constructs a stream buffer that encodes what is written to it with
+    \a codec using the conversion \a flags, and writes the result to
+    \a sink. Up to \a bufferSize characters are collected before they are
+    encoded.
+
+    The sink and the codec must outlive the stream buffer.
+*/
+    EncodingStreambuf::EncodingStreambuf(std::streambuf *sink, const TextCodec *codec,
+                                         TextCodec::ConversionFlags flags, size_t bufferSize)
+            : sink(sink), encoder(codec, flags),
+              in(std::max<size_t>(bufferSize, MinimumBufferSize)),
+              out(std::max<size_t>(bufferSize, MinimumBufferSize)) {
+        setp(&in[0], &in[0] + in.size());
+    }
+
+/*!
+    Writes out the buffered characters and destroys the stream buffer. The
+    sink is left open.
+*/
+    EncodingStreambuf::~EncodingStreambuf() {
+        sync();
+    }
+
+/*!
+    \fn bool EncodingStreambuf::hasFailure() const
+
+    Returns true if a character could not be represented in the target
+    encoding.
+
+    \sa TextEncoder::hasFailure()
+*/
+
+/*!
+    \reimp
+*/
+    EncodingStreambuf::int_type EncodingStreambuf::overflow(int_type ch) {
+        if (!flushPending())
+            return traits_type::eof();
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        return ch;
+    }
+
+/*!
+    \reimp
+*/
+    std::streamsize EncodingStreambuf::xsputn(const uint16_t *s, std::streamsize n) {
+        if (static_cast<size_t>(n) < in.size())
+            return std::basic_streambuf<uint16_t>::xsputn(s, n);
+        if (!flushPending() || !encode(s, static_cast<size_t>(n)))
+            return 0;
+        return n;
+    }
+
+/*!
+    \reimp
+
+    Encodes the buffered characters, writes them out and syncs the sink.
+*/
+    int EncodingStreambuf::sync() {
+        if (!flushPending())
+            return -1;
+        return sink->pubsync();
+    }
+
+    bool EncodingStreambuf::flushPending() {
+        const size_t n = static_cast<size_t>(pptr() - pbase());
+        setp(&in[0], &in[0] + in.size());
+        return encode(&in[0], n);
+    }
+
+    bool EncodingStreambuf::encode(const uint16_t *uc, size_t len) {
+        size_t pos = 0;
+        while (pos < len) {
+            size_t take = len - pos;
+            TextCodec::ConversionResult r;
+            for (;;) {
+                r = encoder.fromUnicode(&out[0], out.size(), uc + pos, take);
+                if (Z_LIKELY(r.consumed || r.produced || take == 1))
+                    break;
+                take /= 2;
+            }
+            if (r.produced
+                && sink->sputn(&out[0], static_cast<std::streamsize>(r.produced))
+                   != static_cast<std::streamsize>(r.produced))
+                return false;
+            pos += r.consumed;
+            if (Z_UNLIKELY(!r.consumed && !r.produced))
+                return false;
+        }
+        return true;
+    }
+
+/*!
+    \class TranscodingStreambuf
+    \brief The TranscodingStreambuf class reads a byte stream converted into another encoding.
+
+    This is the byte oriented counterpart of DecodingStreambuf: the input is
+    converted by a TextTranscoder, so a stream can for example be read as
+    UTF-8 text through a plain std::istream.
+
+    \code
+    TranscodingStreambuf buf(file.rdbuf(), TextCodec::codecForName("GB18030"),
+                             TextCodec::codecForName("UTF-8"));
+    std::istream in(&buf);
+    std::string line;
+    while (std::getline(in, line))
+        handle(line);
+    \endcode
+
+    \sa DecodingStreambuf
+*/
+
+/*!
+    \enum TranscodingStreambuf::DefaultBufferSize
+
+    The buffer size, in bytes read and bytes produced, used when none is
+    given.
+*/
+
+/*!
+    Constructs a stream buffer that reads bytes in the \a from encoding from
+    \a source and hands them out in the \a to encoding, converting with the
+    given \a flags. Up to \a bufferSize bytes are read at a time.
+
+    The source and the codecs must outlive the stream buffer.
+*/
+    TranscodingStreambuf::TranscodingStreambuf(std::streambuf *source, const TextCodec *from,
+                                               const TextCodec *to, TextCodec::ConversionFlags flags,
+                                               size_t bufferSize)
+            : source(source), transcoder(from, to, flags),
+              in(std::max<size_t>(bufferSize, MinimumBufferSize)),
+              out(std::max<size_t>(bufferSize, MinimumBufferSize)),
+              inStart(0), inEnd(0), atEnd(false) {
+    }
+
+/*!
+    Destroys the stream buffer. The source is left open.
+*/
+    TranscodingStreambuf::~TranscodingStreambuf() {
+    }
+
+/*!
+    \fn bool TranscodingStreambuf::hasFailure() const
+
+    Returns true if invalid input was found or a character could not be
+    represented in the target encoding.
+
+    \sa TextTranscoder::hasFailure()
+*/
+
+/*!
+    \reimp
+*/
+    TranscodingStreambuf::int_type TranscodingStreambuf::underflow() {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        for (;;) {
+            if (inStart == inEnd && !atEnd) {
+                std::streamsize n = source->sgetn(&in[0], static_cast<std::streamsize>(in.size()));
+                inStart = 0;
+                inEnd = n > 0 ? static_cast<size_t>(n) : 0;
+                atEnd = n <= 0;
+            }
+
+            // called even when no input is left, the transcoder may still
+            // hold decoded text that did not fit last time
+            TextCodec::ConversionResult r = transcoder.transcode(&out[0], out.size(),
+                                                                 &in[0] + inStart, inEnd - inStart);
+            inStart += r.consumed;
+            if (r.produced) {
+                setg(&out[0], &out[0], &out[0] + r.produced);
+                return traits_type::to_int_type(out[0]);
+            }
+            if ((atEnd && inStart == inEnd) || Z_UNLIKELY(!r.consumed))
+                return traits_type::eof();
+        }
+    }
+}
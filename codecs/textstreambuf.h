@@ -0,0 +1,113 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef TEXTSTREAMBUF_H
+#define TEXTSTREAMBUF_H
+
+#include <streambuf>
+#include <vector>
+#include "textcodec.h"
+namespace zdytool {
+    class DecodingStreambuf : public std::basic_streambuf<uint16_t> {
+    public:
+        enum { DefaultBufferSize = 65536 };
+
+        DecodingStreambuf(std::streambuf *source, const TextCodec *codec,
+                          TextCodec::ConversionFlags flags = TextCodec::DefaultConversion,
+                          size_t bufferSize = DefaultBufferSize);
+
+        ~DecodingStreambuf();
+
+        bool hasFailure() const { return decoder.hasFailure(); }
+
+    protected:
+        int_type underflow();
+
+    private:
+        std::streambuf *source;
+        TextDecoder decoder;
+        std::vector<char> in;
+        std::vector<uint16_t> out;
+        size_t inStart;
+        size_t inEnd;
+        bool atEnd;
+
+        DecodingStreambuf(const DecodingStreambuf &) = delete;
+
+        DecodingStreambuf &operator=(const DecodingStreambuf &) = delete;
+    };
+
+    class EncodingStreambuf : public std::basic_streambuf<uint16_t> {
+    public:
+        enum { DefaultBufferSize = 65536 };
+
+        EncodingStreambuf(std::streambuf *sink, const TextCodec *codec,
+                          TextCodec::ConversionFlags flags = TextCodec::DefaultConversion,
+                          size_t bufferSize = DefaultBufferSize);
+
+        ~EncodingStreambuf();
+
+        bool hasFailure() const { return encoder.hasFailure(); }
+
+    protected:
+        int_type overflow(int_type ch);
+
+        std::streamsize xsputn(const uint16_t *s, std::streamsize n);
+
+        int sync();
+
+    private:
+        std::streambuf *sink;
+        TextEncoder encoder;
+        std::vector<uint16_t> in;
+        std::vector<char> out;
+
+        bool encode(const uint16_t *uc, size_t len);
+
+        bool flushPending();
+
+        EncodingStreambuf(const EncodingStreambuf &) = delete;
+
+        EncodingStreambuf &operator=(const EncodingStreambuf &) = delete;
+    };
+
+    class TranscodingStreambuf : public std::streambuf {
+    public:
+        enum { DefaultBufferSize = 65536 };
+
+        TranscodingStreambuf(std::streambuf *source, const TextCodec *from, const TextCodec *to,
+                             TextCodec::ConversionFlags flags = TextCodec::DefaultConversion,
+                             size_t bufferSize = DefaultBufferSize);
+
+        ~TranscodingStreambuf();
+
+        bool hasFailure() const { return transcoder.hasFailure(); }
+
+    protected:
+        int_type underflow();
+
+    private:
+        std::streambuf *source;
+        TextTranscoder transcoder;
+        std::vector<char> in;
+        std::vector<char> out;
+        size_t inStart;
+        size_t inEnd;
+        bool atEnd;
+
+        TranscodingStreambuf(const TranscodingStreambuf &) = delete;
+
+        TranscodingStreambuf &operator=(const TranscodingStreambuf &) = delete;
+    };
+}
+#endif // TEXTSTREAMBUF_H
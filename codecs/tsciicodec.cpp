@@ -26,8 +26,28 @@ namespace zdytool {
 	{
 	}
 	
+	size_t TsciiCodec::maxDecodedLength(size_t len, const ConverterState *) const
+	{
+		// a TSCII byte expands to at most three characters
+		return boundedSize(len, 3);
+	}
+
+	size_t TsciiCodec::maxEncodedLength(size_t len, const ConverterState *) const
+	{
+		return len;
+	}
+
 	string TsciiCodec::convertFromUnicode(const ushort *uc, int len, ConverterState *state) const
 	{
+		string rstr(maxEncodedLength(len, state), '\0');
+		rstr.resize(convertFromUnicode(&rstr[0], rstr.size(), uc, len, state).produced);
+		return rstr;
+	}
+
+	TextCodec::ConversionResult TsciiCodec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+															   ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		char replacement = '?';
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -35,22 +55,27 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		std::vector<char> rstr(len+1);
-		rstr[len] = '\0';
-		uchar* cursor = (uchar*)rstr.data();
-		for (int i = 0; i < len; i++) {
+		uchar* cursor = (uchar*)out;
+		uchar* const cursorEnd = cursor + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
+			if (Z_UNLIKELY(cursor == cursorEnd)) {
+				result.status = ConversionOutputFull;
+				break;
+			}
 			ushort ch = uc[i];
+			ushort next = i + 1 < len ? uc[i + 1] : 0;
 			uchar j;
 			if (UCS2Tool::row(ch) == 0x00 && UCS2Tool::cell(ch) < 0x80) {
 				// ASCII
 				j = UCS2Tool::cell(ch);
-			} else if ((j = UnicodeToTSCII(uc[i],
-											  uc[i + 1],
-											  uc[i + 2]))) {
+			} else if (i + 2 < len && (j = UnicodeToTSCII(uc[i],
+														  next,
+														  uc[i + 2]))) {
 				// We have to check the combined chars first!
 				i += 2;
-			} else if ((j = UnicodeToTSCII(uc[i],
-											  uc[i + 1], 0))) {
+			} else if (i + 1 < len && (j = UnicodeToTSCII(uc[i],
+														  next, 0))) {
 				i++;
 			} else if ((j = UnicodeToTSCII(uc[i], 0, 0))) {
 			} else {
@@ -60,16 +85,26 @@ namespace zdytool {
 			}
 			*cursor++ = j;
 		}
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
 
 		if (state) {
 			state->invalidChars += invalid;
 		}
-		return rstr_str;
+		result.consumed = i;
+		result.produced = cursor - (uchar*)out;
+		return result;
 	}
 
 	u16string TsciiCodec::convertToUnicode(const char* chars, int len, ConverterState *state) const
 	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult TsciiCodec::convertToUnicode(ushort *out, size_t outLength, const char *chars, size_t len,
+															 ConverterState *state) const
+	{
+		ConversionResult result = { 0, 0, ConversionOk };
 		ushort replacement = SpecialCharacter::ReplacementCharacter;
 		if (state) {
 			if (state->flags & ConvertInvalidToNull)
@@ -77,29 +112,43 @@ namespace zdytool {
 		}
 		int invalid = 0;
 
-		u16string result;
-		for (int i = 0; i < len; i++) {
+		ushort *dst = out;
+		ushort *const dstEnd = out + outLength;
+		size_t i = 0;
+		for (; i < len; i++) {
 			uchar ch = chars[i];
 			if (ch < 0x80) {
 				// ASCII
-				result += char(ch);
+				if (Z_UNLIKELY(dst == dstEnd)) {
+					result.status = ConversionOutputFull;
+					break;
+				}
+				*dst++ = char(ch);
 			} else if (IsTSCIIChar(ch)) {
 				// TSCII
 				uint s[3];
 				uint u = TSCIIToUnicode(ch, s);
+				if (Z_UNLIKELY(uint(dstEnd - dst) < u)) {
+					result.status = ConversionOutputFull;
+					break;
+				}
 				uint *p = s;
 				while (u--) {
 					uint c = *p++;
 					if (c)
-						result += ushort(c);
+						*dst++ = ushort(c);
 					else {
-						result += replacement;
+						*dst++ = replacement;
 						++invalid;
 					}
 				}
 			} else {
 				// Invalid
-				result += replacement;
+				if (Z_UNLIKELY(dst == dstEnd)) {
+					result.status = ConversionOutputFull;
+					break;
+				}
+				*dst++ = replacement;
 				++invalid;
 			}
 		}
@@ -107,15 +156,17 @@ namespace zdytool {
 		if (state) {
 			state->invalidChars += invalid;
 		}
+		result.consumed = i;
+		result.produced = dst - out;
 		return result;
 	}
 
-	string TsciiCodec::name() const
+	string TsciiCodec::_name()
 	{
 		return "TSCII";
 	}
 
-	int TsciiCodec::mibEnum() const
+	int TsciiCodec::_mibEnum()
 	{
 	  return 2107;
 	}
@@ -53,11 +53,20 @@ namespace zdytool {
 	public:
 		~TsciiCodec();
 
-		string name() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases() { return list<string>(); }
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
 	};
 }
 #endif // TSCIICODEC_P_H
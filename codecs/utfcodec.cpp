@@ -15,17 +15,17 @@
 // and the grateful thanks of the Qt team.
 
 #include "utfcodec_p.h"
+#include "textkernels.h"
 #include <string>
 #include "endian/endian.hpp"
 namespace zdytool {
-	enum { Endian = 0, Data = 1 };
+	enum { Endian = 0, Data = 1, Surrogate = 2 };
 	static const uchar utf8bom[] = { 0xef, 0xbb, 0xbf };
 
-	string Utf8::convertFromUnicode(const ushort *uc, int len)
+	string Utf8::convertFromUnicode(const ushort *uc, size_t len)
 	{
-		std::vector<char> result(len * 3 + 1);
-		result[len * 3] = '\0';
-		uchar *dst = reinterpret_cast<uchar *>(result.data());
+		string result(boundedSize(len, 3), '\0');
+		uchar *dst = reinterpret_cast<uchar *>(&result[0]);
 		const ushort *src = reinterpret_cast<const ushort *>(uc);
 		const ushort *const end = src + len;
 
@@ -42,33 +42,61 @@ namespace zdytool {
 			} while (src < nextAscii);
 		}
 
-		string result_str(result.data(),dst - reinterpret_cast<uchar *>(result.data()));
-		return result_str;
+		result.resize(dst - reinterpret_cast<uchar *>(&result[0]));
+		return result;
 	}
 
-	string Utf8::convertFromUnicode(const ushort *uc, int len, TextCodec::ConverterState *state)
+	size_t Utf8::maxEncodedLength(size_t len, const TextCodec::ConverterState *state)
 	{
+		// three octets per uint16_t; the buffer based conversion wants room for
+		// a four octet sequence before it encodes a character
+		size_t extra = 4;
+		if (state && !(state->flags & TextCodec::IgnoreHeader))
+			extra += sizeof(utf8bom);
+		return boundedSize(len, 3, extra);
+	}
+
+	string Utf8::convertFromUnicode(const ushort *uc, size_t len, TextCodec::ConverterState *state)
+	{
+		string result(maxEncodedLength(len, state), '\0');
+		result.resize(convertFromUnicode(&result[0], result.size(), uc, len, state).produced);
+		return result;
+	}
+
+	/*!
+		\overload
+
+		Converts the \a len uint16_t beginning at \a uc to UTF-8, writing at most
+		\a outLength octets to \a out. A character is only written if all of its
+		octets fit, so the conversion can be resumed from the first uint16_t not
+		consumed.
+
+		This function never allocates.
+	*/
+	TextCodec::ConversionResult Utf8::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														 TextCodec::ConverterState *state)
+	{
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
 		uchar replacement = '?';
-		int rlen = 3*len;
 		int surrogate_high = -1;
 		if (state) {
 			if (state->flags & TextCodec::ConvertInvalidToNull)
 				replacement = 0;
-			if (!(state->flags & TextCodec::IgnoreHeader))
-				rlen += 3;
 			if (state->remainingChars)
 				surrogate_high = state->state_data[0];
 		}
 
-
-		std::vector<char> rstr(rlen+1);
-		rstr[rlen] = '\0';
-		uchar *cursor = reinterpret_cast<uchar *>(rstr.data());
+		uchar *cursor = reinterpret_cast<uchar *>(out);
+		uchar *const cursorEnd = cursor + outLength;
 		const ushort *src = reinterpret_cast<const ushort *>(uc);
 		const ushort *const end = src + len;
 
 		int invalid = 0;
 		if (state && !(state->flags & TextCodec::IgnoreHeader)) {
+			if (Z_UNLIKELY(outLength < sizeof(utf8bom))) {
+				result.status = TextCodec::ConversionOutputFull;
+				return result;
+			}
 			// append UTF-8 BOM
 			*cursor++ = utf8bom[0];
 			*cursor++ = utf8bom[1];
@@ -76,6 +104,11 @@ namespace zdytool {
 		}
 
 		while (src != end) {
+			// the longest sequence we can write for one character
+			if (Z_UNLIKELY(cursorEnd - cursor < 4)) {
+				result.status = TextCodec::ConversionOutputFull;
+				break;
+			}
 			int res;
 			ushort uc;
 			if (surrogate_high != -1) {
@@ -99,7 +132,8 @@ namespace zdytool {
 			}
 		}
 
-		string rstr_str(rstr.data(),cursor - (const uchar*)rstr.data());
+		result.consumed = src - uc;
+		result.produced = cursor - reinterpret_cast<uchar *>(out);
 		if (state) {
 			state->invalidChars += invalid;
 			state->flags = TextCodec::ConversionFlags(state->flags | TextCodec::IgnoreHeader);
@@ -107,12 +141,14 @@ namespace zdytool {
 			if (surrogate_high >= 0) {
 				state->remainingChars = 1;
 				state->state_data[0] = surrogate_high;
+				if (result.status == TextCodec::ConversionOk)
+					result.status = TextCodec::ConversionIncomplete;
 			}
 		}
-		return rstr_str;
+		return result;
 	}
 
-	u16string Utf8::convertToUnicode(const char *chars, int len)
+	u16string Utf8::convertToUnicode(const char *chars, size_t len)
 	{
 		// UTF-8 to UTF-16 always needs the exact same number of words or less:
 		//    UTF-8     UTF-16
@@ -126,12 +162,11 @@ namespace zdytool {
 		//
 		// The table holds for invalid sequences too: we'll insert one replacement char
 		// per invalid byte.
-		std::vector<uint16_t> result(len+1);
-		result[len] = '\0';
-		ushort *data = const_cast<ushort*>(result.data()); // we know we're not shared
+		u16string result(len, 0);
+		ushort *data = &result[0];
 		const ushort *end = convertToUnicode(data, chars, len);
-		u16string result_str(result.data(),end - data);
-		return result_str;
+		result.resize(end - data);
+		return result;
 	}
 
 	/*!
@@ -150,7 +185,7 @@ namespace zdytool {
 		This function never throws.
 	*/
 
-	ushort *Utf8::convertToUnicode(ushort *buffer, const char *chars, int len)
+	ushort *Utf8::convertToUnicode(ushort *buffer, const char *chars, size_t len)
 	{
 		ushort *dst = reinterpret_cast<ushort *>(buffer);
 		const uchar *src = reinterpret_cast<const uchar *>(chars);
@@ -180,14 +215,8 @@ namespace zdytool {
 		return reinterpret_cast<ushort *>(dst);
 	}
 
-	u16string Utf8::convertToUnicode(const char *chars, int len, TextCodec::ConverterState *state)
+	size_t Utf8::maxDecodedLength(size_t len, const TextCodec::ConverterState *)
 	{
-		bool headerdone = false;
-		ushort replacement = SpecialCharacter::ReplacementCharacter;
-		int invalid = 0;
-		int res;
-		uchar ch = 0;
-
 		// See above for buffer requirements for stateless decoding. However, that
 		// fails if the state is not empty. The following situations can add to the
 		// requirements:
@@ -198,10 +227,34 @@ namespace zdytool {
 		//   1 of 2 bytes       invalid continuation        +1 (need to insert replacement and restart)
 		//   2 of 3 bytes       same                        +1 (same)
 		//   3 of 4 bytes       same                        +1 (same)
-		std::vector<uint16_t> result(len+2);
-		result[len+1] = '\0';
+		// The buffer based conversion wants room for a surrogate pair before it
+		// decodes a character, hence the second extra uint16_t.
+		return boundedSize(len, 1, 2);
+	}
 
-		ushort *dst = const_cast<ushort *>(result.data());
+	u16string Utf8::convertToUnicode(const char *chars, size_t len, TextCodec::ConverterState *state)
+	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state).produced);
+		return result;
+	}
+
+	// Decodes into UTF-16 when Char is ushort and into UCS-4 when it is char32_t;
+	// the UCS-4 output takes a single unit for characters that need a surrogate pair.
+	template <typename Char>
+	static TextCodec::ConversionResult utf8ToUnicode(Char *buffer, size_t bufferLength, const char *chars, size_t len,
+													 TextCodec::ConverterState *state)
+	{
+		const ptrdiff maxCharLength = sizeof(Char) == sizeof(ushort) ? 2 : 1;
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
+		bool headerdone = false;
+		ushort replacement = SpecialCharacter::ReplacementCharacter;
+		int invalid = 0;
+		int res;
+		uchar ch = 0;
+
+		Char *dst = buffer;
+		Char *const dstEnd = buffer + bufferLength;
 		const uchar *src = reinterpret_cast<const uchar *>(chars);
 		const uchar *end = src + len;
 
@@ -211,10 +264,15 @@ namespace zdytool {
 			if (state->flags & TextCodec::ConvertInvalidToNull)
 				replacement = SpecialCharacter::Null;
 			if (state->remainingChars) {
+				if (Z_UNLIKELY(ptrdiff(bufferLength) < maxCharLength)) {
+					result.status = TextCodec::ConversionOutputFull;
+					return result;
+				}
+
 				// handle incoming state first
 				uchar remainingCharsData[4]; // longest UTF-8 sequence possible
 				int remainingCharsCount = state->remainingChars;
-				int newCharsToCopy = std::min<int>(sizeof(remainingCharsData) - remainingCharsCount, end - src);
+				int newCharsToCopy = std::min<ptrdiff>(sizeof(remainingCharsData) - remainingCharsCount, end - src);
 
 				memset(remainingCharsData, 0, sizeof(remainingCharsData));
 				memcpy(remainingCharsData, &state->state_data[0], remainingCharsCount);
@@ -233,7 +291,9 @@ namespace zdytool {
 					// copy to our state and return
 					state->remainingChars = remainingCharsCount + newCharsToCopy;
 					memcpy(&state->state_data[0], remainingCharsData, state->remainingChars);
-					return u16string();
+					result.consumed = newCharsToCopy;
+					result.status = TextCodec::ConversionIncomplete;
+					return result;
 				} else if (!headerdone && res >= 0) {
 					// eat the UTF-8 BOM
 					headerdone = true;
@@ -252,6 +312,10 @@ namespace zdytool {
 		res = 0;
 		const uchar *start = src;
 		while (res >= 0 && src < end) {
+			if (Z_UNLIKELY(dstEnd - dst < maxCharLength)) {
+				result.status = TextCodec::ConversionOutputFull;
+				break;
+			}
 			ch = *src++;
 			res = Utf8Functions::fromUtf8<Utf8BaseTraits>(ch, dst, src, end);
 			if (!headerdone && res >= 0) {
@@ -271,12 +335,18 @@ namespace zdytool {
 
 		if (!state && res == Utf8BaseTraits::EndOfString) {
 			// unterminated UTF sequence
-			*dst++ = SpecialCharacter::ReplacementCharacter;
-			while (src++ < end)
+			if (dstEnd - dst > end - src) {
 				*dst++ = SpecialCharacter::ReplacementCharacter;
+				while (src < end) {
+					*dst++ = SpecialCharacter::ReplacementCharacter;
+					++src;
+				}
+			} else {
+				--src; // unread the byte in ch
+				result.status = TextCodec::ConversionOutputFull;
+			}
 		}
 
-		u16string result_str(result.data(),dst - (const ushort *)result.data());
 		if (state) {
 			state->invalidChars += invalid;
 			if (headerdone)
@@ -285,11 +355,44 @@ namespace zdytool {
 				--src; // unread the byte in ch
 				state->remainingChars = end - src;
 				memcpy(&state->state_data[0], src, end - src);
+				src = end;
+				result.status = TextCodec::ConversionIncomplete;
 			} else {
 				state->remainingChars = 0;
 			}
 		}
-		return result_str;
+		result.consumed = src - reinterpret_cast<const uchar *>(chars);
+		result.produced = dst - buffer;
+		return result;
+	}
+
+	/*!
+		\overload
+
+		Converts the UTF-8 sequence of \a len octets beginning at \a chars to
+		UTF-16, writing at most \a bufferLength uint16_t to \a buffer. Decoding
+		stops before a character when fewer than two uint16_t (room for a
+		surrogate pair) are left, so the conversion can be resumed from the
+		first octet not consumed.
+
+		This function never allocates.
+	*/
+	TextCodec::ConversionResult Utf8::convertToUnicode(ushort *buffer, size_t bufferLength, const char *chars, size_t len,
+													   TextCodec::ConverterState *state)
+	{
+		return utf8ToUnicode(buffer, bufferLength, chars, len, state);
+	}
+
+	/*!
+		Converts the UTF-8 sequence of \a len octets beginning at \a chars to
+		UCS-4, writing at most \a bufferLength code points to \a buffer. This
+		is the same conversion as the UTF-16 one, the state included, without
+		splitting characters into surrogate pairs.
+	*/
+	TextCodec::ConversionResult Utf8::convertToUcs4(char32_t *buffer, size_t bufferLength, const char *chars, size_t len,
+													TextCodec::ConverterState *state)
+	{
+		return utf8ToUnicode(buffer, bufferLength, chars, len, state);
 	}
 	struct QUtf8NoOutputTraits : public Utf8BaseTraitsNoAscii
 	{
@@ -298,43 +401,81 @@ namespace zdytool {
 		static void appendUcs4(const NoOutput &, uint) {}
 	};
 
+	// Skips a run of US-ASCII eight bytes at a time and returns the first
+	// byte with the high bit set, or end.
+	static inline const uchar *findNonAscii(const uchar *src, const uchar *end)
+	{
+		while (end - src >= 8) {
+			uint64_t data;
+			memcpy(&data, src, sizeof(data));
+			if (data & 0x8080808080808080ULL)
+				break;
+			src += 8;
+		}
+		while (src != end && *src < 0x80)
+			++src;
+		return src;
+	}
+
 	Utf8::ValidUtf8Result Utf8::isValidUtf8(const char *chars, size_t len)
 	{
 		const uchar *src = reinterpret_cast<const uchar *>(chars);
 		const uchar *end = src + len;
-		const uchar *nextAscii = src;
 		bool isValidAscii = true;
 
 		while (src < end) {
-			if (src >= nextAscii)
-				nextAscii = end;
+			src = findNonAscii(src, end);
 			if (src == end)
 				break;
 
-			do {
-				uchar b = *src++;
-				if ((b & 0x80) == 0)
-					continue;
-
-				isValidAscii = false;
-				QUtf8NoOutputTraits::NoOutput output;
-				int res = Utf8Functions::fromUtf8<QUtf8NoOutputTraits>(b, output, src, end);
-				if (res < 0) {
-					// decoding error
-					return { false, false };
-				}
-			} while (src < nextAscii);
+			uchar b = *src++;
+			isValidAscii = false;
+			QUtf8NoOutputTraits::NoOutput output;
+			int res = Utf8Functions::fromUtf8<QUtf8NoOutputTraits>(b, output, src, end);
+			if (res < 0) {
+				// decoding error
+				return { false, false };
+			}
 		}
 
 		return { true, isValidAscii };
 	}
 
-	int Utf8::compareUtf8(const char *utf8, size_t u8len, const ushort *utf16, int u16len)
+	bool Utf8::countUtf8(const char *chars, size_t len, size_t *units, size_t *codePoints)
+	{
+		const uchar *src = reinterpret_cast<const uchar *>(chars);
+		const uchar *end = src + len;
+		size_t count = 0;
+		size_t supplementary = 0;
+
+		while (src < end) {
+			const uchar *ascii = src;
+			src = findNonAscii(src, end);
+			count += src - ascii;
+			if (src == end)
+				break;
+
+			uchar b = *src++;
+			QUtf8NoOutputTraits::NoOutput output;
+			int res = Utf8Functions::fromUtf8<QUtf8NoOutputTraits>(b, output, src, end);
+			if (res < 0)
+				return false;
+			++count;
+			if (res == 4)
+				++supplementary;
+		}
+
+		*units = count + supplementary;
+		*codePoints = count;
+		return true;
+	}
+
+	int Utf8::compareUtf8(const char *utf8, size_t u8len, const ushort *utf16, size_t u16len)
 	{
 		uint uc1, uc2;
 		auto src1 = reinterpret_cast<const uchar *>(utf8);
 		auto end1 = src1 + u8len;
-		int src2 = 0;
+		size_t src2 = 0;
 		//QStringIterator src2(utf16, utf16 + u16len);
 
 		while (src1 < end1 && src2 < u16len) {
@@ -382,21 +523,37 @@ namespace zdytool {
 		return (end1 > src1) - (end2 > src2);
 	}
 
-	string Utf16::convertFromUnicode(const ushort *uc, int len, TextCodec::ConverterState *state, DataEndianness e)
+	size_t Utf16::maxEncodedLength(size_t len, const TextCodec::ConverterState *state)
 	{
-		DataEndianness endian = e;
-		int length =  2*len;
+		size_t extra = 0;
 		if (!state || (!(state->flags & TextCodec::IgnoreHeader))) {
-			length += 2;
+			extra = 2;
 		}
+		return boundedSize(len, 2, extra);
+	}
+
+	string Utf16::convertFromUnicode(const ushort *uc, size_t len, TextCodec::ConverterState *state, DataEndianness e)
+	{
+		string result(maxEncodedLength(len, state), '\0');
+		result.resize(convertFromUnicode(&result[0], result.size(), uc, len, state, e).produced);
+		return result;
+	}
+
+	TextCodec::ConversionResult Utf16::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														  TextCodec::ConverterState *state, DataEndianness e)
+	{
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
+		DataEndianness endian = e;
 		if (e == DetectEndianness) {
 			endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
 		}
 
-		std::vector<char> d(length+1);
-		d[length] = '\0';
-		char *data = d.data();
+		char *data = out;
 		if (!state || !(state->flags & TextCodec::IgnoreHeader)) {
+			if (Z_UNLIKELY(outLength < 2)) {
+				result.status = TextCodec::ConversionOutputFull;
+				return result;
+			}
 			ushort bom(SpecialCharacter::ByteOrderMark);
 			if (endian == BigEndianness) {
 				data[0] = UCS2Tool::row(bom);
@@ -407,13 +564,16 @@ namespace zdytool {
 			}
 			data += 2;
 		}
+		size_t count = std::min<size_t>(len, (out + outLength - data) / 2);
+		if (count < len)
+			result.status = TextCodec::ConversionOutputFull;
 		if (endian == BigEndianness) {
-			for (int i = 0; i < len; ++i) {
+			for (size_t i = 0; i < count; ++i) {
 				*(data++) = UCS2Tool::row(uc[i]);
 				*(data++) = UCS2Tool::cell(uc[i]);
 			}
 		} else {
-			for (int i = 0; i < len; ++i) {
+			for (size_t i = 0; i < count; ++i) {
 				*(data++) = UCS2Tool::cell(uc[i]);
 				*(data++) = UCS2Tool::row(uc[i]);
 			}
@@ -423,32 +583,157 @@ namespace zdytool {
 			state->remainingChars = 0;
 			state->flags = TextCodec::ConversionFlags(state->flags | TextCodec::IgnoreHeader);
 		}
-		string d_str(d.data(),length);
-		return d_str;
+		result.consumed = count;
+		result.produced = data - out;
+		return result;
 	}
 
-	u16string Utf16::convertToUnicode(const char *chars, int len, TextCodec::ConverterState *state, DataEndianness e)
+	/*!
+		Converts \a len code points from \a uc to UTF-16, writing at most
+		\a outLength bytes to \a out. Characters outside the Basic Multilingual
+		Plane become surrogate pairs and are never split by a full buffer.
+	*/
+	TextCodec::ConversionResult Utf16::convertFromUcs4(char *out, size_t outLength, const char32_t *uc, size_t len,
+													   TextCodec::ConverterState *state, DataEndianness e)
 	{
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
+		DataEndianness endian = e;
+		if (e == DetectEndianness) {
+			endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
+		}
+
+		char *data = out;
+		char *const end = out + outLength;
+		if (!state || !(state->flags & TextCodec::IgnoreHeader)) {
+			if (Z_UNLIKELY(outLength < 2)) {
+				result.status = TextCodec::ConversionOutputFull;
+				return result;
+			}
+			ushort bom(SpecialCharacter::ByteOrderMark);
+			if (endian == BigEndianness) {
+				data[0] = UCS2Tool::row(bom);
+				data[1] = UCS2Tool::cell(bom);
+			} else {
+				data[0] = UCS2Tool::cell(bom);
+				data[1] = UCS2Tool::row(bom);
+			}
+			data += 2;
+		}
+		size_t i = 0;
+		for (; i < len; ++i) {
+			uint cp = uc[i];
+			if (Z_UNLIKELY(cp > SpecialCharacter::LastValidCodePoint))
+				cp = SpecialCharacter::ReplacementCharacter;
+			ushort units[2] = { ushort(cp), 0 };
+			int n = 1;
+			if (UCS4Tool::requiresSurrogates(cp)) {
+				units[0] = UCS4Tool::highSurrogate(cp);
+				units[1] = UCS4Tool::lowSurrogate(cp);
+				n = 2;
+			}
+			if (Z_UNLIKELY(end - data < 2 * n)) {
+				result.status = TextCodec::ConversionOutputFull;
+				break;
+			}
+			for (int k = 0; k < n; ++k) {
+				if (endian == BigEndianness) {
+					*(data++) = UCS2Tool::row(units[k]);
+					*(data++) = UCS2Tool::cell(units[k]);
+				} else {
+					*(data++) = UCS2Tool::cell(units[k]);
+					*(data++) = UCS2Tool::row(units[k]);
+				}
+			}
+		}
+
+		if (state) {
+			state->remainingChars = 0;
+			state->flags = TextCodec::ConversionFlags(state->flags | TextCodec::IgnoreHeader);
+		}
+		result.consumed = i;
+		result.produced = data - out;
+		return result;
+	}
+
+	size_t Utf16::maxDecodedLength(size_t len, const TextCodec::ConverterState *)
+	{
+		// a pending byte from the state completes one more uint16_t
+		return len / 2 + 2;
+	}
+
+	u16string Utf16::convertToUnicode(const char *chars, size_t len, TextCodec::ConverterState *state, DataEndianness e)
+	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state, e).produced);
+		return result;
+	}
+
+	// Appends a decoded UTF-16 unit to the output. UCS-4 output holds a high
+	// surrogate back in \a high until the low one is known; a surrogate
+	// without its other half is invalid there.
+	static inline void appendUtf16Unit(ushort *&dst, ushort ch, ushort &, TextCodec::ConverterState *)
+	{
+		*dst++ = ch;
+	}
+
+	static inline void appendUtf16Unit(char32_t *&dst, ushort ch, ushort &high, TextCodec::ConverterState *state)
+	{
+		if (high) {
+			if (UCS4Tool::isLowSurrogate(ch)) {
+				*dst++ = UCS4Tool::surrogateToUcs4(high, ch);
+				high = 0;
+				return;
+			}
+			*dst++ = ucs4ScalarValue(high, state);
+			high = 0;
+		}
+		if (UCS4Tool::isHighSurrogate(ch))
+			high = ch;
+		else
+			*dst++ = ucs4ScalarValue(ch, state);
+	}
+
+	template <typename Char>
+	static TextCodec::ConversionResult utf16ToUnicode(Char *buffer, size_t bufferLength, const char *chars, size_t len,
+													  TextCodec::ConverterState *state, DataEndianness e)
+	{
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
 		DataEndianness endian = e;
 		bool half = false;
 		uchar buf = 0;
+		ushort high = 0;
 		bool headerdone = false;
 		if (state) {
 			headerdone = state->flags & TextCodec::IgnoreHeader;
 			if (endian == DetectEndianness)
 				endian = (DataEndianness)state->state_data[Endian];
-			if (state->remainingChars) {
+			if (state->remainingChars & 1) {
 				half = true;
 				buf = state->state_data[Data];
 			}
+			// a high surrogate held back by the UCS-4 conversion
+			if (state->remainingChars & 2)
+				high = state->state_data[Surrogate];
 		}
 		if (headerdone && endian == DetectEndianness)
 			endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
 
-		std::vector<uint16_t> result(len+1);
-		result[len] ='\0';
-		ushort *zch = (ushort *)result.data();
-		while (len--) {
+		Char *zch = buffer;
+		Char *const zchEnd = buffer + bufferLength;
+		if (sizeof(Char) == sizeof(ushort) && high) {
+			if (Z_UNLIKELY(!bufferLength)) {
+				result.status = TextCodec::ConversionOutputFull;
+				return result;
+			}
+			*zch++ = high;
+			high = 0;
+		}
+
+		const char *const begin = chars;
+		const char *const end = chars + len;
+		if (Z_UNLIKELY(half && len && zch == zchEnd))
+			result.status = TextCodec::ConversionOutputFull;
+		while (result.status == TextCodec::ConversionOk && chars < end) {
 			if (half) {
 				ushort ch =0;
 				if (endian == LittleEndianness) {
@@ -458,6 +743,20 @@ namespace zdytool {
 					UCS2Tool::setRow(ch,buf);
 					UCS2Tool::setCell(ch,*chars++);
 				}
+				if (Z_UNLIKELY(high && !UCS4Tool::isSurrogate(ch) && zchEnd - zch < 2)) {
+					// the held back surrogate and this unit are two code points;
+					// write the surrogate and leave the unit for the next call
+					*zch++ = ucs4ScalarValue(high, state);
+					high = 0;
+					if (state) {
+						--chars;
+					} else {
+						chars -= 2;
+						half = false;
+					}
+					result.status = TextCodec::ConversionOutputFull;
+					break;
+				}
 				if (!headerdone) {
 					headerdone = true;
 					if (endian == DetectEndianness) {
@@ -472,52 +771,120 @@ namespace zdytool {
 								endian = LittleEndianness;
 								ch = ushort((ch >> 8) | ((ch & 0xff) << 8));
 							}
-							*zch++ = ch;
+							appendUtf16Unit(zch, ch, high, state);
 						}
 					} else if (ch != SpecialCharacter::ByteOrderMark) {
-						*zch++ = ch;
+						appendUtf16Unit(zch, ch, high, state);
 					}
 				} else {
-					*zch++ = ch;
+					appendUtf16Unit(zch, ch, high, state);
 				}
 				half = false;
 			} else {
+				if (Z_UNLIKELY(zch == zchEnd)) {
+					result.status = TextCodec::ConversionOutputFull;
+					break;
+				}
 				buf = *chars++;
 				half = true;
 			}
 		}
-		u16string result_str(result.data(),zch - result.data());
+
+		if (high && !state) {
+			// at the end of the input the surrogate stays on its own; if the
+			// output ran full, it is decoded again with its low half next time
+			if (Z_LIKELY(result.status == TextCodec::ConversionOk && zch != zchEnd)) {
+				*zch++ = ucs4ScalarValue(high, state);
+			} else {
+				chars -= half ? 3 : 2;
+				half = false;
+				result.status = TextCodec::ConversionOutputFull;
+			}
+			high = 0;
+		}
 
 		if (state) {
 			if (headerdone)
 				state->flags = TextCodec::ConversionFlags(state->flags | TextCodec::IgnoreHeader);
 			state->state_data[Endian] = endian;
-			if (half) {
-				state->remainingChars = 1;
-				state->state_data[Data] = buf;
-			} else {
-				state->remainingChars = 0;
-				state->state_data[Data] = 0;
-			}
+			state->state_data[Data] = half ? buf : 0;
+			state->state_data[Surrogate] = high;
+			state->remainingChars = (half ? 1 : 0) | (high ? 2 : 0);
+			if (state->remainingChars && result.status == TextCodec::ConversionOk)
+				result.status = TextCodec::ConversionIncomplete;
 		}
-		return result_str;
+		result.consumed = chars - begin;
+		result.produced = zch - buffer;
+		return result;
 	}
 
-	string Utf32::convertFromUnicode(const ushort *uc, int len, TextCodec::ConverterState *state, DataEndianness e)
+	TextCodec::ConversionResult Utf16::convertToUnicode(ushort *buffer, size_t bufferLength, const char *chars, size_t len,
+														TextCodec::ConverterState *state, DataEndianness e)
 	{
-		DataEndianness endian = e;
-		int length =  4*len;
+		return utf16ToUnicode(buffer, bufferLength, chars, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf16::convertToUcs4(char32_t *buffer, size_t bufferLength, const char *chars, size_t len,
+													 TextCodec::ConverterState *state, DataEndianness e)
+	{
+		return utf16ToUnicode(buffer, bufferLength, chars, len, state, e);
+	}
+
+	size_t Utf32::maxEncodedLength(size_t len, const TextCodec::ConverterState *state)
+	{
+		size_t extra = 0;
 		if (!state || (!(state->flags & TextCodec::IgnoreHeader))) {
-			length += 4;
+			extra = 4;
 		}
+		// a high surrogate held back from the last call may stay on its own
+		if (state && state->remainingChars)
+			extra += 4;
+		return boundedSize(len, 4, extra);
+	}
+
+	string Utf32::convertFromUnicode(const ushort *uc, size_t len, TextCodec::ConverterState *state, DataEndianness e)
+	{
+		string result(maxEncodedLength(len, state), '\0');
+		result.resize(convertFromUnicode(&result[0], result.size(), uc, len, state, e).produced);
+		return result;
+	}
+
+	// Reads the code point at \a uc into \a cp and returns the number of
+	// units it takes: a surrogate pair is one code point, a surrogate
+	// without its other half is written as it is.
+	static inline size_t utf32Code(const ushort *uc, size_t len, uint *cp)
+	{
+		if (UCS4Tool::isHighSurrogate(uc[0]) && len > 1 && UCS4Tool::isLowSurrogate(uc[1])) {
+			*cp = UCS4Tool::surrogateToUcs4(uc[0], uc[1]);
+			return 2;
+		}
+		*cp = uc[0];
+		return 1;
+	}
+
+	static inline size_t utf32Code(const char32_t *uc, size_t, uint *cp)
+	{
+		*cp = uc[0] <= SpecialCharacter::LastValidCodePoint ? uint(uc[0]) : uint(SpecialCharacter::ReplacementCharacter);
+		return 1;
+	}
+
+	// Encodes UTF-16 when Char is ushort, code points when it is char32_t.
+	template <typename Char>
+	static TextCodec::ConversionResult utf32FromUnicode(char *out, size_t outLength, const Char *uc, size_t len,
+														TextCodec::ConverterState *state, DataEndianness e)
+	{
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
+		DataEndianness endian = e;
 		if (e == DetectEndianness) {
 			endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
 		}
 
-		std::vector<char> d(length+1);
-		d[length] ='\0';
-		char *data = d.data();
+		char *data = out;
 		if (!state || !(state->flags & TextCodec::IgnoreHeader)) {
+			if (Z_UNLIKELY(outLength < 4)) {
+				result.status = TextCodec::ConversionOutputFull;
+				return result;
+			}
 			if (endian == BigEndianness) {
 				data[0] = 0;
 				data[1] = 0;
@@ -532,22 +899,37 @@ namespace zdytool {
 			data += 4;
 		}
 
-		int uc_pos = 0;
-		if (endian == BigEndianness) {
-			while (uc_pos < len) {
-				uint cp = uc[uc_pos];
-				uc_pos++;
+		ushort high = 0;
+		if (state && state->remainingChars)
+			high = ushort(state->state_data[Surrogate]);
+		size_t uc_pos = 0;
+		while (uc_pos < len) {
+			if (sizeof(Char) == sizeof(ushort) && state && !high && uc_pos + 1 == len
+				&& UCS4Tool::isHighSurrogate(uc[uc_pos])) {
+				// the low half comes with the next call
+				high = ushort(uc[uc_pos++]);
+				break;
+			}
+			if (Z_UNLIKELY(out + outLength - data < 4)) {
+				result.status = TextCodec::ConversionOutputFull;
+				break;
+			}
+			uint cp;
+			if (Z_UNLIKELY(high)) {
+				cp = high;
+				if (UCS4Tool::isLowSurrogate(uc[uc_pos]))
+					cp = UCS4Tool::surrogateToUcs4(high, ushort(uc[uc_pos++]));
+				high = 0;
+			} else {
+				uc_pos += utf32Code(uc + uc_pos, len - uc_pos, &cp);
+			}
 
+			if (endian == BigEndianness) {
 				*(data++) = cp >> 24;
 				*(data++) = (cp >> 16) & 0xff;
 				*(data++) = (cp >> 8) & 0xff;
 				*(data++) = cp & 0xff;
-			}
-		} else {
-			while (uc_pos < len) {
-				uint cp = uc[uc_pos];
-				uc_pos++;
-
+			} else {
 				*(data++) = cp & 0xff;
 				*(data++) = (cp >> 8) & 0xff;
 				*(data++) = (cp >> 16) & 0xff;
@@ -556,15 +938,61 @@ namespace zdytool {
 		}
 
 		if (state) {
-			state->remainingChars = 0;
+			state->remainingChars = high ? 1 : 0;
+			state->state_data[Surrogate] = high;
 			state->flags = TextCodec::ConversionFlags(state->flags | TextCodec::IgnoreHeader);
 		}
-		string d_str(d.data(),length);
-		return d_str;
+		result.consumed = uc_pos;
+		result.produced = data - out;
+		return result;
 	}
 
-	u16string Utf32::convertToUnicode(const char *chars, int len, TextCodec::ConverterState *state, DataEndianness e)
+	TextCodec::ConversionResult Utf32::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+														  TextCodec::ConverterState *state, DataEndianness e)
 	{
+		return utf32FromUnicode(out, outLength, uc, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf32::convertFromUcs4(char *out, size_t outLength, const char32_t *uc, size_t len,
+													   TextCodec::ConverterState *state, DataEndianness e)
+	{
+		return utf32FromUnicode(out, outLength, uc, len, state, e);
+	}
+
+	size_t Utf32::maxDecodedLength(size_t len, const TextCodec::ConverterState *)
+	{
+		// every complete tuple gives at most a surrogate pair
+		return len / 2 + 4;
+	}
+
+	u16string Utf32::convertToUnicode(const char *chars, size_t len, TextCodec::ConverterState *state, DataEndianness e)
+	{
+		u16string result(maxDecodedLength(len, state), 0);
+		result.resize(convertToUnicode(&result[0], result.size(), chars, len, state, e).produced);
+		return result;
+	}
+
+	static inline void appendUtf32Code(ushort *&dst, uint code, TextCodec::ConverterState *)
+	{
+		if (UCS4Tool::requiresSurrogates(code)) {
+			*dst++ = UCS4Tool::highSurrogate(code);
+			*dst++ = UCS4Tool::lowSurrogate(code);
+		} else {
+			*dst++ = code;
+		}
+	}
+
+	static inline void appendUtf32Code(char32_t *&dst, uint code, TextCodec::ConverterState *state)
+	{
+		*dst++ = ucs4ScalarValue(code, state);
+	}
+
+	template <typename Char>
+	static TextCodec::ConversionResult utf32ToUnicode(Char *buffer, size_t bufferLength, const char *chars, size_t len,
+													  TextCodec::ConverterState *state, DataEndianness e)
+	{
+		const ptrdiff maxCharLength = sizeof(Char) == sizeof(ushort) ? 2 : 1;
+		TextCodec::ConversionResult result = { 0, 0, TextCodec::ConversionOk };
 		DataEndianness endian = e;
 		uchar tuple[4];
 		int num = 0;
@@ -580,16 +1008,20 @@ namespace zdytool {
 		if (headerdone && endian == DetectEndianness)
 			endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
 
-		int result_size = (num + len) >> 2 << 1;
-		std::vector<uint16_t> result(result_size+1);
-		result[result_size] = '\0';
-		ushort *zch = (ushort *)result.data();
-
+		Char *zch = buffer;
+		Char *const zchEnd = buffer + bufferLength;
+		const char *const begin = chars;
 		const char *end = chars + len;
 		while (chars < end) {
+			// a tuple gives at most a surrogate pair
+			if ((num == 0 || chars == begin) && Z_UNLIKELY(zchEnd - zch < maxCharLength)) {
+				result.status = TextCodec::ConversionOutputFull;
+				break;
+			}
 			tuple[num++] = *chars++;
 			if (num == 4) {
 				if (!headerdone) {
+					headerdone = true;
 					if (endian == DetectEndianness) {
 						if (tuple[0] == 0xff && tuple[1] == 0xfe && tuple[2] == 0 && tuple[3] == 0 && endian != BigEndianness) {
 							endian = LittleEndianness;
@@ -610,16 +1042,10 @@ namespace zdytool {
 					}
 				}
 				uint code = (((endian == BigEndianness) == (Z_BYTE_ORDER == Z_BIG_ENDIAN)) ? zdytool::endian::fromUnaligned<uint32_t>(tuple) : zdytool::endian::endian_reverse(zdytool::endian::fromUnaligned<uint32_t>(tuple)));
-				if (UCS4Tool::requiresSurrogates(code)) {
-					*zch++ = UCS4Tool::highSurrogate(code);
-					*zch++ = UCS4Tool::lowSurrogate(code);
-				} else {
-					*zch++ = code;
-				}
+				appendUtf32Code(zch, code, state);
 				num = 0;
 			}
 		}
-		u16string result_str(result.data(),zch - result.data());
 
 		if (state) {
 			if (headerdone)
@@ -627,8 +1053,24 @@ namespace zdytool {
 			state->state_data[Endian] = endian;
 			state->remainingChars = num;
 			memcpy(&state->state_data[Data], tuple, 4);
+			if (num && result.status == TextCodec::ConversionOk)
+				result.status = TextCodec::ConversionIncomplete;
 		}
-		return result_str;
+		result.consumed = chars - begin;
+		result.produced = zch - buffer;
+		return result;
+	}
+
+	TextCodec::ConversionResult Utf32::convertToUnicode(ushort *buffer, size_t bufferLength, const char *chars, size_t len,
+														TextCodec::ConverterState *state, DataEndianness e)
+	{
+		return utf32ToUnicode(buffer, bufferLength, chars, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf32::convertToUcs4(char32_t *buffer, size_t bufferLength, const char *chars, size_t len,
+													 TextCodec::ConverterState *state, DataEndianness e)
+	{
+		return utf32ToUnicode(buffer, bufferLength, chars, len, state, e);
 	}
 
 	Utf8Codec::~Utf8Codec()
@@ -640,22 +1082,209 @@ namespace zdytool {
 		return Utf8::convertFromUnicode(uc, len, state);
 	}
 
-	void Utf8Codec::convertToUnicode(u16string *target, const char *chars, int len, ConverterState *state) const
+	u16string Utf8Codec::convertToUnicode(const char *chars, int len, ConverterState *state) const
 	{
-		*target += Utf8::convertToUnicode(chars, len, state);
+		return Utf8::convertToUnicode(chars, len, state);
 	}
 
-	u16string Utf8Codec::convertToUnicode(const char *chars, int len, ConverterState *state) const
+	TextCodec::ConversionResult Utf8Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+													   ConverterState *state) const
 	{
-		return Utf8::convertToUnicode(chars, len, state);
+		return Utf8::convertFromUnicode(out, outLength, uc, len, state);
+	}
+
+	TextCodec::ConversionResult Utf8Codec::convertToUnicode(ushort *buffer, size_t bufferLength, const char *chars, size_t len,
+													 ConverterState *state) const
+	{
+		return Utf8::convertToUnicode(buffer, bufferLength, chars, len, state);
+	}
+
+	TextCodec::ConversionResult Utf8Codec::convertToUcs4(char32_t *buffer, size_t bufferLength, const char *chars, size_t len,
+													ConverterState *state) const
+	{
+		return Utf8::convertToUcs4(buffer, bufferLength, chars, len, state);
 	}
 
-	string Utf8Codec::name() const
+	const uchar *Utf8CodePoints::skipHeader(const uchar *begin, const uchar *end)
+	{
+		if (end - begin >= 3 && memcmp(begin, utf8bom, sizeof(utf8bom)) == 0)
+			return begin + sizeof(utf8bom);
+		return begin;
+	}
+
+	char32_t Utf8CodePoints::nextMultibyte(const uchar *&src, const uchar *end)
+	{
+		char32_t uc;
+		char32_t *dst = &uc;
+		const uchar b = *src++;
+		// on error only the lead byte is taken, like utf8ToUnicode() does;
+		// a sequence cut off by the end of the input gives a replacement
+		// character for each of its bytes that way too
+		if (Utf8Functions::fromUtf8<Utf8BaseTraits>(b, dst, src, end) < 0)
+			return SpecialCharacter::ReplacementCharacter;
+		return uc;
+	}
+
+	char32_t kernels::Utf8Tag::nextMultibyte(const uchar *&src, const uchar *end)
+	{
+		char32_t uc;
+		char32_t *dst = &uc;
+		const uchar *next = src + 1;
+		const int res = Utf8Functions::fromUtf8<Utf8BaseTraits>(*src, dst, next, end);
+		// unlike a code point iterator, a kernel leaves a sequence cut off
+		// by the end of the input for the next buffer
+		if (res == Utf8BaseTraits::EndOfString)
+			return Incomplete;
+		if (res < 0) {
+			++src;
+			return SpecialCharacter::ReplacementCharacter;
+		}
+		src = next;
+		return uc;
+	}
+
+	int kernels::Utf8Tag::encodeMultibyte(const ushort *&src, const ushort *end, uchar *dst)
+	{
+		uchar *cursor = dst;
+		const ushort uc = *src++;
+		const int res = Utf8Functions::toUtf8<Utf8BaseTraits>(uc, cursor, src, end);
+		if (Z_LIKELY(res >= 0))
+			return cursor - dst;
+		if (res == Utf8BaseTraits::EndOfString) {
+			// a surrogate at the end of the input is left unencoded, as
+			// convertFromUnicode() leaves it, whether it is high or low
+			--src;
+			return 0;
+		}
+		*dst = '?';
+		return 1;
+	}
+
+	size_t Utf8Codec::maxDecodedLength(size_t len, const ConverterState *state) const
+	{
+		return Utf8::maxDecodedLength(len, state);
+	}
+
+	size_t Utf8Codec::maxEncodedLength(size_t len, const ConverterState *state) const
+	{
+		return Utf8::maxEncodedLength(len, state);
+	}
+
+	size_t Utf8Codec::nextSyncPoint(const char *chars, size_t len, size_t from) const
+	{
+		// a decoder starting at a byte order mark would take it for a header
+		size_t pos = nextSyncPointAfter(chars, len, from, 0x80);
+		while (pos < len && uchar(chars[pos]) == 0xef)
+			pos = nextSyncPointAfter(chars, len, pos + 1, 0x80);
+		return pos;
+	}
+
+	size_t Utf8Codec::previousSyncPoint(const char *chars, size_t len, size_t to, ConverterState *) const
+	{
+		// no sequence takes a byte that is not a continuation byte as
+		// anything but its first
+		while (to > 0 && to < len && Utf8Functions::isContinuationByte(chars[to]))
+			--to;
+		return to;
+	}
+
+	size_t Utf8Codec::nextEncodeSyncPoint(const ushort *uc, size_t len, size_t from) const
+	{
+		return nextCharacterBoundary(uc, len, from);
+	}
+
+	size_t Utf8Codec::encodedLength(const ushort *uc, size_t len, const ConverterState *state) const
+	{
+		// adds up what toUtf8() writes; a surrogate the input ends on is kept
+		// pending, and one that is not part of a pair becomes a '?'. A
+		// stateless conversion writes no byte order mark
+		size_t n = (state && !(state->flags & IgnoreHeader)) ? sizeof(utf8bom) : 0;
+		size_t i = 0;
+		if (state && state->remainingChars) {
+			// the surrogate was left over from the last call
+			if (!len)
+				return n;
+			if (UCS4Tool::isHighSurrogate(state->state_data[0]) && UCS4Tool::isLowSurrogate(uc[0])) {
+				n += 4;
+				i = 1;
+			} else {
+				++n;
+			}
+		}
+		for (; i < len; ++i) {
+			const ushort u = uc[i];
+			if (u < 0x80) {
+				++n;
+			} else if (u < 0x800) {
+				n += 2;
+			} else if (!UCS4Tool::isSurrogate(u)) {
+				n += 3;
+			} else if (i + 1 == len) {
+				break;
+			} else if (UCS4Tool::isHighSurrogate(u) && UCS4Tool::isLowSurrogate(uc[i + 1])) {
+				n += 4;
+				++i;
+			} else {
+				++n;
+			}
+		}
+		return n;
+	}
+
+	// Whether decoding \a chars with \a state drops a leading byte order mark.
+	static inline bool utf8SkipsHeader(const char *chars, size_t len, const TextCodec::ConverterState *state)
+	{
+		if (state && (state->flags & TextCodec::IgnoreHeader))
+			return false;
+		return len >= 3 && memcmp(chars, utf8bom, sizeof(utf8bom)) == 0;
+	}
+
+	size_t Utf8Codec::decodedLength(const char *chars, size_t len, const ConverterState *state) const
+	{
+		// well-formed input is counted without decoding it; anything else,
+		// or a sequence pending in the state, takes the generic path
+		size_t units, codePoints;
+		if ((!state || !state->remainingChars) && Utf8::countUtf8(chars, len, &units, &codePoints))
+			return units - (utf8SkipsHeader(chars, len, state) ? 1 : 0);
+		return TextCodec::decodedLength(chars, len, state);
+	}
+
+	size_t Utf8Codec::codePointCount(const char *chars, size_t len, const ConverterState *state) const
+	{
+		size_t units, codePoints;
+		if ((!state || !state->remainingChars) && Utf8::countUtf8(chars, len, &units, &codePoints))
+			return codePoints - (utf8SkipsHeader(chars, len, state) ? 1 : 0);
+		return TextCodec::codePointCount(chars, len, state);
+	}
+
+	bool Utf8Codec::validateToUnicode(const char *chars, size_t len) const
+	{
+		return Utf8::isValidUtf8(chars, len).isValidUtf8;
+	}
+
+	bool Utf8Codec::validateFromUnicode(const ushort *uc, size_t len) const
+	{
+		// every code point has a UTF-8 form, so only an unpaired surrogate
+		// fails; a surrogate at the very end is kept pending like
+		// convertFromUnicode() does
+		for (size_t i = 0; i < len; ++i) {
+			if (Z_LIKELY(!UCS4Tool::isSurrogate(uc[i])))
+				continue;
+			if (i + 1 == len)
+				break;
+			if (!UCS4Tool::isHighSurrogate(uc[i]) || !UCS4Tool::isLowSurrogate(uc[i + 1]))
+				return false;
+			++i;
+		}
+		return true;
+	}
+
+	string Utf8Codec::_name()
 	{
 		return "UTF-8";
 	}
 
-	int Utf8Codec::mibEnum() const
+	int Utf8Codec::_mibEnum()
 	{
 		return 106;
 	}
@@ -674,48 +1303,97 @@ namespace zdytool {
 		return Utf16::convertToUnicode(chars, len, state, e);
 	}
 
-	int Utf16Codec::mibEnum() const
+	TextCodec::ConversionResult Utf16Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+													   ConverterState *state) const
+	{
+		return Utf16::convertFromUnicode(out, outLength, uc, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf16Codec::convertFromUcs4(char *out, size_t outLength, const char32_t *uc, size_t len,
+															ConverterState *state) const
+	{
+		return Utf16::convertFromUcs4(out, outLength, uc, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf16Codec::convertToUnicode(ushort *buffer, size_t bufferLength, const char *chars, size_t len,
+													 ConverterState *state) const
+	{
+		return Utf16::convertToUnicode(buffer, bufferLength, chars, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf16Codec::convertToUcs4(char32_t *buffer, size_t bufferLength, const char *chars, size_t len,
+														ConverterState *state) const
+	{
+		return Utf16::convertToUcs4(buffer, bufferLength, chars, len, state, e);
+	}
+
+	int Utf16Codec::_mibEnum()
 	{
 		return 1015;
 	}
 
-	string Utf16Codec::name() const
+	size_t Utf16Codec::maxDecodedLength(size_t len, const ConverterState *state) const
+	{
+		return Utf16::maxDecodedLength(len, state);
+	}
+
+	size_t Utf16Codec::maxEncodedLength(size_t len, const ConverterState *state) const
+	{
+		return Utf16::maxEncodedLength(len, state);
+	}
+
+	size_t Utf16Codec::previousSyncPoint(const char *chars, size_t len, size_t to, ConverterState *state) const
+	{
+		if (e == DetectEndianness) {
+			// the byte order is taken from the header, as at the start
+			DataEndianness endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
+			if (len >= 2 && uchar(chars[0]) == 0xfe && uchar(chars[1]) == 0xff)
+				endian = BigEndianness;
+			else if (len >= 2 && uchar(chars[0]) == 0xff && uchar(chars[1]) == 0xfe)
+				endian = LittleEndianness;
+			state->state_data[Endian] = endian;
+		}
+		// units are passed through one by one, surrogates and all
+		return to & ~size_t(1);
+	}
+
+	string Utf16Codec::_name()
 	{
 		return "UTF-16";
 	}
 
-	list<string> Utf16Codec::aliases() const
+	list<string> Utf16Codec::_aliases()
 	{
 		return list<string>();
 	}
 
-	int Utf16BECodec::mibEnum() const
+	int Utf16BECodec::_mibEnum()
 	{
 		return 1013;
 	}
 
-	string Utf16BECodec::name() const
+	string Utf16BECodec::_name()
 	{
 		return "UTF-16BE";
 	}
 
-	list<string> Utf16BECodec::aliases() const
+	list<string> Utf16BECodec::_aliases()
 	{
 		list<string> list;
 		return list;
 	}
 
-	int Utf16LECodec::mibEnum() const
+	int Utf16LECodec::_mibEnum()
 	{
 		return 1014;
 	}
 
-	string Utf16LECodec::name() const
+	string Utf16LECodec::_name()
 	{
 		return "UTF-16LE";
 	}
 
-	list<string> Utf16LECodec::aliases() const
+	list<string> Utf16LECodec::_aliases()
 	{
 		list<string> list;
 		return list;
@@ -735,49 +1413,99 @@ namespace zdytool {
 		return Utf32::convertToUnicode(chars, len, state, e);
 	}
 
-	int Utf32Codec::mibEnum() const
+	TextCodec::ConversionResult Utf32Codec::convertFromUnicode(char *out, size_t outLength, const ushort *uc, size_t len,
+													   ConverterState *state) const
+	{
+		return Utf32::convertFromUnicode(out, outLength, uc, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf32Codec::convertFromUcs4(char *out, size_t outLength, const char32_t *uc, size_t len,
+															ConverterState *state) const
+	{
+		return Utf32::convertFromUcs4(out, outLength, uc, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf32Codec::convertToUnicode(ushort *buffer, size_t bufferLength, const char *chars, size_t len,
+													 ConverterState *state) const
+	{
+		return Utf32::convertToUnicode(buffer, bufferLength, chars, len, state, e);
+	}
+
+	TextCodec::ConversionResult Utf32Codec::convertToUcs4(char32_t *buffer, size_t bufferLength, const char *chars, size_t len,
+														ConverterState *state) const
+	{
+		return Utf32::convertToUcs4(buffer, bufferLength, chars, len, state, e);
+	}
+
+	int Utf32Codec::_mibEnum()
 	{
 		return 1017;
 	}
 
-	string Utf32Codec::name() const
+	size_t Utf32Codec::maxDecodedLength(size_t len, const ConverterState *state) const
+	{
+		return Utf32::maxDecodedLength(len, state);
+	}
+
+	size_t Utf32Codec::maxEncodedLength(size_t len, const ConverterState *state) const
+	{
+		return Utf32::maxEncodedLength(len, state);
+	}
+
+	size_t Utf32Codec::previousSyncPoint(const char *chars, size_t len, size_t to, ConverterState *state) const
+	{
+		if (e == DetectEndianness) {
+			// the byte order is taken from the header, as at the start
+			static const uchar le[] = { 0xff, 0xfe, 0, 0 };
+			static const uchar be[] = { 0, 0, 0xfe, 0xff };
+			DataEndianness endian = (Z_BYTE_ORDER == Z_BIG_ENDIAN) ? BigEndianness : LittleEndianness;
+			if (len >= 4 && memcmp(chars, be, 4) == 0)
+				endian = BigEndianness;
+			else if (len >= 4 && memcmp(chars, le, 4) == 0)
+				endian = LittleEndianness;
+			state->state_data[Endian] = endian;
+		}
+		return to & ~size_t(3);
+	}
+
+	string Utf32Codec::_name()
 	{
 		return "UTF-32";
 	}
 
-	list<string> Utf32Codec::aliases() const
+	list<string> Utf32Codec::_aliases()
 	{
 		list<string> list;
 		return list;
 	}
 
-	int Utf32BECodec::mibEnum() const
+	int Utf32BECodec::_mibEnum()
 	{
 		return 1018;
 	}
 
-	string Utf32BECodec::name() const
+	string Utf32BECodec::_name()
 	{
 		return "UTF-32BE";
 	}
 
-	list<string> Utf32BECodec::aliases() const
+	list<string> Utf32BECodec::_aliases()
 	{
 		list<string> list;
 		return list;
 	}
 
-	int Utf32LECodec::mibEnum() const
+	int Utf32LECodec::_mibEnum()
 	{
 		return 1019;
 	}
 
-	string Utf32LECodec::name() const
+	string Utf32LECodec::_name()
 	{
 		return "UTF-32LE";
 	}
 
-	list<string> Utf32LECodec::aliases() const
+	list<string> Utf32LECodec::_aliases()
 	{
 		list<string> list;
 		return list;
@@ -70,6 +70,12 @@ namespace zdytool {
 
 		static void appendUcs4(uint *&ptr, uint uc)
 		{ *ptr++ = uc; }
+
+		static void appendUtf16(char32_t *&ptr, ushort uc)
+		{ *ptr++ = uc; }
+
+		static void appendUcs4(char32_t *&ptr, uint uc)
+		{ *ptr++ = uc; }
 	};
 
 	struct Utf8BaseTraitsNoAscii : public Utf8BaseTraits
@@ -251,42 +257,77 @@ namespace zdytool {
 
 	struct Utf8
 	{
-		static ushort *convertToUnicode(ushort *, const char *, int);
-		static u16string convertToUnicode(const char *, int);
-		static u16string convertToUnicode(const char *, int, TextCodec::ConverterState *);
-		static string convertFromUnicode(const ushort *, int);
-		static string convertFromUnicode(const ushort *, int, TextCodec::ConverterState *);
+		static ushort *convertToUnicode(ushort *, const char *, size_t);
+		static u16string convertToUnicode(const char *, size_t);
+		static u16string convertToUnicode(const char *, size_t, TextCodec::ConverterState *);
+		static TextCodec::ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, TextCodec::ConverterState *);
+		static TextCodec::ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, TextCodec::ConverterState *);
+		static string convertFromUnicode(const ushort *, size_t);
+		static string convertFromUnicode(const ushort *, size_t, TextCodec::ConverterState *);
+		static TextCodec::ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, TextCodec::ConverterState *);
+		static size_t maxDecodedLength(size_t, const TextCodec::ConverterState *);
+		static size_t maxEncodedLength(size_t, const TextCodec::ConverterState *);
 		struct ValidUtf8Result {
 			bool isValidUtf8;
 			bool isValidAscii;
 		};
 		static ValidUtf8Result isValidUtf8(const char *, size_t);
-		static int compareUtf8(const char *, size_t, const ushort *, int);
+		static bool countUtf8(const char *, size_t, size_t *, size_t *);
+		static int compareUtf8(const char *, size_t, const ushort *, size_t);
 		static int compareUtf8(const char *, size_t, string s);
 	};
 
 	struct Utf16
 	{
-		static u16string convertToUnicode(const char *, int, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
-		static string convertFromUnicode(const ushort *, int, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static u16string convertToUnicode(const char *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static string convertFromUnicode(const ushort *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertFromUcs4(char *, size_t, const char32_t *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static size_t maxDecodedLength(size_t, const TextCodec::ConverterState *);
+		static size_t maxEncodedLength(size_t, const TextCodec::ConverterState *);
 	};
 
 	struct Utf32
 	{
-		static u16string convertToUnicode(const char *, int, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
-		static string convertFromUnicode(const ushort *, int, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static u16string convertToUnicode(const char *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static string convertFromUnicode(const ushort *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static TextCodec::ConversionResult convertFromUcs4(char *, size_t, const char32_t *, size_t, TextCodec::ConverterState *, DataEndianness = DetectEndianness);
+		static size_t maxDecodedLength(size_t, const TextCodec::ConverterState *);
+		static size_t maxEncodedLength(size_t, const TextCodec::ConverterState *);
 	};
 
 	class Utf8Codec : public TextCodec {
 	public:
 		~Utf8Codec();
 
-		string name() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases() { return list<string>(); }
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
-		void convertToUnicode(u16string *target, const char *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t nextSyncPoint(const char *, size_t, size_t) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
+		size_t nextEncodeSyncPoint(const ushort *, size_t, size_t) const;
+		size_t decodedLength(const char *, size_t, const ConverterState *) const;
+		size_t codePointCount(const char *, size_t, const ConverterState *) const;
+		size_t encodedLength(const ushort *, size_t, const ConverterState *) const;
+		bool validateToUnicode(const char *, size_t) const;
+		bool validateFromUnicode(const ushort *, size_t) const;
 	};
 
 	class Utf16Codec : public TextCodec {
@@ -295,12 +336,23 @@ namespace zdytool {
 		Utf16Codec() { e = DetectEndianness; }
 		~Utf16Codec();
 
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUcs4(char *, size_t, const char32_t *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
 
 	protected:
 		DataEndianness e;
@@ -309,17 +361,25 @@ namespace zdytool {
 	class Utf16BECodec : public Utf16Codec {
 	public:
 		Utf16BECodec() : Utf16Codec() { e = BigEndianness; }
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 	};
 
 	class Utf16LECodec : public Utf16Codec {
 	public:
 		Utf16LECodec() : Utf16Codec() { e = LittleEndianness; }
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 	};
 
 	class Utf32Codec : public TextCodec {
@@ -327,12 +387,23 @@ namespace zdytool {
 		Utf32Codec() { e = DetectEndianness; }
 		~Utf32Codec();
 
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 
 		u16string convertToUnicode(const char *, int, ConverterState *) const;
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
+		ConversionResult convertToUnicode(ushort *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUnicode(char *, size_t, const ushort *, size_t, ConverterState *) const;
+		ConversionResult convertToUcs4(char32_t *, size_t, const char *, size_t, ConverterState *) const;
+		ConversionResult convertFromUcs4(char *, size_t, const char32_t *, size_t, ConverterState *) const;
+		size_t maxDecodedLength(size_t, const ConverterState *) const;
+		size_t maxEncodedLength(size_t, const ConverterState *) const;
+		size_t previousSyncPoint(const char *, size_t, size_t, ConverterState *) const;
 
 	protected:
 		DataEndianness e;
@@ -341,17 +412,25 @@ namespace zdytool {
 	class Utf32BECodec : public Utf32Codec {
 	public:
 		Utf32BECodec() : Utf32Codec() { e = BigEndianness; }
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 	};
 
 	class Utf32LECodec : public Utf32Codec {
 	public:
 		Utf32LECodec() : Utf32Codec() { e = LittleEndianness; }
-		string name() const;
-		list<string> aliases() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases();
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 	};
 }
 #endif // UTFCODEC_P_H
@@ -207,12 +207,12 @@ namespace zdytool {
 	}
 
 
-	string WindowsLocalCodec::name() const
+	string WindowsLocalCodec::_name()
 	{
 		return "System";
 	}
 
-	int WindowsLocalCodec::mibEnum() const
+	int WindowsLocalCodec::_mibEnum()
 	{
 		return 0;
 	}
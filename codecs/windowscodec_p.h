@@ -33,8 +33,13 @@ namespace zdytool {
 		string convertFromUnicode(const ushort *, int, ConverterState *) const;
 		u16string convertToUnicodeCharByChar(const char *chars, int length, ConverterState *state) const;
 
-		string name() const;
-		int mibEnum() const;
+		static string _name();
+		static list<string> _aliases() { return list<string>(); }
+		static int _mibEnum();
+
+		string name() const { return _name(); }
+		list<string> aliases() const { return _aliases(); }
+		int mibEnum() const { return _mibEnum(); }
 
 	};
 }
@@ -22,7 +22,14 @@ HEADERS += \
     ../codecs/tsciicodec_p.h \
     ../codecs/utfcodec_p.h \
     ../codecs/textcodec_p.h \
-    ../codecs/jpunicode_p.h
+    ../codecs/jpunicode_p.h \
+    ../codecs/textstreambuf.h \
+    ../codecs/textfile.h \
+    ../codecs/textpipeline.h \
+    ../codecs/textlines.h \
+    ../codecs/textcodepoints.h \
+    ../codecs/textindex.h \
+    ../codecs/textkernels.h
 
 SOURCES += \
     ../codecs/gb18030codec.cpp \
@@ -37,7 +44,14 @@ SOURCES += \
     ../codecs/textcodec.cpp \
     ../codecs/tsciicodec.cpp \
     ../codecs/utfcodec.cpp \
-    ../codecs/jpunicode.cpp
+    ../codecs/jpunicode.cpp \
+    ../codecs/textstreambuf.cpp \
+    ../codecs/textfile.cpp \
+    ../codecs/textpipeline.cpp \
+    ../codecs/textlines.cpp \
+    ../codecs/textcodepoints.cpp \
+    ../codecs/textindex.cpp \
+    ../codecs/textkernels.cpp
 	
 	
 win32{
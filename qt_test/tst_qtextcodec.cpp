@@ -37,6 +37,11 @@
 # include <qprocess.h>
 #endif
 #include <QThreadPool>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
 class Q_TextDecoder {
 public:
     TextDecoder *m_tdecode;
@@ -163,6 +168,65 @@ private slots:
     void shiftJis();
 #endif
     void userCodec();
+
+    void bufferConversion_data();
+    void bufferConversion();
+    void bufferConversionChunked_data();
+    void bufferConversionChunked();
+    void outputLengths_data();
+    void outputLengths();
+    void appendConversion_data();
+    void appendConversion();
+    void sizeTypeLengths_data();
+    void sizeTypeLengths();
+    void transcoder_data();
+    void transcoder();
+    void ucs4_data();
+    void ucs4();
+    void ucs4Invalid_data();
+    void ucs4Invalid();
+    void allocatorStrings_data();
+    void allocatorStrings();
+    void resetAndPool_data();
+    void resetAndPool();
+    void decoderPoolThreads();
+    void inlineState_data();
+    void inlineState();
+    void batchConversion_data();
+    void batchConversion();
+    void validation_data();
+    void validation();
+    void codePointCounts_data();
+    void codePointCounts();
+    void invalidSequences_data();
+    void invalidSequences();
+    void streambufs_data();
+    void streambufs();
+    void fileTranscoding_data();
+    void fileTranscoding();
+    void parallelDecoding_data();
+    void parallelDecoding();
+    void parallelEncoding_data();
+    void parallelEncoding();
+    void pipelinedDecoder_data();
+    void pipelinedDecoder();
+    void pipelinedDecoderIdle();
+    void lineDecoder_data();
+    void lineDecoder();
+    void codePointIterator_data();
+    void codePointIterator();
+    void decodeIndex_data();
+    void decodeIndex();
+    void decodeBackward_data();
+    void decodeBackward();
+    void kernels_data();
+    void kernels();
+    void codecNameLookup_data();
+    void codecNameLookup();
+    void codecNameLookupThreads();
+    void lazyCodecs();
+    void userCodecPrecedence();
+    void transcoderCodecState();
 };
 
 void tst_QTextCodec::toUnicode_data()
@@ -2526,6 +2590,1930 @@ void tst_QTextCodec::userCodec()
     QCOMPARE(pcodec.m_tcodec, codec.m_tcodec);
 }
 
+// A line with characters from many scripts and two outside the BMP, as
+// UTF-16
+static std::basic_string<uint16_t> sampleText()
+{
+    static const char utf8[] =
+        "Hello, world! caf\xc3\xa9 \xc2\xa3\xe2\x82\xac "
+        "\xce\xb1\xce\xb2\xce\xb3 \xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 "
+        "\xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d \xd8\xb3\xd9\x84\xd8\xa7\xd9\x85 "
+        "\xe0\xa4\xa8\xe0\xa4\xae\xe0\xa4\xb8\xe0\xa5\x8d\xe0\xa4\xa4\xe0\xa5\x87 "
+        "\xe0\xae\xb5\xe0\xae\xa3\xe0\xae\x95\xe0\xaf\x8d\xe0\xae\x95\xe0\xae\xae\xe0\xaf\x8d "
+        "\xe0\xb8\xaa\xe0\xb8\xa7\xe0\xb8\xb1\xe0\xb8\xaa\xe0\xb8\x94\xe0\xb8\xb5 "
+        "\xe4\xbd\xa0\xe5\xa5\xbd\xe4\xb8\x96\xe7\x95\x8c \xe3\x81\x93\xe3\x82\x93\xe3\x81\xab\xe3\x81\xa1\xe3\x81\xaf "
+        "\xe3\x82\xab\xe3\x82\xbf\xef\xbd\xb6\xef\xbe\x80 \xec\x95\x88\xeb\x85\x95\xed\x95\x98\xec\x84\xb8\xec\x9a\x94 "
+        "\xf0\xa0\x80\x8b\xf0\x9f\x98\x80 end\r\n";
+    return TextCodec::codecForName("UTF-8")->toUnicode(utf8, sizeof(utf8) - 1);
+}
+
+// Adds a "mib" column and a row for every codec
+static void addCodecRows()
+{
+    QTest::addColumn<int>("mib");
+    const std::list<int> mibs = TextCodec::availableMibs();
+    for (int mib : mibs)
+        QTest::newRow(TextCodec::codecForMib(mib)->name().c_str()) << mib;
+}
+
+void tst_QTextCodec::bufferConversion_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::bufferConversion()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+    QVERIFY(!decoded.empty());
+
+    // a conversion that runs out of room stops at a character and resumes
+    // there; two units hold any character
+    for (size_t room = 2; room <= 5; ++room) {
+        TextCodec::ConverterState state;
+        std::basic_string<uint16_t> result;
+        uint16_t buffer[5];
+        size_t pos = 0;
+        TextCodec::ConversionResult r;
+        do {
+            r = codec->toUnicode(buffer, room, encoded.data() + pos, encoded.size() - pos, &state);
+            QVERIFY(r.produced <= room);
+            QVERIFY(r.consumed || r.produced);
+            result.append(buffer, r.produced);
+            pos += r.consumed;
+        } while (r.status == TextCodec::ConversionOutputFull);
+        QCOMPARE(pos, encoded.size());
+        QCOMPARE(r.status, TextCodec::ConversionOk);
+        QCOMPARE(result, decoded);
+    }
+
+    // nine bytes hold any character with a byte order mark, or with the
+    // shift into its character set and back
+    for (size_t room = 9; room <= 12; ++room) {
+        TextCodec::ConverterState state;
+        std::basic_string<char> result;
+        char buffer[12];
+        size_t pos = 0;
+        TextCodec::ConversionResult r;
+        do {
+            r = codec->fromUnicode(buffer, room, decoded.data() + pos, decoded.size() - pos, &state);
+            QVERIFY(r.produced <= room);
+            QVERIFY(r.consumed || r.produced);
+            result.append(buffer, r.produced);
+            pos += r.consumed;
+        } while (r.status == TextCodec::ConversionOutputFull);
+        QCOMPARE(pos, decoded.size());
+        QCOMPARE(codec->toUnicode(result.data(), result.size()), decoded);
+    }
+
+    // the stateless buffer conversions give what the string ones give
+    std::basic_string<uint16_t> units(codec->maxDecodedLength(encoded.size()), 0);
+    TextCodec::ConversionResult r = codec->toUnicode(&units[0], units.size(), encoded.data(), encoded.size());
+    QCOMPARE(r.status, TextCodec::ConversionOk);
+    QCOMPARE(r.consumed, encoded.size());
+    units.resize(r.produced);
+    QCOMPARE(units, decoded);
+
+    std::basic_string<char> bytes(codec->maxEncodedLength(decoded.size()), '\0');
+    r = codec->fromUnicode(&bytes[0], bytes.size(), decoded.data(), decoded.size());
+    QCOMPARE(r.status, TextCodec::ConversionOk);
+    QCOMPARE(r.consumed, decoded.size());
+    bytes.resize(r.produced);
+    QCOMPARE(bytes, codec->fromUnicode(decoded.data(), decoded.size()));
+}
+
+void tst_QTextCodec::bufferConversionChunked_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::bufferConversionChunked()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // how the input is cut into chunks does not change the result, even
+    // when a cut falls inside a character
+    for (size_t chunk = 1; chunk <= 5; ++chunk) {
+        TextCodec::ConverterState state;
+        std::basic_string<uint16_t> result;
+        std::basic_string<uint16_t> buffer;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk) {
+            const size_t length = std::min(chunk, encoded.size() - pos);
+            buffer.resize(codec->maxDecodedLength(length, &state));
+            TextCodec::ConversionResult r = codec->toUnicode(&buffer[0], buffer.size(), encoded.data() + pos, length, &state);
+            QVERIFY(r.status != TextCodec::ConversionOutputFull);
+            QCOMPARE(r.consumed, length);
+            result.append(buffer.data(), r.produced);
+        }
+        QCOMPARE(state.remainingChars, 0);
+        QCOMPARE(result, decoded);
+
+        TextCodec::ConverterState encodeState;
+        std::basic_string<char> bytes;
+        std::basic_string<char> out;
+        for (size_t pos = 0; pos < decoded.size(); pos += chunk) {
+            const size_t length = std::min(chunk, decoded.size() - pos);
+            out.resize(codec->maxEncodedLength(length, &encodeState));
+            TextCodec::ConversionResult r = codec->fromUnicode(&out[0], out.size(), decoded.data() + pos, length, &encodeState);
+            QVERIFY(r.status != TextCodec::ConversionOutputFull);
+            QCOMPARE(r.consumed, length);
+            bytes.append(out.data(), r.produced);
+        }
+        QCOMPARE(codec->toUnicode(bytes.data(), bytes.size()), decoded);
+    }
+}
+
+void tst_QTextCodec::outputLengths_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::outputLengths()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // every byte value, so that the invalid sequences are counted too
+    std::basic_string<char> bytes;
+    for (int i = 0; i < 256; ++i)
+        bytes += char(i);
+    bytes += encoded;
+    const std::basic_string<uint16_t> garbage = codec->toUnicode(bytes.data(), bytes.size());
+
+    QCOMPARE(codec->decodedLength(encoded.data(), encoded.size()), decoded.size());
+    QCOMPARE(codec->decodedLength(bytes.data(), bytes.size()), garbage.size());
+    QCOMPARE(codec->encodedLength(decoded.data(), decoded.size()), codec->fromUnicode(decoded.data(), decoded.size()).size());
+    QCOMPARE(codec->encodedLength(garbage.data(), garbage.size()), codec->fromUnicode(garbage.data(), garbage.size()).size());
+    QVERIFY(codec->maxDecodedLength(encoded.size()) >= decoded.size());
+    QVERIFY(codec->maxDecodedLength(bytes.size()) >= garbage.size());
+    QVERIFY(codec->maxEncodedLength(decoded.size()) >= encoded.size());
+
+    // with a state, the lengths are those of the next call, and asking
+    // for them leaves the state alone
+    for (size_t cut = 1; cut < 8 && cut < bytes.size(); ++cut) {
+        TextCodec::ConverterState state;
+        codec->toUnicode(bytes.data(), cut, &state);
+        const size_t exact = codec->decodedLength(bytes.data() + cut, bytes.size() - cut, &state);
+        const size_t bound = codec->maxDecodedLength(bytes.size() - cut, &state);
+        const std::basic_string<uint16_t> rest = codec->toUnicode(bytes.data() + cut, bytes.size() - cut, &state);
+        QCOMPARE(exact, rest.size());
+        QVERIFY(bound >= rest.size());
+    }
+
+    // the same for an encoder holding the first half of a surrogate pair
+    const size_t high = text.find_first_of(uint16_t(0xd840));
+    QVERIFY(high != std::basic_string<uint16_t>::npos);
+    TextCodec::ConverterState state;
+    codec->fromUnicode(text.data(), high + 1, &state);
+    const size_t exact = codec->encodedLength(text.data() + high + 1, text.size() - high - 1, &state);
+    const size_t bound = codec->maxEncodedLength(text.size() - high - 1, &state);
+    const std::basic_string<char> rest = codec->fromUnicode(text.data() + high + 1, text.size() - high - 1, &state);
+    QCOMPARE(exact, rest.size());
+    QVERIFY(bound >= rest.size());
+
+    // without a state, the held back half is converted with the rest
+    QCOMPARE(codec->encodedLength(text.data(), high + 1), codec->fromUnicode(text.data(), high + 1).size());
+}
+
+void tst_QTextCodec::appendConversion_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::appendConversion()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+    const std::basic_string<uint16_t> prefix(3, uint16_t('>'));
+    const std::basic_string<char> bytePrefix(3, '>');
+
+    // what is already in the target is kept, whatever the chunks
+    for (size_t chunk = 1; chunk <= 5; ++chunk) {
+        TextDecoder decoder(codec);
+        std::basic_string<uint16_t> target = prefix;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk)
+            decoder.toUnicode(&target, encoded.data() + pos, std::min(chunk, encoded.size() - pos));
+        QVERIFY(!decoder.hasFailure());
+        QCOMPARE(target, prefix + decoded);
+
+        TextCodec::ConverterState state;
+        target = prefix;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk)
+            codec->appendToUnicode(&target, encoded.data() + pos, std::min(chunk, encoded.size() - pos), &state);
+        QCOMPARE(target, prefix + decoded);
+
+        TextCodec::ConverterState encodeState;
+        std::basic_string<char> bytes = bytePrefix;
+        for (size_t pos = 0; pos < decoded.size(); pos += chunk)
+            codec->appendFromUnicode(&bytes, decoded.data() + pos, std::min(chunk, decoded.size() - pos), &encodeState);
+        QCOMPARE(bytes.substr(0, bytePrefix.size()), bytePrefix);
+        QCOMPARE(codec->toUnicode(bytes.data() + bytePrefix.size(), bytes.size() - bytePrefix.size()), decoded);
+    }
+
+    // a stateless append is the stateless conversion
+    std::basic_string<uint16_t> target = prefix;
+    codec->appendToUnicode(&target, encoded.data(), encoded.size());
+    QCOMPARE(target, prefix + decoded);
+    std::basic_string<char> bytes = bytePrefix;
+    codec->appendFromUnicode(&bytes, decoded.data(), decoded.size());
+    QCOMPARE(bytes, bytePrefix + codec->fromUnicode(decoded.data(), decoded.size()));
+}
+
+void tst_QTextCodec::sizeTypeLengths_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::sizeTypeLengths()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // lengths of any integer type pick the same overload
+    QCOMPARE(codec->toUnicode(encoded.data(), int(encoded.size())), decoded);
+    QCOMPARE(codec->toUnicode(encoded.data(), long(encoded.size())), decoded);
+    QCOMPARE(codec->toUnicode(encoded.data(), unsigned(encoded.size())), decoded);
+    QCOMPARE(codec->toUnicode(encoded.data(), ptrdiff_t(encoded.size())), decoded);
+    const std::basic_string<char> reencoded = codec->fromUnicode(decoded.data(), decoded.size());
+    QCOMPARE(codec->fromUnicode(decoded.data(), int(decoded.size())), reencoded);
+    QCOMPARE(codec->fromUnicode(decoded.data(), uint64_t(decoded.size())), reencoded);
+    TextDecoder decoder(codec);
+    QCOMPARE(decoder.toUnicode(encoded.data(), long(encoded.size())), decoded);
+    TextEncoder encoder(codec);
+    const std::basic_string<char> bytes = encoder.fromUnicode(decoded.data(), long(decoded.size()));
+    QCOMPARE(codec->toUnicode(bytes.data(), bytes.size()), decoded);
+
+    // the bounds saturate instead of wrapping around
+    const size_t huge = std::numeric_limits<size_t>::max();
+    const size_t sizes[] = { 0, 1, 1000, size_t(INT_MAX) + 1, huge / 4, huge / 2, huge - 1, huge };
+    for (size_t i = 1; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        QVERIFY(codec->maxDecodedLength(sizes[i]) >= codec->maxDecodedLength(sizes[i - 1]));
+        QVERIFY(codec->maxEncodedLength(sizes[i]) >= codec->maxEncodedLength(sizes[i - 1]));
+        QVERIFY(codec->maxEncodedLength(sizes[i]) >= sizes[i]);
+    }
+}
+
+void tst_QTextCodec::transcoder_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::transcoder()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+    const TextCodec *utf8 = TextCodec::codecForName("UTF-8");
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+    const std::basic_string<char> decodedUtf8 = utf8->fromUnicode(decoded.data(), decoded.size());
+
+    // to UTF-8 and back, in chunks and through small output buffers
+    for (size_t chunk = 1; chunk <= 5; ++chunk) {
+        TextTranscoder toUtf8(codec, utf8);
+        std::basic_string<char> result;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk)
+            toUtf8.transcode(&result, encoded.data() + pos, std::min(chunk, encoded.size() - pos));
+        QVERIFY(!toUtf8.hasFailure());
+        QCOMPARE(utf8->toUnicode(result.data(), result.size()), decoded);
+
+        TextTranscoder fromUtf8(utf8, codec);
+        result.clear();
+        for (size_t pos = 0; pos < decodedUtf8.size(); pos += chunk)
+            result += fromUtf8.transcode(decodedUtf8.data() + pos, std::min(chunk, decodedUtf8.size() - pos));
+        QCOMPARE(codec->toUnicode(result.data(), result.size()), decoded);
+    }
+
+    for (size_t room = 9; room <= 12; ++room) {
+        TextTranscoder transcoder(codec, utf8);
+        std::basic_string<char> result;
+        char buffer[12];
+        size_t pos = 0;
+        TextCodec::ConversionResult r;
+        do {
+            r = transcoder.transcode(buffer, room, encoded.data() + pos, encoded.size() - pos);
+            QVERIFY(r.produced <= room);
+            QVERIFY(r.consumed || r.produced);
+            result.append(buffer, r.produced);
+            pos += r.consumed;
+        } while (r.status == TextCodec::ConversionOutputFull);
+        QCOMPARE(pos, encoded.size());
+        QCOMPARE(utf8->toUnicode(result.data(), result.size()), decoded);
+    }
+}
+
+// Joins the surrogate pairs of \a text into code points
+static std::basic_string<char32_t> toCodePoints(const std::basic_string<uint16_t> &text)
+{
+    std::basic_string<char32_t> result;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char32_t uc = text[i];
+        if ((uc & 0xfc00) == 0xd800 && i + 1 < text.size() && (text[i + 1] & 0xfc00) == 0xdc00)
+            uc = (uc << 10) + text[++i] - 0x35fdc00;
+        result += uc;
+    }
+    return result;
+}
+
+void tst_QTextCodec::ucs4_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::ucs4()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+    const std::basic_string<char32_t> codePoints = toCodePoints(decoded);
+
+    QCOMPARE(codec->toUcs4(encoded), codePoints);
+    QCOMPARE(codec->fromUcs4(codePoints), codec->fromUnicode(decoded.data(), decoded.size()));
+
+    // a buffer for a single code point is enough to make progress
+    for (size_t room = 1; room <= 3; ++room) {
+        TextCodec::ConverterState state;
+        std::basic_string<char32_t> result;
+        char32_t buffer[3];
+        size_t pos = 0;
+        TextCodec::ConversionResult r;
+        do {
+            r = codec->toUcs4(buffer, room, encoded.data() + pos, encoded.size() - pos, &state);
+            QVERIFY(r.produced <= room);
+            QVERIFY(r.consumed || r.produced);
+            result.append(buffer, r.produced);
+            pos += r.consumed;
+        } while (r.status == TextCodec::ConversionOutputFull);
+        QCOMPARE(pos, encoded.size());
+        QCOMPARE(result, codePoints);
+    }
+
+    for (size_t chunk = 1; chunk <= 5; ++chunk) {
+        TextDecoder decoder(codec);
+        std::basic_string<char32_t> result;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk)
+            result += decoder.toUcs4(encoded.data() + pos, std::min(chunk, encoded.size() - pos));
+        QCOMPARE(result, codePoints);
+
+        TextEncoder encoder(codec);
+        std::basic_string<char> bytes;
+        for (size_t pos = 0; pos < codePoints.size(); pos += chunk)
+            bytes += encoder.fromUcs4(codePoints.data() + pos, std::min(chunk, codePoints.size() - pos));
+        QCOMPARE(codec->toUnicode(bytes.data(), bytes.size()), decoded);
+    }
+
+    for (size_t room = 9; room <= 12; ++room) {
+        TextCodec::ConverterState state;
+        std::basic_string<char> result;
+        char buffer[12];
+        size_t pos = 0;
+        TextCodec::ConversionResult r;
+        do {
+            r = codec->fromUcs4(buffer, room, codePoints.data() + pos, codePoints.size() - pos, &state);
+            QVERIFY(r.produced <= room);
+            QVERIFY(r.consumed || r.produced);
+            result.append(buffer, r.produced);
+            pos += r.consumed;
+        } while (r.status == TextCodec::ConversionOutputFull);
+        QCOMPARE(pos, codePoints.size());
+        QCOMPARE(codec->toUnicode(result.data(), result.size()), decoded);
+    }
+}
+
+void tst_QTextCodec::ucs4Invalid_data()
+{
+    QTest::addColumn<QByteArray>("codecName");
+    QTest::addColumn<QByteArray>("input");
+    QTest::addColumn<QList<uint> >("codePoints");
+    QTest::addColumn<int>("invalid");
+
+    QTest::newRow("utf32le-valid") << QByteArray("UTF-32LE") << QByteArray("\xff\xff\x10\x00\x41\x00\x00\x00", 8)
+                                   << (QList<uint>() << 0x10ffff << 0x41) << 0;
+    QTest::newRow("utf32le-range") << QByteArray("UTF-32LE") << QByteArray("\x00\x00\x11\x00\x41\x00\x00\x00", 8)
+                                   << (QList<uint>() << 0xfffd << 0x41) << 1;
+    QTest::newRow("utf32le-surrogate") << QByteArray("UTF-32LE") << QByteArray("\x00\xd8\x00\x00\x41\x00\x00\x00", 8)
+                                       << (QList<uint>() << 0xfffd << 0x41) << 1;
+    QTest::newRow("utf32le-both") << QByteArray("UTF-32LE")
+                                  << QByteArray("\x00\x00\x11\x00\x00\xd8\x00\x00\x41\x00\x00\x00", 12)
+                                  << (QList<uint>() << 0xfffd << 0xfffd << 0x41) << 2;
+    QTest::newRow("utf32be-huge") << QByteArray("UTF-32BE") << QByteArray("\xff\xff\xff\xff\x00\x00\x00\x42", 8)
+                                  << (QList<uint>() << 0xfffd << 0x42) << 1;
+    QTest::newRow("utf16le-lone-low") << QByteArray("UTF-16LE") << QByteArray("\x00\xdc\x41\x00", 4)
+                                      << (QList<uint>() << 0xfffd << 0x41) << 1;
+    QTest::newRow("utf16be-lone-high") << QByteArray("UTF-16BE") << QByteArray("\xd8\x00\x00\x41", 4)
+                                       << (QList<uint>() << 0xfffd << 0x41) << 1;
+    QTest::newRow("utf16be-pair") << QByteArray("UTF-16BE") << QByteArray("\xd8\x40\xdc\x0b\x00\x41", 6)
+                                  << (QList<uint>() << 0x2000b << 0x41) << 0;
+}
+
+void tst_QTextCodec::ucs4Invalid()
+{
+    QFETCH(QByteArray, codecName);
+    QFETCH(QByteArray, input);
+    QFETCH(QList<uint>, codePoints);
+    QFETCH(int, invalid);
+
+    const TextCodec *codec = TextCodec::codecForName(codecName.toStdString());
+    QVERIFY(codec);
+
+    // only Unicode scalar values come out, and the others are counted
+    std::basic_string<char32_t> expected;
+    std::basic_string<char32_t> expectedNull;
+    for (int i = 0; i < codePoints.size(); ++i) {
+        expected += char32_t(codePoints.at(i));
+        expectedNull += codePoints.at(i) == 0xfffd ? char32_t(0) : char32_t(codePoints.at(i));
+    }
+
+    TextCodec::ConverterState state;
+    QCOMPARE(codec->toUcs4(input.constData(), input.size(), &state), expected);
+    QCOMPARE(state.invalidChars, invalid);
+    QCOMPARE(codec->toUcs4(input.toStdString()), expected);
+
+    TextCodec::ConverterState nullState(TextCodec::ConvertInvalidToNull);
+    QCOMPARE(codec->toUcs4(input.constData(), input.size(), &nullState), expectedNull);
+    QCOMPARE(nullState.invalidChars, invalid);
+
+    // the same a code point at a time
+    TextCodec::ConverterState bufferState;
+    std::basic_string<char32_t> result;
+    size_t pos = 0;
+    TextCodec::ConversionResult r;
+    do {
+        char32_t uc;
+        r = codec->toUcs4(&uc, 1, input.constData() + pos, input.size() - pos, &bufferState);
+        QVERIFY(r.consumed || r.produced);
+        result.append(&uc, r.produced);
+        pos += r.consumed;
+    } while (r.status == TextCodec::ConversionOutputFull);
+    QCOMPARE(result, expected);
+    QCOMPARE(bufferState.invalidChars, invalid);
+}
+
+// An allocator that counts the bytes it hands out
+template <typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+
+    explicit CountingAllocator(size_t *counter) : allocated(counter) {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &other) : allocated(other.allocated) {}
+
+    T *allocate(size_t n)
+    {
+        *allocated += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U> &other) const { return allocated == other.allocated; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U> &other) const { return allocated != other.allocated; }
+
+    size_t *allocated;
+};
+
+void tst_QTextCodec::allocatorStrings_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::allocatorStrings()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    typedef std::basic_string<uint16_t, std::char_traits<uint16_t>, CountingAllocator<uint16_t> > Units;
+    typedef std::basic_string<char, std::char_traits<char>, CountingAllocator<char> > Bytes;
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // the conversions give what the default strings hold, and allocate
+    // through the allocator they were given
+    size_t allocated = 0;
+    const CountingAllocator<uint16_t> unitAllocator(&allocated);
+    const CountingAllocator<char> byteAllocator(&allocated);
+    const Units units = codec->toUnicode(encoded.data(), encoded.size(), unitAllocator);
+    QCOMPARE(std::basic_string<uint16_t>(units.data(), units.size()), decoded);
+    QVERIFY(allocated >= units.size() * sizeof(uint16_t));
+
+    allocated = 0;
+    const Bytes bytes = codec->fromUnicode(decoded.data(), decoded.size(), byteAllocator);
+    QCOMPARE(std::basic_string<char>(bytes.data(), bytes.size()), codec->fromUnicode(decoded.data(), decoded.size()));
+    QVERIFY(allocated >= bytes.size());
+
+    // appending keeps what the string already holds
+    Units prefixed(unitAllocator);
+    prefixed.push_back('>');
+    codec->appendToUnicode(&prefixed, encoded.data(), encoded.size());
+    QCOMPARE(prefixed.size(), decoded.size() + 1);
+    QCOMPARE(std::basic_string<uint16_t>(prefixed.data() + 1, prefixed.size() - 1), decoded);
+
+    Bytes prefixedBytes(byteAllocator);
+    prefixedBytes.push_back('>');
+    codec->appendFromUnicode(&prefixedBytes, decoded.data(), decoded.size());
+    QCOMPARE(std::basic_string<char>(prefixedBytes.data() + 1, prefixedBytes.size() - 1),
+             codec->fromUnicode(decoded.data(), decoded.size()));
+
+    // a decoder and an encoder fed in chunks give the same result
+    for (size_t chunk = 1; chunk <= 5; ++chunk) {
+        TextDecoder decoder(codec);
+        Units result(unitAllocator);
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk) {
+            const Units part = decoder.toUnicode(encoded.data() + pos, std::min(chunk, encoded.size() - pos),
+                                                 unitAllocator);
+            result.append(part);
+        }
+        QCOMPARE(std::basic_string<uint16_t>(result.data(), result.size()), decoded);
+
+        TextEncoder encoder(codec);
+        Bytes out(byteAllocator);
+        for (size_t pos = 0; pos < decoded.size(); pos += chunk)
+            encoder.fromUnicode(&out, decoded.data() + pos, std::min(chunk, decoded.size() - pos));
+        QCOMPARE(codec->toUnicode(out.data(), out.size()), decoded);
+    }
+}
+
+void tst_QTextCodec::resetAndPool_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::resetAndPool()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // a reset decoder forgets a stream that stopped inside a character
+    TextDecoder decoder(codec);
+    for (size_t cut = 1; cut < 8 && cut < encoded.size(); ++cut) {
+        decoder.toUnicode(encoded.data() + encoded.size() - cut, cut);
+        decoder.reset();
+        QCOMPARE(decoder.toUnicode(encoded.data(), encoded.size()), decoded);
+        decoder.reset();
+    }
+
+    // a reset encoder starts over with a byte order mark or initial shift
+    // state, giving the same bytes as a fresh one
+    TextEncoder encoder(codec);
+    const std::basic_string<char> first = encoder.fromUnicode(decoded.data(), decoded.size());
+    encoder.fromUnicode(text.data(), text.size() - 1);
+    encoder.reset();
+    QCOMPARE(encoder.fromUnicode(decoded.data(), decoded.size()), first);
+
+    // a moved decoder carries on where the stream stopped
+    const size_t half = encoded.size() / 2;
+    TextDecoder before(codec);
+    std::basic_string<uint16_t> result = before.toUnicode(encoded.data(), half);
+    TextDecoder after(std::move(before));
+    result += after.toUnicode(encoded.data() + half, encoded.size() - half);
+    QCOMPARE(result, decoded);
+
+    // and so does a moved state
+    TextCodec::ConverterState state;
+    result = codec->toUnicode(encoded.data(), half, &state);
+    TextCodec::ConverterState moved(std::move(state));
+    result += codec->toUnicode(encoded.data() + half, encoded.size() - half, &moved);
+    QCOMPARE(result, decoded);
+    // clear() keeps the flags, including an IgnoreHeader the codec added
+    moved.clear();
+    QCOMPARE(moved.remainingChars, 0);
+    QCOMPARE(moved.invalidChars, 0);
+    moved.flags = TextCodec::DefaultConversion;
+    QCOMPARE(codec->toUnicode(encoded.data(), encoded.size(), &moved), decoded);
+
+    // the pool hands back released decoders, reset, and keeps decoders
+    // with other flags apart
+    TextDecoderPool pool(1);
+    TextDecoder *pooled = pool.acquire(codec);
+    pooled->toUnicode(encoded.data(), half);
+    pool.release(pooled);
+    TextDecoder *other = pool.acquire(codec, TextCodec::IgnoreHeader);
+    QVERIFY(other != pooled);
+    TextDecoder *again = pool.acquire(codec);
+    QCOMPARE(again, pooled);
+    QCOMPARE(again->toUnicode(encoded.data(), encoded.size()), decoded);
+    TextDecoder *extra = pool.acquire(codec);
+    QVERIFY(extra != again);
+    pool.release(again);
+    pool.release(extra);
+    pool.release(other);
+    pool.clear();
+}
+
+void tst_QTextCodec::decoderPoolThreads()
+{
+    const TextCodec *codec = TextCodec::codecForName("UTF-8");
+    QVERIFY(codec);
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+
+    TextDecoderPool pool(4);
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < 200; ++i) {
+                TextDecoder *decoder = pool.acquire(codec);
+                std::basic_string<uint16_t> result;
+                for (size_t pos = 0; pos < encoded.size(); pos += 7)
+                    result += decoder->toUnicode(encoded.data() + pos, std::min<size_t>(7, encoded.size() - pos));
+                if (result != text)
+                    ++mismatches;
+                // leave some decoders in the middle of a character
+                decoder->toUnicode(encoded.data() + encoded.size() - 5, i % 5);
+                pool.release(decoder);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    QCOMPARE(mismatches.load(), 0);
+}
+
+void tst_QTextCodec::inlineState_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::inlineState()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // the built-in codecs keep everything in state_data: the stream can be
+    // handed to a new state after every chunk, and d is never allocated
+    for (size_t chunk = 1; chunk <= 5; ++chunk) {
+        TextCodec::ConverterState state;
+        std::basic_string<uint16_t> result;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk) {
+            result += codec->toUnicode(encoded.data() + pos, std::min(chunk, encoded.size() - pos), &state);
+            QVERIFY(!state.d);
+            QVERIFY(!(state.flags & TextCodec::FreeFunction));
+            TextCodec::ConverterState next(std::move(state));
+            state = std::move(next);
+        }
+        QCOMPARE(result, decoded);
+
+        TextCodec::ConverterState encodeState;
+        std::basic_string<char> bytes;
+        for (size_t pos = 0; pos < decoded.size(); pos += chunk) {
+            bytes += codec->fromUnicode(decoded.data() + pos, std::min(chunk, decoded.size() - pos), &encodeState);
+            QVERIFY(!encodeState.d);
+            TextCodec::ConverterState next(std::move(encodeState));
+            encodeState = std::move(next);
+        }
+        QCOMPARE(codec->toUnicode(bytes.data(), bytes.size()), decoded);
+    }
+
+    // a codec that does allocate d has it released by clear() and handed
+    // over by a move
+    TextCodec::ConverterState state;
+    state.d = malloc(16);
+    TextCodec::ConverterState moved(std::move(state));
+    QVERIFY(!state.d);
+    QVERIFY(moved.d);
+    moved.clear();
+    QVERIFY(!moved.d);
+}
+
+void tst_QTextCodec::batchConversion_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::batchConversion()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    // the words of the sample as separate fields, with an empty field and
+    // a field that stops inside a character
+    const std::basic_string<uint16_t> text = sampleText();
+    std::vector<std::basic_string<uint16_t> > words(1);
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == ' ')
+            words.push_back(std::basic_string<uint16_t>());
+        else
+            words.back() += text[i];
+    }
+    words.push_back(std::basic_string<uint16_t>());
+    std::vector<std::basic_string<char> > fields;
+    for (size_t i = 0; i < words.size(); ++i)
+        fields.push_back(codec->fromUnicode(words[i].data(), words[i].size()));
+    const std::basic_string<char> &nonBmp = fields[fields.size() - 3];
+    fields.push_back(nonBmp.substr(0, nonBmp.size() - 1));
+
+    std::vector<const char *> inputs;
+    std::vector<size_t> lengths;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        inputs.push_back(fields[i].data());
+        lengths.push_back(fields[i].size());
+    }
+
+    // each field decodes as it would on its own, after what the target
+    // already holds
+    std::basic_string<uint16_t> units(3, 'x');
+    std::vector<size_t> offsets(fields.size() + 1);
+    codec->toUnicodeBatch(&units, &offsets[0], &inputs[0], &lengths[0], fields.size());
+    QCOMPARE(offsets[0], size_t(3));
+    QCOMPARE(offsets[fields.size()], units.size());
+    QCOMPARE(units.substr(0, 3), std::basic_string<uint16_t>(3, 'x'));
+    std::vector<std::basic_string<uint16_t> > decoded;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        decoded.push_back(codec->toUnicode(fields[i].data(), fields[i].size()));
+        QCOMPARE(units.substr(offsets[i], offsets[i + 1] - offsets[i]), decoded[i]);
+    }
+
+    std::vector<const uint16_t *> unitInputs;
+    std::vector<size_t> unitLengths;
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        unitInputs.push_back(decoded[i].data());
+        unitLengths.push_back(decoded[i].size());
+    }
+    std::basic_string<char> bytes(2, '>');
+    codec->fromUnicodeBatch(&bytes, &offsets[0], &unitInputs[0], &unitLengths[0], decoded.size());
+    QCOMPARE(offsets[0], size_t(2));
+    QCOMPARE(offsets[decoded.size()], bytes.size());
+    for (size_t i = 0; i < decoded.size(); ++i)
+        QCOMPARE(bytes.substr(offsets[i], offsets[i + 1] - offsets[i]),
+                 codec->fromUnicode(decoded[i].data(), decoded[i].size()));
+
+    // an empty batch leaves the target alone
+    codec->toUnicodeBatch(&units, &offsets[0], &inputs[0], &lengths[0], 0);
+    QCOMPARE(offsets[0], units.size());
+}
+
+void tst_QTextCodec::validation_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::validation()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    std::basic_string<char> repeated;
+    for (int i = 0; i < 40; ++i)
+        repeated += encoded;
+    std::basic_string<char> allBytes;
+    for (int i = 0; i < 256; ++i)
+        allBytes += char(i);
+
+    // validate() agrees with what a full conversion reports
+    std::vector<std::basic_string<char> > inputs;
+    inputs.push_back(std::basic_string<char>());
+    inputs.push_back(encoded);
+    inputs.push_back(repeated);
+    inputs.push_back(allBytes);
+    inputs.push_back(repeated + allBytes);
+    for (size_t cut = 1; cut <= 3; ++cut)
+        inputs.push_back(encoded.substr(0, encoded.size() - cut));
+    inputs.push_back(encoded.substr(0, 20) + "\xff" + encoded.substr(20));
+    inputs.push_back(encoded.substr(0, 20) + "\x80\xfe" + encoded.substr(20));
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        TextCodec::ConverterState state;
+        codec->toUnicode(inputs[i].data(), inputs[i].size(), &state);
+        const bool valid = state.invalidChars == 0 && state.remainingChars == 0;
+        QCOMPARE(codec->validate(inputs[i]), valid);
+        QCOMPARE(codec->validate(inputs[i].data(), inputs[i].size()), valid);
+    }
+    QVERIFY(codec->validate(encoded));
+    QVERIFY(codec->validate(repeated));
+
+    // canEncode() agrees with what a full conversion reports, for the
+    // whole text, every character and a lone surrogate
+    std::vector<std::basic_string<uint16_t> > texts;
+    texts.push_back(text);
+    for (int i = 0; i < 40; ++i)
+        texts.push_back(text.substr(0, text.size() - i));
+    for (size_t i = 0; i < text.size(); ++i)
+        texts.push_back(text.substr(i, 1));
+    texts.push_back(std::basic_string<uint16_t>(1, 0xdc00));
+    for (size_t i = 0; i < texts.size(); ++i) {
+        TextCodec::ConverterState state(TextCodec::ConvertInvalidToNull);
+        codec->fromUnicode(texts[i].data(), texts[i].size(), &state);
+        const bool encodable = state.invalidChars == 0;
+        QCOMPARE(codec->canEncode(texts[i]), encodable);
+        QCOMPARE(codec->canEncode(texts[i].data(), texts[i].size()), encodable);
+        if (texts[i].size() == 1)
+            QCOMPARE(codec->canEncode(texts[i][0]), encodable);
+    }
+}
+
+void tst_QTextCodec::codePointCounts_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::codePointCounts()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    std::basic_string<char> bytes;
+    for (int i = 0; i < 40; ++i)
+        bytes += encoded;
+    for (int i = 0; i < 256; ++i)
+        bytes += char(255 - i);
+
+    // the counts match the decoded text, past the length of any scratch
+    // buffer the counting kernels use; for well-formed input that is the
+    // UTF-16 text with each surrogate pair counted once
+    QCOMPARE(codec->codePointCount(encoded.data(), encoded.size()),
+             toCodePoints(codec->toUnicode(encoded.data(), encoded.size())).size());
+    for (size_t length = 0; length <= bytes.size(); length += (length < 64 ? 1 : 97)) {
+        const std::basic_string<uint16_t> decoded = codec->toUnicode(bytes.data(), length);
+        QCOMPARE(codec->codePointCount(bytes.data(), length), codec->toUcs4(bytes.data(), length).size());
+        QCOMPARE(codec->decodedLength(bytes.data(), length), decoded.size());
+        QCOMPARE(codec->encodedLength(decoded.data(), decoded.size()),
+                 codec->fromUnicode(decoded.data(), decoded.size()).size());
+    }
+
+    // with a state the count is that of the next call, and the state is
+    // left alone
+    for (size_t cut = 1; cut < 8; ++cut) {
+        TextCodec::ConverterState state;
+        codec->toUnicode(bytes.data(), cut, &state);
+        const int remaining = state.remainingChars;
+        const size_t count = codec->codePointCount(bytes.data() + cut, encoded.size() - cut, &state);
+        QCOMPARE(state.remainingChars, remaining);
+        QCOMPARE(count, codec->toUcs4(bytes.data() + cut, encoded.size() - cut, &state).size());
+    }
+}
+
+void tst_QTextCodec::invalidSequences_data()
+{
+    QTest::addColumn<QByteArray>("codecName");
+    QTest::addColumn<QByteArray>("input");
+    QTest::addColumn<QByteArray>("records");
+
+    QTest::newRow("utf8-valid") << QByteArray("UTF-8") << QByteArray("a\xc3\xa9\xe4\xb8\x96") << QByteArray("");
+    QTest::newRow("utf8-split") << QByteArray("UTF-8") << QByteArray("ab\xff" "cd\xe4\xb8" "e\x80\xe4")
+                                << QByteArray("2:ff 5:e4b865 8:80");
+    QTest::newRow("utf8-overlong") << QByteArray("UTF-8") << QByteArray("\xc0\xaf" "a\xf0\x9f\x98" "b")
+                                   << QByteArray("0:c0 1:af 3:f09f9862");
+    QTest::newRow("utf8-four") << QByteArray("UTF-8") << QByteArray("x\xf4\x90\x80\x80y")
+                               << QByteArray("1:f4908080");
+#ifndef Z_NO_BIG_TEXTCODECS
+    QTest::newRow("gb18030") << QByteArray("GB18030") << QByteArray("a\x81\x30\x81\x30\xff\x81\x30\x81\x41")
+                             << QByteArray("5:ff 6:81308141");
+    QTest::newRow("shift-jis") << QByteArray("Shift_JIS") << QByteArray("a\x81\x81\x41\xfd\x81")
+                               << QByteArray("4:fd");
+#endif
+}
+
+// Formats the recorded sequences as "offset:hexbytes", space separated
+static std::string formatInvalidSequences(const std::vector<TextDecoder::InvalidSequence> &sequences)
+{
+    std::string result;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%s%llu:", i ? " " : "", (unsigned long long)sequences[i].offset);
+        result += buffer;
+        for (int j = 0; j < sequences[i].length; ++j) {
+            snprintf(buffer, sizeof(buffer), "%02x", sequences[i].bytes[j]);
+            result += buffer;
+        }
+    }
+    return result;
+}
+
+void tst_QTextCodec::invalidSequences()
+{
+    QFETCH(QByteArray, codecName);
+    QFETCH(QByteArray, input);
+    QFETCH(QByteArray, records);
+    const TextCodec *codec = TextCodec::codecForName(codecName.toStdString());
+    QVERIFY(codec);
+    const std::string bytes = input.toStdString();
+
+    // the same sequences are recorded, with the same bytes, however the
+    // input is cut into calls
+    for (size_t chunk = 1; chunk <= bytes.size(); ++chunk) {
+        TextDecoder decoder(codec, TextCodec::RecordInvalid);
+        for (size_t pos = 0; pos < bytes.size(); pos += chunk)
+            decoder.toUnicode(bytes.data() + pos, std::min(chunk, bytes.size() - pos));
+        QCOMPARE(formatInvalidSequences(decoder.invalidSequences()), records.toStdString());
+        QCOMPARE(decoder.hasFailure(), !records.isEmpty());
+
+        uint16_t buffer[64];
+        TextDecoder bufferDecoder(codec, TextCodec::RecordInvalid);
+        for (size_t pos = 0; pos < bytes.size(); pos += chunk)
+            bufferDecoder.toUnicode(buffer, 64, bytes.data() + pos, std::min(chunk, bytes.size() - pos));
+        QCOMPARE(formatInvalidSequences(bufferDecoder.invalidSequences()), records.toStdString());
+    }
+
+    // the limit keeps the first sequences, and reset() forgets them
+    TextDecoder decoder(codec, TextCodec::RecordInvalid);
+    decoder.setInvalidSequenceLimit(1);
+    decoder.toUnicode(bytes.data(), bytes.size());
+    QCOMPARE(decoder.invalidSequences().size(), size_t(records.isEmpty() ? 0 : 1));
+    decoder.reset();
+    QVERIFY(decoder.invalidSequences().empty());
+    decoder.setInvalidSequenceLimit(16);
+    decoder.toUnicode(bytes.data(), bytes.size());
+    QCOMPARE(formatInvalidSequences(decoder.invalidSequences()), records.toStdString());
+}
+
+void tst_QTextCodec::streambufs_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::streambufs()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+    const TextCodec *utf8 = TextCodec::codecForName("UTF-8");
+
+    const std::basic_string<uint16_t> text = sampleText();
+    std::basic_string<char> encoded;
+    for (int i = 0; i < 20; ++i)
+        encoded += codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // the smallest buffers refill many times, cutting characters apart
+    const size_t bufferSizes[] = { 1, 100, DecodingStreambuf::DefaultBufferSize };
+    for (size_t b = 0; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]); ++b) {
+        const size_t bufferSize = bufferSizes[b];
+
+        // reading one unit at a time and in blocks gives the decoded text
+        std::stringbuf source(encoded);
+        DecodingStreambuf decoding(&source, codec, TextCodec::DefaultConversion, bufferSize);
+        std::basic_string<uint16_t> result;
+        uint16_t block[37];
+        for (;;) {
+            const DecodingStreambuf::int_type ch = decoding.sbumpc();
+            if (ch == DecodingStreambuf::traits_type::eof())
+                break;
+            result += DecodingStreambuf::traits_type::to_char_type(ch);
+            const std::streamsize n = decoding.sgetn(block, 37);
+            result.append(block, size_t(n));
+        }
+        QCOMPARE(result, decoded);
+        QVERIFY(!decoding.hasFailure());
+
+        // writing one unit at a time and in blocks gives bytes that decode
+        // to the text, once flushed
+        std::stringbuf sink;
+        {
+            EncodingStreambuf encoding(&sink, codec, TextCodec::DefaultConversion, bufferSize);
+            for (size_t pos = 0; pos < decoded.size(); pos += 38) {
+                encoding.sputc(decoded[pos]);
+                encoding.sputn(decoded.data() + pos + 1, std::streamsize(std::min<size_t>(37, decoded.size() - pos - 1)));
+            }
+            QCOMPARE(encoding.pubsync(), 0);
+            QCOMPARE(codec->toUnicode(sink.str().data(), sink.str().size()), decoded);
+            encoding.sputn(decoded.data(), std::streamsize(decoded.size()));
+        }
+        const std::string written = sink.str();
+        QCOMPARE(codec->toUnicode(written.data(), written.size()), decoded + decoded);
+
+        // transcoding to UTF-8 gives what decoding and encoding again gives
+        std::stringbuf transcodeSource(encoded);
+        TranscodingStreambuf transcoding(&transcodeSource, codec, utf8, TextCodec::DefaultConversion, bufferSize);
+        std::istream stream(&transcoding);
+        std::ostringstream copy;
+        copy << stream.rdbuf();
+        const std::string utf8Text = copy.str();
+        QCOMPARE(utf8->toUnicode(utf8Text.data(), utf8Text.size()), decoded);
+    }
+}
+
+static bool writeFile(const std::string &path, const std::string &contents)
+{
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), std::streamsize(contents.size()));
+    return bool(file);
+}
+
+static std::string readFile(const std::string &path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+void tst_QTextCodec::fileTranscoding_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::fileTranscoding()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+    const TextCodec *utf8 = TextCodec::codecForName("UTF-8");
+
+    // larger than one conversion window, so that characters are cut at
+    // the joins
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> once = codec->fromUnicode(text.data(), text.size());
+    std::basic_string<char> encoded;
+    while (encoded.size() < 600 * 1024)
+        encoded += once;
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    const std::string source = "tst_qtextcodec_transcode.in";
+    const std::string target = "tst_qtextcodec_transcode.out";
+    QVERIFY(writeFile(source, encoded));
+
+    TranscodeStats stats;
+    QVERIFY(transcodeFile(source, codec, target, utf8, TextCodec::DefaultConversion, &stats));
+    std::string written = readFile(target);
+    QCOMPARE(stats.bytesRead, uint64_t(encoded.size()));
+    QCOMPARE(stats.bytesWritten, uint64_t(written.size()));
+    QVERIFY(!stats.hasFailure);
+    QCOMPARE(utf8->toUnicode(written.data(), written.size()), decoded);
+
+    // and back again
+    QVERIFY(transcodeFile(target, utf8, source, codec, TextCodec::DefaultConversion, &stats));
+    written = readFile(source);
+    QCOMPARE(stats.bytesWritten, uint64_t(written.size()));
+    QCOMPARE(codec->toUnicode(written.data(), written.size()), decoded);
+
+    // an empty file gives an empty file, and a missing one fails
+    QVERIFY(writeFile(source, std::string()));
+    QVERIFY(transcodeFile(source, codec, target, utf8, TextCodec::DefaultConversion, &stats));
+    QCOMPARE(stats.bytesRead, uint64_t(0));
+    QVERIFY(readFile(target).empty());
+    std::remove(source.c_str());
+    QVERIFY(!transcodeFile(source, codec, target, utf8));
+
+    // invalid input is converted and reported
+    QVERIFY(writeFile(source, "a\xff" "b\xe4"));
+    QVERIFY(transcodeFile(source, utf8, target, codec, TextCodec::DefaultConversion, &stats));
+    QVERIFY(stats.hasFailure);
+
+    std::remove(source.c_str());
+    std::remove(target.c_str());
+}
+
+void tst_QTextCodec::parallelDecoding_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::parallelDecoding()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    // long enough for every thread to get a piece of its own
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> once = codec->fromUnicode(text.data(), text.size());
+    std::basic_string<char> encoded;
+    while (encoded.size() < 1300 * 1024)
+        encoded += once;
+
+    // the same text with stray bytes every few kilobytes, so that the
+    // pieces start next to invalid sequences
+    std::basic_string<char> damaged = encoded;
+    unsigned int seed = 1;
+    for (size_t pos = 1000; pos < damaged.size(); pos += 3000 + seed % 4096) {
+        seed = seed * 1103515245 + 12345;
+        damaged[pos] = char(seed >> 16);
+    }
+
+    const unsigned int threadCounts[] = { 0, 1, 2, 3, 5 };
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+        const unsigned int threads = threadCounts[t];
+        QCOMPARE(codec->parallelToUnicode(encoded.data(), encoded.size(), threads),
+                 codec->toUnicode(encoded.data(), encoded.size()));
+        QCOMPARE(codec->parallelToUnicode(damaged.data(), damaged.size(), threads),
+                 codec->toUnicode(damaged.data(), damaged.size()));
+        // an odd length ends inside a character
+        QCOMPARE(codec->parallelToUnicode(encoded.data(), encoded.size() - 1, threads),
+                 codec->toUnicode(encoded.data(), encoded.size() - 1));
+    }
+    QVERIFY(codec->parallelToUnicode(encoded.data(), 0, 4).empty());
+}
+
+void tst_QTextCodec::parallelEncoding_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::parallelEncoding()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    // long enough for every thread to get a piece of its own, with lone
+    // surrogates now and then
+    const std::basic_string<uint16_t> once = sampleText();
+    std::basic_string<uint16_t> text;
+    for (int i = 0; text.size() < 1300 * 1024; ++i) {
+        text += once;
+        if (i % 97 == 0)
+            text += uint16_t(i % 2 ? 0xd83d : 0xdc00);
+    }
+
+    const unsigned int threadCounts[] = { 0, 1, 2, 3, 5 };
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+        const unsigned int threads = threadCounts[t];
+        const std::basic_string<char> expected = codec->fromUnicode(text.data(), text.size());
+        QCOMPARE(codec->parallelFromUnicode(text.data(), text.size(), threads), expected);
+
+        // the segments joined give the same bytes
+        std::vector<std::basic_string<char> > segments;
+        codec->parallelFromUnicode(&segments, text.data(), text.size(), threads);
+        QVERIFY(!segments.empty());
+        std::basic_string<char> joined;
+        for (size_t i = 0; i < segments.size(); ++i)
+            joined += segments[i];
+        QCOMPARE(joined, expected);
+
+        // ending on the first half of a pair
+        const size_t high = text.rfind(uint16_t(0xd840));
+        QCOMPARE(codec->parallelFromUnicode(text.data(), high + 1, threads),
+                 codec->fromUnicode(text.data(), high + 1));
+    }
+    // even empty input gets any byte order mark
+    QCOMPARE(codec->parallelFromUnicode(text.data(), 0, 4), codec->fromUnicode(text.data(), 0));
+}
+
+void tst_QTextCodec::pipelinedDecoder_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::pipelinedDecoder()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    std::basic_string<char> encoded;
+    for (int i = 0; i < 8; ++i)
+        encoded += codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+
+    // a small ring fills up, and pauses in the producer leave it empty, so
+    // both sides end up waiting for the other
+    PipelinedDecoder pipeline(codec, TextCodec::DefaultConversion, 2);
+    QCOMPARE(pipeline.capacity(), size_t(2));
+    std::thread producer([&]() {
+        size_t chunk = 1;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk, chunk = chunk % 7 + 1) {
+            pipeline.push(encoded.data() + pos, std::min(chunk, encoded.size() - pos));
+            if (pos % 500 < 7)
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        pipeline.finish();
+    });
+    std::basic_string<uint16_t> result;
+    std::basic_string<uint16_t> part;
+    while (pipeline.pop(&part))
+        result += part;
+    producer.join();
+    QCOMPARE(result, decoded);
+    QVERIFY(!pipeline.hasFailure());
+    QVERIFY(!pipeline.tryPop(&part));
+    QVERIFY(!pipeline.pop(&part));
+}
+
+void tst_QTextCodec::pipelinedDecoderIdle()
+{
+    PipelinedDecoder pipeline(TextCodec::codecForName("UTF-8"));
+
+    // a consumer waiting on an idle stream sleeps instead of spinning
+    std::basic_string<uint16_t> text;
+    std::thread consumer([&]() {
+        std::basic_string<uint16_t> part;
+        while (pipeline.pop(&part))
+            text += part;
+    });
+    const std::clock_t start = std::clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    const double busy = double(std::clock() - start) / CLOCKS_PER_SEC;
+    pipeline.push("idle", 4);
+    pipeline.finish();
+    consumer.join();
+    QVERIFY2(busy < 0.15, "the consumer kept a core busy while waiting");
+    QCOMPARE(text, TextCodec::codecForName("UTF-8")->toUnicode("idle"));
+}
+
+void tst_QTextCodec::lineDecoder_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::lineDecoder()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    // lines ended by every kind of break, empty ones among them, and a
+    // last line with no break
+    const std::basic_string<uint16_t> sample = sampleText();
+    const std::basic_string<uint16_t> line = sample.substr(0, sample.size() - 2);
+    const uint16_t breaks[][2] = { { '\n', 0 }, { '\r', '\n' }, { 0x2028, 0 }, { 0x2029, 0 }, { '\n', 0 } };
+    std::basic_string<uint16_t> text;
+    for (int i = 0; i < 60; ++i) {
+        text += line.substr(0, (i * 37) % line.size());
+        text += breaks[i % 5][0];
+        if (breaks[i % 5][1])
+            text += breaks[i % 5][1];
+    }
+    text += line;
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+
+    // the lines of the decoded text, split the way the documentation says
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+    std::vector<std::basic_string<uint16_t> > expected;
+    size_t start = 0;
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        if (decoded[i] != '\n' && decoded[i] != 0x2028 && decoded[i] != 0x2029)
+            continue;
+        size_t end = i;
+        if (decoded[i] == '\n' && end > start && decoded[end - 1] == '\r')
+            --end;
+        expected.push_back(decoded.substr(start, end - start));
+        start = i + 1;
+    }
+    if (start < decoded.size())
+        expected.push_back(decoded.substr(start));
+
+    const size_t chunks[] = { 1, 2, 3, 5, 7, 4096, 100000 };
+    LineDecoder decoder(codec);
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        const size_t chunk = chunks[c];
+        std::vector<std::basic_string<uint16_t> > result;
+        std::vector<LineDecoder::Line> lines;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk) {
+            lines.clear();
+            decoder.decode(encoded.data() + pos, std::min(chunk, encoded.size() - pos), &lines);
+            for (size_t i = 0; i < lines.size(); ++i)
+                result.push_back(std::basic_string<uint16_t>(lines[i].data, lines[i].length));
+        }
+        lines.clear();
+        decoder.finish(&lines);
+        for (size_t i = 0; i < lines.size(); ++i)
+            result.push_back(std::basic_string<uint16_t>(lines[i].data, lines[i].length));
+        QCOMPARE(result.size(), expected.size());
+        QVERIFY(result == expected);
+
+        // a reset decoder drops an open line
+        decoder.decode(encoded.data(), 5, &lines);
+        decoder.reset();
+    }
+}
+
+template <typename Traits>
+static std::basic_string<char32_t> iterateCodePoints(const std::basic_string<char> &bytes, size_t length,
+                                                     size_t stopAfter, size_t *stopPosition)
+{
+    std::basic_string<char32_t> result;
+    CodePointRange<Traits> range = codePoints<Traits>(bytes.data(), length);
+    for (typename CodePointRange<Traits>::iterator it = range.begin(); it != range.end(); ++it) {
+        if (result.size() == stopAfter) {
+            *stopPosition = size_t(it.position() - bytes.data());
+            break;
+        }
+        result += *it;
+    }
+    return result;
+}
+
+void tst_QTextCodec::codePointIterator_data()
+{
+    QTest::addColumn<QByteArray>("codecName");
+    QTest::addColumn<int>("traits");
+
+    QTest::newRow("UTF-8") << QByteArray("UTF-8") << 0;
+    QTest::newRow("ISO-8859-1") << QByteArray("ISO-8859-1") << 1;
+#ifndef Z_NO_BIG_TEXTCODECS
+    QTest::newRow("GB18030") << QByteArray("GB18030") << 2;
+    QTest::newRow("Big5") << QByteArray("Big5") << 3;
+    QTest::newRow("EUC-JP") << QByteArray("EUC-JP") << 4;
+    QTest::newRow("EUC-KR") << QByteArray("EUC-KR") << 5;
+    QTest::newRow("Shift_JIS") << QByteArray("Shift_JIS") << 6;
+#endif
+}
+
+void tst_QTextCodec::codePointIterator()
+{
+    QFETCH(QByteArray, codecName);
+    QFETCH(int, traits);
+    const TextCodec *codec = TextCodec::codecForName(codecName.toStdString());
+    QVERIFY(codec);
+
+    typedef std::basic_string<char32_t> (*Iterate)(const std::basic_string<char> &, size_t, size_t, size_t *);
+    const Iterate iterators[] = {
+        iterateCodePoints<Utf8CodePoints>, iterateCodePoints<Latin1CodePoints>,
+#ifndef Z_NO_BIG_TEXTCODECS
+        iterateCodePoints<Gb18030CodePoints>, iterateCodePoints<Big5CodePoints>,
+        iterateCodePoints<EucJpCodePoints>, iterateCodePoints<EucKrCodePoints>,
+        iterateCodePoints<SjisCodePoints>,
+#endif
+    };
+    const Iterate iterate = iterators[traits];
+
+    // the sample, then every byte value
+    const std::basic_string<uint16_t> text = sampleText();
+    std::basic_string<char> bytes = codec->fromUnicode(text.data(), text.size());
+    for (int i = 0; i < 256; ++i)
+        bytes += char(i);
+    for (int i = 0; i < 256; ++i)
+        bytes += char(0x80 | i) + std::basic_string<char>(1, char(i));
+
+    // every prefix gives what the codec gives, including for a sequence
+    // cut off by the end
+    size_t unused = 0;
+    for (size_t length = 0; length <= bytes.size(); ++length)
+        QCOMPARE(iterate(bytes, length, size_t(-1), &unused), codec->toUcs4(bytes.data(), length));
+
+    // an iterator that stops early points at the rest of the input
+    const std::basic_string<char32_t> all = codec->toUcs4(bytes.data(), bytes.size());
+    for (size_t stop = 0; stop < all.size(); stop += 13) {
+        size_t position = 0;
+        QCOMPARE(iterate(bytes, bytes.size(), stop, &position), all.substr(0, stop));
+        QCOMPARE(codec->toUcs4(bytes.data() + position, bytes.size() - position), all.substr(stop));
+    }
+}
+
+void tst_QTextCodec::decodeIndex_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::decodeIndex()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    const std::basic_string<uint16_t> text = sampleText();
+    std::basic_string<char> data;
+    for (int i = 0; i < 60; ++i)
+        data += codec->fromUnicode(text.data(), text.size());
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(data.data(), data.size());
+    const std::string path = "tst_qtextcodec_index.idx";
+
+    const size_t intervals[] = { 64, 1000 };
+    for (size_t n = 0; n < sizeof(intervals) / sizeof(intervals[0]); ++n) {
+        // how the data is passed to add() does not change what is indexed
+        DecodeIndex index(codec, TextCodec::DefaultConversion, intervals[n]);
+        DecodeIndex chunked(codec, TextCodec::DefaultConversion, intervals[n]);
+        QVERIFY(index.add(data.data(), data.size()));
+        for (size_t pos = 0; pos < data.size(); pos += 7)
+            QVERIFY(chunked.add(data.data() + pos, std::min<size_t>(7, data.size() - pos)));
+        QCOMPARE(index.byteCount(), uint64_t(data.size()));
+        QCOMPARE(index.utf16Count(), uint64_t(decoded.size()));
+        QCOMPARE(chunked.utf16Count(), uint64_t(decoded.size()));
+        QVERIFY(index.checkpointCount() >= decoded.size() / intervals[n] / 2);
+        QCOMPARE(index.checkpoint(0).byteOffset, uint64_t(0));
+
+        // any range decodes to that range of the text, whichever index
+        for (size_t offset = 0; offset < decoded.size(); offset += 37) {
+            const std::basic_string<uint16_t> expected = decoded.substr(offset, 150);
+            QCOMPARE(index.decode(data.data(), data.size(), offset, 150), expected);
+            QCOMPARE(chunked.decode(data.data(), data.size(), offset, 150), expected);
+        }
+
+        // decoding from the checkpoint up to byteOffset() gives the text up
+        // to that offset, or up to the start of the pair it is inside of
+        uint64_t previous = 0;
+        for (size_t offset = 0; offset < decoded.size(); offset += (offset % 200 < 20 ? 1 : 13)) {
+            const uint64_t byte = index.byteOffset(data.data(), data.size(), offset);
+            QVERIFY(byte >= previous);
+            previous = byte;
+            const DecodeIndex::Checkpoint &checkpoint = index.checkpointFor(offset);
+            QVERIFY(checkpoint.utf16Offset <= offset);
+            TextCodec::ConverterState state;
+            DecodeIndex::restore(checkpoint, &state);
+            const std::basic_string<uint16_t> before =
+                    codec->toUnicode(data.data() + checkpoint.byteOffset, size_t(byte - checkpoint.byteOffset), &state);
+            QCOMPARE(state.remainingChars, 0);
+            const uint64_t reached = checkpoint.utf16Offset + before.size();
+            QVERIFY(reached == offset || (reached + 1 == offset && (decoded[offset - 1] & 0xfc00) == 0xd800));
+        }
+        QCOMPARE(index.byteOffset(data.data(), data.size(), decoded.size()), uint64_t(data.size()));
+
+        // a saved index loads back, and can be grown after loading
+        QVERIFY(index.save(path));
+        DecodeIndex loaded;
+        QVERIFY(loaded.load(path));
+        QVERIFY(loaded.codec() == codec);
+        QCOMPARE(loaded.interval(), index.interval());
+        QCOMPARE(loaded.checkpointCount(), index.checkpointCount());
+        QCOMPARE(loaded.utf16Count(), index.utf16Count());
+        for (size_t offset = 0; offset < decoded.size(); offset += 401)
+            QCOMPARE(loaded.decode(data.data(), data.size(), offset, 150), decoded.substr(offset, 150));
+
+        const size_t half = data.size() / 2;
+        DecodeIndex partial(codec, TextCodec::DefaultConversion, intervals[n]);
+        QVERIFY(partial.add(data.data(), half));
+        QVERIFY(partial.save(path));
+        DecodeIndex grown;
+        QVERIFY(grown.load(path));
+        QVERIFY(grown.add(data.data() + half, data.size() - half));
+        QCOMPARE(grown.utf16Count(), uint64_t(decoded.size()));
+        for (size_t offset = 0; offset < decoded.size(); offset += 401)
+            QCOMPARE(grown.decode(data.data(), data.size(), offset, 150), decoded.substr(offset, 150));
+    }
+
+    // files that are not an index do not load
+    QVERIFY(writeFile(path, "TCDI"));
+    DecodeIndex broken;
+    QVERIFY(!broken.load(path));
+    std::remove(path.c_str());
+    QVERIFY(!broken.load(path));
+}
+
+void tst_QTextCodec::decodeBackward_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::decodeBackward()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    // the sample, then runs of bytes that are both lead and trail bytes in
+    // the double byte codecs, then the sample again
+    const std::basic_string<uint16_t> text = sampleText();
+    const std::basic_string<char> encoded = codec->fromUnicode(text.data(), text.size());
+    std::basic_string<char> data = encoded + encoded;
+    for (int i = 0x81; i < 0x100; i += 3)
+        data += std::basic_string<char>(i % 7 + 1, char(i));
+    data += "\x81\x40\x81\x81\x81\x40";
+    data += encoded;
+
+    // the returned text is the end of what decoding up to end gives
+    const size_t minLengths[] = { 1, 10, 100 };
+    for (size_t end = 0; end <= data.size(); end += (end < 40 ? 1 : 17)) {
+        const std::basic_string<uint16_t> whole = codec->toUnicode(data.data(), end);
+        for (size_t m = 0; m < sizeof(minLengths) / sizeof(minLengths[0]); ++m) {
+            size_t start = size_t(-1);
+            const std::basic_string<uint16_t> tail = codec->decodeBackward(data.data(), end, minLengths[m], &start);
+            QVERIFY(start <= end);
+            QVERIFY(start == 0 || tail.size() >= minLengths[m]);
+            QCOMPARE(codec->toUnicode(data.data(), start) + tail, whole);
+        }
+    }
+
+    // walking backwards a block at a time gives the whole text
+    std::vector<std::basic_string<uint16_t> > blocks;
+    size_t end = data.size();
+    while (end > 0) {
+        const size_t before = end;
+        blocks.push_back(codec->decodeBackward(data.data(), end, 50, &end));
+        QVERIFY(end < before);
+    }
+    std::basic_string<uint16_t> walked;
+    for (size_t i = blocks.size(); i > 0; --i)
+        walked += blocks[i - 1];
+    QCOMPARE(walked, codec->toUnicode(data.data(), data.size()));
+}
+
+template <typename Tag>
+static std::basic_string<char> kernelEncode(const std::basic_string<uint16_t> &text, size_t *consumed)
+{
+    std::basic_string<char> bytes;
+    *consumed = kernels::encode<Tag>(text, bytes);
+    return bytes;
+}
+
+template <typename Tag>
+static std::basic_string<uint16_t> kernelDecode(const std::basic_string<char> &bytes, size_t *consumed)
+{
+    std::basic_string<uint16_t> text;
+    *consumed = kernels::decode<Tag>(bytes, text);
+    return text;
+}
+
+void tst_QTextCodec::kernels_data()
+{
+    QTest::addColumn<int>("tag");
+
+    QTest::newRow("UTF-8") << 0;
+    QTest::newRow("ISO-8859-1") << 1;
+#ifndef Z_NO_BIG_TEXTCODECS
+    QTest::newRow("GB18030") << 2;
+    QTest::newRow("Big5") << 3;
+    QTest::newRow("EUC-JP") << 4;
+    QTest::newRow("EUC-KR") << 5;
+    QTest::newRow("Shift_JIS") << 6;
+#endif
+}
+
+void tst_QTextCodec::kernels()
+{
+    QFETCH(int, tag);
+
+    typedef std::basic_string<char> (*Encode)(const std::basic_string<uint16_t> &, size_t *);
+    typedef std::basic_string<uint16_t> (*Decode)(const std::basic_string<char> &, size_t *);
+    struct Kernel { const char *name; Encode encode; Decode decode; };
+    const Kernel kernelList[] = {
+        { kernels::Utf8Tag::name(), kernelEncode<kernels::Utf8Tag>, kernelDecode<kernels::Utf8Tag> },
+        { kernels::Latin1Tag::name(), kernelEncode<kernels::Latin1Tag>, kernelDecode<kernels::Latin1Tag> },
+#ifndef Z_NO_BIG_TEXTCODECS
+        { kernels::Gb18030Tag::name(), kernelEncode<kernels::Gb18030Tag>, kernelDecode<kernels::Gb18030Tag> },
+        { kernels::Big5Tag::name(), kernelEncode<kernels::Big5Tag>, kernelDecode<kernels::Big5Tag> },
+        { kernels::EucJpTag::name(), kernelEncode<kernels::EucJpTag>, kernelDecode<kernels::EucJpTag> },
+        { kernels::EucKrTag::name(), kernelEncode<kernels::EucKrTag>, kernelDecode<kernels::EucKrTag> },
+        { kernels::SjisTag::name(), kernelEncode<kernels::SjisTag>, kernelDecode<kernels::SjisTag> },
+#endif
+    };
+    const Kernel &kernel = kernelList[tag];
+    const TextCodec *codec = TextCodec::codecForName(kernel.name);
+    QVERIFY(codec);
+
+    // the sample round trips as it does through the codec
+    const std::basic_string<uint16_t> text = sampleText();
+    size_t consumed = 0;
+    const std::basic_string<char> encoded = kernel.encode(text, &consumed);
+    QCOMPARE(consumed, text.size());
+    QCOMPARE(encoded, codec->fromUnicode(text.data(), text.size()));
+    QCOMPARE(kernel.decode(encoded, &consumed), codec->toUnicode(encoded.data(), encoded.size()));
+    QCOMPARE(consumed, encoded.size());
+
+    // a character cut off by the end of the input is left for the next
+    // buffer, so decoding in chunks gives what the codec gives
+    const std::basic_string<uint16_t> han(1, 0x4e2d);
+    const std::basic_string<char> wide = "a" + codec->fromUnicode(han.data(), han.size());
+    for (size_t cut = 2; cut < wide.size(); ++cut) {
+        QCOMPARE(kernel.decode(wide.substr(0, cut), &consumed), std::basic_string<uint16_t>(1, 'a'));
+        QCOMPARE(consumed, size_t(1));
+    }
+    const std::basic_string<uint16_t> decoded = codec->toUnicode(encoded.data(), encoded.size());
+    for (size_t chunk = 1; chunk <= 7; ++chunk) {
+        std::basic_string<char> pending;
+        std::basic_string<uint16_t> chunked;
+        for (size_t pos = 0; pos < encoded.size(); pos += chunk) {
+            pending += encoded.substr(pos, chunk);
+            chunked += kernel.decode(pending, &consumed);
+            pending.erase(0, consumed);
+        }
+        QVERIFY(pending.empty());
+        QCOMPARE(chunked, decoded);
+    }
+
+    // lone and paired surrogates, at the start, in the middle and at the end
+    static const uint16_t cases[][4] = {
+        { 0xd800 }, { 0xdc00 }, { 0xd83d, 0xde00 }, { 0xdbff, 0xdfff },
+        { 'a', 0xd800 }, { 'a', 0xdc00 }, { 0xd800, 'a' }, { 0xdc00, 'a' },
+        { 0xd800, 0xd800 }, { 0xdc00, 0xdc00 }, { 0xdc00, 0xd800 },
+        { 0xd83d, 0xde00, 0xd800 }, { 0xd83d, 0xde00, 0xdc00 }, { 'a', 0xdc00, 0xde00, 'b' },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        std::basic_string<uint16_t> units;
+        for (size_t j = 0; j < 4 && cases[i][j]; ++j)
+            units += cases[i][j];
+
+        // the same bytes as the stateless codec, which drops what the
+        // kernel leaves unconsumed
+        const std::basic_string<char> bytes = kernel.encode(units, &consumed);
+        QVERIFY(consumed <= units.size());
+        QCOMPARE(bytes, codec->fromUnicode(units.data(), units.size()));
+
+        // and as an encoder, which keeps it for the next call
+        TextEncoder encoder(codec, TextCodec::IgnoreHeader);
+        const std::basic_string<uint16_t> more(1, 'b');
+        std::basic_string<char> expected = encoder.fromUnicode(units.data(), units.size());
+        QCOMPARE(bytes, expected);
+        expected += encoder.fromUnicode(more.data(), more.size());
+        size_t unused = 0;
+        QCOMPARE(bytes + kernel.encode(units.substr(consumed) + more, &unused), expected);
+
+        // the encoded text decodes as it does through the codec
+        QCOMPARE(kernel.decode(bytes, &unused), codec->toUnicode(bytes.data(), bytes.size()));
+    }
+}
+
+// the letters and digits of a codec name, lower-cased, which is all
+// codecForName() compares
+static std::string codecNameKey(const std::string &name)
+{
+    std::string key;
+    for (size_t i = 0; i < name.size(); ++i) {
+        const char c = name[i];
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+            key += c;
+        else if (c >= 'A' && c <= 'Z')
+            key += char(c + 0x20);
+    }
+    return key;
+}
+
+static bool codecHasNameKey(const TextCodec *codec, const std::string &key)
+{
+    if (codecNameKey(codec->name()) == key)
+        return true;
+    const std::list<std::string> aliases = codec->aliases();
+    for (std::list<std::string>::const_iterator it = aliases.begin(); it != aliases.end(); ++it) {
+        if (codecNameKey(*it) == key)
+            return true;
+    }
+    return false;
+}
+
+void tst_QTextCodec::codecNameLookup_data()
+{
+    addCodecRows();
+}
+
+void tst_QTextCodec::codecNameLookup()
+{
+    QFETCH(int, mib);
+    const TextCodec *codec = TextCodec::codecForMib(mib);
+    QVERIFY(codec);
+
+    std::list<std::string> names = codec->aliases();
+    names.push_front(codec->name());
+    for (std::list<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+        const std::string &name = *it;
+        const std::string key = codecNameKey(name);
+
+        // the first codec to claim a name keeps it, which need not be this one
+        const TextCodec *found = TextCodec::codecForName(name);
+        QVERIFY(found);
+        QVERIFY(codecHasNameKey(found, key));
+
+        // every spelling with the same letters and digits finds the same codec
+        std::string upper, lower, separated;
+        for (size_t i = 0; i < name.size(); ++i) {
+            const char c = name[i];
+            upper += c >= 'a' && c <= 'z' ? char(c - 0x20) : c;
+            lower += c >= 'A' && c <= 'Z' ? char(c + 0x20) : c;
+            separated += c;
+            separated += i % 2 ? " " : "_-";
+        }
+        QVERIFY(TextCodec::codecForName(upper) == found);
+        QVERIFY(TextCodec::codecForName(lower) == found);
+        QVERIFY(TextCodec::codecForName(key) == found);
+        QVERIFY(TextCodec::codecForName(separated) == found);
+        QVERIFY(TextCodec::codecForName("--" + name + "  ") == found);
+        QVERIFY(TextCodec::codecForName(name.c_str()) == found);
+
+        // a name with more or fewer letters is another name
+        const char *const suffixes[] = { "0", "x", "-1" };
+        for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+            const TextCodec *other = TextCodec::codecForName(name + suffixes[i]);
+            QVERIFY(!other || codecHasNameKey(other, key + codecNameKey(suffixes[i])));
+        }
+        if (key.size() > 1) {
+            const TextCodec *other = TextCodec::codecForName(key.substr(0, key.size() - 1));
+            QVERIFY(!other || codecHasNameKey(other, key.substr(0, key.size() - 1)));
+        }
+    }
+}
+
+void tst_QTextCodec::codecNameLookupThreads()
+{
+    // names that match nothing, including ones too long for any codec
+    const char *const unknown[] = { "", "-", " - _ ", "utf", "utf-9", "UTF-8x", "latin0", "\xc3\xa9" };
+    for (size_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); ++i)
+        QVERIFY(!TextCodec::codecForName(std::string(unknown[i])));
+    QVERIFY(!TextCodec::codecForName(std::string(200, 'a')));
+    std::string padded;
+    for (const char *p = "utf-8"; *p; ++p)
+        padded += *p + std::string(100, '-');
+    QVERIFY(TextCodec::codecForName(padded) == TextCodec::codecForName("UTF-8"));
+
+    // lookups from many threads at once give what one thread gets
+    const std::list<std::string> available = TextCodec::availableCodecs();
+    const std::vector<std::string> names(available.begin(), available.end());
+    std::vector<const TextCodec *> expected;
+    for (size_t i = 0; i < names.size(); ++i) {
+        expected.push_back(TextCodec::codecForName(names[i]));
+        QVERIFY(expected.back());
+    }
+
+    const size_t threadCount = 8;
+    std::vector<std::vector<const TextCodec *> > results(threadCount);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.push_back(std::thread([&names, &results, t]() {
+            std::vector<const TextCodec *> &found = results[t];
+            found.resize(names.size());
+            for (int round = 0; round < 20; ++round) {
+                for (size_t n = 0; n < names.size(); ++n) {
+                    const size_t i = (n + t * 7) % names.size();
+                    found[i] = TextCodec::codecForName(round % 2 ? names[i] : codecNameKey(names[i]));
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threadCount; ++t)
+        threads[t].join();
+    for (size_t t = 0; t < threadCount; ++t)
+        QVERIFY(results[t] == expected);
+}
+
+void tst_QTextCodec::lazyCodecs()
+{
+    const std::list<int> available = TextCodec::availableMibs();
+    const std::vector<int> mibs(available.begin(), available.end());
+    QVERIFY(!mibs.empty());
+
+    // threads asking for the same codecs at once get the same objects
+    const size_t threadCount = 8;
+    std::vector<std::vector<const TextCodec *> > results(threadCount);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.push_back(std::thread([&mibs, &results, t]() {
+            std::vector<const TextCodec *> &found = results[t];
+            found.resize(mibs.size());
+            for (size_t n = 0; n < mibs.size(); ++n) {
+                const size_t i = t % 2 ? mibs.size() - 1 - n : n;
+                found[i] = TextCodec::codecForMib(mibs[i]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threadCount; ++t)
+        threads[t].join();
+
+    std::vector<const TextCodec *> codecs;
+    for (size_t i = 0; i < mibs.size(); ++i) {
+        const TextCodec *codec = TextCodec::codecForMib(mibs[i]);
+        QVERIFY(codec);
+        QCOMPARE(codec->mibEnum(), mibs[i]);
+        QVERIFY(TextCodec::codecForMib(mibs[i]) == codec);
+        QVERIFY(std::find(codecs.begin(), codecs.end(), codec) == codecs.end());
+        codecs.push_back(codec);
+
+        // the codec created for a MIB is the one its name finds
+        const TextCodec *named = TextCodec::codecForName(codec->name());
+        QVERIFY(named);
+        QVERIFY(named == codec || codecHasNameKey(named, codecNameKey(codec->name())));
+    }
+    for (size_t t = 0; t < threadCount; ++t)
+        QVERIFY(results[t] == codecs);
+
+    // every listed name finds a codec that has it
+    const std::list<std::string> names = TextCodec::availableCodecs();
+    for (std::list<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+        const TextCodec *codec = TextCodec::codecForName(*it);
+        QVERIFY(codec);
+        QVERIFY(codecHasNameKey(codec, codecNameKey(*it)));
+    }
+}
+
+struct ShadowCodec : public TextCodec
+{
+    std::basic_string<char> name() const Q_DECL_OVERRIDE
+    { return "ShadowLatin2"; }
+    std::list<std::basic_string<char>> aliases() const Q_DECL_OVERRIDE
+    { return std::list<std::basic_string<char>>() = { "latin2" }; }
+    int mibEnum() const Q_DECL_OVERRIDE
+    { return 5001; }
+
+    virtual std::basic_string<uint16_t> convertToUnicode(const char *, int, ConverterState *) const Q_DECL_OVERRIDE
+    { return std::basic_string<uint16_t>(); }
+    virtual std::basic_string<char> convertFromUnicode(const uint16_t *, int, ConverterState *) const Q_DECL_OVERRIDE
+    { return std::basic_string<char>(); }
+};
+
+void tst_QTextCodec::userCodecPrecedence()
+{
+    static bool executedOnce = false;
+    if (executedOnce)
+        QSKIP("Test already executed once");
+
+    const TextCodec *latin2 = TextCodec::codecForName("latin2");
+    QVERIFY(latin2);
+    QCOMPARE(latin2->mibEnum(), 5);
+    QVERIFY(!TextCodec::codecForMib(5001));
+
+    // a codec created by the application takes a name from a built-in one
+    const TextCodec *shadow = new ShadowCodec;
+    executedOnce = true;
+    QVERIFY(TextCodec::codecForName("latin2") == shadow);
+    QVERIFY(TextCodec::codecForName("Latin-2") == shadow);
+    QVERIFY(TextCodec::codecForName("shadow latin 2") == shadow);
+    QVERIFY(TextCodec::codecForMib(5001) == shadow);
+
+    // and leaves the built-in codec its other names and its MIB
+    QVERIFY(TextCodec::codecForName("ISO-8859-2") == latin2);
+    QVERIFY(TextCodec::codecForName("iso-ir-101") == latin2);
+    QVERIFY(TextCodec::codecForMib(5) == latin2);
+    QVERIFY(TextCodec::codecForName("UTF-8"));
+    QVERIFY(!TextCodec::codecForName("latin22"));
+
+    const std::list<std::string> names = TextCodec::availableCodecs();
+    QVERIFY(std::find(names.begin(), names.end(), "ShadowLatin2") != names.end());
+    QVERIFY(std::find(names.begin(), names.end(), "ISO-8859-2") != names.end());
+    const std::list<int> mibs = TextCodec::availableMibs();
+    QVERIFY(std::find(mibs.begin(), mibs.end(), 5001) != mibs.end());
+    QVERIFY(std::find(mibs.begin(), mibs.end(), 5) != mibs.end());
+}
+
+// Upper-cases the letters after 0x8e until 0x8f, and keeps whether it
+// is shifted in the last word of the state
+struct ShiftingCodec : public TextCodec
+{
+    std::basic_string<char> name() const Q_DECL_OVERRIDE
+    { return "x-shifting-test"; }
+    int mibEnum() const Q_DECL_OVERRIDE
+    { return 5002; }
+
+    virtual std::basic_string<uint16_t> convertToUnicode(const char *in, int length, ConverterState *state) const Q_DECL_OVERRIDE
+    {
+        const int last = ConverterState::StateDataSize - 1;
+        bool shifted = state && state->state_data[last];
+        std::basic_string<uint16_t> result;
+        for (int i = 0; i < length; ++i) {
+            if (uint8_t(in[i]) == 0x8e)
+                shifted = true;
+            else if (uint8_t(in[i]) == 0x8f)
+                shifted = false;
+            else
+                result += uint16_t(shifted && in[i] >= 'a' && in[i] <= 'z' ? in[i] - 0x20 : uint8_t(in[i]));
+        }
+        if (state)
+            state->state_data[last] = shifted;
+        return result;
+    }
+    virtual std::basic_string<char> convertFromUnicode(const uint16_t *in, int length, ConverterState *) const Q_DECL_OVERRIDE
+    {
+        std::basic_string<char> result;
+        for (int i = 0; i < length; ++i)
+            result += in[i] < 0x100 ? char(in[i]) : '?';
+        return result;
+    }
+};
+
+void tst_QTextCodec::transcoderCodecState()
+{
+    static const TextCodec *shifting = new ShiftingCodec;
+    const TextCodec *utf8 = TextCodec::codecForName("UTF-8");
+
+    // the ASCII shortcut waits while the decoder is shifted, whichever
+    // word of the state says so
+    TextTranscoder transcoder(shifting, utf8, TextCodec::IgnoreHeader);
+    std::basic_string<char> result = transcoder.transcode(std::basic_string<char>("ab\x8e"));
+    result += transcoder.transcode(std::basic_string<char>("cd\x8f"));
+    result += transcoder.transcode(std::basic_string<char>("ef"));
+    QCOMPARE(result, std::basic_string<char>("abCDef"));
+}
+
 struct DontCrashAtExit {
     ~DontCrashAtExit() {
         Q_TextCodec c = Q_TextCodec::codecForName("utf8");
@@ -2,5 +2,12 @@
 #define ZDYTOOL_TEXTCODEC_H
 
 #include "codecs/textcodec.h"
+#include "codecs/textcodepoints.h"
+#include "codecs/textfile.h"
+#include "codecs/textindex.h"
+#include "codecs/textkernels.h"
+#include "codecs/textlines.h"
+#include "codecs/textpipeline.h"
+#include "codecs/textstreambuf.h"
 using namespace zdytool;
 #endif // ZDYTOOL_TEXTCODEC_H
\ No newline at end of file
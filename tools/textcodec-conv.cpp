@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+// textcodec-conv converts a file between encodings, like iconv, and
+// reports how fast it went.
+//
+//     textcodec-conv -f GB18030 -t UTF-8 [-o output] [-q] [input]
+//     textcodec-conv -l
+
+#include "textcodec.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static void usage() {
+    std::fprintf(stderr,
+                 "usage: textcodec-conv -f from -t to [-o output] [-q] [input]\n"
+                 "       textcodec-conv -l\n"
+                 "\n"
+                 "  -f from     encoding of the input\n"
+                 "  -t to       encoding of the output\n"
+                 "  -o output   output file, standard output if not given\n"
+                 "  -q          do not report throughput\n"
+                 "  -l          list the available encodings\n"
+                 "\n"
+                 "The input is read from standard input if not given.\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *from = nullptr;
+    const char *to = nullptr;
+    const char *output = "-";
+    const char *input = "-";
+    bool quiet = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (!std::strcmp(arg, "-l")) {
+            std::list<std::string> names = TextCodec::availableCodecs();
+            for (std::list<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+                std::printf("%s\n", it->c_str());
+            return 0;
+        } else if (!std::strcmp(arg, "-q")) {
+            quiet = true;
+        } else if ((!std::strcmp(arg, "-f") || !std::strcmp(arg, "-t") || !std::strcmp(arg, "-o"))
+                   && i + 1 < argc) {
+            const char *value = argv[++i];
+            if (arg[1] == 'f')
+                from = value;
+            else if (arg[1] == 't')
+                to = value;
+            else
+                output = value;
+        } else if (arg[0] != '-' || !arg[1]) {
+            input = arg;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (!from || !to) {
+        usage();
+        return 2;
+    }
+
+    const TextCodec *srcCodec = TextCodec::codecForName(from);
+    if (!srcCodec) {
+        std::fprintf(stderr, "textcodec-conv: unknown encoding '%s'\n", from);
+        return 2;
+    }
+    const TextCodec *dstCodec = TextCodec::codecForName(to);
+    if (!dstCodec) {
+        std::fprintf(stderr, "textcodec-conv: unknown encoding '%s'\n", to);
+        return 2;
+    }
+
+    // like iconv, keep a byte order mark the input has and add none of our own
+    TranscodeStats stats;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool ok = transcodeFile(input, srcCodec, output, dstCodec, TextCodec::IgnoreHeader, &stats);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!ok) {
+        std::fprintf(stderr, "textcodec-conv: cannot convert '%s' to '%s'\n", input, output);
+        return 1;
+    }
+    if (!quiet) {
+        double mb = stats.bytesRead / (1024.0 * 1024.0);
+        std::fprintf(stderr, "textcodec-conv: %llu bytes in, %llu bytes out, %.3f s, %.1f MiB/s%s\n",
+                     static_cast<unsigned long long>(stats.bytesRead),
+                     static_cast<unsigned long long>(stats.bytesWritten),
+                     seconds, seconds > 0 ? mb / seconds : 0.0,
+                     stats.mapped ? " (mapped)" : "");
+    }
+    if (stats.hasFailure) {
+        std::fprintf(stderr, "textcodec-conv: invalid or unrepresentable characters found\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright zjzdy
+**
+** This source code is licensed under under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+****************************************************************************/
+
+// textcodec-startup reports what the first use of the library costs a
+// short-lived process: the first codec lookup, the first conversion, and
+// with -a the lookup of every available codec. Each run measures one
+// process start, so run it a few times.
+//
+//     textcodec-startup [-a] [encoding]
+
+#include "textcodec.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+typedef std::chrono::steady_clock Clock;
+
+static double microseconds(Clock::time_point since) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - since).count();
+}
+
+int main(int argc, char *argv[]) {
+    const char *encoding = "UTF-8";
+    bool all = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "-a")) {
+            all = true;
+        } else if (argv[i][0] != '-') {
+            encoding = argv[i];
+        } else {
+            std::fprintf(stderr, "usage: textcodec-startup [-a] [encoding]\n");
+            return 2;
+        }
+    }
+
+    Clock::time_point start = Clock::now();
+    const TextCodec *codec = TextCodec::codecForName(encoding);
+    double lookup = microseconds(start);
+    if (!codec) {
+        std::fprintf(stderr, "textcodec-startup: unknown encoding '%s'\n", encoding);
+        return 2;
+    }
+
+    const char line[] = "The quick brown fox jumps over the lazy dog\n";
+    start = Clock::now();
+    std::basic_string<uint16_t> text = codec->toUnicode(line, sizeof(line) - 1);
+    double conversion = microseconds(start);
+
+    std::printf("first codecForName(\"%s\"): %.1f us\n", encoding, lookup);
+    std::printf("first conversion: %.1f us (%u units)\n", conversion, unsigned(text.size()));
+
+    if (all) {
+        start = Clock::now();
+        std::list<std::string> names = TextCodec::availableCodecs();
+        size_t found = 0;
+        for (std::list<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+            found += TextCodec::codecForName(*it) != nullptr;
+        std::printf("all %u names: %.1f us\n", unsigned(found), microseconds(start));
+    }
+    return 0;
+}
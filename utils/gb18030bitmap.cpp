@@ -31,6 +31,18 @@
     The \a len is the \a chars max length.
 */
 Gb18030Bitmap::Block Gb18030Bitmap::findFirstBlock(const unsigned char *chars, int len) {
+    if (len < 1)
+        return ERROR;
+    return findFirstBlock(chars, size_t(len));
+}
+
+/*!
+    \fn Gb18030Bitmap::Block Gb18030Bitmap::findFirstBlock(const unsigned char *chars, size_t len)
+    \overload
+
+    The \a len may be any size, such as that of a whole mapped file.
+*/
+Gb18030Bitmap::Block Gb18030Bitmap::findFirstBlock(const unsigned char *chars, size_t len) {
     if (len < 1)
         return ERROR;
     if (IsLatin(*chars))
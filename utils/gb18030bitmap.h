@@ -15,6 +15,7 @@
 #define LIBTEXTCODEC_GB18030BITMAP_H
 
 #include <string>
+#include <cstddef>
 
 /*
  * ASCII                    00-7F
@@ -62,6 +63,7 @@ public:
     };
 
     static Block findFirstBlock(const unsigned char *chars, int len);
+    static Block findFirstBlock(const unsigned char *chars, size_t len);
     static int getLengthForBlock(Block block);
     static unsigned long calcOffsetForBitmap(const unsigned char *word, Block wordBlock, Block startBlock, CalcMode mode = Valid);
     static unsigned long long calcOffsetForBitmapFile(const unsigned char *word, Block wordBlock, Block startBlock, CalcMode mode, unsigned int width, unsigned int height);